@@ -284,6 +284,41 @@ int decode_block6(unsigned char *in, int length, unsigned char *out)
    return len;
 }
 
+unsigned char *blast_decode(unsigned char *in, int in_len, int type, unsigned char *lut, int *out_len)
+{
+   unsigned char *out_buf;
+   int len;
+
+   // estimate worst case size
+   out_buf = malloc(100*in_len);
+   if (out_buf == NULL) {
+      return NULL;
+   }
+
+   switch (type) {
+      // a0 - input buffer
+      // a1 - input length
+      // a2 - type (always unused)
+      // a3 - output buffer
+      // t4 - blocks 4 & 5 reference t4 which is set to FP
+      case 0: len = decode_block0(in, in_len, out_buf); break;
+      case 1: len = decode_block1(in, in_len, out_buf); break;
+      case 2: len = decode_block2(in, in_len, out_buf); break;
+      // TODO: need to figure out where last param is set for decoders 4 and 5
+      case 4: len = decode_block4(in, in_len, out_buf, lut); break;
+      case 5: len = decode_block5(in, in_len, out_buf, lut); break;
+      case 3: len = decode_block3(in, in_len, out_buf); break;
+      case 6: len = decode_block6(in, in_len, out_buf); break;
+      default:
+         ERROR("Unknown Blast type %d\n", type);
+         free(out_buf);
+         return NULL;
+   }
+
+   *out_len = len;
+   return out_buf;
+}
+
 int blast_decode_file(char *in_filename, int type, char *out_filename, unsigned char *lut)
 {
    unsigned char *in_buf = NULL;
@@ -298,30 +333,12 @@ int blast_decode_file(char *in_filename, int type, char *out_filename, unsigned
       return 1;
    }
 
-   // estimate worst case size
-   out_buf = malloc(100*in_len);
+   out_buf = blast_decode(in_buf, in_len, type, lut, &out_len);
    if (out_buf == NULL) {
       ret_val = 2;
       goto free_all;
    }
 
-   switch (type) {
-      // a0 - input buffer
-      // a1 - input length
-      // a2 - type (always unused)
-      // a3 - output buffer
-      // t4 - blocks 4 & 5 reference t4 which is set to FP
-      case 0: out_len = decode_block0(in_buf, in_len, out_buf); break;
-      case 1: out_len = decode_block1(in_buf, in_len, out_buf); break;
-      case 2: out_len = decode_block2(in_buf, in_len, out_buf); break;
-      // TODO: need to figure out where last param is set for decoders 4 and 5
-      case 4: out_len = decode_block4(in_buf, in_len, out_buf, lut); break;
-      case 5: out_len = decode_block5(in_buf, in_len, out_buf, lut); break;
-      case 3: out_len = decode_block3(in_buf, in_len, out_buf); break;
-      case 6: out_len = decode_block6(in_buf, in_len, out_buf); break;
-      default: ERROR("Unknown Blast type %d\n", type); break;
-   }
-
    write_len = write_file(out_filename, out_buf, out_len);
    if (write_len != out_len) {
       ret_val = 2;
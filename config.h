@@ -85,6 +85,15 @@ void config_print(const rom_config *config);
 int config_validate(const rom_config *config, unsigned int max_len);
 void config_free(rom_config *config);
 
+// serialize a parsed config for config_read_binary()
+// length: set to the size of the returned buffer
+// returns buffer to be freed by the caller, or NULL on failure
+unsigned char *config_write_binary(const rom_config *config, unsigned int *length);
+
+// load a config from config_write_binary() output, to be freed with config_free()
+// returns 0 on success, -1 if the data is truncated
+int config_read_binary(const unsigned char *buf, unsigned int length, rom_config *config);
+
 section_type config_str2section(const char *type_name);
 const char *config_section2str(section_type section);
 
@@ -23,6 +23,15 @@ int decode_block5(unsigned char *in, int length, unsigned char *out, unsigned ch
 // 802A5958 (061198)
 int decode_block6(unsigned char *in, int length, unsigned char *out);
 
+// decode Blast Corps compressed data of given type in memory
+// in - buffer of compressed data
+// in_len - length of compressed data
+// type - type of compression: 0-6
+// lut - lookup table to use for types 4 and 5
+// out_len - set to length of uncompressed data
+// returns buffer of uncompressed data to be freed by the caller, or NULL on failure
+unsigned char *blast_decode(unsigned char *in, int in_len, int type, unsigned char *lut, int *out_len);
+
 // decode Blast Corps compressed data of given type
 // in_filename - input file name of compressed data
 // type - type of compression: 0-6
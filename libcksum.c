@@ -0,0 +1,380 @@
+#include <string.h>
+
+#include "libcksum.h"
+#include "utils.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define CKSUM_X86 1
+  #include <immintrin.h>
+#endif
+
+// words per chunk: byte swapped and rotated in bulk, then run through the recurrences
+#define CKSUM_CHUNK 1024
+
+// boot code accumulators, named after the registers they live in
+typedef struct
+{
+   unsigned int a3; // running sum of words
+   unsigned int t2; // carries out of a3
+   unsigned int t3; // xor of words
+   unsigned int s0; // running sum of rotated words
+   unsigned int a2; // xor of data selected by comparison
+   unsigned int t4; // sum of word xor running s0
+} cksum_state;
+
+// fill vals[] with big-endian words from buf and rots[] with each word rotated left by its low 5 bits
+typedef void (*cksum_prepare_fn)(const unsigned char *buf, unsigned int vals[], unsigned int rots[], int count, cksum_state *st);
+
+static inline unsigned int rotl32(unsigned int val, unsigned int shift)
+{
+   shift &= 0x1F;
+   return (val << shift) | (val >> ((32 - shift) & 0x1F));
+}
+
+static void cksum_prepare_scalar(const unsigned char *buf, unsigned int vals[], unsigned int rots[], int count, cksum_state *st)
+{
+   unsigned int t3 = st->t3;
+   for (int i = 0; i < count; i++) {
+      unsigned int v = read_u32_be(&buf[4*i]);
+      vals[i] = v;
+      rots[i] = rotl32(v, v);
+      t3 ^= v;
+   }
+   st->t3 = t3;
+}
+
+#ifdef CKSUM_X86
+__attribute__((target("ssse3")))
+static void cksum_prepare_ssse3(const unsigned char *buf, unsigned int vals[], unsigned int rots[], int count, cksum_state *st)
+{
+   const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+   __m128i t3 = _mm_setzero_si128();
+   unsigned int lanes[4];
+   int i;
+   // no per-lane variable shifts before AVX2, so only the swap and xor are vectorized
+   for (i = 0; i + 4 <= count; i += 4) {
+      __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&buf[4*i]), bswap);
+      _mm_storeu_si128((__m128i *)&vals[i], v);
+      t3 = _mm_xor_si128(t3, v);
+   }
+   _mm_storeu_si128((__m128i *)lanes, t3);
+   st->t3 ^= lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3];
+   for (int j = 0; j < i; j++) {
+      rots[j] = rotl32(vals[j], vals[j]);
+   }
+   cksum_prepare_scalar(&buf[4*i], &vals[i], &rots[i], count - i, st);
+}
+
+__attribute__((target("avx2")))
+static void cksum_prepare_avx2(const unsigned char *buf, unsigned int vals[], unsigned int rots[], int count, cksum_state *st)
+{
+   const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                         12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+   const __m256i mask = _mm256_set1_epi32(0x1F);
+   const __m256i width = _mm256_set1_epi32(32);
+   __m256i t3 = _mm256_setzero_si256();
+   unsigned int lanes[8];
+   int i;
+   for (i = 0; i + 8 <= count; i += 8) {
+      __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)&buf[4*i]), bswap);
+      __m256i shift = _mm256_and_si256(v, mask);
+      // shifts of 32 produce 0 in AVX2, so a shift of 0 rotates to v | 0
+      __m256i r = _mm256_or_si256(_mm256_sllv_epi32(v, shift),
+                                  _mm256_srlv_epi32(v, _mm256_sub_epi32(width, shift)));
+      _mm256_storeu_si256((__m256i *)&vals[i], v);
+      _mm256_storeu_si256((__m256i *)&rots[i], r);
+      t3 = _mm256_xor_si256(t3, v);
+   }
+   _mm256_storeu_si256((__m256i *)lanes, t3);
+   st->t3 ^= lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3] ^ lanes[4] ^ lanes[5] ^ lanes[6] ^ lanes[7];
+   cksum_prepare_scalar(&buf[4*i], &vals[i], &rots[i], count - i, st);
+}
+#endif
+
+// run the order dependent recurrences over prepared words without branches
+// a3/t2 and s0 are running sums that a2 and t4 need after every word, so these stay serial
+static void cksum_accumulate(const unsigned int vals[], const unsigned int rots[], int count, cksum_state *st)
+{
+   unsigned int a3 = st->a3;
+   unsigned int t2 = st->t2;
+   unsigned int s0 = st->s0;
+   unsigned int a2 = st->a2;
+   unsigned int t4 = st->t4;
+   for (int i = 0; i < count; i++) {
+      unsigned int v = vals[i];
+      unsigned int r = rots[i];
+      unsigned int sel;
+      a3 += v;
+      t2 += (a3 < v);
+      s0 += r;
+      // simple select compiles to a conditional move, avoiding the boot code's
+      // data dependent branch which mispredicts about half the time
+      sel = (a2 < v) ? (a3 ^ v) : r;
+      a2 ^= sel;
+      t4 += v ^ s0;
+   }
+   st->a3 = a3;
+   st->t2 = t2;
+   st->s0 = s0;
+   st->a2 = a2;
+   st->t4 = t4;
+}
+
+static cksum_prepare_fn cksum_select(const char **name)
+{
+#ifdef CKSUM_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      *name = "avx2";
+      return cksum_prepare_avx2;
+   }
+   if (__builtin_cpu_supports("ssse3")) {
+      *name = "ssse3";
+      return cksum_prepare_ssse3;
+   }
+#endif
+   *name = "scalar";
+   return cksum_prepare_scalar;
+}
+
+const char *n64_cksum_engine(void)
+{
+   const char *name;
+   cksum_select(&name);
+   return name;
+}
+
+// 6105 mixes each word with one of the 64 words at 0x750 in the IPL3 instead of the running s0
+static void cksum_accumulate_6105(const unsigned int vals[], const unsigned int rots[], int count,
+                                  const unsigned int lut[], cksum_state *st)
+{
+   unsigned int a3 = st->a3;
+   unsigned int t2 = st->t2;
+   unsigned int s0 = st->s0;
+   unsigned int a2 = st->a2;
+   unsigned int t4 = st->t4;
+   for (int i = 0; i < count; i++) {
+      unsigned int v = vals[i];
+      unsigned int r = rots[i];
+      unsigned int sel;
+      a3 += v;
+      t2 += (a3 < v);
+      s0 += r;
+      sel = (a2 < v) ? (a3 ^ v) : r;
+      a2 ^= sel;
+      t4 += v ^ lut[i & 0x3F];
+   }
+   st->a3 = a3;
+   st->t2 = t2;
+   st->s0 = s0;
+   st->a2 = a2;
+   st->t4 = t4;
+}
+
+// CRC-32 (polynomial 0xEDB88320) lookup table
+static const unsigned int crc32_table[256] =
+{
+   0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+   0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+   0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+   0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+   0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+   0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+   0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+   0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+   0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+   0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+   0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+   0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+   0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+   0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+   0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+   0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+   0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+   0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+   0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+   0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+   0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+   0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+   0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+   0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+   0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+   0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+   0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+   0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+   0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+   0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+   0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+   0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+   0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+   0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+   0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+   0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+   0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+   0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+   0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+   0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+   0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+   0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+   0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+};
+
+// standard CRC-32 of the IPL3 boot code, used to identify the CIC
+static unsigned int ipl3_crc32(const unsigned char *buf, unsigned int length)
+{
+   unsigned int crc = 0xFFFFFFFF;
+   for (unsigned int i = 0; i < length; i++) {
+      crc = crc32_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+   }
+   return ~crc;
+}
+
+cic_type n64_detect_cic(const unsigned char *buf)
+{
+   static const struct
+   {
+      unsigned int crc;
+      cic_type cic;
+   } ipl3_table[] =
+   {
+      {0x6170A4A1, CIC_6101},
+      {0x90BB6CB5, CIC_6102},
+      {0x0B050EE0, CIC_6103},
+      {0x98BC2C86, CIC_6105},
+      {0xACC8580A, CIC_6106},
+   };
+   unsigned int crc = ipl3_crc32(&buf[IPL3_START], CKSUM_START - IPL3_START);
+   for (unsigned int i = 0; i < DIM(ipl3_table); i++) {
+      if (ipl3_table[i].crc == crc) {
+         return ipl3_table[i].cic;
+      }
+   }
+   return CIC_UNKNOWN;
+}
+
+int n64_calc_checksums_cic(const unsigned char *buf, cic_type cic, unsigned int cksum[])
+{
+   unsigned int vals[CKSUM_CHUNK];
+   unsigned int rots[CKSUM_CHUNK];
+   unsigned int lut[64];
+   unsigned int seed;
+   cksum_state st;
+   cksum_prepare_fn prepare;
+   const char *name;
+
+   // seeds from the boot code: seed byte * multiplier + 1
+   switch (cic) {
+      case CIC_6101:
+      case CIC_6102: seed = 0x3Fu * 0x5D588B65u + 1; break;
+      case CIC_6103: seed = 0x78u * 0x6C078965u + 1; break;
+      case CIC_6105: seed = 0x91u * 0x5D588B65u + 1; break;
+      case CIC_6106: seed = 0x85u * 0x6C078965u + 1; break;
+      default: return -1;
+   }
+   if (cic == CIC_6105) {
+      for (int i = 0; i < 64; i++) {
+         lut[i] = read_u32_be(&buf[IPL3_START + 0x710 + 4*i]);
+      }
+   }
+
+   prepare = cksum_select(&name);
+   st.a3 = st.t2 = st.t3 = st.s0 = st.a2 = st.t4 = seed;
+   for (unsigned int off = 0; off < CKSUM_LENGTH; off += 4 * CKSUM_CHUNK) {
+      prepare(&buf[CKSUM_START + off], vals, rots, CKSUM_CHUNK, &st);
+      // chunks are a multiple of 64 words, so lut indexes line up with the word offset
+      if (cic == CIC_6105) {
+         cksum_accumulate_6105(vals, rots, CKSUM_CHUNK, lut, &st);
+      } else {
+         cksum_accumulate(vals, rots, CKSUM_CHUNK, &st);
+      }
+   }
+
+   switch (cic) {
+      case CIC_6103:
+         cksum[0] = (st.a3 ^ st.t2) + st.t3;
+         cksum[1] = (st.s0 ^ st.a2) + st.t4;
+         break;
+      case CIC_6106:
+         cksum[0] = (st.a3 * st.t2) + st.t3;
+         cksum[1] = (st.s0 * st.a2) + st.t4;
+         break;
+      default:
+         cksum[0] = st.a3 ^ st.t2 ^ st.t3;
+         cksum[1] = st.s0 ^ st.a2 ^ st.t4;
+         break;
+   }
+   return 0;
+}
+
+void n64_calc_checksums(const unsigned char *buf, unsigned int cksum[])
+{
+   n64_calc_checksums_cic(buf, CIC_6102, cksum);
+}
+
+void n64_calc_checksums_ref(const unsigned char *buf, unsigned int cksum[]) {
+   unsigned int t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+   unsigned int s0, s6;
+   unsigned int a0, a1, a2, a3, at;
+   unsigned int lo;
+   unsigned int v0, v1;
+   unsigned int ra;
+
+   // derived from the SM64 boot code
+   s6 = 0x3f;
+   a0 = 0x1000;     // 59c:   8d640008    lw a0,8(t3)
+   a1 = s6;         // 5a0:   02c02825    move  a1,s6
+   at = 0x5d588b65; // 5a4:   3c015d58    lui   at,0x5d58
+                    // 5a8:   34218b65    ori   at,at,0x8b65
+   lo = a1 * at;    // 5ac:   00a10019    multu a1,at    16 F8CA 4DDB
+
+   ra = 0x100000; // 5bc:  3c1f0010    lui   ra,0x10
+   v1 = 0;  // 5c0:  00001825    move  v1,zero
+   t0 = 0;  // 5c4:  00004025    move  t0,zero
+   t1 = a0; // 5c8:  00804825    move  t1,a0
+   t5 = 32; // 5cc:  240d0020    li t5,32
+   v0 = lo; // 5d0:  00001012    mflo  v0
+   v0++;    // 5d4:  24420001    addiu v0,v0,1
+   a3 = v0; // 5d8:  00403825    move  a3,v0
+   t2 = v0; // 5dc:  00405025    move  t2,v0
+   t3 = v0; // 5e0:  00405825    move  t3,v0
+   s0 = v0; // 5e4:  00408025    move  s0,v0
+   a2 = v0; // 5e8:  00403025    move  a2,v0
+   t4 = v0; // 5ec:  00406025    move  t4,v0
+
+   do {
+      v0 = read_u32_be(&buf[t1]);   // 5f0: 8d220000    lw v0,0(t1)
+      v1 = a3 + v0;   // 5f4: 00e21821    addu  v1,a3,v0
+      at = (v1 < a3); // 5f8: 0067082b    sltu  at,v1,a3
+      a1 = v1;        // 600: 00602825    move  a1,v1 branch delay slot
+      if (at) {       // 5fc: 10200002    beqz  at,0x608
+         t2++;        // 604: 254a0001    addiu t2,t2,1
+      }
+      v1 = v0 & 0x1F;  // 608: 3043001f    andi  v1,v0,0x1f
+      t7 = t5 - v1;    // 60c: 01a37823    subu  t7,t5,v1
+      t8 = v0 >> t7;   // 610: 01e2c006    srlv  t8,v0,t7
+      t6 = v0 << v1;   // 614: 00627004    sllv  t6,v0,v1
+      a0 = t6 | t8;    // 618: 01d82025    or a0,t6,t8
+      at = (a2 < v0);  // 61c: 00c2082b    sltu  at,a2,v0
+      a3 = a1;         // 620: 00a03825    move  a3,a1
+      t3 ^= v0;        // 624: 01625826    xor   t3,t3,v0
+      s0 += a0;        // 62c: 02048021    addu  s0,s0,a0 branch delay slot
+      if (at) {        // 628: 10200004    beqz  at,0x63c
+         t9 = a3 ^ v0; // 630: 00e2c826    xor   t9,a3,v0
+                       // 634: 10000002    b  0x640
+         a2 ^= t9;     // 638: 03263026    xor   a2,t9,a2 branch delay
+      } else {
+         a2 ^= a0;     // 63c: 00c43026    xor   a2,a2,a0
+      }
+      t0 += 4;         // 640: 25080004    addiu t0,t0,4
+      t7 = v0 ^ s0;    // 644: 00507826    xor   t7,v0,s0
+      t1 += 4;         // 648: 25290004    addiu t1,t1,4
+      t4 += t7;        // 650: 01ec6021    addu  t4,t7,t4 branch delay
+   } while (t0 != ra); // 64c: 151fffe8    bne   t0,ra,0x5f0
+   t6 = a3 ^ t2;       // 654: 00ea7026    xor   t6,a3,t2
+   a3 = t6 ^ t3;       // 658: 01cb3826    xor   a3,t6,t3
+   t8 = s0 ^ a2;       // 65c: 0206c026    xor   t8,s0,a2
+   s0 = t8 ^ t4;       // 660: 030c8026    xor   s0,t8,t4
+   
+   cksum[0] = a3;
+   cksum[1] = s0;
+}
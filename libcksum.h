@@ -0,0 +1,52 @@
+#ifndef LIBCKSUM_H_
+#define LIBCKSUM_H_
+
+// defines
+
+// ROM region covered by the boot code checksum
+#define CKSUM_START  0x1000
+#define CKSUM_LENGTH 0x100000
+// IPL3 boot code, hashed to identify the CIC
+#define IPL3_START   0x40
+
+// typedefs
+
+typedef enum
+{
+   CIC_UNKNOWN = 0,
+   CIC_6101 = 6101,
+   CIC_6102 = 6102,
+   CIC_6103 = 6103,
+   CIC_6105 = 6105,
+   CIC_6106 = 6106,
+} cic_type;
+
+// function prototypes
+
+// identify the CIC a ROM is for from the CRC-32 of its IPL3 boot code
+// buf: buffer with big-endian ROM data, at least CKSUM_START bytes
+// returns CIC type or CIC_UNKNOWN
+cic_type n64_detect_cic(const unsigned char *buf);
+
+// compute N64 ROM header checksums for a CIC
+// uses AVX2 or SSSE3 when the processor supports them
+// buf: buffer with big-endian ROM data, at least CKSUM_START + CKSUM_LENGTH bytes
+// cic: CIC type to compute checksums for
+// cksum: two element array to write CRC1 and CRC2 to
+// returns 0 on success, -1 if cic is unknown
+int n64_calc_checksums_cic(const unsigned char *buf, cic_type cic, unsigned int cksum[]);
+
+// compute N64 ROM header checksums for CIC-NUS-6102
+// buf: buffer with big-endian ROM data, at least CKSUM_START + CKSUM_LENGTH bytes
+// cksum: two element array to write CRC1 and CRC2 to
+void n64_calc_checksums(const unsigned char *buf, unsigned int cksum[]);
+
+// reference implementation of n64_calc_checksums(), transliterated from the boot code
+// buf: buffer with big-endian ROM data, at least CKSUM_START + CKSUM_LENGTH bytes
+// cksum: two element array to write CRC1 and CRC2 to
+void n64_calc_checksums_ref(const unsigned char *buf, unsigned int cksum[]);
+
+// name of the implementation n64_calc_checksums() uses on this processor
+const char *n64_cksum_engine(void);
+
+#endif // LIBCKSUM_H_
@@ -20,6 +20,34 @@ typedef struct
    int start;
 } lookback;
 
+// hash chain over the 4096-byte window
+#define WINDOW_SIZE 4096
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_BITS   15
+#define HASH_SIZE   (1 << HASH_BITS)
+#define HASH_MASK   (HASH_SIZE - 1)
+#define HASH_SHIFT  5 // HASH_BITS / 3, so bytes fall out after three updates
+typedef struct
+{
+   int head[HASH_SIZE];  // most recent position for each hash, -1 if none
+   int prev[WINDOW_SIZE]; // previous position with same hash, indexed by position & WINDOW_MASK
+   unsigned int hash;    // rolling hash of the next three bytes to insert
+   int next_insert;      // next position to insert into the chains
+} hash_chain;
+
+typedef enum
+{
+   FINDER_LOOKBACK, // per-first-byte lookback lists
+   FINDER_HASH,     // 3-byte hash chains
+} finder_type;
+
+typedef struct
+{
+   finder_type type;
+   lookback *lookbacks;
+   hash_chain *chain;
+} match_finder;
+
 // functions
 #define LOOKBACK_COUNT 256
 #define LOOKBACK_INIT_SIZE 128
@@ -53,6 +81,34 @@ static inline void lookback_push(lookback *lkbk, unsigned char val, int index)
    lb->indexes[lb->count++] = index;
 }
 
+#define HASH_UPDATE(HASH_, VAL_) ((((HASH_) << HASH_SHIFT) ^ (VAL_)) & HASH_MASK)
+
+static hash_chain *hash_chain_init(const unsigned char *buf, unsigned int length)
+{
+   hash_chain *hc = malloc(sizeof(*hc));
+   memset(hc->head, 0xFF, sizeof(hc->head));
+   hc->hash = 0;
+   if (length > 0) hc->hash = HASH_UPDATE(hc->hash, buf[0]);
+   if (length > 1) hc->hash = HASH_UPDATE(hc->hash, buf[1]);
+   hc->next_insert = 0;
+   return hc;
+}
+
+// insert all positions up to and including 'index' into the hash chains
+// positions without three bytes remaining can never start a match and are skipped
+static inline void hash_chain_push(hash_chain *hc, const unsigned char *buf, unsigned int length, int index)
+{
+   while (hc->next_insert <= index) {
+      int pos = hc->next_insert;
+      if ((unsigned int)pos + 2 < length) {
+         hc->hash = HASH_UPDATE(hc->hash, buf[pos + 2]);
+         hc->prev[pos & WINDOW_MASK] = hc->head[hc->hash];
+         hc->head[hc->hash] = pos;
+      }
+      hc->next_insert++;
+   }
+}
+
 static void PUT_BIT(unsigned char *buf, int bit, int val)
 {
    unsigned char mask = 1 << (7 - (bit % 8));
@@ -121,6 +177,105 @@ static int find_longest(const unsigned char *buf, int start_offset, int max_sear
    return best_length;
 }
 
+// hash chain version of find_longest(): only visits earlier positions whose
+// first three bytes hash the same as 'start_offset', newest to oldest
+// match lengths are the same as find_longest(), but ties prefer the nearest
+// offset so the search can stop as soon as a max length match is found
+// buf: buffer
+// length: length of buf
+// start_offset: offset in buf to look back from
+// max_search: max number of bytes to find
+// found_offset: returned offset found (0 if none found)
+// returns max length of matching stream (0 if none or less than 3 found)
+static int find_longest_hash(const unsigned char *buf, unsigned int length, int start_offset, int max_search, int *found_offset, hash_chain *hc)
+{
+   const unsigned char *cur = &buf[start_offset];
+   int best_length = 2;
+   int best_offset = 0;
+   int farthest;
+   int off;
+   unsigned int hash;
+
+   *found_offset = 0;
+   if (max_search < 3 || (unsigned int)start_offset + 2 >= length) {
+      return 0;
+   }
+
+   hash = HASH_UPDATE(HASH_UPDATE(HASH_UPDATE(0, cur[0]), cur[1]), cur[2]);
+   farthest = MAX(start_offset - WINDOW_SIZE, 0);
+   off = hc->head[hash];
+   // positions at or after start_offset have not been pushed yet or are stale
+   while (off >= farthest && off < start_offset) {
+      const unsigned char *cand = &buf[off];
+      // cheap rejection of hash collisions and candidates that can't beat the best
+      if (cand[best_length] == cur[best_length] && cand[0] == cur[0] && cand[1] == cur[1] && cand[2] == cur[2]) {
+         int i;
+         // overlapping matches compare against input, which is what the decoder reproduces
+         for (i = 3; i < max_search; i++) {
+            if (cand[i] != cur[i]) {
+               break;
+            }
+         }
+         if (i > best_length) {
+            best_length = i;
+            best_offset = start_offset - off;
+            if (best_length == max_search) {
+               break;
+            }
+         }
+      }
+      int next = hc->prev[off & WINDOW_MASK];
+      if (next >= off) {
+         break;
+      }
+      off = next;
+   }
+
+   if (best_offset == 0) {
+      return 0;
+   }
+   *found_offset = best_offset;
+   return best_length;
+}
+
+static void finder_init(match_finder *mf, finder_type type, const unsigned char *buf, unsigned int length)
+{
+   mf->type = type;
+   mf->lookbacks = NULL;
+   mf->chain = NULL;
+   switch (type) {
+      case FINDER_LOOKBACK: mf->lookbacks = lookback_init(); break;
+      case FINDER_HASH:     mf->chain = hash_chain_init(buf, length); break;
+   }
+}
+
+static void finder_free(match_finder *mf)
+{
+   if (mf->lookbacks) {
+      lookback_free(mf->lookbacks);
+   }
+   if (mf->chain) {
+      free(mf->chain);
+   }
+}
+
+static inline void finder_push(match_finder *mf, const unsigned char *buf, unsigned int length, int index)
+{
+   switch (mf->type) {
+      case FINDER_LOOKBACK: lookback_push(mf->lookbacks, buf[index], index); break;
+      case FINDER_HASH:     hash_chain_push(mf->chain, buf, length, index); break;
+   }
+}
+
+static inline int finder_find(match_finder *mf, const unsigned char *buf, unsigned int length, int start_offset, int max_search, int *found_offset)
+{
+   switch (mf->type) {
+      case FINDER_LOOKBACK: return find_longest(buf, start_offset, max_search, found_offset, mf->lookbacks);
+      case FINDER_HASH:     return find_longest_hash(buf, length, start_offset, max_search, found_offset, mf->chain);
+   }
+   return 0;
+}
+
 // decode MIO0 header
 // returns 1 if valid header, 0 otherwise
 int mio0_decode_header(const unsigned char *buf, mio0_header_t *head)
@@ -142,9 +297,36 @@ void mio0_encode_header(unsigned char *buf, const mio0_header_t *head)
    write_u32_be(&buf[12], head->uncomp_offset);
 }
 
+// number of consecutive set bits from the MSb of 'word'
+static inline int count_leading_ones(unsigned int word)
+{
+#if defined(__GNUC__)
+   return (word == 0xFFFFFFFF) ? 32 : __builtin_clz(~word);
+#else
+   int count = 0;
+   while (word & 0x80000000) {
+      count++;
+      word <<= 1;
+   }
+   return count;
+#endif
+}
+
+// copy 8 bytes, source and destination may be unaligned but must not overlap
+static inline void copy8(unsigned char *dst, const unsigned char *src)
+{
+   memcpy(dst, src, 8);
+}
+
+// fast path needs room for a back-reference copied in whole 8-byte chunks
+#define DECODE_SLACK 24
+
 int mio0_decode(const unsigned char *in, unsigned char *out, unsigned int *end)
 {
    mio0_header_t head;
+   const unsigned char *bits;
+   const unsigned char *comp;
+   const unsigned char *uncomp;
    unsigned int bytes_written = 0;
    int bit_idx = 0;
    int comp_idx = 0;
@@ -157,12 +339,62 @@ int mio0_decode(const unsigned char *in, unsigned char *out, unsigned int *end)
    if (!valid) {
       return -2;
    }
+   bits = &in[MIO0_HEADER_LENGTH];
+   comp = &in[head.comp_offset];
+   uncomp = &in[head.uncomp_offset];
 
-   // decode data
+   // fast path: consume control bits 32 at a time while the output has room for
+   // chunked copies that may write up to DECODE_SLACK bytes past the current position
+   while (head.dest_size >= DECODE_SLACK && bytes_written <= head.dest_size - DECODE_SLACK) {
+      unsigned int word = read_u32_be(&bits[bit_idx / 8]);
+      int bits_left = 32;
+      while (bits_left > 0 && bytes_written <= head.dest_size - DECODE_SLACK) {
+         if (word & 0x80000000) {
+            // 1s - run of uncompressed bytes
+            int run = MIN(count_leading_ones(word), bits_left);
+            run = MIN((unsigned int)run, head.dest_size - bytes_written);
+            memcpy(&out[bytes_written], &uncomp[uncomp_idx], run);
+            bytes_written += run;
+            uncomp_idx += run;
+            bit_idx += run;
+            bits_left -= run;
+            word = (run < 32) ? (word << run) : 0;
+         } else {
+            // 0 - read compressed data
+            const unsigned char *vals = &comp[comp_idx];
+            int length = (vals[0] >> 4) + 3;
+            int idx = ((vals[0] & 0x0F) << 8) + vals[1] + 1;
+            unsigned char *dst = &out[bytes_written];
+            comp_idx += 2;
+            if (idx >= 8) {
+               // each chunk only reads bytes written before it
+               const unsigned char *src = dst - idx;
+               copy8(dst, src);
+               copy8(dst + 8, src + 8);
+               if (length > 16) {
+                  copy8(dst + 16, src + 16);
+               }
+            } else {
+               for (int i = 0; i < length; i++) {
+                  dst[i] = dst[i - idx];
+               }
+            }
+            bytes_written += length;
+            bit_idx++;
+            bits_left--;
+            word <<= 1;
+         }
+      }
+      if (bits_left > 0) {
+         break;
+      }
+   }
+
+   // decode remaining data a bit at a time
    while (bytes_written < head.dest_size) {
-      if (GET_BIT(&in[MIO0_HEADER_LENGTH], bit_idx)) {
+      if (GET_BIT(bits, bit_idx)) {
          // 1 - pull uncompressed data
-         out[bytes_written] = in[head.uncomp_offset + uncomp_idx];
+         out[bytes_written] = uncomp[uncomp_idx];
          bytes_written++;
          uncomp_idx++;
       } else {
@@ -170,7 +402,7 @@ int mio0_decode(const unsigned char *in, unsigned char *out, unsigned int *end)
          int idx;
          int length;
          int i;
-         const unsigned char *vals = &in[head.comp_offset + comp_idx];
+         const unsigned char *vals = &comp[comp_idx];
          comp_idx += 2;
          length = ((vals[0] & 0xF0) >> 4) + 3;
          idx = ((vals[0] & 0x0F) << 8) + vals[1] + 1;
@@ -189,23 +421,178 @@ int mio0_decode(const unsigned char *in, unsigned char *out, unsigned int *end)
    return bytes_written;
 }
 
-int mio0_encode(const unsigned char *in, unsigned int length, unsigned char *out)
+void mio0_stream_init(mio0_stream *s, unsigned char *buf, unsigned int buf_size, unsigned int in_limit)
+{
+   memset(s, 0, sizeof(*s));
+   s->buf = buf;
+   s->buf_size = buf_size;
+   s->in_limit = in_limit;
+   s->status = MIO0_STREAM_NEED_INPUT;
+}
+
+// validate header offsets against the input limit and pick linear or ring output
+static int mio0_stream_header(mio0_stream *s, const unsigned char *in)
+{
+   mio0_header_t *head = &s->head;
+   if (!mio0_decode_header(in, head)) {
+      return MIO0_STREAM_ERR_HEADER;
+   }
+   if (head->comp_offset < MIO0_HEADER_LENGTH || head->comp_offset > head->uncomp_offset ||
+       head->uncomp_offset > s->in_limit) {
+      return MIO0_STREAM_ERR_HEADER;
+   }
+   if (s->buf_size >= head->dest_size) {
+      s->buf_mask = 0xFFFFFFFF;
+   } else if (s->buf_size >= WINDOW_SIZE && (s->buf_size & (s->buf_size - 1)) == 0) {
+      s->buf_mask = s->buf_size - 1;
+   } else {
+      return MIO0_STREAM_ERR_BUFFER;
+   }
+   s->have_header = 1;
+   return MIO0_STREAM_OK;
+}
+
+int mio0_stream_feed(mio0_stream *s, const unsigned char *in, unsigned int in_len)
+{
+   const mio0_header_t *head = &s->head;
+
+   if (s->status < 0 || s->status == MIO0_STREAM_DONE) {
+      return s->status;
+   }
+   s->in_len = in_len = MIN(in_len, s->in_limit);
+   if (!s->have_header) {
+      int ret;
+      if (in_len < MIO0_HEADER_LENGTH) {
+         s->status = (in_len < s->in_limit) ? MIO0_STREAM_NEED_INPUT : MIO0_STREAM_ERR_HEADER;
+         return s->status;
+      }
+      ret = mio0_stream_header(s, in);
+      if (ret < 0) {
+         return s->status = ret;
+      }
+   }
+
+   // every read is checked against its section first, then against the input
+   // received so far, so a stream can only stall for input if it is still valid
+   while (s->written < head->dest_size) {
+      unsigned int bit_byte = MIO0_HEADER_LENGTH + s->bit_idx / 8;
+      if (bit_byte >= head->comp_offset) {
+         return s->status = MIO0_STREAM_ERR_CORRUPT;
+      }
+      if (bit_byte >= in_len) {
+         return s->status = MIO0_STREAM_NEED_INPUT;
+      }
+      if (in[bit_byte] & (0x80 >> (s->bit_idx % 8))) {
+         // 1 - pull uncompressed data
+         unsigned int src = head->uncomp_offset + s->uncomp_idx;
+         if (src >= s->in_limit) {
+            return s->status = MIO0_STREAM_ERR_CORRUPT;
+         }
+         if (src >= in_len) {
+            return s->status = MIO0_STREAM_NEED_INPUT;
+         }
+         if (s->written - s->drained >= s->buf_size) {
+            return s->status = MIO0_STREAM_OK;
+         }
+         s->buf[s->written & s->buf_mask] = in[src];
+         s->written++;
+         s->uncomp_idx++;
+      } else {
+         // 0 - read compressed data
+         unsigned int src = head->comp_offset + s->comp_idx;
+         unsigned int length;
+         unsigned int idx;
+         if (src + 1 >= head->uncomp_offset) {
+            return s->status = MIO0_STREAM_ERR_CORRUPT;
+         }
+         if (src + 1 >= in_len) {
+            return s->status = MIO0_STREAM_NEED_INPUT;
+         }
+         length = (in[src] >> 4) + 3;
+         idx = ((in[src] & 0x0F) << 8) + in[src + 1] + 1;
+         if (idx > s->written || length > head->dest_size - s->written) {
+            return s->status = MIO0_STREAM_ERR_CORRUPT;
+         }
+         if (s->written - s->drained + length > s->buf_size) {
+            return s->status = MIO0_STREAM_OK;
+         }
+         for (unsigned int i = 0; i < length; i++) {
+            s->buf[s->written & s->buf_mask] = s->buf[(s->written - idx) & s->buf_mask];
+            s->written++;
+         }
+         s->comp_idx += 2;
+      }
+      s->bit_idx++;
+   }
+
+   return s->status = MIO0_STREAM_DONE;
+}
+
+unsigned int mio0_stream_drain(mio0_stream *s, unsigned char *out, unsigned int out_len)
+{
+   unsigned int count = MIN(s->written - s->drained, out_len);
+   unsigned int start = s->drained & s->buf_mask;
+   // ring buffer contents may wrap around once
+   unsigned int first = MIN(count, s->buf_size - start);
+   memcpy(out, &s->buf[start], first);
+   memcpy(&out[first], s->buf, count - first);
+   s->drained += count;
+   return count;
+}
+
+unsigned int mio0_stream_end(const mio0_stream *s)
+{
+   return s->head.uncomp_offset + s->uncomp_idx;
+}
+
+// assemble MIO0 header and the three encoded streams into 'out'
+// returns size of compressed data in 'out' including MIO0 header
+static int mio0_write_output(unsigned char *out, unsigned int length,
+      const unsigned char *bit_buf, int bit_count,
+      const unsigned char *comp_buf, int comp_idx,
+      const unsigned char *uncomp_buf, int uncomp_idx)
 {
-   unsigned char *bit_buf;
-   unsigned char *comp_buf;
-   unsigned char *uncomp_buf;
    unsigned int bit_length;
    unsigned int comp_offset;
    unsigned int uncomp_offset;
+
+   // compute final sizes and offsets
+   // +7 so int division accounts for all bits
+   bit_length = ((bit_count + 7) / 8);
+   // compressed data after control bits and aligned to 4-byte boundary
+   comp_offset = ALIGN(MIO0_HEADER_LENGTH + bit_length, 4);
+   uncomp_offset = comp_offset + comp_idx;
+
+   // output header
+   memcpy(out, "MIO0", 4);
+   write_u32_be(&out[4], length);
+   write_u32_be(&out[8], comp_offset);
+   write_u32_be(&out[12], uncomp_offset);
+   // output data, zeroing alignment padding after the control bits
+   memcpy(&out[MIO0_HEADER_LENGTH], bit_buf, bit_length);
+   memset(&out[MIO0_HEADER_LENGTH + bit_length], 0, comp_offset - MIO0_HEADER_LENGTH - bit_length);
+   memcpy(&out[comp_offset], comp_buf, comp_idx);
+   memcpy(&out[uncomp_offset], uncomp_buf, uncomp_idx);
+
+   return uncomp_offset + uncomp_idx;
+}
+
+// greedy MIO0 encoder with one byte lookahead
+// finder: match finder engine to use, all engines produce the same output size
+static int mio0_encode_greedy(const unsigned char *in, unsigned int length, unsigned char *out, finder_type finder)
+{
+   unsigned char *bit_buf;
+   unsigned char *comp_buf;
+   unsigned char *uncomp_buf;
    unsigned int bytes_proc = 0;
    int bytes_written;
    int bit_idx = 0;
    int comp_idx = 0;
    int uncomp_idx = 0;
-   lookback *lookbacks;
+   match_finder mf;
 
-   // initialize lookback buffer
-   lookbacks = lookback_init();
+   // initialize match finder
+   finder_init(&mf, finder, in, length);
 
    // allocate some temporary buffers worst case size
    bit_buf = malloc((length + 7) / 8); // 1-bit/byte
@@ -215,7 +602,7 @@ int mio0_encode(const unsigned char *in, unsigned int length, unsigned char *out
 
    // encode data
    // special case for first byte
-   lookback_push(lookbacks, in[0], 0);
+   finder_push(&mf, in, length, 0);
    uncomp_buf[uncomp_idx] = in[0];
    uncomp_idx += 1;
    bytes_proc += 1;
@@ -223,14 +610,14 @@ int mio0_encode(const unsigned char *in, unsigned int length, unsigned char *out
    while (bytes_proc < length) {
       int offset;
       int max_length = MIN(length - bytes_proc, 18);
-      int longest_match = find_longest(in, bytes_proc, max_length, &offset, lookbacks);
+      int longest_match = finder_find(&mf, in, length, bytes_proc, max_length, &offset);
       // push current byte before checking next longer match
-      lookback_push(lookbacks, in[bytes_proc], bytes_proc);
+      finder_push(&mf, in, length, bytes_proc);
       if (longest_match > 2) {
          int lookahead_offset;
          // lookahead to next byte to see if longer match
          int lookahead_length = MIN(length - bytes_proc - 1, 18);
-         int lookahead_match = find_longest(in, bytes_proc + 1, lookahead_length, &lookahead_offset, lookbacks);
+         int lookahead_match = finder_find(&mf, in, length, bytes_proc + 1, lookahead_length, &lookahead_offset);
          // better match found, use uncompressed + lookahead compressed
          if ((longest_match + 1) < lookahead_match) {
             // uncompressed byte
@@ -241,11 +628,11 @@ int mio0_encode(const unsigned char *in, unsigned int length, unsigned char *out
             longest_match = lookahead_match;
             offset = lookahead_offset;
             bit_idx++;
-            lookback_push(lookbacks, in[bytes_proc], bytes_proc);
+            finder_push(&mf, in, length, bytes_proc);
          }
          // first byte already pushed above
          for (int i = 1; i < longest_match; i++) {
-            lookback_push(lookbacks, in[bytes_proc + i], bytes_proc + i);
+            finder_push(&mf, in, length, bytes_proc + i);
          }
          // compressed block
          comp_buf[comp_idx] = (((longest_match - 3) & 0x0F) << 4) |
@@ -264,99 +651,271 @@ int mio0_encode(const unsigned char *in, unsigned int length, unsigned char *out
       bit_idx++;
    }
 
-   // compute final sizes and offsets
-   // +7 so int division accounts for all bits
-   bit_length = ((bit_idx + 7) / 8);
-   // compressed data after control bits and aligned to 4-byte boundary
-   comp_offset = ALIGN(MIO0_HEADER_LENGTH + bit_length, 4);
-   uncomp_offset = comp_offset + comp_idx;
-   bytes_written = uncomp_offset + uncomp_idx;
+   bytes_written = mio0_write_output(out, length, bit_buf, bit_idx, comp_buf, comp_idx, uncomp_buf, uncomp_idx);
 
-   // output header
-   memcpy(out, "MIO0", 4);
-   write_u32_be(&out[4], length);
-   write_u32_be(&out[8], comp_offset);
-   write_u32_be(&out[12], uncomp_offset);
-   // output data
-   memcpy(&out[MIO0_HEADER_LENGTH], bit_buf, bit_length);
-   memcpy(&out[comp_offset], comp_buf, comp_idx);
-   memcpy(&out[uncomp_offset], uncomp_buf, uncomp_idx);
+   // free allocated buffers
+   free(bit_buf);
+   free(comp_buf);
+   free(uncomp_buf);
+   finder_free(&mf);
+
+   return bytes_written;
+}
+
+// optimal parse MIO0 encoder
+// finds the longest match at every position, then picks the sequence of literals
+// and back-references with the lowest total size using dynamic programming
+// a literal costs 9 bits (control bit + byte), a back-reference 17 bits (control bit
+// + 2 bytes) regardless of its length or offset, so any match of length 3..M at a
+// position is available at the offset of the longest one
+static int mio0_encode_optimal(const unsigned char *in, unsigned int length, unsigned char *out)
+{
+   unsigned char *bit_buf;
+   unsigned char *comp_buf;
+   unsigned char *uncomp_buf;
+   unsigned char *match_len;    // longest match at each position, 0 if none
+   unsigned short *match_off;   // offset of longest match at each position
+   unsigned int *cost;          // minimum bits to encode from each position to the end
+   unsigned char *choice;       // token length chosen at each position, 1 for literal
+   unsigned int i;
+   int bytes_written;
+   int bit_idx = 0;
+   int comp_idx = 0;
+   int uncomp_idx = 0;
+   hash_chain *hc;
+
+   match_len = malloc(length);
+   match_off = malloc(length * sizeof(*match_off));
+   cost = malloc((length + 1) * sizeof(*cost));
+   choice = malloc(length);
+
+   // find longest match at every position
+   hc = hash_chain_init(in, length);
+   for (i = 0; i < length; i++) {
+      int offset;
+      int max_length = MIN(length - i, 18);
+      match_len[i] = find_longest_hash(in, length, i, max_length, &offset, hc);
+      match_off[i] = offset;
+      hash_chain_push(hc, in, length, i);
+   }
+   free(hc);
+
+   // lowest cost parse from the end backwards
+   cost[length] = 0;
+   for (i = length; i-- > 0; ) {
+      unsigned int best = 9 + cost[i + 1];
+      int best_len = 1;
+      for (int l = 3; l <= match_len[i]; l++) {
+         unsigned int c = 17 + cost[i + l];
+         // ties prefer longer matches so fewer tokens are emitted
+         if (c <= best) {
+            best = c;
+            best_len = l;
+         }
+      }
+      cost[i] = best;
+      choice[i] = best_len;
+   }
+
+   // allocate some temporary buffers worst case size
+   bit_buf = malloc((length + 7) / 8); // 1-bit/byte
+   comp_buf = malloc(length); // 16-bits/2bytes
+   uncomp_buf = malloc(length); // all uncompressed
+   memset(bit_buf, 0, (length + 7) / 8);
+
+   // emit chosen tokens
+   i = 0;
+   while (i < length) {
+      int len = choice[i];
+      if (len > 2) {
+         int offset = match_off[i];
+         comp_buf[comp_idx] = (((len - 3) & 0x0F) << 4) |
+                              (((offset - 1) >> 8) & 0x0F);
+         comp_buf[comp_idx + 1] = (offset - 1) & 0xFF;
+         comp_idx += 2;
+         PUT_BIT(bit_buf, bit_idx, 0);
+      } else {
+         uncomp_buf[uncomp_idx] = in[i];
+         uncomp_idx++;
+         PUT_BIT(bit_buf, bit_idx, 1);
+      }
+      bit_idx++;
+      i += len;
+   }
+
+   bytes_written = mio0_write_output(out, length, bit_buf, bit_idx, comp_buf, comp_idx, uncomp_buf, uncomp_idx);
 
    // free allocated buffers
    free(bit_buf);
    free(comp_buf);
    free(uncomp_buf);
-   lookback_free(lookbacks);
+   free(choice);
+   free(cost);
+   free(match_off);
+   free(match_len);
 
    return bytes_written;
 }
 
-int mio0_decode_file(const char *in_file, unsigned long offset, const char *out_file)
+int mio0_encode_ex(const unsigned char *in, unsigned int length, unsigned char *out, int level)
+{
+   if (level >= MIO0_LEVEL_BEST) {
+      return mio0_encode_optimal(in, length, out);
+   }
+   return mio0_encode_greedy(in, length, out, FINDER_HASH);
+}
+
+int mio0_encode(const unsigned char *in, unsigned int length, unsigned char *out)
+{
+   return mio0_encode_ex(in, length, out, MIO0_LEVEL_DEFAULT);
+}
+
+// ring buffer and chunk size used when decoding to files
+#define STREAM_CHUNK (64 * KB)
+
+// write all decoded bytes not yet drained from a stream to a file, opening it on first use
+// returns 0 on success, 4 if file could not be opened, 5 on write error
+static int mio0_stream_write(mio0_stream *s, FILE **out, const char *out_file, unsigned char *chunk)
+{
+   unsigned int count;
+   if (*out == NULL) {
+      *out = fopen(out_file, "wb");
+      if (*out == NULL) {
+         return 4;
+      }
+   }
+   while ((count = mio0_stream_drain(s, chunk, STREAM_CHUNK)) > 0) {
+      if (fwrite(chunk, 1, count, *out) != count) {
+         return 5;
+      }
+   }
+   return 0;
+}
+
+unsigned char *mio0_decode_alloc(const unsigned char *in, unsigned int in_len, unsigned int *out_len)
 {
    mio0_header_t head;
+   mio0_stream s;
+   unsigned char *out;
+
+   if (in_len < MIO0_HEADER_LENGTH || !mio0_decode_header(in, &head)) {
+      return NULL;
+   }
+   // output is sized from the header, every read from 'in' is bounded by the stream
+   out = malloc(head.dest_size ? head.dest_size : 1);
+   if (out == NULL) {
+      return NULL;
+   }
+   mio0_stream_init(&s, out, head.dest_size, in_len);
+   if (mio0_stream_feed(&s, in, in_len) != MIO0_STREAM_DONE) {
+      free(out);
+      return NULL;
+   }
+   if (out_len) {
+      *out_len = head.dest_size;
+   }
+   return out;
+}
+
+int mio0_decode_buffer_file(const unsigned char *in, unsigned int in_len, const char *out_file)
+{
+   mio0_stream s;
+   FILE *out = NULL;
+   unsigned char *ring = malloc(STREAM_CHUNK);
+   unsigned char *chunk = malloc(STREAM_CHUNK);
+   int ret_val = 0;
+   int status;
+
+   mio0_stream_init(&s, ring, STREAM_CHUNK, in_len);
+   do {
+      status = mio0_stream_feed(&s, in, in_len);
+      if (status < 0 || status == MIO0_STREAM_NEED_INPUT) {
+         ret_val = 3;
+         break;
+      }
+      ret_val = mio0_stream_write(&s, &out, out_file, chunk);
+   } while (ret_val == 0 && status != MIO0_STREAM_DONE);
+
+   if (out) {
+      fclose(out);
+      // don't leave partial output from a corrupt block behind
+      if (ret_val == 3) {
+         remove(out_file);
+      }
+   }
+   free(chunk);
+   free(ring);
+
+   return ret_val;
+}
+
+int mio0_decode_file(const char *in_file, unsigned long offset, const char *out_file)
+{
+   mio0_stream s;
    FILE *in;
-   FILE *out;
+   FILE *out = NULL;
    unsigned char *in_buf = NULL;
-   unsigned char *out_buf = NULL;
+   unsigned char *ring;
+   unsigned char *chunk;
+   unsigned int in_limit;
+   unsigned int in_len = 0;
    long file_size;
    int ret_val = 0;
-   size_t bytes_read;
-   int bytes_decoded;
-   int bytes_written;
-   int valid;
+   int status;
 
    in = fopen(in_file, "rb");
    if (in == NULL) {
       return 1;
    }
 
-   // allocate buffer to read from offset to end of file
+   // input is read on demand up to the end of the file, never more than the block needs
    fseek(in, 0, SEEK_END);
    file_size = ftell(in);
-   in_buf = malloc(file_size - offset);
-   fseek(in, offset, SEEK_SET);
-
-   // read bytes
-   bytes_read = fread(in_buf, 1, file_size - offset, in);
-   if (bytes_read != file_size - offset) {
-      ret_val = 2;
-      goto free_all;
-   }
-
-   // verify header
-   valid = mio0_decode_header(in_buf, &head);
-   if (!valid) {
-      ret_val = 3;
-      goto free_all;
-   }
-   out_buf = malloc(head.dest_size);
-
-   // decompress MIO0 encoded data
-   bytes_decoded = mio0_decode(in_buf, out_buf, NULL);
-   if (bytes_decoded < 0) {
-      ret_val = 3;
-      goto free_all;
-   }
-
-   // open output file
-   out = fopen(out_file, "wb");
-   if (out == NULL) {
-      ret_val = 4;
-      goto free_all;
+   if (file_size < 0 || (unsigned long)file_size < offset) {
+      fclose(in);
+      return 2;
    }
+   in_limit = file_size - offset;
+   fseek(in, offset, SEEK_SET);
 
-   // write data to file
-   bytes_written = fwrite(out_buf, 1, bytes_decoded, out);
-   if (bytes_written != bytes_decoded) {
-      ret_val = 5;
+   ring = malloc(STREAM_CHUNK);
+   chunk = malloc(STREAM_CHUNK);
+   mio0_stream_init(&s, ring, STREAM_CHUNK, in_limit);
+   for (;;) {
+      status = mio0_stream_feed(&s, in_buf, in_len);
+      if (status == MIO0_STREAM_NEED_INPUT) {
+         unsigned int count = MIN(STREAM_CHUNK, in_limit - in_len);
+         if (count == 0) {
+            ret_val = 3;
+            break;
+         }
+         in_buf = realloc(in_buf, in_len + count);
+         if (fread(&in_buf[in_len], 1, count, in) != count) {
+            ret_val = 2;
+            break;
+         }
+         in_len += count;
+         continue;
+      }
+      if (status < 0) {
+         ret_val = 3;
+         break;
+      }
+      ret_val = mio0_stream_write(&s, &out, out_file, chunk);
+      if (ret_val != 0 || status == MIO0_STREAM_DONE) {
+         break;
+      }
    }
 
-   // clean up
-   fclose(out);
-free_all:
-   if (out_buf) {
-      free(out_buf);
+   if (out) {
+      fclose(out);
+      // don't leave partial output from a corrupt block behind
+      if (ret_val == 2 || ret_val == 3) {
+         remove(out_file);
+      }
    }
+   free(chunk);
+   free(ring);
    if (in_buf) {
       free(in_buf);
    }
@@ -430,12 +989,15 @@ free_all:
 
 // mio0 standalone executable
 #ifdef MIO0_STANDALONE
+#include <time.h>
+
 typedef struct
 {
    char *in_filename;
    char *out_filename;
    unsigned int offset;
    int compress;
+   int benchmark; // 1: compression, 2: ROM decompression
 } arg_config;
 
 static arg_config default_config =
@@ -443,18 +1005,21 @@ static arg_config default_config =
    NULL,
    NULL,
    0,
-   1
+   1,
+   0
 };
 
 static void print_usage(void)
 {
-   ERROR("Usage: mio0 [-c / -d] [-o OFFSET] FILE [OUTPUT]\n"
+   ERROR("Usage: mio0 [-c / -d / -b / -r] [-o OFFSET] FILE [OUTPUT]\n"
          "\n"
          "mio0 v" MIO0_VERSION ": MIO0 compression and decompression tool\n"
          "\n"
          "Optional arguments:\n"
          " -c           compress raw data into MIO0 (default: compress)\n"
          " -d           decompress MIO0 into raw data\n"
+         " -b           benchmark compression match finders and levels on FILE\n"
+         " -r           benchmark decoding all MIO0 blocks in ROM FILE 100 times\n"
          " -o OFFSET    starting offset in FILE (default: 0)\n"
          "\n"
          "File arguments:\n"
@@ -475,6 +1040,12 @@ static void parse_arguments(int argc, char *argv[], arg_config *config)
    for (i = 1; i < argc; i++) {
       if (argv[i][0] == '-') {
          switch (argv[i][1]) {
+            case 'b':
+               config->benchmark = 1;
+               break;
+            case 'r':
+               config->benchmark = 2;
+               break;
             case 'c':
                config->compress = 1;
                break;
@@ -511,6 +1082,219 @@ static void parse_arguments(int argc, char *argv[], arg_config *config)
    }
 }
 
+typedef int (*encoder_fn)(const unsigned char *in, unsigned int length, unsigned char *out);
+
+static int encode_lookback(const unsigned char *in, unsigned int length, unsigned char *out)
+{
+   return mio0_encode_greedy(in, length, out, FINDER_LOOKBACK);
+}
+
+static int encode_hash(const unsigned char *in, unsigned int length, unsigned char *out)
+{
+   return mio0_encode_greedy(in, length, out, FINDER_HASH);
+}
+
+// time one encoder on the same input until at least a second has elapsed
+// returns compressed size, throughput in MB/s written to 'mbps'
+static int benchmark_encoder(const unsigned char *in, unsigned int length, unsigned char *out, encoder_fn encode, double *mbps)
+{
+   clock_t start = clock();
+   clock_t elapsed;
+   int runs = 0;
+   int out_len;
+   do {
+      out_len = encode(in, length, out);
+      runs++;
+      elapsed = clock() - start;
+   } while (elapsed < CLOCKS_PER_SEC);
+   *mbps = ((double)length * runs / MB) / ((double)elapsed / CLOCKS_PER_SEC);
+   return out_len;
+}
+
+// read FILE from 'offset' to the end into a new buffer
+// returns buffer and its length in 'length', or NULL with error code in 'ret_val'
+static unsigned char *benchmark_read(const char *in_file, unsigned long offset, unsigned int *length, int *ret_val)
+{
+   FILE *in;
+   unsigned char *in_buf;
+   long file_size;
+
+   in = fopen(in_file, "rb");
+   if (in == NULL) {
+      *ret_val = 1;
+      return NULL;
+   }
+   fseek(in, 0, SEEK_END);
+   file_size = ftell(in);
+   if (file_size <= 0 || (unsigned long)file_size <= offset) {
+      fclose(in);
+      *ret_val = 2;
+      return NULL;
+   }
+   *length = file_size - offset;
+   in_buf = malloc(*length);
+   fseek(in, offset, SEEK_SET);
+   if (fread(in_buf, 1, *length, in) != *length) {
+      free(in_buf);
+      fclose(in);
+      *ret_val = 2;
+      return NULL;
+   }
+   fclose(in);
+   *ret_val = 0;
+   return in_buf;
+}
+
+static int mio0_benchmark(const char *in_file, unsigned long offset)
+{
+   unsigned char *in_buf;
+   unsigned char *out_old;
+   unsigned char *out_new;
+   unsigned int length;
+   int ret_val;
+   int len_old, len_new, len_best;
+   double mbps_old, mbps_new, mbps_best;
+
+   in_buf = benchmark_read(in_file, offset, &length, &ret_val);
+   if (in_buf == NULL) {
+      return ret_val;
+   }
+
+   out_old = malloc(MIO0_HEADER_LENGTH + ((length+7)/8) + length);
+   out_new = malloc(MIO0_HEADER_LENGTH + ((length+7)/8) + length);
+
+   len_old = benchmark_encoder(in_buf, length, out_old, encode_lookback, &mbps_old);
+   len_new = benchmark_encoder(in_buf, length, out_new, encode_hash, &mbps_new);
+
+   printf("Input: %u bytes\n", length);
+   printf("lookback: %8d bytes %8.2f MB/s\n", len_old, mbps_old);
+   printf("hash:     %8d bytes %8.2f MB/s (%.2fx)\n", len_new, mbps_new, mbps_new / mbps_old);
+   if (len_old == len_new && !memcmp(out_old, out_new, len_new)) {
+      printf("Output identical\n");
+   } else {
+      printf("Output size %s (%+d bytes)\n", len_new <= len_old ? "not larger" : "LARGER", len_new - len_old);
+   }
+   len_best = benchmark_encoder(in_buf, length, out_new, mio0_encode_optimal, &mbps_best);
+   printf("optimal:  %8d bytes %8.2f MB/s (%+d bytes, %.2f%%)\n", len_best, mbps_best,
+         len_best - len_old, 100.0 * (len_best - len_old) / len_old);
+
+   free(out_new);
+   free(out_old);
+   free(in_buf);
+   return 0;
+}
+
+// reference decoder: one control bit and one byte at a time
+static int mio0_decode_bytewise(const unsigned char *in, unsigned char *out)
+{
+   mio0_header_t head;
+   unsigned int bytes_written = 0;
+   int bit_idx = 0;
+   int comp_idx = 0;
+   int uncomp_idx = 0;
+
+   if (!mio0_decode_header(in, &head)) {
+      return -2;
+   }
+   while (bytes_written < head.dest_size) {
+      if (GET_BIT(&in[MIO0_HEADER_LENGTH], bit_idx)) {
+         out[bytes_written++] = in[head.uncomp_offset + uncomp_idx++];
+      } else {
+         const unsigned char *vals = &in[head.comp_offset + comp_idx];
+         int length = ((vals[0] & 0xF0) >> 4) + 3;
+         int idx = ((vals[0] & 0x0F) << 8) + vals[1] + 1;
+         comp_idx += 2;
+         for (int i = 0; i < length; i++) {
+            out[bytes_written] = out[bytes_written - idx];
+            bytes_written++;
+         }
+      }
+      bit_idx++;
+   }
+   return bytes_written;
+}
+
+#define DECODE_BENCH_RUNS 100
+// decode every MIO0 block found at 4-byte alignment in a ROM DECODE_BENCH_RUNS times
+// with the reference and fast decoders, checking that their output matches
+static int mio0_benchmark_decode(const char *in_file, unsigned long offset)
+{
+   unsigned char *in_buf;
+   unsigned char *out_old;
+   unsigned char *out_new;
+   unsigned int *blocks;
+   unsigned int length;
+   unsigned int max_size = 0;
+   unsigned long long total = 0;
+   int block_count = 0;
+   int mismatches = 0;
+   int ret_val;
+   clock_t start;
+   double sec_old, sec_new;
+
+   in_buf = benchmark_read(in_file, offset, &length, &ret_val);
+   if (in_buf == NULL) {
+      return ret_val;
+   }
+
+   // find plausible MIO0 headers
+   blocks = malloc((length / 4 + 1) * sizeof(*blocks));
+   for (unsigned int i = 0; i + MIO0_HEADER_LENGTH <= length; i += 4) {
+      mio0_header_t head;
+      if (mio0_decode_header(&in_buf[i], &head) &&
+          head.comp_offset >= MIO0_HEADER_LENGTH && head.comp_offset <= head.uncomp_offset &&
+          head.uncomp_offset < length - i && head.dest_size > 0 && head.dest_size < 16*MB) {
+         blocks[block_count++] = i;
+         max_size = MAX(max_size, head.dest_size);
+         total += head.dest_size;
+      }
+   }
+   printf("Input: %u bytes, %d MIO0 blocks, %llu bytes decoded per run\n", length, block_count, total);
+   if (block_count == 0) {
+      free(blocks);
+      free(in_buf);
+      return 3;
+   }
+
+   out_old = malloc(max_size);
+   out_new = malloc(max_size);
+
+   start = clock();
+   for (int r = 0; r < DECODE_BENCH_RUNS; r++) {
+      for (int b = 0; b < block_count; b++) {
+         mio0_decode_bytewise(&in_buf[blocks[b]], out_old);
+      }
+   }
+   sec_old = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+   start = clock();
+   for (int r = 0; r < DECODE_BENCH_RUNS; r++) {
+      for (int b = 0; b < block_count; b++) {
+         mio0_decode(&in_buf[blocks[b]], out_new, NULL);
+      }
+   }
+   sec_new = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+   for (int b = 0; b < block_count; b++) {
+      int len_old = mio0_decode_bytewise(&in_buf[blocks[b]], out_old);
+      int len_new = mio0_decode(&in_buf[blocks[b]], out_new, NULL);
+      if (len_old != len_new || memcmp(out_old, out_new, len_new)) {
+         ERROR("Mismatch decoding block at 0x%X\n", blocks[b] + (unsigned int)offset);
+         mismatches++;
+      }
+   }
+
+   printf("bytewise: %8.3f s %8.2f MB/s\n", sec_old, (double)total * DECODE_BENCH_RUNS / MB / sec_old);
+   printf("fast:     %8.3f s %8.2f MB/s (%.2fx)\n", sec_new, (double)total * DECODE_BENCH_RUNS / MB / sec_new, sec_old / sec_new);
+   printf("%s\n", mismatches ? "Output MISMATCH" : "Output identical");
+
+   free(out_new);
+   free(out_old);
+   free(blocks);
+   free(in_buf);
+   return 0;
+}
+
 int main(int argc, char *argv[])
 {
    char out_filename[FILENAME_MAX];
@@ -526,7 +1310,11 @@ int main(int argc, char *argv[])
    }
 
    // operation
-   if (config.compress) {
+   if (config.benchmark == 2) {
+      ret_val = mio0_benchmark_decode(config.in_filename, config.offset);
+   } else if (config.benchmark) {
+      ret_val = mio0_benchmark(config.in_filename, config.offset);
+   } else if (config.compress) {
       ret_val = mio0_encode_file(config.in_filename, config.out_filename);
    } else {
       ret_val = mio0_decode_file(config.in_filename, config.offset, config.out_filename);
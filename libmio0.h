@@ -5,6 +5,19 @@
 
 #define MIO0_HEADER_LENGTH 16
 
+// compression levels for mio0_encode_ex()
+#define MIO0_LEVEL_FAST    1 // greedy parse with one byte lookahead
+#define MIO0_LEVEL_BEST    2 // optimal parse, smallest output
+#define MIO0_LEVEL_DEFAULT MIO0_LEVEL_FAST
+
+// mio0_stream_feed() status codes
+#define MIO0_STREAM_OK           0 // output buffer full, drain before feeding again
+#define MIO0_STREAM_DONE         1 // all dest_size bytes decoded
+#define MIO0_STREAM_NEED_INPUT   2 // more input bytes needed to continue
+#define MIO0_STREAM_ERR_HEADER  -1 // missing "MIO0" or offsets outside input limit
+#define MIO0_STREAM_ERR_CORRUPT -2 // stream reads outside its section or before the output start
+#define MIO0_STREAM_ERR_BUFFER  -3 // output buffer smaller than dest_size and not a valid ring
+
 // typedefs
 
 typedef struct
@@ -14,6 +27,24 @@ typedef struct
    unsigned int uncomp_offset;
 } mio0_header_t;
 
+// incremental decoder state, see mio0_stream_init()
+typedef struct
+{
+   mio0_header_t head;
+   unsigned char *buf;      // caller provided output buffer
+   unsigned int buf_size;
+   unsigned int buf_mask;   // position mask, all ones when buf holds the whole output
+   unsigned int in_len;     // bytes of input available
+   unsigned int in_limit;   // total bytes that may ever be read from the input
+   unsigned int bit_idx;    // next control bit
+   unsigned int comp_idx;   // next byte in compressed stream
+   unsigned int uncomp_idx; // next byte in uncompressed stream
+   unsigned int written;    // bytes decoded so far
+   unsigned int drained;    // bytes returned by mio0_stream_drain() so far
+   int have_header;
+   int status;
+} mio0_stream;
+
 // function prototypes
 
 // decode MIO0 header
@@ -30,18 +61,65 @@ void mio0_encode_header(unsigned char *buf, const mio0_header_t *head);
 // returns bytes extracted to 'out' or negative value on failure
 int mio0_decode(const unsigned char *in, unsigned char *out, unsigned int *end);
 
+// set up incremental MIO0 decoding into a caller provided output buffer
+// s: stream state to initialize
+// buf: output buffer, either at least dest_size bytes, or a ring buffer whose
+//      size is a power of 2 of at least 4 KB when drained while decoding
+// buf_size: size of buf
+// in_limit: max bytes that may be read from the MIO0 block, including header
+void mio0_stream_init(mio0_stream *s, unsigned char *buf, unsigned int buf_size, unsigned int in_limit);
+
+// decode as much as input and output space allow
+// s: stream state
+// in: MIO0 block starting at its header. may move between calls, but must
+//     hold the same data
+// in_len: bytes available in 'in', clamped to in_limit. must not shrink
+// returns one of the MIO0_STREAM_* codes, negative values are errors
+int mio0_stream_feed(mio0_stream *s, const unsigned char *in, unsigned int in_len);
+
+// copy decoded bytes not yet drained out of the stream, freeing ring buffer space
+// s: stream state
+// out: destination buffer
+// out_len: max bytes to copy
+// returns bytes copied to 'out'
+unsigned int mio0_stream_drain(mio0_stream *s, unsigned char *out, unsigned int out_len);
+
+// input offset one past the last byte consumed, valid once decoding is done
+unsigned int mio0_stream_end(const mio0_stream *s);
+
 // encode MIO0 data in memory
 // in: buffer containing raw data
 // out: buffer for MIO0 data
 // returns size of compressed data in 'out' including MIO0 header
 int mio0_encode(const unsigned char *in, unsigned int length, unsigned char *out);
 
+// encode MIO0 data in memory at a given compression level
+// in: buffer containing raw data
+// out: buffer for MIO0 data
+// level: MIO0_LEVEL_FAST for greedy parsing, MIO0_LEVEL_BEST for lowest size
+// returns size of compressed data in 'out' including MIO0 header
+int mio0_encode_ex(const unsigned char *in, unsigned int length, unsigned char *out, int level);
+
+// decode an MIO0 block from memory into a newly allocated buffer
+// in: buffer containing MIO0 block
+// in_len: max bytes that may be read from 'in'
+// out_len: set to the decoded length (set to NULL if unwanted)
+// returns buffer to be freed by the caller, or NULL on a corrupt block
+unsigned char *mio0_decode_alloc(const unsigned char *in, unsigned int in_len, unsigned int *out_len);
+
 // decode an entire MIO0 block at an offset from file to output file
 // in_file: input filename
 // offset: offset to start decoding from in_file
 // out_file: output filename
 int mio0_decode_file(const char *in_file, unsigned long offset, const char *out_file);
 
+// decode an MIO0 block from memory, e.g. a section of a loaded ROM, to output file
+// in: buffer containing MIO0 block
+// in_len: max bytes that may be read from 'in'
+// out_file: output filename
+// returns 0 on success, 3 on a corrupt block, 4/5 on output file errors
+int mio0_decode_buffer_file(const unsigned char *in, unsigned int in_len, const char *out_file);
+
 // encode an entire file
 // in_file: input filename containing raw data to be encoded
 // out_file: output filename to write MIO0 compressed data to
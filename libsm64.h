@@ -32,6 +32,7 @@ typedef struct
    unsigned int alignment;
    char fill;
    char dump;
+   int threads;
 } sm64_config;
 
 // determine ROM type based on data
@@ -46,7 +47,8 @@ rom_type sm64_rom_type(unsigned char *buf, unsigned int length);
 rom_version sm64_rom_version(unsigned char *buf);
 
 // find and decompress all MIO0 blocks
-// config: configuration to determine alignment, padding and size
+// output layout is planned from the MIO0 headers, then blocks are decoded on config->threads threads
+// config: configuration to determine alignment, padding, size and threads
 // in_buf: buffer containing entire contents of SM64 data in big endian
 // length: length of in_buf
 // out_buf: buffer containing extended SM64
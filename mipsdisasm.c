@@ -4,14 +4,88 @@
 #include <string.h>
 #include <inttypes.h>
 
+#ifdef MIPSDISASM_CAPSTONE
 #include <capstone/capstone.h>
+#endif
 
 #include "mipsdisasm.h"
+#include "parallel.h"
+#include "strutils.h"
 #include "utils.h"
 
 #define MIPSDISASM_VERSION "0.2+"
 
 // typedefs
+// R4300i instruction IDs
+typedef enum
+{
+   R4K_INS_INVALID = 0,
+   R4K_INS_ADD, R4K_INS_ADDI, R4K_INS_ADDIU, R4K_INS_ADDU, R4K_INS_AND, R4K_INS_ANDI,
+   R4K_INS_B, R4K_INS_BAL, R4K_INS_BC1F, R4K_INS_BC1FL, R4K_INS_BC1T, R4K_INS_BC1TL,
+   R4K_INS_BEQ, R4K_INS_BEQL, R4K_INS_BEQZ, R4K_INS_BEQZL, R4K_INS_BGEZ, R4K_INS_BGEZAL, R4K_INS_BGEZALL, R4K_INS_BGEZL,
+   R4K_INS_BGTZ, R4K_INS_BGTZL, R4K_INS_BLEZ, R4K_INS_BLEZL, R4K_INS_BLTZ, R4K_INS_BLTZAL, R4K_INS_BLTZALL, R4K_INS_BLTZL,
+   R4K_INS_BNE, R4K_INS_BNEL, R4K_INS_BNEZ, R4K_INS_BNEZL, R4K_INS_BREAK,
+   R4K_INS_CACHE, R4K_INS_CFC1, R4K_INS_CTC1,
+   R4K_INS_DADD, R4K_INS_DADDI, R4K_INS_DADDIU, R4K_INS_DADDU, R4K_INS_DDIV, R4K_INS_DDIVU, R4K_INS_DIV, R4K_INS_DIVU,
+   R4K_INS_DMFC0, R4K_INS_DMFC1, R4K_INS_DMTC0, R4K_INS_DMTC1, R4K_INS_DMULT, R4K_INS_DMULTU, R4K_INS_DNEG, R4K_INS_DNEGU,
+   R4K_INS_DSLL, R4K_INS_DSLL32, R4K_INS_DSLLV, R4K_INS_DSRA, R4K_INS_DSRA32, R4K_INS_DSRAV,
+   R4K_INS_DSRL, R4K_INS_DSRL32, R4K_INS_DSRLV, R4K_INS_DSUB, R4K_INS_DSUBU,
+   R4K_INS_ERET, R4K_INS_J, R4K_INS_JAL, R4K_INS_JALR, R4K_INS_JR,
+   R4K_INS_LB, R4K_INS_LBU, R4K_INS_LD, R4K_INS_LDC1, R4K_INS_LDC2, R4K_INS_LDL, R4K_INS_LDR, R4K_INS_LH, R4K_INS_LHU,
+   R4K_INS_LI, R4K_INS_LL, R4K_INS_LLD, R4K_INS_LUI, R4K_INS_LW, R4K_INS_LWC1, R4K_INS_LWC2, R4K_INS_LWL, R4K_INS_LWR, R4K_INS_LWU,
+   R4K_INS_MFC0, R4K_INS_MFC1, R4K_INS_MFHI, R4K_INS_MFLO, R4K_INS_MOVE, R4K_INS_MTC0, R4K_INS_MTC1, R4K_INS_MTHI, R4K_INS_MTLO,
+   R4K_INS_MULT, R4K_INS_MULTU, R4K_INS_NEG, R4K_INS_NEGU, R4K_INS_NOP, R4K_INS_NOR, R4K_INS_NOT, R4K_INS_OR, R4K_INS_ORI, R4K_INS_PREF,
+   R4K_INS_SB, R4K_INS_SC, R4K_INS_SCD, R4K_INS_SD, R4K_INS_SDC1, R4K_INS_SDC2, R4K_INS_SDL, R4K_INS_SDR, R4K_INS_SH,
+   R4K_INS_SLL, R4K_INS_SLLV, R4K_INS_SLT, R4K_INS_SLTI, R4K_INS_SLTIU, R4K_INS_SLTU,
+   R4K_INS_SRA, R4K_INS_SRAV, R4K_INS_SRL, R4K_INS_SRLV, R4K_INS_SUB, R4K_INS_SUBU,
+   R4K_INS_SW, R4K_INS_SWC1, R4K_INS_SWC2, R4K_INS_SWL, R4K_INS_SWR, R4K_INS_SYNC, R4K_INS_SYSCALL,
+   R4K_INS_TEQ, R4K_INS_TEQI, R4K_INS_TGE, R4K_INS_TGEI, R4K_INS_TGEIU, R4K_INS_TGEU,
+   R4K_INS_TLBP, R4K_INS_TLBR, R4K_INS_TLBWI, R4K_INS_TLBWR,
+   R4K_INS_TLT, R4K_INS_TLTI, R4K_INS_TLTIU, R4K_INS_TLTU, R4K_INS_TNE, R4K_INS_TNEI,
+   R4K_INS_XOR, R4K_INS_XORI,
+   // COP1 arithmetic, mnemonic is suffixed with the operand format
+   R4K_INS_ABS_FMT, R4K_INS_ADD_FMT, R4K_INS_C_FMT, R4K_INS_CEIL_L_FMT, R4K_INS_CEIL_W_FMT,
+   R4K_INS_CVT_D_FMT, R4K_INS_CVT_L_FMT, R4K_INS_CVT_S_FMT, R4K_INS_CVT_W_FMT, R4K_INS_DIV_FMT,
+   R4K_INS_FLOOR_L_FMT, R4K_INS_FLOOR_W_FMT, R4K_INS_MOV_FMT, R4K_INS_MUL_FMT, R4K_INS_NEG_FMT,
+   R4K_INS_ROUND_L_FMT, R4K_INS_ROUND_W_FMT, R4K_INS_SQRT_FMT, R4K_INS_SUB_FMT,
+   R4K_INS_TRUNC_L_FMT, R4K_INS_TRUNC_W_FMT,
+   R4K_INS_ENDING
+} r4k_insn;
+
+// register numbers: GPRs, FPRs, coprocessor registers printed by number, then FPU condition codes
+enum
+{
+   R4K_REG_ZERO   = 0,
+   R4K_REG_RA     = 31,
+   R4K_REG_F0     = 32,
+   R4K_REG_C0     = 64,
+   R4K_REG_FCC0   = 96,
+   R4K_REG_ENDING = 104
+};
+
+typedef enum
+{
+   R4K_OP_INVALID = 0,
+   R4K_OP_REG,
+   R4K_OP_IMM,
+   R4K_OP_MEM,
+} r4k_op_type;
+
+typedef struct
+{
+   r4k_op_type type;
+   union
+   {
+      unsigned int reg;
+      int64_t imm;
+      struct
+      {
+         unsigned int base;
+         int64_t disp;
+      } mem;
+   };
+} r4k_operand;
+
 typedef struct
 {
    char name[60];
@@ -23,33 +97,49 @@ typedef struct
    asm_label *labels;
    int alloc;
    int count;
+   // open addressed vaddr -> labels[] index, -1 for empty slots
+   int *index;
+   int index_size;
 } label_buf;
 
+// decoded instruction, filled in by decode_insn() and rendered to text by render_insn()
 typedef struct
 {
-   // copied from cs_insn structure
    unsigned int id;
    uint8_t bytes[4];
-   char op_str[32];
-   char mnemonic[16];
-   cs_mips_op operands[8];
+   r4k_operand operands[4];
    uint8_t op_count;
-   // n64split-specific data
-   int is_jump;
-   int linked_insn;
-   union
-   {
-      unsigned int linked_value;
-      float linked_float;
-   };
-   int newline;
+   uint8_t is_jump;
+   char fp_format;
+   const char *name;
+   char mnemonic[16];
+   char op_str[32];
 } disasm_data;
 
+// asm_block.flags
+#define INSN_JUMP    0x01 // branch, jump or call
+#define INSN_NEWLINE 0x02 // first instruction after a function return
+
 typedef struct _asm_block
 {
    label_buf locals;
-   disasm_data *instructions;
+   // instructions stored as parallel arrays, text is only rendered in pass 2
+   uint32_t *words;        // raw instruction word
+   uint16_t *ids;          // r4k_insn, LUI/ADDIU/ORI may be rewritten to R4K_INS_LI
+   uint32_t *regs;         // registers of first 3 operands, 8 bits each, see pack_regs()
+   uint8_t *flags;         // INSN_*
+   int *linked_insn;       // index of paired instruction for pseudoinstructions, -1 if none
+   uint32_t *linked_value; // paired address, or float bits for LI
    int instruction_count;
+   // control flow graph, see cfg_build()
+   disasm_function *functions;
+   int function_count;
+   disasm_bblock *bblocks;
+   int bblock_count;
+   disasm_jump_table *jump_tables;
+   int jump_table_count;
+   unsigned int *jump_targets;
+   int jump_target_count;
    unsigned int offset;
    unsigned int length;
    unsigned int vaddr;
@@ -64,18 +154,711 @@ typedef struct _disasm_state
    int block_alloc;
    int block_count;
 
-   csh handle;
-
    asm_syntax syntax;
    int merge_pseudo;
 } disasm_state;
 
+// native R4300i decoder
+// text output follows the capstone 4 MIPS64 printer so generated assembly is unchanged
+
+static const char *const reg_names[R4K_REG_ENDING] =
+{
+   "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+   "t0",   "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+   "s0",   "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+   "t8",   "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+   "f0",  "f1",  "f2",  "f3",  "f4",  "f5",  "f6",  "f7",
+   "f8",  "f9",  "f10", "f11", "f12", "f13", "f14", "f15",
+   "f16", "f17", "f18", "f19", "f20", "f21", "f22", "f23",
+   "f24", "f25", "f26", "f27", "f28", "f29", "f30", "f31",
+   "0",  "1",  "2",  "3",  "4",  "5",  "6",  "7",
+   "8",  "9",  "10", "11", "12", "13", "14", "15",
+   "16", "17", "18", "19", "20", "21", "22", "23",
+   "24", "25", "26", "27", "28", "29", "30", "31",
+   "fcc0", "fcc1", "fcc2", "fcc3", "fcc4", "fcc5", "fcc6", "fcc7",
+};
+
+static const char *reg_name(unsigned int reg)
+{
+   return reg < R4K_REG_ENDING ? reg_names[reg] : "";
+}
+
+// operand layouts, named by the order operands are printed in
+typedef enum
+{
+   FMT_NONE,       // no operands
+   FMT_RD_RS_RT,   // addu rd, rs, rt
+   FMT_RD_RT_SA,   // sll rd, rt, sa
+   FMT_RD_RT_RS,   // sllv rd, rt, rs
+   FMT_RD_RS,      // jalr rd, rs
+   FMT_RS,         // jr rs
+   FMT_RD,         // mfhi rd
+   FMT_RS_RT,      // mult rs, rt
+   FMT_ZERO_RS_RT, // div $zero, rs, rt
+   FMT_RS_RT_CODE, // teq rs, rt[, code]
+   FMT_CODE20,     // syscall[ code]
+   FMT_CODE10,     // break[ code1[, code2]]
+   FMT_STYPE,      // sync[ stype]
+   FMT_RS_BRANCH,  // bltz rs, target
+   FMT_RS_BRANCH0, // blez rs, target
+   FMT_RS_SIMM,    // teqi rs, simm
+   FMT_JUMP,       // jal target
+   FMT_RS_RT_BRANCH, // beq rs, rt, target
+   FMT_RT_RS_SIMM, // addiu rt, rs, simm
+   FMT_RT_RS_UIMM, // ori rt, rs, uimm
+   FMT_RT_UIMM,    // lui rt, uimm
+   FMT_RT_MEM,     // lw rt, simm(base)
+   FMT_FT_MEM,     // lwc1 ft, simm(base)
+   FMT_CT_MEM,     // lwc2 ct, simm(base)
+   FMT_OP_MEM,     // cache op, simm(base)
+   FMT_RT_CD_SEL,  // mfc0 rt, cd, sel
+   FMT_RT_FS,      // mfc1 rt, fs
+   FMT_RT_FCR,     // cfc1 rt, fcr
+   FMT_BRANCH,     // bc1f [$fccN, ]target
+   FMT_FD_FS_FT,   // add.s fd, fs, ft
+   FMT_FD_FS,      // mov.s fd, fs
+   FMT_FS_FT,      // c.eq.s [$fccN, ]fs, ft
+} insn_format;
+
+// fields that must be zero for each layout, anything else is not a valid encoding
+static const uint32_t format_zero_mask[] =
+{
+   [FMT_NONE]         = 0x01FFFFC0,
+   [FMT_RD_RS_RT]     = 0x000007C0,
+   [FMT_RD_RT_SA]     = 0x03E00000,
+   [FMT_RD_RT_RS]     = 0x000007C0,
+   [FMT_RD_RS]        = 0x001F07C0,
+   [FMT_RS]           = 0x001FFFC0,
+   [FMT_RD]           = 0x03FF07C0,
+   [FMT_RS_RT]        = 0x0000FFC0,
+   [FMT_ZERO_RS_RT]   = 0x0000FFC0,
+   [FMT_RS_RT_CODE]   = 0x00000000,
+   [FMT_CODE20]       = 0x00000000,
+   [FMT_CODE10]       = 0x00000000,
+   [FMT_STYPE]        = 0x00000000,
+   [FMT_RS_BRANCH]    = 0x00000000,
+   [FMT_RS_BRANCH0]   = 0x001F0000,
+   [FMT_RS_SIMM]      = 0x00000000,
+   [FMT_JUMP]         = 0x00000000,
+   [FMT_RS_RT_BRANCH] = 0x00000000,
+   [FMT_RT_RS_SIMM]   = 0x00000000,
+   [FMT_RT_RS_UIMM]   = 0x00000000,
+   [FMT_RT_UIMM]      = 0x03E00000,
+   [FMT_RT_MEM]       = 0x00000000,
+   [FMT_FT_MEM]       = 0x00000000,
+   [FMT_CT_MEM]       = 0x00000000,
+   [FMT_OP_MEM]       = 0x00000000,
+   [FMT_RT_CD_SEL]    = 0x000007F8,
+   [FMT_RT_FS]        = 0x000007FF,
+   [FMT_RT_FCR]       = 0x000007FF,
+   [FMT_BRANCH]       = 0x00000000,
+   [FMT_FD_FS_FT]     = 0x00000000,
+   [FMT_FD_FS]        = 0x001F0000,
+   [FMT_FS_FT]        = 0x000000C0,
+};
+
+typedef struct
+{
+   const char *name;
+   uint8_t id;
+   uint8_t format;
+} opcode_entry;
+
+// primary opcode, bits 31-26
+static const opcode_entry opcode_table[64] =
+{
+   [0x02] = {"j",      R4K_INS_J,      FMT_JUMP},
+   [0x03] = {"jal",    R4K_INS_JAL,    FMT_JUMP},
+   [0x04] = {"beq",    R4K_INS_BEQ,    FMT_RS_RT_BRANCH},
+   [0x05] = {"bne",    R4K_INS_BNE,    FMT_RS_RT_BRANCH},
+   [0x06] = {"blez",   R4K_INS_BLEZ,   FMT_RS_BRANCH0},
+   [0x07] = {"bgtz",   R4K_INS_BGTZ,   FMT_RS_BRANCH0},
+   [0x08] = {"addi",   R4K_INS_ADDI,   FMT_RT_RS_SIMM},
+   [0x09] = {"addiu",  R4K_INS_ADDIU,  FMT_RT_RS_SIMM},
+   [0x0A] = {"slti",   R4K_INS_SLTI,   FMT_RT_RS_SIMM},
+   [0x0B] = {"sltiu",  R4K_INS_SLTIU,  FMT_RT_RS_SIMM},
+   [0x0C] = {"andi",   R4K_INS_ANDI,   FMT_RT_RS_UIMM},
+   [0x0D] = {"ori",    R4K_INS_ORI,    FMT_RT_RS_UIMM},
+   [0x0E] = {"xori",   R4K_INS_XORI,   FMT_RT_RS_UIMM},
+   [0x0F] = {"lui",    R4K_INS_LUI,    FMT_RT_UIMM},
+   [0x14] = {"beql",   R4K_INS_BEQL,   FMT_RS_RT_BRANCH},
+   [0x15] = {"bnel",   R4K_INS_BNEL,   FMT_RS_RT_BRANCH},
+   [0x16] = {"blezl",  R4K_INS_BLEZL,  FMT_RS_BRANCH0},
+   [0x17] = {"bgtzl",  R4K_INS_BGTZL,  FMT_RS_BRANCH0},
+   [0x18] = {"daddi",  R4K_INS_DADDI,  FMT_RT_RS_SIMM},
+   [0x19] = {"daddiu", R4K_INS_DADDIU, FMT_RT_RS_SIMM},
+   [0x1A] = {"ldl",    R4K_INS_LDL,    FMT_RT_MEM},
+   [0x1B] = {"ldr",    R4K_INS_LDR,    FMT_RT_MEM},
+   [0x20] = {"lb",     R4K_INS_LB,     FMT_RT_MEM},
+   [0x21] = {"lh",     R4K_INS_LH,     FMT_RT_MEM},
+   [0x22] = {"lwl",    R4K_INS_LWL,    FMT_RT_MEM},
+   [0x23] = {"lw",     R4K_INS_LW,     FMT_RT_MEM},
+   [0x24] = {"lbu",    R4K_INS_LBU,    FMT_RT_MEM},
+   [0x25] = {"lhu",    R4K_INS_LHU,    FMT_RT_MEM},
+   [0x26] = {"lwr",    R4K_INS_LWR,    FMT_RT_MEM},
+   [0x27] = {"lwu",    R4K_INS_LWU,    FMT_RT_MEM},
+   [0x28] = {"sb",     R4K_INS_SB,     FMT_RT_MEM},
+   [0x29] = {"sh",     R4K_INS_SH,     FMT_RT_MEM},
+   [0x2A] = {"swl",    R4K_INS_SWL,    FMT_RT_MEM},
+   [0x2B] = {"sw",     R4K_INS_SW,     FMT_RT_MEM},
+   [0x2C] = {"sdl",    R4K_INS_SDL,    FMT_RT_MEM},
+   [0x2D] = {"sdr",    R4K_INS_SDR,    FMT_RT_MEM},
+   [0x2E] = {"swr",    R4K_INS_SWR,    FMT_RT_MEM},
+   [0x2F] = {"cache",  R4K_INS_CACHE,  FMT_OP_MEM},
+   [0x30] = {"ll",     R4K_INS_LL,     FMT_RT_MEM},
+   [0x31] = {"lwc1",   R4K_INS_LWC1,   FMT_FT_MEM},
+   [0x32] = {"lwc2",   R4K_INS_LWC2,   FMT_CT_MEM},
+   [0x33] = {"pref",   R4K_INS_PREF,   FMT_OP_MEM},
+   [0x34] = {"lld",    R4K_INS_LLD,    FMT_RT_MEM},
+   [0x35] = {"ldc1",   R4K_INS_LDC1,   FMT_FT_MEM},
+   [0x36] = {"ldc2",   R4K_INS_LDC2,   FMT_CT_MEM},
+   [0x37] = {"ld",     R4K_INS_LD,     FMT_RT_MEM},
+   [0x38] = {"sc",     R4K_INS_SC,     FMT_RT_MEM},
+   [0x39] = {"swc1",   R4K_INS_SWC1,   FMT_FT_MEM},
+   [0x3A] = {"swc2",   R4K_INS_SWC2,   FMT_CT_MEM},
+   [0x3C] = {"scd",    R4K_INS_SCD,    FMT_RT_MEM},
+   [0x3D] = {"sdc1",   R4K_INS_SDC1,   FMT_FT_MEM},
+   [0x3E] = {"sdc2",   R4K_INS_SDC2,   FMT_CT_MEM},
+   [0x3F] = {"sd",     R4K_INS_SD,     FMT_RT_MEM},
+};
+
+// SPECIAL function, bits 5-0
+static const opcode_entry special_table[64] =
+{
+   [0x00] = {"sll",     R4K_INS_SLL,     FMT_RD_RT_SA},
+   [0x02] = {"srl",     R4K_INS_SRL,     FMT_RD_RT_SA},
+   [0x03] = {"sra",     R4K_INS_SRA,     FMT_RD_RT_SA},
+   [0x04] = {"sllv",    R4K_INS_SLLV,    FMT_RD_RT_RS},
+   [0x06] = {"srlv",    R4K_INS_SRLV,    FMT_RD_RT_RS},
+   [0x07] = {"srav",    R4K_INS_SRAV,    FMT_RD_RT_RS},
+   [0x08] = {"jr",      R4K_INS_JR,      FMT_RS},
+   [0x09] = {"jalr",    R4K_INS_JALR,    FMT_RD_RS},
+   [0x0C] = {"syscall", R4K_INS_SYSCALL, FMT_CODE20},
+   [0x0D] = {"break",   R4K_INS_BREAK,   FMT_CODE10},
+   [0x0F] = {"sync",    R4K_INS_SYNC,    FMT_STYPE},
+   [0x10] = {"mfhi",    R4K_INS_MFHI,    FMT_RD},
+   [0x11] = {"mthi",    R4K_INS_MTHI,    FMT_RS},
+   [0x12] = {"mflo",    R4K_INS_MFLO,    FMT_RD},
+   [0x13] = {"mtlo",    R4K_INS_MTLO,    FMT_RS},
+   [0x14] = {"dsllv",   R4K_INS_DSLLV,   FMT_RD_RT_RS},
+   [0x16] = {"dsrlv",   R4K_INS_DSRLV,   FMT_RD_RT_RS},
+   [0x17] = {"dsrav",   R4K_INS_DSRAV,   FMT_RD_RT_RS},
+   [0x18] = {"mult",    R4K_INS_MULT,    FMT_RS_RT},
+   [0x19] = {"multu",   R4K_INS_MULTU,   FMT_RS_RT},
+   [0x1A] = {"div",     R4K_INS_DIV,     FMT_ZERO_RS_RT},
+   [0x1B] = {"divu",    R4K_INS_DIVU,    FMT_ZERO_RS_RT},
+   [0x1C] = {"dmult",   R4K_INS_DMULT,   FMT_RS_RT},
+   [0x1D] = {"dmultu",  R4K_INS_DMULTU,  FMT_RS_RT},
+   [0x1E] = {"ddiv",    R4K_INS_DDIV,    FMT_ZERO_RS_RT},
+   [0x1F] = {"ddivu",   R4K_INS_DDIVU,   FMT_ZERO_RS_RT},
+   [0x20] = {"add",     R4K_INS_ADD,     FMT_RD_RS_RT},
+   [0x21] = {"addu",    R4K_INS_ADDU,    FMT_RD_RS_RT},
+   [0x22] = {"sub",     R4K_INS_SUB,     FMT_RD_RS_RT},
+   [0x23] = {"subu",    R4K_INS_SUBU,    FMT_RD_RS_RT},
+   [0x24] = {"and",     R4K_INS_AND,     FMT_RD_RS_RT},
+   [0x25] = {"or",      R4K_INS_OR,      FMT_RD_RS_RT},
+   [0x26] = {"xor",     R4K_INS_XOR,     FMT_RD_RS_RT},
+   [0x27] = {"nor",     R4K_INS_NOR,     FMT_RD_RS_RT},
+   [0x2A] = {"slt",     R4K_INS_SLT,     FMT_RD_RS_RT},
+   [0x2B] = {"sltu",    R4K_INS_SLTU,    FMT_RD_RS_RT},
+   [0x2C] = {"dadd",    R4K_INS_DADD,    FMT_RD_RS_RT},
+   [0x2D] = {"daddu",   R4K_INS_DADDU,   FMT_RD_RS_RT},
+   [0x2E] = {"dsub",    R4K_INS_DSUB,    FMT_RD_RS_RT},
+   [0x2F] = {"dsubu",   R4K_INS_DSUBU,   FMT_RD_RS_RT},
+   [0x30] = {"tge",     R4K_INS_TGE,     FMT_RS_RT_CODE},
+   [0x31] = {"tgeu",    R4K_INS_TGEU,    FMT_RS_RT_CODE},
+   [0x32] = {"tlt",     R4K_INS_TLT,     FMT_RS_RT_CODE},
+   [0x33] = {"tltu",    R4K_INS_TLTU,    FMT_RS_RT_CODE},
+   [0x34] = {"teq",     R4K_INS_TEQ,     FMT_RS_RT_CODE},
+   [0x36] = {"tne",     R4K_INS_TNE,     FMT_RS_RT_CODE},
+   [0x38] = {"dsll",    R4K_INS_DSLL,    FMT_RD_RT_SA},
+   [0x3A] = {"dsrl",    R4K_INS_DSRL,    FMT_RD_RT_SA},
+   [0x3B] = {"dsra",    R4K_INS_DSRA,    FMT_RD_RT_SA},
+   [0x3C] = {"dsll32",  R4K_INS_DSLL32,  FMT_RD_RT_SA},
+   [0x3E] = {"dsrl32",  R4K_INS_DSRL32,  FMT_RD_RT_SA},
+   [0x3F] = {"dsra32",  R4K_INS_DSRA32,  FMT_RD_RT_SA},
+};
+
+// REGIMM rt, bits 20-16
+static const opcode_entry regimm_table[32] =
+{
+   [0x00] = {"bltz",    R4K_INS_BLTZ,    FMT_RS_BRANCH},
+   [0x01] = {"bgez",    R4K_INS_BGEZ,    FMT_RS_BRANCH},
+   [0x02] = {"bltzl",   R4K_INS_BLTZL,   FMT_RS_BRANCH},
+   [0x03] = {"bgezl",   R4K_INS_BGEZL,   FMT_RS_BRANCH},
+   [0x08] = {"tgei",    R4K_INS_TGEI,    FMT_RS_SIMM},
+   [0x09] = {"tgeiu",   R4K_INS_TGEIU,   FMT_RS_SIMM},
+   [0x0A] = {"tlti",    R4K_INS_TLTI,    FMT_RS_SIMM},
+   [0x0B] = {"tltiu",   R4K_INS_TLTIU,   FMT_RS_SIMM},
+   [0x0C] = {"teqi",    R4K_INS_TEQI,    FMT_RS_SIMM},
+   [0x0E] = {"tnei",    R4K_INS_TNEI,    FMT_RS_SIMM},
+   [0x10] = {"bltzal",  R4K_INS_BLTZAL,  FMT_RS_BRANCH},
+   [0x11] = {"bgezal",  R4K_INS_BGEZAL,  FMT_RS_BRANCH},
+   [0x12] = {"bltzall", R4K_INS_BLTZALL, FMT_RS_BRANCH},
+   [0x13] = {"bgezall", R4K_INS_BGEZALL, FMT_RS_BRANCH},
+};
+
+// COP0 rs, bits 25-21, and COP0 function when rs is CO
+static const opcode_entry cop0_table[32] =
+{
+   [0x00] = {"mfc0",  R4K_INS_MFC0,  FMT_RT_CD_SEL},
+   [0x01] = {"dmfc0", R4K_INS_DMFC0, FMT_RT_CD_SEL},
+   [0x04] = {"mtc0",  R4K_INS_MTC0,  FMT_RT_CD_SEL},
+   [0x05] = {"dmtc0", R4K_INS_DMTC0, FMT_RT_CD_SEL},
+};
+
+static const opcode_entry cop0_co_table[64] =
+{
+   [0x01] = {"tlbr",  R4K_INS_TLBR,  FMT_NONE},
+   [0x02] = {"tlbwi", R4K_INS_TLBWI, FMT_NONE},
+   [0x06] = {"tlbwr", R4K_INS_TLBWR, FMT_NONE},
+   [0x08] = {"tlbp",  R4K_INS_TLBP,  FMT_NONE},
+   [0x18] = {"eret",  R4K_INS_ERET,  FMT_NONE},
+};
+
+// COP1 rs, bits 25-21, and BC1 rt, bits 20-16
+static const opcode_entry cop1_table[32] =
+{
+   [0x00] = {"mfc1",  R4K_INS_MFC1,  FMT_RT_FS},
+   [0x01] = {"dmfc1", R4K_INS_DMFC1, FMT_RT_FS},
+   [0x02] = {"cfc1",  R4K_INS_CFC1,  FMT_RT_FCR},
+   [0x04] = {"mtc1",  R4K_INS_MTC1,  FMT_RT_FS},
+   [0x05] = {"dmtc1", R4K_INS_DMTC1, FMT_RT_FS},
+   [0x06] = {"ctc1",  R4K_INS_CTC1,  FMT_RT_FCR},
+};
+
+static const opcode_entry bc1_table[4] =
+{
+   {"bc1f",  R4K_INS_BC1F,  FMT_BRANCH},
+   {"bc1t",  R4K_INS_BC1T,  FMT_BRANCH},
+   {"bc1fl", R4K_INS_BC1FL, FMT_BRANCH},
+   {"bc1tl", R4K_INS_BC1TL, FMT_BRANCH},
+};
+
+// COP1 operand formats, indexed by rs - 16
+#define FP_S (1 << 0)
+#define FP_D (1 << 1)
+#define FP_W (1 << 4)
+#define FP_L (1 << 5)
+static const char fp_format_names[] = "sd??wl";
+
+typedef struct
+{
+   opcode_entry op;
+   uint8_t formats; // FP_* accepted for this function
+} cop1_fmt_entry;
+
+// COP1 function, bits 5-0, for the S/D/W/L formats
+static const cop1_fmt_entry cop1_fmt_table[64] =
+{
+   [0x00] = {{"add",     R4K_INS_ADD_FMT,     FMT_FD_FS_FT}, FP_S | FP_D},
+   [0x01] = {{"sub",     R4K_INS_SUB_FMT,     FMT_FD_FS_FT}, FP_S | FP_D},
+   [0x02] = {{"mul",     R4K_INS_MUL_FMT,     FMT_FD_FS_FT}, FP_S | FP_D},
+   [0x03] = {{"div",     R4K_INS_DIV_FMT,     FMT_FD_FS_FT}, FP_S | FP_D},
+   [0x04] = {{"sqrt",    R4K_INS_SQRT_FMT,    FMT_FD_FS},    FP_S | FP_D},
+   [0x05] = {{"abs",     R4K_INS_ABS_FMT,     FMT_FD_FS},    FP_S | FP_D},
+   [0x06] = {{"mov",     R4K_INS_MOV_FMT,     FMT_FD_FS},    FP_S | FP_D},
+   [0x07] = {{"neg",     R4K_INS_NEG_FMT,     FMT_FD_FS},    FP_S | FP_D},
+   [0x08] = {{"round.l", R4K_INS_ROUND_L_FMT, FMT_FD_FS},    FP_S | FP_D},
+   [0x09] = {{"trunc.l", R4K_INS_TRUNC_L_FMT, FMT_FD_FS},    FP_S | FP_D},
+   [0x0A] = {{"ceil.l",  R4K_INS_CEIL_L_FMT,  FMT_FD_FS},    FP_S | FP_D},
+   [0x0B] = {{"floor.l", R4K_INS_FLOOR_L_FMT, FMT_FD_FS},    FP_S | FP_D},
+   [0x0C] = {{"round.w", R4K_INS_ROUND_W_FMT, FMT_FD_FS},    FP_S | FP_D},
+   [0x0D] = {{"trunc.w", R4K_INS_TRUNC_W_FMT, FMT_FD_FS},    FP_S | FP_D},
+   [0x0E] = {{"ceil.w",  R4K_INS_CEIL_W_FMT,  FMT_FD_FS},    FP_S | FP_D},
+   [0x0F] = {{"floor.w", R4K_INS_FLOOR_W_FMT, FMT_FD_FS},    FP_S | FP_D},
+   [0x20] = {{"cvt.s",   R4K_INS_CVT_S_FMT,   FMT_FD_FS},    FP_D | FP_W | FP_L},
+   [0x21] = {{"cvt.d",   R4K_INS_CVT_D_FMT,   FMT_FD_FS},    FP_S | FP_W | FP_L},
+   [0x24] = {{"cvt.w",   R4K_INS_CVT_W_FMT,   FMT_FD_FS},    FP_S | FP_D},
+   [0x25] = {{"cvt.l",   R4K_INS_CVT_L_FMT,   FMT_FD_FS},    FP_S | FP_D},
+   [0x30] = {{"c.f",     R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x31] = {{"c.un",    R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x32] = {{"c.eq",    R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x33] = {{"c.ueq",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x34] = {{"c.olt",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x35] = {{"c.ult",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x36] = {{"c.ole",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x37] = {{"c.ule",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x38] = {{"c.sf",    R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x39] = {{"c.ngle",  R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x3A] = {{"c.seq",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x3B] = {{"c.ngl",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x3C] = {{"c.lt",    R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x3D] = {{"c.nge",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x3E] = {{"c.le",    R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+   [0x3F] = {{"c.ngt",   R4K_INS_C_FMT,       FMT_FS_FT},    FP_S | FP_D},
+};
+
+// find the table entry for an instruction word
+// fp_format: set to the COP1 format character for S/D/W/L instructions, 0 otherwise
+// returns table entry, or NULL if word is not a valid R4300i instruction
+static const opcode_entry *decode_lookup(uint32_t word, char *fp_format)
+{
+   const opcode_entry *entry;
+   unsigned int rs = (word >> 21) & 0x1F;
+   unsigned int rt = (word >> 16) & 0x1F;
+   *fp_format = 0;
+   switch (word >> 26) {
+      case 0x00: entry = &special_table[word & 0x3F]; break;
+      case 0x01: entry = &regimm_table[rt]; break;
+      case 0x10: entry = (rs & 0x10) ? &cop0_co_table[word & 0x3F] : &cop0_table[rs]; break;
+      case 0x11:
+         if (rs == 0x08) {
+            entry = &bc1_table[rt & 0x3];
+         } else if (rs >= 0x10 && rs <= 0x15 && (cop1_fmt_table[word & 0x3F].formats & (1 << (rs - 0x10)))) {
+            entry = &cop1_fmt_table[word & 0x3F].op;
+            *fp_format = fp_format_names[rs - 0x10];
+         } else {
+            entry = &cop1_table[rs];
+         }
+         break;
+      default: entry = &opcode_table[word >> 26]; break;
+   }
+   if (entry->name == NULL || (word & format_zero_mask[entry->format])) {
+      return NULL;
+   }
+   return entry;
+}
+
+static void add_reg(disasm_data *insn, unsigned int reg)
+{
+   r4k_operand *op = &insn->operands[insn->op_count++];
+   op->type = R4K_OP_REG;
+   op->reg = reg;
+}
+
+static void add_imm(disasm_data *insn, int64_t imm)
+{
+   r4k_operand *op = &insn->operands[insn->op_count++];
+   op->type = R4K_OP_IMM;
+   op->imm = imm;
+}
+
+static void add_mem(disasm_data *insn, unsigned int base, int64_t disp)
+{
+   r4k_operand *op = &insn->operands[insn->op_count++];
+   op->type = R4K_OP_MEM;
+   op->mem.base = base;
+   op->mem.disp = disp;
+}
+
+// copy null-terminated string to out, returns end of the copy (not terminated)
+static char *put_str(char *out, const char *str)
+{
+   while (*str) {
+      *out++ = *str++;
+   }
+   return out;
+}
+
+// print immediate like capstone: decimal up to 9, hex beyond
+// returns end of the output (not terminated)
+static char *put_imm(char *out, int64_t imm)
+{
+   uint64_t mag = imm < 0 ? -(uint64_t)imm : (uint64_t)imm;
+   if (imm < 0) {
+      *out++ = '-';
+   }
+   if (mag > 9) {
+      *out++ = '0';
+      *out++ = 'x';
+      out += str_hex(out, mag, 1, 0);
+   } else {
+      *out++ = '0' + (char)mag;
+   }
+   return out;
+}
+
+// render mnemonic and op_str from decoded instruction
+static void render_insn(disasm_data *insn)
+{
+   char *out = insn->op_str;
+   if (insn->id == R4K_INS_INVALID) {
+      strcpy(insn->mnemonic, ".byte");
+      for (int b = 0; b < 4; b++) {
+         out = put_str(out, b > 0 ? ", 0x" : "0x");
+         out += str_hex(out, insn->bytes[b], 2, 0);
+      }
+      *out = '\0';
+      return;
+   }
+   out = put_str(insn->mnemonic, insn->name);
+   if (insn->fp_format) {
+      *out++ = '.';
+      *out++ = insn->fp_format;
+   }
+   *out = '\0';
+   out = insn->op_str;
+   for (int o = 0; o < insn->op_count; o++) {
+      const r4k_operand *op = &insn->operands[o];
+      if (o > 0) {
+         out = put_str(out, ", ");
+      }
+      switch (op->type) {
+         case R4K_OP_REG:
+            *out++ = '$';
+            out = put_str(out, reg_name(op->reg));
+            break;
+         case R4K_OP_IMM: out = put_imm(out, op->imm); break;
+         case R4K_OP_MEM:
+            out = put_imm(out, op->mem.disp);
+            out = put_str(out, "($");
+            out = put_str(out, reg_name(op->mem.base));
+            *out++ = ')';
+            break;
+         default: break;
+      }
+   }
+   *out = '\0';
+}
+
+// decode one R4300i instruction, without rendering any text
+// word: instruction word
+// vaddr: virtual address of the instruction, used for branch and jump targets
+// insn: filled in with id, bytes, operands, is_jump and the name used by render_insn()
+static void decode_insn(uint32_t word, unsigned int vaddr, disasm_data *insn)
+{
+   unsigned int rs = (word >> 21) & 0x1F;
+   unsigned int rt = (word >> 16) & 0x1F;
+   unsigned int rd = (word >> 11) & 0x1F;
+   unsigned int sa = (word >> 6) & 0x1F;
+   int64_t simm = (int16_t)(word & 0xFFFF);
+   unsigned int uimm = word & 0xFFFF;
+   unsigned int branch_target = vaddr + 4 + (unsigned int)(simm * 4);
+   const opcode_entry *entry;
+   const char *name;
+
+   write_u32_be(insn->bytes, word);
+   insn->op_count = 0;
+   insn->is_jump = 0;
+
+   entry = decode_lookup(word, &insn->fp_format);
+   if (entry == NULL) {
+      // unknown encoding, emit as data like capstone's SKIPDATA
+      insn->id = R4K_INS_INVALID;
+      return;
+   }
+   insn->id = entry->id;
+   name = entry->name;
+
+   switch (entry->format) {
+      case FMT_NONE:         break;
+      case FMT_RD_RS_RT:     add_reg(insn, rd); add_reg(insn, rs); add_reg(insn, rt); break;
+      case FMT_RD_RT_SA:     add_reg(insn, rd); add_reg(insn, rt); add_imm(insn, sa); break;
+      case FMT_RD_RT_RS:     add_reg(insn, rd); add_reg(insn, rt); add_reg(insn, rs); break;
+      case FMT_RD_RS:        add_reg(insn, rd); add_reg(insn, rs); break;
+      case FMT_RS:           add_reg(insn, rs); break;
+      case FMT_RD:           add_reg(insn, rd); break;
+      case FMT_RS_RT:        add_reg(insn, rs); add_reg(insn, rt); break;
+      case FMT_ZERO_RS_RT:   add_reg(insn, R4K_REG_ZERO); add_reg(insn, rs); add_reg(insn, rt); break;
+      case FMT_RS_RT_CODE:
+         add_reg(insn, rs); add_reg(insn, rt);
+         if ((word >> 6) & 0x3FF) {
+            add_imm(insn, (word >> 6) & 0x3FF);
+         }
+         break;
+      case FMT_CODE20:
+         if ((word >> 6) & 0xFFFFF) {
+            add_imm(insn, (word >> 6) & 0xFFFFF);
+         }
+         break;
+      case FMT_CODE10:
+         if ((word >> 6) & 0xFFFFF) {
+            add_imm(insn, (word >> 16) & 0x3FF);
+            if ((word >> 6) & 0x3FF) {
+               add_imm(insn, (word >> 6) & 0x3FF);
+            }
+         }
+         break;
+      case FMT_STYPE:
+         if (sa) {
+            add_imm(insn, sa);
+         }
+         break;
+      case FMT_RS_BRANCH:
+      case FMT_RS_BRANCH0:   add_reg(insn, rs); add_imm(insn, branch_target); break;
+      case FMT_RS_SIMM:      add_reg(insn, rs); add_imm(insn, simm); break;
+      case FMT_JUMP:         add_imm(insn, (vaddr & 0xF0000000) | ((word & 0x3FFFFFF) << 2)); break;
+      case FMT_RS_RT_BRANCH: add_reg(insn, rs); add_reg(insn, rt); add_imm(insn, branch_target); break;
+      case FMT_RT_RS_SIMM:   add_reg(insn, rt); add_reg(insn, rs); add_imm(insn, simm); break;
+      case FMT_RT_RS_UIMM:   add_reg(insn, rt); add_reg(insn, rs); add_imm(insn, uimm); break;
+      case FMT_RT_UIMM:      add_reg(insn, rt); add_imm(insn, uimm); break;
+      case FMT_RT_MEM:       add_reg(insn, rt); add_mem(insn, rs, simm); break;
+      case FMT_FT_MEM:       add_reg(insn, R4K_REG_F0 + rt); add_mem(insn, rs, simm); break;
+      case FMT_CT_MEM:       add_reg(insn, R4K_REG_C0 + rt); add_mem(insn, rs, simm); break;
+      case FMT_OP_MEM:       add_imm(insn, rt); add_mem(insn, rs, simm); break;
+      case FMT_RT_CD_SEL:    add_reg(insn, rt); add_reg(insn, R4K_REG_C0 + rd); add_imm(insn, word & 0x7); break;
+      case FMT_RT_FS:        add_reg(insn, rt); add_reg(insn, R4K_REG_F0 + rd); break;
+      case FMT_RT_FCR:       add_reg(insn, rt); add_reg(insn, R4K_REG_C0 + rd); break;
+      case FMT_BRANCH:
+         if ((word >> 18) & 0x7) {
+            add_reg(insn, R4K_REG_FCC0 + ((word >> 18) & 0x7));
+         }
+         add_imm(insn, branch_target);
+         break;
+      case FMT_FD_FS_FT:     add_reg(insn, R4K_REG_F0 + sa); add_reg(insn, R4K_REG_F0 + rd); add_reg(insn, R4K_REG_F0 + rt); break;
+      case FMT_FD_FS:        add_reg(insn, R4K_REG_F0 + sa); add_reg(insn, R4K_REG_F0 + rd); break;
+      case FMT_FS_FT:
+         if ((word >> 8) & 0x7) {
+            add_reg(insn, R4K_REG_FCC0 + ((word >> 8) & 0x7));
+         }
+         add_reg(insn, R4K_REG_F0 + rd); add_reg(insn, R4K_REG_F0 + rt);
+         break;
+   }
+
+   // aliases printed by capstone in place of the real instruction
+   switch (insn->id) {
+      case R4K_INS_SLL:
+         if (word == 0) {
+            insn->id = R4K_INS_NOP;
+            name = "nop";
+            insn->op_count = 0;
+         }
+         break;
+      case R4K_INS_ADDU:
+      case R4K_INS_DADDU:
+      case R4K_INS_OR:
+         if (rt == R4K_REG_ZERO) {
+            insn->id = R4K_INS_MOVE;
+            name = "move";
+            insn->op_count = 2;
+         }
+         break;
+      case R4K_INS_NOR:
+         if (rt == R4K_REG_ZERO) {
+            insn->id = R4K_INS_NOT;
+            name = "not";
+            insn->op_count = 2;
+         }
+         break;
+      case R4K_INS_SUB:
+      case R4K_INS_SUBU:
+      case R4K_INS_DSUB:
+      case R4K_INS_DSUBU:
+         if (rs == R4K_REG_ZERO) {
+            switch (insn->id) {
+               case R4K_INS_SUB:  insn->id = R4K_INS_NEG;   name = "neg";   break;
+               case R4K_INS_SUBU: insn->id = R4K_INS_NEGU;  name = "negu";  break;
+               case R4K_INS_DSUB: insn->id = R4K_INS_DNEG;  name = "dneg";  break;
+               default:           insn->id = R4K_INS_DNEGU; name = "dnegu"; break;
+            }
+            insn->operands[1] = insn->operands[2];
+            insn->op_count = 2;
+         }
+         break;
+      case R4K_INS_BEQ:
+         if (rs == R4K_REG_ZERO && rt == R4K_REG_ZERO) {
+            insn->id = R4K_INS_B;
+            name = "b";
+            insn->operands[0] = insn->operands[2];
+            insn->op_count = 1;
+            break;
+         }
+         // fall through
+      case R4K_INS_BNE:
+      case R4K_INS_BEQL:
+      case R4K_INS_BNEL:
+         if (rt == R4K_REG_ZERO) {
+            switch (insn->id) {
+               case R4K_INS_BEQ:  insn->id = R4K_INS_BEQZ;  name = "beqz";  break;
+               case R4K_INS_BNE:  insn->id = R4K_INS_BNEZ;  name = "bnez";  break;
+               case R4K_INS_BEQL: insn->id = R4K_INS_BEQZL; name = "beqzl"; break;
+               default:           insn->id = R4K_INS_BNEZL; name = "bnezl"; break;
+            }
+            insn->operands[1] = insn->operands[2];
+            insn->op_count = 2;
+         }
+         break;
+      case R4K_INS_BGEZAL:
+         if (rs == R4K_REG_ZERO) {
+            insn->id = R4K_INS_BAL;
+            name = "bal";
+            insn->operands[0] = insn->operands[1];
+            insn->op_count = 1;
+         }
+         break;
+      case R4K_INS_JALR:
+         if (rd == R4K_REG_RA) {
+            insn->operands[0] = insn->operands[1];
+            insn->op_count = 1;
+         }
+         break;
+   }
+
+   // branches, jumps and calls that get labels and delay slot indentation
+   switch (insn->id) {
+      case R4K_INS_B: case R4K_INS_BAL:
+      case R4K_INS_BC1F: case R4K_INS_BC1FL: case R4K_INS_BC1T: case R4K_INS_BC1TL:
+      case R4K_INS_BEQ: case R4K_INS_BEQL: case R4K_INS_BEQZ: case R4K_INS_BEQZL:
+      case R4K_INS_BGEZ: case R4K_INS_BGEZL: case R4K_INS_BGTZ: case R4K_INS_BGTZL:
+      case R4K_INS_BLEZ: case R4K_INS_BLEZL: case R4K_INS_BLTZ: case R4K_INS_BLTZL:
+      case R4K_INS_BNE: case R4K_INS_BNEL: case R4K_INS_BNEZ: case R4K_INS_BNEZL:
+      case R4K_INS_J: case R4K_INS_JAL: case R4K_INS_JALR: case R4K_INS_JR:
+         insn->is_jump = 1;
+         break;
+      default:
+         break;
+   }
+
+   insn->name = name;
+}
+
+// hash slot for vaddr in an index of power of 2 size
+static unsigned int labels_slot(unsigned int vaddr, int index_size)
+{
+   return ((vaddr >> 2) * 0x9E3779B1) & (index_size - 1);
+}
+
+// add labels[id] to the index unless its vaddr already has an entry, so the
+// index always references the first label in array order for each vaddr
+static void labels_index_add(label_buf *buf, int id)
+{
+   unsigned int vaddr = buf->labels[id].vaddr;
+   unsigned int slot = labels_slot(vaddr, buf->index_size);
+   while (buf->index[slot] >= 0) {
+      if (buf->labels[buf->index[slot]].vaddr == vaddr) {
+         return;
+      }
+      slot = (slot + 1) & (buf->index_size - 1);
+   }
+   buf->index[slot] = id;
+}
+
+// rebuild index from labels[], growing it to keep load factor under 1/2
+static void labels_index_build(label_buf *buf)
+{
+   int size = buf->index_size;
+   while (size < 2 * buf->alloc) {
+      size *= 2;
+   }
+   if (size != buf->index_size) {
+      buf->index_size = size;
+      buf->index = realloc(buf->index, sizeof(*buf->index) * buf->index_size);
+   }
+   memset(buf->index, 0xFF, sizeof(*buf->index) * buf->index_size);
+   for (int i = 0; i < buf->count; i++) {
+      labels_index_add(buf, i);
+   }
+}
+
 // default label buffer allocate
 static void labels_alloc(label_buf *buf)
 {
    buf->count = 0;
    buf->alloc = 128;
    buf->labels = malloc(sizeof(*buf->labels) * buf->alloc);
+   buf->index_size = 2 * buf->alloc;
+   buf->index = malloc(sizeof(*buf->index) * buf->index_size);
+   memset(buf->index, 0xFF, sizeof(*buf->index) * buf->index_size);
+}
+
+static void labels_free(label_buf *buf)
+{
+   free(buf->labels);
+   free(buf->index);
+   buf->labels = NULL;
+   buf->index = NULL;
+   buf->count = buf->alloc = buf->index_size = 0;
 }
 
 static void labels_add(label_buf *buf, const char *name, unsigned int vaddr)
@@ -93,6 +876,11 @@ static void labels_add(label_buf *buf, const char *name, unsigned int vaddr)
    }
    l->vaddr = vaddr;
    buf->count++;
+   if (buf->index_size < 2 * buf->alloc) {
+      labels_index_build(buf);
+   } else {
+      labels_index_add(buf, buf->count - 1);
+   }
 }
 
 static int label_cmp(const void *a, const void *b)
@@ -112,135 +900,857 @@ static int label_cmp(const void *a, const void *b)
 static void labels_sort(label_buf *buf)
 {
    qsort(buf->labels, buf->count, sizeof(buf->labels[0]), label_cmp);
+   // indices moved, so rebuild the lookup index
+   labels_index_build(buf);
 }
 
 // labels: label buffer to search in
 // vaddr: virtual address to find
-// returns index in buf->labels if found, -1 otherwise
+// returns index in buf->labels of first label at vaddr if found, -1 otherwise
 static int labels_find(const label_buf *buf, unsigned int vaddr)
 {
-   for (int i = 0; i < buf->count; i++) {
-      if (buf->labels[i].vaddr == vaddr) {
-         return i;
+   unsigned int slot = labels_slot(vaddr, buf->index_size);
+   while (buf->index[slot] >= 0) {
+      if (buf->labels[buf->index[slot]].vaddr == vaddr) {
+         return buf->index[slot];
       }
+      slot = (slot + 1) & (buf->index_size - 1);
    }
    return -1;
 }
 
-// try to find a matching LUI for a given register
-static void link_with_lui(disasm_state *state, int block_id, int offset, unsigned int reg, unsigned int mem_imm)
+// add a generated global label unless one already exists at vaddr
+// state: disassembler state, globals are only read
+// new_globals: buffer to add the label to, either state->globals or a per-block list
+// fmt: printf format of the label name, passed vaddr
+// vaddr: virtual address of label
+static void global_label_add(const disasm_state *state, label_buf *new_globals, const char *fmt, unsigned int vaddr)
 {
-   asm_block *block = &state->blocks[block_id];
-#define MAX_LOOKBACK 128
-   disasm_data *insn = block->instructions;
-   // don't attempt to compute addresses for zero offset
-   if (mem_imm != 0x0) {
-      // end search after some sane max number of instructions
-      int end_search = MAX(0, offset - MAX_LOOKBACK);
-      for (int search = offset - 1; search >= end_search; search--) {
-         // use an `if` instead of `case` block to allow breaking out of the `for` loop
-         if (insn[search].id == MIPS_INS_LUI) {
-            unsigned int rd = insn[search].operands[0].reg;
-            if (reg == rd) {
-               unsigned int lui_imm = (unsigned int)insn[search].operands[1].imm;
-               unsigned int addr = ((lui_imm << 16) + mem_imm);
-               insn[search].linked_insn = offset;
-               insn[search].linked_value = addr;
-               insn[offset].linked_insn = search;
-               insn[offset].linked_value = addr;
-               // if not ORI, create global data label if one does not exist
-               if (insn[offset].id != MIPS_INS_ORI) {
-                  int label = labels_find(&state->globals, addr);
-                  if (label < 0) {
-                     char label_name[32];
-                     sprintf(label_name, "D_%08X", addr);
-                     labels_add(&state->globals, label_name, addr);
-                  }
+   if (labels_find(&state->globals, vaddr) < 0 && labels_find(new_globals, vaddr) < 0) {
+      char label_name[32];
+      sprintf(label_name, fmt, vaddr);
+      labels_add(new_globals, label_name, vaddr);
+   }
+}
+
+// pack the registers of the first 3 operands into 8 bits each
+// memory operands store their base register, non-register operands 0xFF
+static uint32_t pack_regs(const disasm_data *insn)
+{
+   uint32_t regs = 0xFFFFFF;
+   for (int o = 0; o < MIN(insn->op_count, 3); o++) {
+      unsigned int reg;
+      switch (insn->operands[o].type) {
+         case R4K_OP_REG: reg = insn->operands[o].reg; break;
+         case R4K_OP_MEM: reg = insn->operands[o].mem.base; break;
+         default: continue;
+      }
+      regs = (regs & ~(0xFFu << (8 * o))) | (reg << (8 * o));
+   }
+   return regs;
+}
+
+// register of operand o of instruction i, as packed by pack_regs()
+static unsigned int insn_reg(const asm_block *block, int i, int o)
+{
+   return (block->regs[i] >> (8 * o)) & 0xFF;
+}
+
+// true if instruction i is a valid LUI, checked on the encoding since pairing may rewrite its id to LI
+static int insn_is_lui(const asm_block *block, int i)
+{
+   return (block->words[i] & 0xFFE00000) == 0x3C000000;
+}
+
+static void block_insns_alloc(asm_block *block, int count)
+{
+   block->instruction_count = count;
+   block->words = malloc(count * sizeof(*block->words));
+   block->ids = malloc(count * sizeof(*block->ids));
+   block->regs = malloc(count * sizeof(*block->regs));
+   block->flags = calloc(count, sizeof(*block->flags));
+   block->linked_insn = malloc(count * sizeof(*block->linked_insn));
+   block->linked_value = calloc(count, sizeof(*block->linked_value));
+}
+
+static void block_insns_free(asm_block *block)
+{
+   free(block->words);
+   free(block->ids);
+   free(block->regs);
+   free(block->flags);
+   free(block->linked_insn);
+   free(block->linked_value);
+   block->words = NULL;
+   block->ids = NULL;
+   block->regs = NULL;
+   block->flags = NULL;
+   block->linked_insn = NULL;
+   block->linked_value = NULL;
+   block->instruction_count = 0;
+}
+
+// branch_kind() flags
+#define BRANCH_JUMP   0x01 // transfers control, set for all branches, jumps and calls
+#define BRANCH_COND   0x02 // falls through to the instruction after the delay slot when not taken
+#define BRANCH_LIKELY 0x04 // delay slot only executed when taken
+#define BRANCH_CALL   0x08 // returns to the instruction after the delay slot
+
+static int branch_kind(unsigned int id)
+{
+   switch (id) {
+      case R4K_INS_BEQ: case R4K_INS_BNE: case R4K_INS_BEQZ: case R4K_INS_BNEZ:
+      case R4K_INS_BGEZ: case R4K_INS_BGTZ: case R4K_INS_BLEZ: case R4K_INS_BLTZ:
+      case R4K_INS_BC1F: case R4K_INS_BC1T:
+         return BRANCH_JUMP | BRANCH_COND;
+      case R4K_INS_BEQL: case R4K_INS_BNEL: case R4K_INS_BEQZL: case R4K_INS_BNEZL:
+      case R4K_INS_BGEZL: case R4K_INS_BGTZL: case R4K_INS_BLEZL: case R4K_INS_BLTZL:
+      case R4K_INS_BC1FL: case R4K_INS_BC1TL:
+         return BRANCH_JUMP | BRANCH_COND | BRANCH_LIKELY;
+      case R4K_INS_B: case R4K_INS_J: case R4K_INS_JR:
+         return BRANCH_JUMP;
+      case R4K_INS_JAL: case R4K_INS_JALR: case R4K_INS_BAL: case R4K_INS_BGEZAL: case R4K_INS_BLTZAL:
+         return BRANCH_JUMP | BRANCH_CALL;
+      case R4K_INS_BGEZALL: case R4K_INS_BLTZALL:
+         return BRANCH_JUMP | BRANCH_COND | BRANCH_LIKELY | BRANCH_CALL;
+      default:
+         return 0;
+   }
+}
+
+// index in block of the encoded target of branch or jump i
+// returns -1 for register jumps and targets outside the block
+static int jump_target_index(const asm_block *block, int i)
+{
+   uint32_t word = block->words[i];
+   unsigned int target;
+   switch (block->ids[i]) {
+      case R4K_INS_JR:
+      case R4K_INS_JALR:
+         return -1;
+      case R4K_INS_J:
+      case R4K_INS_JAL:
+         target = ((block->vaddr + 4 * i) & 0xF0000000) | ((word & 0x3FFFFFF) << 2);
+         break;
+      default:
+         target = block->vaddr + 4 * (i + 1) + 4 * (int16_t)(word & 0xFFFF);
+         break;
+   }
+   if (target < block->vaddr || (target - block->vaddr) / 4 >= (unsigned int)block->instruction_count) {
+      return -1;
+   }
+   return (target - block->vaddr) / 4;
+}
+
+// GPR written by instruction i, 0 if none
+static unsigned int insn_dest_gpr(const asm_block *block, int i)
+{
+   unsigned int reg;
+   switch (block->ids[i]) {
+      // first operand is a source
+      case R4K_INS_SB: case R4K_INS_SH: case R4K_INS_SW: case R4K_INS_SD:
+      case R4K_INS_SWL: case R4K_INS_SWR: case R4K_INS_SDL: case R4K_INS_SDR:
+      case R4K_INS_BEQ: case R4K_INS_BNE: case R4K_INS_BEQZ: case R4K_INS_BNEZ:
+      case R4K_INS_BEQL: case R4K_INS_BNEL: case R4K_INS_BEQZL: case R4K_INS_BNEZL:
+      case R4K_INS_BGEZ: case R4K_INS_BGTZ: case R4K_INS_BLEZ: case R4K_INS_BLTZ:
+      case R4K_INS_BGEZL: case R4K_INS_BGTZL: case R4K_INS_BLEZL: case R4K_INS_BLTZL:
+      case R4K_INS_JR:
+      case R4K_INS_MTC0: case R4K_INS_DMTC0: case R4K_INS_MTC1: case R4K_INS_DMTC1: case R4K_INS_CTC1:
+      case R4K_INS_MTHI: case R4K_INS_MTLO:
+      case R4K_INS_MULT: case R4K_INS_MULTU: case R4K_INS_DMULT: case R4K_INS_DMULTU:
+      case R4K_INS_TEQ: case R4K_INS_TGE: case R4K_INS_TGEU: case R4K_INS_TLT: case R4K_INS_TLTU: case R4K_INS_TNE:
+      case R4K_INS_TEQI: case R4K_INS_TGEI: case R4K_INS_TGEIU: case R4K_INS_TLTI: case R4K_INS_TLTIU: case R4K_INS_TNEI:
+         return 0;
+      // calls write the return address
+      case R4K_INS_JAL: case R4K_INS_BAL:
+      case R4K_INS_BGEZAL: case R4K_INS_BLTZAL: case R4K_INS_BGEZALL: case R4K_INS_BLTZALL:
+         return R4K_REG_RA;
+      case R4K_INS_JALR:
+         return (block->words[i] >> 11) & 0x1F;
+      default:
+         // packed 0xFF for immediates and FPRs/COP registers are all above the GPRs
+         reg = insn_reg(block, i, 0);
+         return reg < 32 ? reg : 0;
+   }
+}
+
+// find the last instruction before i, back to fs, that writes reg
+// returns instruction index, -1 if not found within MAX_DEF_SEARCH instructions
+#define MAX_DEF_SEARCH 32
+static int find_def(const asm_block *block, int fs, int i, unsigned int reg)
+{
+   for (int k = i - 1; k >= MAX(fs, i - MAX_DEF_SEARCH); k--) {
+      if (insn_dest_gpr(block, k) == reg) {
+         return k;
+      }
+   }
+   return -1;
+}
+
+// match the JR at index i against the jump table dispatch emitted by IDO and GCC:
+//    sltiu $at, $idx, N           (optional, gives the entry count)
+//    sll   $off, $idx, 2
+//    lui   $base, %hi(table)
+//   [addiu $base, $base, %lo(table)]
+//    addu  $ptr, $base, $off
+//    lw    $dst, %lo(table)($ptr)
+//    jr    $dst
+// fs: index of start of function
+// table: set to address of table
+// count: set to the entry count from the bounds check, 0 if there is none
+// returns 1 if matched, 0 otherwise
+static int match_jump_table(const asm_block *block, int fs, int i, unsigned int *table, int *count)
+{
+   int lw, addu;
+   lw = find_def(block, fs, i, insn_reg(block, i, 0));
+   if (lw < 0 || block->ids[lw] != R4K_INS_LW) {
+      return 0;
+   }
+   addu = find_def(block, fs, lw, insn_reg(block, lw, 1));
+   if (addu < 0 || block->ids[addu] != R4K_INS_ADDU) {
+      return 0;
+   }
+   for (int o = 1; o <= 2; o++) {
+      unsigned int base = insn_reg(block, addu, o);
+      unsigned int off = insn_reg(block, addu, 3 - o);
+      int lo = (int16_t)(block->words[lw] & 0xFFFF);
+      int hi = find_def(block, fs, addu, base);
+      if (hi >= 0 && block->ids[hi] == R4K_INS_ADDIU && insn_reg(block, hi, 1) == base) {
+         lo += (int16_t)(block->words[hi] & 0xFFFF);
+         hi = find_def(block, fs, hi, base);
+      }
+      if (hi >= 0 && insn_is_lui(block, hi)) {
+         int sll = find_def(block, fs, addu, off);
+         *table = ((block->words[hi] & 0xFFFF) << 16) + lo;
+         *count = 0;
+         if (sll >= 0 && block->ids[sll] == R4K_INS_SLL && ((block->words[sll] >> 6) & 0x1F) == 2) {
+            unsigned int idx = insn_reg(block, sll, 1);
+            for (int k = sll - 1; k >= MAX(fs, sll - MAX_DEF_SEARCH); k--) {
+               if (block->ids[k] == R4K_INS_SLTIU && insn_reg(block, k, 1) == idx) {
+                  *count = (int16_t)(block->words[k] & 0xFFFF);
+                  break;
                }
-               break;
             }
-         } else if (insn[search].id == MIPS_INS_LW ||
-                    insn[search].id == MIPS_INS_LD ||
-                    insn[search].id == MIPS_INS_ADDIU ||
-                    insn[search].id == MIPS_INS_ADDU ||
-                    insn[search].id == MIPS_INS_ADD ||
-                    insn[search].id == MIPS_INS_SUB ||
-                    insn[search].id == MIPS_INS_SUBU) {
-            unsigned int rd = insn[search].operands[0].reg;
-            if (reg == rd) {
-               // ignore: reg is pointer, offset is probably struct data member
+         }
+         return 1;
+      }
+   }
+   return 0;
+}
+
+// read jump table entries from whichever range up to and including block_id holds the table
+// later ranges are not searched so results do not depend on how pass 1 is split into jobs
+// data: buffer all ranges are disassembled from
+// table: address of table
+// count: number of entries from the bounds check, 0 to read until an entry is out of bounds
+// lo, hi: entries must be in [lo, hi)
+// targets: filled in with up to MAX_JUMP_TABLE entries
+// returns number of entries read
+#define MAX_JUMP_TABLE 1024
+static int read_jump_table(const disasm_state *state, const unsigned char *data, int block_id, unsigned int table, int count,
+                           unsigned int lo, unsigned int hi, unsigned int *targets)
+{
+   if (count <= 0 || count > MAX_JUMP_TABLE) {
+      count = MAX_JUMP_TABLE;
+   }
+   for (int b = 0; b <= block_id; b++) {
+      const asm_block *range = &state->blocks[b];
+      if (table >= range->vaddr && table - range->vaddr < range->length) {
+         int n = 0;
+         unsigned int offset = range->offset + (table - range->vaddr);
+         unsigned int end = range->offset + range->length;
+         for (n = 0; n < count && offset + 4 * n + 4 <= end; n++) {
+            unsigned int target = read_u32_be(&data[offset + 4 * n]);
+            if (target < lo || target >= hi || (target & 3)) {
                break;
             }
-         } else if (insn[search].id == MIPS_INS_JR &&
-               insn[search].operands[0].reg == MIPS_REG_RA) {
-            // stop looking when previous `jr ra` is hit
-            break;
+            targets[n] = target;
          }
+         return n;
       }
    }
+   return 0;
+}
+
+// cfg_build() marks
+#define CFG_ENTRY    0x01 // function entry
+#define CFG_EXTERNAL 0x02 // reached by a call or from another function
+#define CFG_LEADER   0x04 // starts a basic block
+
+// grow array to hold at least count elements of size bytes, doubling alloc as needed
+static void *cfg_grow(void *array, int *alloc, int count, size_t size)
+{
+   if (count > *alloc) {
+      *alloc = MAX(2 * *alloc, MAX(count, 16));
+      array = realloc(array, *alloc * size);
+   }
+   return array;
+}
+
+// add a function to the block, returns its index
+static int cfg_add_function(asm_block *block, int *alloc, int start, int end, unsigned int tail_call)
+{
+   disasm_function *fn;
+   block->functions = cfg_grow(block->functions, alloc, block->function_count + 1, sizeof(*block->functions));
+   fn = &block->functions[block->function_count];
+   memset(fn, 0, sizeof(*fn));
+   fn->vaddr = block->vaddr + 4 * start;
+   fn->length = 4 * (end - start);
+   fn->tail_call = tail_call;
+   return block->function_count++;
+}
+
+// basic block of function fn containing vaddr, -1 if none
+static int bblock_find(const disasm_function *fn, unsigned int vaddr)
+{
+   int lo = 0, hi = fn->bblock_count - 1;
+   while (lo <= hi) {
+      int mid = (lo + hi) / 2;
+      const disasm_bblock *bb = &fn->bblocks[mid];
+      if (vaddr < bb->vaddr) {
+         hi = mid - 1;
+      } else if (vaddr - bb->vaddr >= bb->length) {
+         lo = mid + 1;
+      } else {
+         return mid;
+      }
+   }
+   return -1;
 }
 
-// disassemble a block of code and collect JALs and local labels
-static void disassemble_block(unsigned char *data, unsigned int length, unsigned int vaddr, disasm_state *state, int block_id)
+// successor k of basic block b: succ[] first, then jump table entries
+// returns basic block index, -1 for none, -2 once k is past the last successor
+static int bblock_succ(const disasm_function *fn, int b, int k)
+{
+   const disasm_bblock *bb = &fn->bblocks[b];
+   if (k < 2) {
+      return bb->succ[k];
+   }
+   if (bb->jump_table >= 0 && k - 2 < fn->jump_tables[bb->jump_table].count) {
+      return bblock_find(fn, fn->jump_tables[bb->jump_table].targets[k - 2]);
+   }
+   return -2;
+}
+
+// build the control flow graph of a decoded block: functions, their basic blocks and jump tables
+// functions start at the block start, at call targets and after a return, tail call or other
+// unconditional jump that no earlier branch in the function jumps past
+// data: buffer all ranges are disassembled from, jump tables are read from it
+static void cfg_build(disasm_state *state, const unsigned char *data, int block_id)
 {
    asm_block *block = &state->blocks[block_id];
+   int count = block->instruction_count;
+   uint8_t *mark = calloc(count, sizeof(*mark));
+   int *index = malloc(count * sizeof(*index));
+   int *jt_first = NULL;
+   int *fn_start;
+   unsigned int *targets = malloc(MAX_JUMP_TABLE * sizeof(*targets));
+   int fs, max_target;
+   int function_alloc = 0, bblock_alloc = 0, jump_table_alloc = 0, jump_target_alloc = 0;
 
-   // capstone structures require a lot of data, so only request a small block at a time and preserve the required data
-   int remaining = length;
-   int processed = 0;
-   block->instruction_count = 0;
-   block->instructions = calloc(length / 4, sizeof(*block->instructions));
-   while (remaining > 0) {
-      cs_insn *insn;
-      int current_len = MIN(remaining, 1024);
-      int count = cs_disasm(state->handle, &data[processed], current_len, vaddr + processed, 0, &insn);
-      for (int i = 0; i < count; i++) {
-         disasm_data *dis_insn = &block->instructions[block->instruction_count + i];
-         dis_insn->id = insn[i].id;
-         memcpy(dis_insn->bytes, insn[i].bytes, sizeof(dis_insn->bytes));
-         strcpy(dis_insn->mnemonic, insn[i].mnemonic);
-         strcpy(dis_insn->op_str,   insn[i].op_str);
-         if (insn[i].detail != NULL && insn[i].detail->mips.op_count > 0) {
-            dis_insn->op_count = insn[i].detail->mips.op_count;
-            memcpy(dis_insn->operands, insn[i].detail->mips.operands, sizeof(dis_insn->operands));
-         } else {
-            dis_insn->op_count = 0;
+   // function entries: start of block and targets of calls from within it
+   mark[0] |= CFG_ENTRY;
+   for (int i = 0; i < count; i++) {
+      if (branch_kind(block->ids[i]) & BRANCH_CALL) {
+         int target = jump_target_index(block, i);
+         if (target >= 0) {
+            mark[target] |= CFG_ENTRY | CFG_EXTERNAL;
          }
-         dis_insn->is_jump = cs_insn_group(state->handle, &insn[i], MIPS_GRP_JUMP) || insn[i].id == MIPS_INS_JAL || insn[i].id == MIPS_INS_BAL;
       }
-      cs_free(insn, count);
-      block->instruction_count += count;
-      processed += count * 4;
-      remaining = length - processed;
    }
 
-   if (block->instruction_count > 0) {
-      disasm_data *insn = block->instructions;
-      for (int i = 0; i < block->instruction_count; i++) {
-         insn[i].linked_insn = -1;
-         if (insn[i].is_jump) {
-            // flag for newline two instructions after `jr ra` or `j`
-            if ( ((insn[i].id == MIPS_INS_JR || insn[i].id == MIPS_INS_JALR) && insn[i].operands[0].reg == MIPS_REG_RA) ||
-                   insn[i].id == MIPS_INS_J) {
-               if (i + 2 < block->instruction_count) {
-                   insn[i + 2].newline = 1;
+   // split into functions, finding jump tables along the way
+   fs = 0;
+   max_target = 0; // function extends to at least this index
+   for (int i = 0; i < count; i++) {
+      int kind = branch_kind(block->ids[i]);
+      int end = -1;
+      unsigned int tail_call = 0;
+      if (i > fs && (mark[i] & CFG_ENTRY)) {
+         cfg_add_function(block, &function_alloc, fs, i, 0);
+         fs = i;
+         max_target = i;
+      }
+      if ((kind & BRANCH_JUMP) && !(kind & BRANCH_CALL)) {
+         int target = jump_target_index(block, i);
+         if (block->ids[i] == R4K_INS_JR) {
+            unsigned int table;
+            int n;
+            if (insn_reg(block, i, 0) != R4K_REG_RA && match_jump_table(block, fs, i, &table, &n)) {
+               disasm_jump_table *jt;
+               n = read_jump_table(state, data, block_id, table, n, block->vaddr + 4 * fs, block->vaddr + 4 * count, targets);
+               int jt_alloc = jump_table_alloc; // jt_first grows in step with jump_tables
+               block->jump_tables = cfg_grow(block->jump_tables, &jump_table_alloc, block->jump_table_count + 1,
+                                             sizeof(*block->jump_tables));
+               jt_first = cfg_grow(jt_first, &jt_alloc, block->jump_table_count + 1, sizeof(*jt_first));
+               jt = &block->jump_tables[block->jump_table_count];
+               jt->jr_vaddr = block->vaddr + 4 * i;
+               jt->table_vaddr = table;
+               jt->count = n;
+               // targets pointer is set once jump_targets stops growing
+               jt->targets = NULL;
+               jt_first[block->jump_table_count] = block->jump_target_count;
+               block->jump_table_count++;
+               block->jump_targets = cfg_grow(block->jump_targets, &jump_target_alloc, block->jump_target_count + n,
+                                              sizeof(*block->jump_targets));
+               for (int t = 0; t < n; t++) {
+                  int ti = (targets[t] - block->vaddr) / 4;
+                  block->jump_targets[block->jump_target_count++] = targets[t];
+                  max_target = MAX(max_target, ti + 1);
                }
             }
+         } else if (block->ids[i] == R4K_INS_J && (target < fs || (mark[target] & CFG_ENTRY))) {
+            // jump to another function
+            tail_call = ((block->vaddr + 4 * i) & 0xF0000000) | ((block->words[i] & 0x3FFFFFF) << 2);
+         } else if (target >= fs) {
+            max_target = MAX(max_target, target + 1);
+         }
+         if (!(kind & BRANCH_COND) && i + 2 >= max_target) {
+            end = i + 2;
+         }
+      } else if (block->ids[i] == R4K_INS_ERET && i + 1 >= max_target) {
+         end = i + 1;
+      }
+      if (end >= 0) {
+         // alignment padding belongs to the function before it
+         while (end < count && block->words[end] == 0 && !(mark[end] & CFG_ENTRY)) {
+            end++;
+         }
+         end = MIN(end, count);
+         cfg_add_function(block, &function_alloc, fs, end, tail_call);
+         fs = end;
+         max_target = end;
+         i = end - 1;
+      }
+   }
+   if (fs < count) {
+      cfg_add_function(block, &function_alloc, fs, count, 0);
+   }
+
+   // index of function containing each instruction
+   fn_start = malloc(block->function_count * sizeof(*fn_start));
+   for (int f = 0; f < block->function_count; f++) {
+      int start = (block->functions[f].vaddr - block->vaddr) / 4;
+      int end = start + block->functions[f].length / 4;
+      fn_start[f] = start;
+      for (int i = start; i < end; i++) {
+         index[i] = f;
+      }
+   }
+
+   // basic block leaders, and edges entering a function from elsewhere
+   for (int i = 0; i < count; i++) {
+      int kind = branch_kind(block->ids[i]);
+      int fe = fn_start[index[i]] + block->functions[index[i]].length / 4;
+      if (mark[i] & CFG_ENTRY) {
+         mark[i] |= CFG_LEADER;
+      }
+      if (kind) {
+         int target = (kind & BRANCH_CALL) ? -1 : jump_target_index(block, i);
+         if ((kind & BRANCH_LIKELY) && i + 1 < fe) {
+            mark[i + 1] |= CFG_LEADER;
+         }
+         if (!(kind & BRANCH_CALL) || (kind & BRANCH_LIKELY)) {
+            if (i + 2 < fe) {
+               mark[i + 2] |= CFG_LEADER;
+            }
+         }
+         if (target >= 0) {
+            mark[target] |= CFG_LEADER;
+            if (index[target] != index[i]) {
+               mark[target] |= CFG_EXTERNAL;
+            }
+         }
+      }
+   }
+   for (int t = 0; t < block->jump_target_count; t++) {
+      mark[(block->jump_targets[t] - block->vaddr) / 4] |= CFG_LEADER;
+   }
 
-            if (insn[i].id == MIPS_INS_JAL || insn[i].id == MIPS_INS_BAL || insn[i].id == MIPS_INS_J) {
-               unsigned int jal_target  = (unsigned int)insn[i].operands[0].imm;
-               // create label if one does not exist
-               if (labels_find(&state->globals, jal_target) < 0) {
-                  char label_name[32];
-                  sprintf(label_name, "func_%08X", jal_target);
-                  labels_add(&state->globals, label_name, jal_target);
+   // number basic blocks, index[] is reused to map instructions to basic blocks within their function
+   for (int f = 0; f < block->function_count; f++) {
+      disasm_function *fn = &block->functions[f];
+      int start = fn_start[f];
+      int end = start + fn->length / 4;
+      int first = block->bblock_count;
+      for (int i = start; i < end; i++) {
+         if (i == start || (mark[i] & CFG_LEADER)) {
+            disasm_bblock *bb;
+            block->bblocks = cfg_grow(block->bblocks, &bblock_alloc, block->bblock_count + 1, sizeof(*block->bblocks));
+            bb = &block->bblocks[block->bblock_count++];
+            bb->vaddr = block->vaddr + 4 * i;
+            bb->length = 0;
+            bb->succ[0] = bb->succ[1] = -1;
+            bb->jump_table = -1;
+            bb->external = (mark[i] & CFG_EXTERNAL) ? 1 : 0;
+         }
+         block->bblocks[block->bblock_count - 1].length += 4;
+         index[i] = block->bblock_count - 1 - first;
+      }
+      // bblocks pointer is set once bblocks stops growing
+      fn->bblock_count = block->bblock_count - first;
+   }
+
+   // successors
+   for (int f = 0, first = 0, jt = 0; f < block->function_count; f++) {
+      disasm_function *fn = &block->functions[f];
+      int start = fn_start[f];
+      int end = start + fn->length / 4;
+      int first_jt = jt;
+      while (jt < block->jump_table_count && block->jump_tables[jt].jr_vaddr < fn->vaddr + fn->length) {
+         jt++;
+      }
+      fn->jump_table_count = jt - first_jt;
+      for (int b = 0; b < fn->bblock_count; b++) {
+         disasm_bblock *bb = &block->bblocks[first + b];
+         int e = (bb->vaddr - block->vaddr) / 4 + bb->length / 4 - 1;
+         int succ[2] = {-1, -1};
+         int kind;
+         if (e > start && (kind = branch_kind(block->ids[e - 1]))) {
+            // ends with a delay slot
+            int s = e - 1;
+            if (block->ids[s] == R4K_INS_JR) {
+               for (int t = first_jt; t < jt; t++) {
+                  if (block->jump_tables[t].jr_vaddr == block->vaddr + 4 * s) {
+                     bb->jump_table = t - first_jt;
+                  }
                }
+            } else {
+               succ[0] = (kind & BRANCH_CALL) ? s + 2 : jump_target_index(block, s);
+            }
+            if ((kind & BRANCH_COND) && !(kind & BRANCH_LIKELY)) {
+               succ[1] = s + 2;
+            }
+         } else if ((kind = branch_kind(block->ids[e]))) {
+            // delay slot is in the next basic block, skipped on fall through for likely branches
+            succ[0] = e + 1;
+            if (kind & BRANCH_LIKELY) {
+               succ[1] = e + 2;
+            }
+         } else if (block->ids[e] != R4K_INS_ERET) {
+            succ[0] = e + 1;
+         }
+         for (int k = 0; k < 2; k++) {
+            bb->succ[k] = (succ[k] >= start && succ[k] < end) ? index[succ[k]] : -1;
+         }
+      }
+      first += fn->bblock_count;
+   }
+
+   // arrays are final, point functions and jump tables into them
+   for (int f = 0, first = 0, jt = 0; f < block->function_count; f++) {
+      disasm_function *fn = &block->functions[f];
+      fn->bblocks = &block->bblocks[first];
+      fn->jump_tables = fn->jump_table_count ? &block->jump_tables[jt] : NULL;
+      first += fn->bblock_count;
+      jt += fn->jump_table_count;
+   }
+   for (int t = 0; t < block->jump_table_count; t++) {
+      block->jump_tables[t].targets = &block->jump_targets[jt_first[t]];
+   }
+
+   free(mark);
+   free(index);
+   free(jt_first);
+   free(fn_start);
+   free(targets);
+}
+
+static void cfg_free(asm_block *block)
+{
+   free(block->functions);
+   free(block->bblocks);
+   free(block->jump_tables);
+   free(block->jump_targets);
+   block->functions = NULL;
+   block->bblocks = NULL;
+   block->jump_tables = NULL;
+   block->jump_targets = NULL;
+   block->function_count = block->bblock_count = block->jump_table_count = block->jump_target_count = 0;
+}
+
+// lui_state.lui values other than instruction indexes
+#define LUI_UNKNOWN   -1 // not set by a LUI, or set by different LUIs on different paths
+#define LUI_UNVISITED -2 // no path reaching here has been seen yet
+
+// index of the LUI that last set each GPR
+typedef struct
+{
+   int lui[32];
+} lui_state;
+
+// apply the effect of instruction i to the register state
+static void lui_transfer(const asm_block *block, int i, lui_state *st)
+{
+   if (insn_is_lui(block, i)) {
+      unsigned int rt = insn_reg(block, i, 0);
+      if (rt != R4K_REG_ZERO) {
+         st->lui[rt] = i;
+      }
+   } else {
+      unsigned int rd = insn_dest_gpr(block, i);
+      if (rd != R4K_REG_ZERO) {
+         st->lui[rd] = LUI_UNKNOWN;
+      }
+   }
+}
+
+// merge a predecessor's state into in, returns 1 if in changed
+static int lui_meet(lui_state *in, const lui_state *pred)
+{
+   int changed = 0;
+   for (int r = 0; r < 32; r++) {
+      int v = in->lui[r];
+      if (v == LUI_UNVISITED) {
+         v = pred->lui[r];
+      } else if (pred->lui[r] != LUI_UNVISITED && pred->lui[r] != v) {
+         v = LUI_UNKNOWN;
+      }
+      if (v != in->lui[r]) {
+         in->lui[r] = v;
+         changed = 1;
+      }
+   }
+   return changed;
+}
+
+// pair LUI with the instruction using its value as %hi and an immediate as %lo
+static void link_lui(disasm_state *state, asm_block *block, int lui, int use, unsigned int lo_imm, label_buf *new_globals)
+{
+   unsigned int addr = ((block->words[lui] & 0xFFFF) << 16) + lo_imm;
+   block->linked_insn[lui] = use;
+   block->linked_value[lui] = addr;
+   block->linked_insn[use] = lui;
+   block->linked_value[use] = addr;
+   // if not ORI, create global data label if one does not exist
+   if (block->ids[use] != R4K_INS_ORI) {
+      global_label_add(state, new_globals, "D_%08X", addr);
+   }
+}
+
+// link instruction i with the LUI its base or source register holds, if any
+static void link_lui_user(disasm_state *state, asm_block *block, int i, const lui_state *st, label_buf *new_globals)
+{
+   uint32_t word = block->words[i];
+   switch (block->ids[i]) {
+      // find floating point LI
+      case R4K_INS_MTC1:
+      {
+         int lui = st->lui[insn_reg(block, i, 0)];
+         if (lui >= 0) {
+            // link up the LUI with this instruction and the float bits, and rewrite it to be LI
+            block->linked_insn[lui] = i;
+            block->linked_value[lui] = (block->words[lui] & 0xFFFF) << 16;
+            block->ids[lui] = R4K_INS_LI;
+         }
+         break;
+      }
+      case R4K_INS_SD:
+      case R4K_INS_SW:
+      case R4K_INS_SH:
+      case R4K_INS_SB:
+      case R4K_INS_LB:
+      case R4K_INS_LBU:
+      case R4K_INS_LD:
+      case R4K_INS_LDL:
+      case R4K_INS_LDR:
+      case R4K_INS_LH:
+      case R4K_INS_LHU:
+      case R4K_INS_LW:
+      case R4K_INS_LWU:
+      case R4K_INS_LWC1:
+      case R4K_INS_LWC2:
+      case R4K_INS_SWC1:
+      case R4K_INS_SWC2:
+      {
+         int lui = st->lui[insn_reg(block, i, 1)];
+         unsigned int mem_imm = (unsigned int)(int16_t)(word & 0xFFFF);
+         // don't attempt to compute addresses for zero offset
+         if (lui >= 0 && block->ids[lui] == R4K_INS_LUI && mem_imm != 0) {
+            link_lui(state, block, lui, i, mem_imm, new_globals);
+         }
+         break;
+      }
+      case R4K_INS_ADDIU:
+      case R4K_INS_ORI:
+      {
+         unsigned int rd = insn_reg(block, i, 0);
+         unsigned int rs = insn_reg(block, i, 1);
+         unsigned int imm = block->ids[i] == R4K_INS_ORI ? word & 0xFFFF : (unsigned int)(int16_t)(word & 0xFFFF);
+         // only pair if rd and rs are the same
+         if (rd == rs && rs < 32) {
+            int lui = st->lui[rs];
+            if (lui >= 0 && block->ids[lui] == R4K_INS_LUI && imm != 0) {
+               link_lui(state, block, lui, i, imm, new_globals);
+            }
+         }
+         break;
+      }
+   }
+}
+
+// pair LUIs with their %lo users and MTC1s using a forward dataflow pass over each function
+// the LUI each GPR holds is propagated through the basic blocks from cfg_build() to a fixed
+// point, then one final sweep links the users
+static void link_pseudo(disasm_state *state, int block_id, label_buf *new_globals)
+{
+   asm_block *block = &state->blocks[block_id];
+
+   for (int f = 0; f < block->function_count; f++) {
+      const disasm_function *fn = &block->functions[f];
+      int n = fn->bblock_count;
+      int *queue = malloc(n * sizeof(*queue));
+      uint8_t *reached = calloc(n, sizeof(*reached));
+      uint8_t *queued = calloc(n, sizeof(*queued));
+      lui_state *bb_in = malloc(n * sizeof(*bb_in));
+      int q_head = 0, q_count = 0;
+
+      for (int b = 0; b < n; b++) {
+         for (int k = 0, succ; (succ = bblock_succ(fn, b, k)) != -2; k++) {
+            if (succ >= 0) {
+               reached[succ] = 1;
+            }
+         }
+      }
+      // entry, blocks entered from elsewhere and blocks with no known predecessor start unknown
+      for (int b = 0; b < n; b++) {
+         int seed = b == 0 || fn->bblocks[b].external || !reached[b];
+         for (int r = 0; r < 32; r++) {
+            bb_in[b].lui[r] = seed ? LUI_UNKNOWN : LUI_UNVISITED;
+         }
+         reached[b] = seed;
+         queue[q_count++] = b;
+         queued[b] = 1;
+      }
+
+      // propagate to a fixed point, values only ever move from unvisited to a LUI to unknown
+      while (q_count > 0) {
+         int b = queue[q_head];
+         q_head = (q_head + 1) % n;
+         q_count--;
+         queued[b] = 0;
+         if (reached[b]) {
+            const disasm_bblock *bb = &fn->bblocks[b];
+            int start = (bb->vaddr - block->vaddr) / 4;
+            lui_state st = bb_in[b];
+            for (int i = start; i < start + (int)bb->length / 4; i++) {
+               lui_transfer(block, i, &st);
+            }
+            for (int k = 0, succ; (succ = bblock_succ(fn, b, k)) != -2; k++) {
+               if (succ >= 0 && (lui_meet(&bb_in[succ], &st) || !reached[succ])) {
+                  reached[succ] = 1;
+                  if (!queued[succ]) {
+                     queue[(q_head + q_count) % n] = succ;
+                     q_count++;
+                     queued[succ] = 1;
+                  }
+               }
+            }
+         }
+      }
+
+      // link users in one sweep with the converged state
+      for (int b = 0; b < n; b++) {
+         const disasm_bblock *bb = &fn->bblocks[b];
+         int start = (bb->vaddr - block->vaddr) / 4;
+         lui_state st = bb_in[b];
+         for (int r = 0; r < 32; r++) {
+            if (st.lui[r] == LUI_UNVISITED) {
+               st.lui[r] = LUI_UNKNOWN;
+            }
+         }
+         for (int i = start; i < start + (int)bb->length / 4; i++) {
+            link_lui_user(state, block, i, &st, new_globals);
+            lui_transfer(block, i, &st);
+         }
+      }
+
+      free(queue);
+      free(reached);
+      free(queued);
+      free(bb_in);
+   }
+}
+
+#ifdef MIPSDISASM_CAPSTONE
+// cross-check the native decoder against capstone, reporting each instruction that differs
+// data: raw MIPS code of the block
+// vaddr: virtual address of first byte
+// count: number of instructions in data
+// returns number of mismatched instructions
+static int capstone_check(const unsigned char *data, unsigned int vaddr, int count)
+{
+   csh handle;
+   int mismatches = 0;
+   if (cs_open(CS_ARCH_MIPS, CS_MODE_MIPS64 + CS_MODE_BIG_ENDIAN, &handle) != CS_ERR_OK) {
+      ERROR("Error initializing capstone\n");
+      exit(EXIT_FAILURE);
+   }
+   cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+   cs_option(handle, CS_OPT_SKIPDATA, CS_OPT_ON);
+   for (int i = 0; i < count; i++) {
+      disasm_data insn;
+      cs_insn *cs;
+      decode_insn(read_u32_be(&data[i * 4]), vaddr + i * 4, &insn);
+      render_insn(&insn);
+      if (cs_disasm(handle, &data[i * 4], 4, vaddr + i * 4, 1, &cs) == 1) {
+         int is_jump = cs_insn_group(handle, cs, MIPS_GRP_JUMP) || cs->id == MIPS_INS_JAL || cs->id == MIPS_INS_BAL;
+         if (strcmp(cs->mnemonic, insn.mnemonic) || strcmp(cs->op_str, insn.op_str) || is_jump != insn.is_jump) {
+            ERROR("Decoder mismatch at 0x%08X (%02X%02X%02X%02X): capstone \"%s %s\"%s, native \"%s %s\"%s\n",
+                  vaddr + i * 4, insn.bytes[0], insn.bytes[1], insn.bytes[2], insn.bytes[3],
+                  cs->mnemonic, cs->op_str, is_jump ? " jump" : "",
+                  insn.mnemonic, insn.op_str, insn.is_jump ? " jump" : "");
+            mismatches++;
+         }
+         cs_free(cs, 1);
+      }
+   }
+   cs_close(&handle);
+   return mismatches;
+}
+#endif
+
+// disassemble a block of code, collect JALs and local labels and build its control flow graph
+// data: buffer all ranges are disassembled from, the block is read from block->offset
+// new_globals: buffer generated global labels are added to
+static void disassemble_block(unsigned char *data, disasm_state *state, int block_id, label_buf *new_globals)
+{
+   asm_block *block = &state->blocks[block_id];
+   unsigned int length = block->length;
+   unsigned int vaddr = block->vaddr;
+
+   block->functions = NULL;
+   block->bblocks = NULL;
+   block->jump_tables = NULL;
+   block->jump_targets = NULL;
+   block->function_count = block->bblock_count = block->jump_table_count = block->jump_target_count = 0;
+   block_insns_alloc(block, length / 4);
+#ifdef MIPSDISASM_CAPSTONE
+   capstone_check(&data[block->offset], vaddr, block->instruction_count);
+#endif
+
+   if (block->instruction_count > 0) {
+      for (int i = 0; i < block->instruction_count; i++) {
+         // decoded operands are only kept while collecting labels, pairing uses the compact arrays
+         disasm_data decoded;
+         const disasm_data *insn = &decoded;
+         block->words[i] = read_u32_be(&data[block->offset + i * 4]);
+         decode_insn(block->words[i], vaddr + i * 4, &decoded);
+         block->ids[i] = decoded.id;
+         block->regs[i] = pack_regs(&decoded);
+         block->linked_insn[i] = -1;
+         if (insn->is_jump) {
+            block->flags[i] |= INSN_JUMP;
+            if (insn->id == R4K_INS_JAL || insn->id == R4K_INS_BAL || insn->id == R4K_INS_J) {
+               unsigned int jal_target  = (unsigned int)insn->operands[0].imm;
+               // create label if one does not exist
+               global_label_add(state, new_globals, "func_%08X", jal_target);
             } else {
                // all branches and jumps
-               for (int o = 0; o < insn[i].op_count; o++) {
-                  if (insn[i].operands[o].type == MIPS_OP_IMM) {
+               for (int o = 0; o < insn->op_count; o++) {
+                  if (insn->operands[o].type == R4K_OP_IMM) {
                      char label_name[32];
-                     unsigned int branch_target = (unsigned int)insn[i].operands[o].imm;
+                     unsigned int branch_target = (unsigned int)insn->operands[o].imm;
                      // create label if one does not exist
                      int label = labels_find(&block->locals, branch_target);
                      if (label < 0) {
@@ -255,90 +1765,36 @@ static void disassemble_block(unsigned char *data, unsigned int length, unsigned
             }
          }
 
-         if (state->merge_pseudo) {
-            switch (insn[i].id) {
-               // find floating point LI
-               case MIPS_INS_MTC1:
-               {
-                  unsigned int rt = insn[i].operands[0].reg;
-                  for (int s = i - 1; s >= 0; s--) {
-                     if (insn[s].id == MIPS_INS_LUI && insn[s].operands[0].reg == rt) {
-                        float f;
-                        uint32_t lui_imm = (uint32_t)(insn[s].operands[1].imm << 16);
-                        memcpy(&f, &lui_imm, sizeof(f));
-                        // link up the LUI with this instruction and the float
-                        insn[s].linked_insn = i;
-                        insn[s].linked_float = f;
-                        // rewrite LUI instruction to be LI
-                        insn[s].id = MIPS_INS_LI;
-                        strcpy(insn[s].mnemonic, "li");
-                        break;
-                     } else if (insn[s].id == MIPS_INS_LW ||
-                                insn[s].id == MIPS_INS_LD ||
-                                insn[s].id == MIPS_INS_LH ||
-                                insn[s].id == MIPS_INS_LHU ||
-                                insn[s].id == MIPS_INS_LB ||
-                                insn[s].id == MIPS_INS_LBU ||
-                                insn[s].id == MIPS_INS_ADDIU ||
-                                insn[s].id == MIPS_INS_ADD ||
-                                insn[s].id == MIPS_INS_SUB ||
-                                insn[s].id == MIPS_INS_SUBU) {
-                        unsigned int rd = insn[s].operands[0].reg;
-                        if (rt == rd) {
-                           break;
-                        }
-                     } else if (insn[s].id == MIPS_INS_JR &&
-                                insn[s].operands[0].reg == MIPS_REG_RA) {
-                        // stop looking when previous `jr ra` is hit
-                        break;
-                     }
-                  }
-                  break;
-               }
-               case MIPS_INS_SD:
-               case MIPS_INS_SW:
-               case MIPS_INS_SH:
-               case MIPS_INS_SB:
-               case MIPS_INS_LB:
-               case MIPS_INS_LBU:
-               case MIPS_INS_LD:
-               case MIPS_INS_LDL:
-               case MIPS_INS_LDR:
-               case MIPS_INS_LH:
-               case MIPS_INS_LHU:
-               case MIPS_INS_LW:
-               case MIPS_INS_LWU:
-               case MIPS_INS_LWC1:
-               case MIPS_INS_LWC2:
-               case MIPS_INS_LWC3:
-               case MIPS_INS_SWC1:
-               case MIPS_INS_SWC2:
-               case MIPS_INS_SWC3:
-               {
-                  unsigned int mem_rs = insn[i].operands[1].mem.base;
-                  unsigned int mem_imm = (unsigned int)insn[i].operands[1].mem.disp;
-                  link_with_lui(state, block_id, i, mem_rs, mem_imm);
-                  break;
-               }
-               case MIPS_INS_ADDIU:
-               case MIPS_INS_ORI:
-               {
-                  unsigned int rd = insn[i].operands[0].reg;
-                  unsigned int rs = insn[i].operands[1].reg;
-                  int64_t imm = insn[i].operands[2].imm;
-                  if (rs == MIPS_REG_ZERO) { // becomes LI
-                     insn[i].id = MIPS_INS_LI;
-                     strcpy(insn[i].mnemonic, "li");
-                     // TODO: is there allocation for this?
-                     sprintf(insn[i].op_str, "$%s, %" PRIi64, cs_reg_name(state->handle, rd), imm);
-                  } else if (rd == rs) { // only look for LUI if rd and rs are the same
-                     link_with_lui(state, block_id, i, rs, (unsigned int)imm);
-                  }
-                  break;
-               }
+         // ADDIU/ORI from $zero becomes LI, operands are rewritten in pass 2
+         if (state->merge_pseudo && (insn->id == R4K_INS_ADDIU || insn->id == R4K_INS_ORI) &&
+             insn->operands[1].reg == R4K_REG_ZERO) {
+            block->ids[i] = R4K_INS_LI;
+         }
+      }
+      cfg_build(state, data, block_id);
+      // newline and label at the start of each function
+      for (int f = 0; f < block->function_count; f++) {
+         unsigned int start = block->functions[f].vaddr;
+         if (f > 0) {
+            block->flags[(start - vaddr) / 4] |= INSN_NEWLINE;
+         }
+         global_label_add(state, new_globals, "func_%08X", start);
+      }
+      // jump table targets are branched to like any other local label
+      for (int t = 0; t < block->jump_target_count; t++) {
+         unsigned int target = block->jump_targets[t];
+         if (labels_find(&block->locals, target) < 0) {
+            char label_name[32];
+            switch (state->syntax) {
+               case ASM_GAS:    sprintf(label_name, ".L%08X", target); break;
+               case ASM_ARMIPS: sprintf(label_name, "@L%08X", target); break;
             }
+            labels_add(&block->locals, label_name, target);
          }
       }
+      if (state->merge_pseudo) {
+         link_pseudo(state, block_id, new_globals);
+      }
    } else {
       ERROR("Error: Failed to disassemble 0x%X bytes of code at 0x%08X\n", (unsigned int)length, vaddr);
    }
@@ -356,14 +1812,6 @@ disasm_state *disasm_state_init(asm_syntax syntax, int merge_pseudo)
    state->syntax = syntax;
    state->merge_pseudo = merge_pseudo;
 
-   // open capstone disassembler
-   if (cs_open(CS_ARCH_MIPS, CS_MODE_MIPS64 + CS_MODE_BIG_ENDIAN, &state->handle) != CS_ERR_OK) {
-      ERROR("Error initializing disassembler\n");
-      exit(EXIT_FAILURE);
-   }
-   cs_option(state->handle, CS_OPT_DETAIL, CS_OPT_ON);
-   cs_option(state->handle, CS_OPT_SKIPDATA, CS_OPT_ON);
-
    return state;
 }
 
@@ -371,16 +1819,15 @@ void disasm_state_free(disasm_state *state)
 {
    if (state) {
       for (int i = 0; i < state->block_count; i++) {
-         if (state->blocks[i].instructions) {
-            free(state->blocks[i].instructions);
-            state->blocks[i].instructions = NULL;
-         }
+         labels_free(&state->blocks[i].locals);
+         block_insns_free(&state->blocks[i]);
+         cfg_free(&state->blocks[i]);
       }
       if (state->blocks) {
          free(state->blocks);
          state->blocks = NULL;
       }
-      cs_close(&state->handle);
+      labels_free(&state->globals);
    }
 }
 
@@ -401,6 +1848,50 @@ int disasm_label_lookup(const disasm_state *state, unsigned int vaddr, char *nam
    return found;
 }
 
+int disasm_function_count(const disasm_state *state)
+{
+   int count = 0;
+   for (int b = 0; b < state->block_count; b++) {
+      count += state->blocks[b].function_count;
+   }
+   return count;
+}
+
+const disasm_function *disasm_function_get(const disasm_state *state, int index)
+{
+   if (index >= 0) {
+      for (int b = 0; b < state->block_count; b++) {
+         if (index < state->blocks[b].function_count) {
+            return &state->blocks[b].functions[index];
+         }
+         index -= state->blocks[b].function_count;
+      }
+   }
+   return NULL;
+}
+
+const disasm_function *disasm_function_lookup(const disasm_state *state, unsigned int vaddr)
+{
+   for (int b = 0; b < state->block_count; b++) {
+      const asm_block *block = &state->blocks[b];
+      if (vaddr >= block->vaddr && vaddr - block->vaddr < block->length) {
+         int lo = 0, hi = block->function_count - 1;
+         while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            const disasm_function *fn = &block->functions[mid];
+            if (vaddr < fn->vaddr) {
+               hi = mid - 1;
+            } else if (vaddr - fn->vaddr >= fn->length) {
+               lo = mid + 1;
+            } else {
+               return fn;
+            }
+         }
+      }
+   }
+   return NULL;
+}
+
 void mipsdisasm_pass1(unsigned char *data, unsigned int offset, unsigned int length, unsigned int vaddr, disasm_state *state)
 {
    if (state->block_count >= state->block_alloc) {
@@ -414,7 +1905,7 @@ void mipsdisasm_pass1(unsigned char *data, unsigned int offset, unsigned int len
    block->vaddr = vaddr;
 
    // collect all branch and jump targets
-   disassemble_block(&data[offset], length, vaddr, state, state->block_count);
+   disassemble_block(data, state, state->block_count, &state->globals);
 
    // sort global and local labels
    labels_sort(&state->globals);
@@ -422,7 +1913,90 @@ void mipsdisasm_pass1(unsigned char *data, unsigned int offset, unsigned int len
    state->block_count++;
 }
 
-void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset)
+typedef struct
+{
+   unsigned char *data;
+   disasm_state *state;
+   int first_block;
+   label_buf *new_globals;
+} pass1_ctx;
+
+// parallel_for() job: disassemble one range into its reserved block
+static void pass1_job(void *job_ctx, int index)
+{
+   pass1_ctx *ctx = job_ctx;
+   asm_block *block = &ctx->state->blocks[ctx->first_block + index];
+
+   disassemble_block(ctx->data, ctx->state, ctx->first_block + index, &ctx->new_globals[index]);
+   labels_sort(&block->locals);
+}
+
+void mipsdisasm_pass1_parallel(unsigned char *data, const disasm_range *ranges, int count, int threads, disasm_state *state)
+{
+   pass1_ctx ctx;
+
+   // reserve all blocks up front so workers never see state->blocks move
+   if (state->block_count + count > state->block_alloc) {
+      while (state->block_count + count > state->block_alloc) {
+         state->block_alloc *= 2;
+      }
+      state->blocks = realloc(state->blocks, sizeof(*state->blocks) * state->block_alloc);
+   }
+   ctx.data = data;
+   ctx.state = state;
+   ctx.first_block = state->block_count;
+   ctx.new_globals = malloc(count * sizeof(*ctx.new_globals));
+   for (int i = 0; i < count; i++) {
+      asm_block *block = &state->blocks[ctx.first_block + i];
+      labels_alloc(&block->locals);
+      block->offset = ranges[i].offset;
+      block->length = ranges[i].length;
+      block->vaddr = ranges[i].vaddr;
+      labels_alloc(&ctx.new_globals[i]);
+   }
+
+   // workers only read state->globals and collect new labels per block
+   parallel_for(count, threads, pass1_job, &ctx);
+
+   // merge in block order, keeping the first label generated for each address just like the serial pass
+   for (int i = 0; i < count; i++) {
+      label_buf *new_globals = &ctx.new_globals[i];
+      for (int l = 0; l < new_globals->count; l++) {
+         if (labels_find(&state->globals, new_globals->labels[l].vaddr) < 0) {
+            labels_add(&state->globals, new_globals->labels[l].name, new_globals->labels[l].vaddr);
+         }
+      }
+      labels_free(new_globals);
+   }
+   free(ctx.new_globals);
+
+   labels_sort(&state->globals);
+   state->block_count += count;
+}
+
+// append "mnemonic $rt, " with the mnemonic padded like "%-5s "
+static void put_mnemonic_reg(strbuf *out, const char *mnemonic, unsigned int reg)
+{
+   strbuf_puts_pad(out, mnemonic, 5);
+   strbuf_append(out, " $", 2);
+   strbuf_puts(out, reg_name(reg));
+   strbuf_append(out, ", ", 2);
+}
+
+// append "# " or "// " comment start for syntax
+static void put_comment(strbuf *out, asm_syntax syntax)
+{
+   strbuf_puts(out, syntax == ASM_GAS ? " # " : " // ");
+}
+
+// append "0xXXXXXXXX"
+static void put_hex32(strbuf *out, unsigned int value)
+{
+   strbuf_append(out, "0x", 2);
+   strbuf_hex(out, value, 8);
+}
+
+void mipsdisasm_pass2_buf(strbuf *out, disasm_state *state, unsigned int offset)
 {
    asm_block *block = NULL;
    unsigned int vaddr;
@@ -449,56 +2023,85 @@ void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset)
    while ( (local_idx < block->locals.count) && (vaddr > block->locals.labels[local_idx].vaddr) ) {
       local_idx++;
    }
+   // each line is roughly 64 characters
+   strbuf_reserve(out, 64 * block->instruction_count);
    for (int i = 0; i < block->instruction_count; i++) {
-      disasm_data *insn = &block->instructions[i];
+      disasm_data decoded;
+      disasm_data *insn = &decoded;
+      int linked_insn = block->linked_insn[i];
+      decode_insn(block->words[i], vaddr, insn);
+      render_insn(insn);
+      // LUI paired with MTC1, or ADDIU/ORI from $zero, rewritten in pass 1
+      if (block->ids[i] == R4K_INS_LI) {
+         if (linked_insn < 0) {
+            char *op = insn->op_str;
+            *op++ = '$';
+            op = put_str(op, reg_name(insn->operands[0].reg));
+            op = put_str(op, ", ");
+            op += str_dec(op, insn->operands[2].imm);
+            *op = '\0';
+         }
+         insn->id = R4K_INS_LI;
+         strcpy(insn->mnemonic, "li");
+      }
       // newline between functions
-      if (insn->newline) {
-         fprintf(out, "\n");
+      if (block->flags[i] & INSN_NEWLINE) {
+         strbuf_putc(out, '\n');
       }
       // insert all global labels at this address
       while ( (global_idx < state->globals.count) && (vaddr == state->globals.labels[global_idx].vaddr) ) {
-         fprintf(out, "%s:\n", state->globals.labels[global_idx].name);
+         strbuf_puts(out, state->globals.labels[global_idx].name);
+         strbuf_append(out, ":\n", 2);
          global_idx++;
       }
       // insert all local labels at this address
       while ( (local_idx < block->locals.count) && (vaddr == block->locals.labels[local_idx].vaddr) ) {
-         fprintf(out, "%s:\n", block->locals.labels[local_idx].name);
+         strbuf_puts(out, block->locals.labels[local_idx].name);
+         strbuf_append(out, ":\n", 2);
          local_idx++;
       }
-      fprintf(out, "/* %06X %08X %02X%02X%02X%02X */  ", offset, vaddr, insn->bytes[0], insn->bytes[1], insn->bytes[2], insn->bytes[3]);
+      strbuf_append(out, "/* ", 3);
+      strbuf_hex(out, offset, 6);
+      strbuf_putc(out, ' ');
+      strbuf_hex(out, vaddr, 8);
+      strbuf_putc(out, ' ');
+      strbuf_hex(out, block->words[i], 8);
+      strbuf_append(out, " */  ", 5);
       // indent the lines after a jump or branch
       if (indent) {
          indent = 0;
-         fputc(' ', out);
+         strbuf_putc(out, ' ');
       }
-      if (insn->is_jump) {
+      if (block->flags[i] & INSN_JUMP) {
          indent = 1;
-         fprintf(out, "%-5s ", insn->mnemonic);
-         if (insn->id == MIPS_INS_JAL || insn->id == MIPS_INS_BAL || insn->id == MIPS_INS_J) {
+         strbuf_puts_pad(out, insn->mnemonic, 5);
+         strbuf_putc(out, ' ');
+         if (insn->id == R4K_INS_JAL || insn->id == R4K_INS_BAL || insn->id == R4K_INS_J) {
             unsigned int jal_target = (unsigned int)insn->operands[0].imm;
             label = labels_find(&state->globals, jal_target);
             if (label >= 0) {
-               fprintf(out, "%s\n", state->globals.labels[label].name);
+               strbuf_puts(out, state->globals.labels[label].name);
             } else {
-               fprintf(out, "0x%08X\n", jal_target);
+               put_hex32(out, jal_target);
             }
          } else {
             for (int o = 0; o < insn->op_count; o++) {
                if (o > 0) {
-                  fprintf(out, ", ");
+                  strbuf_append(out, ", ", 2);
                }
                switch (insn->operands[o].type) {
-                  case MIPS_OP_REG:
-                     fprintf(out, "$%s", cs_reg_name(state->handle, insn->operands[o].reg));
+                  case R4K_OP_REG:
+                     strbuf_putc(out, '$');
+                     strbuf_puts(out, reg_name(insn->operands[o].reg));
                      break;
-                  case MIPS_OP_IMM:
+                  case R4K_OP_IMM:
                   {
                      unsigned int branch_target = (unsigned int)insn->operands[o].imm;
                      label = labels_find(&block->locals, branch_target);
                      if (label >= 0) {
-                        fprintf(out, block->locals.labels[label].name);
+                        strbuf_puts(out, block->locals.labels[label].name);
                      } else {
-                        fprintf(out, "0x%08X", branch_target);
+                        put_hex32(out, branch_target);
                      }
                      break;
                   }
@@ -506,9 +2109,9 @@ void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset)
                      break;
                }
             }
-            fprintf(out, "\n");
          }
-      } else if (insn->id == MIPS_INS_MTC0 || insn->id == MIPS_INS_MFC0) {
+         strbuf_putc(out, '\n');
+      } else if (insn->id == R4K_INS_MTC0 || insn->id == R4K_INS_MFC0) {
          // workaround bug in capstone/LLVM
          unsigned char rd;
          // 31-24 23-16 15-8 7-0
@@ -519,136 +2122,153 @@ void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset)
          //       010000 00100 00000 11101 000 0000 0000
          // rt = insn->bytes[1] & 0x1F;
          rd = (insn->bytes[2] & 0xF8) >> 3;
-         fprintf(out, "%-5s $%s, $%d\n", insn->mnemonic,
-                 cs_reg_name(state->handle, insn->operands[0].reg), rd);
-      } else {
-         int linked_insn = insn->linked_insn;
-         if (linked_insn >= 0) {
-            if (insn->id == MIPS_INS_LI) {
-               // assume this is LUI converted to LI for matched MTC1
-               fprintf(out, "%-5s ", insn->mnemonic);
-               switch (state->syntax) {
-                  case ASM_GAS:
-                     fprintf(out, "$%s, 0x%04X0000 # %f\n",
-                           cs_reg_name(state->handle, insn->operands[0].reg),
-                           (unsigned int)insn->operands[1].imm,
-                           insn->linked_float);
-                     break;
-                  case ASM_ARMIPS:
-                     fprintf(out, "$%s, 0x%04X0000 // %f\n",
-                           cs_reg_name(state->handle, insn->operands[0].reg),
-                           (unsigned int)insn->operands[1].imm,
-                           insn->linked_float);
-                     break;
-                  // TODO: this is ideal, but it doesn't work exactly for all floats since some emit imprecise float strings
-                  /*
-                     fprintf(out, "$%s, %f // 0x%04X\n",
-                           cs_reg_name(state->handle, insn->operands[0].reg),
-                           insn->linked_float,
-                           (unsigned int)insn->operands[1].imm);
-                     break;
-                   */
-               }
-            } else if (insn->id == MIPS_INS_LUI) {
-               label = labels_find(&state->globals, insn->linked_value);
-               // assume matched LUI with ADDIU/LW/SW etc.
-               switch (state->syntax) {
-                  case ASM_GAS:
-                     switch (block->instructions[linked_insn].id) {
-                        case MIPS_INS_ADDIU:
-                           fprintf(out, "%-5s $%s, %%hi(%s) # %s\n", insn->mnemonic,
-                                 cs_reg_name(state->handle, insn->operands[0].reg),
-                                 state->globals.labels[label].name, insn->op_str);
-                           break;
-                        case MIPS_INS_ORI:
-                           fprintf(out, "%-5s $%s, (0x%08X >> 16) # %s %s\n", insn->mnemonic,
-                                 cs_reg_name(state->handle, insn->operands[0].reg),
-                                 insn->linked_value, insn->mnemonic, insn->op_str);
-                           break;
-                        default: // LW/SW/etc.
-                           fprintf(out, "%-5s $%s, %%hi(%s) # %s\n", insn->mnemonic,
-                                 cs_reg_name(state->handle, insn->operands[0].reg),
-                                 state->globals.labels[label].name, insn->op_str);
-                           break;
-                     }
-                     break;
-                  case ASM_ARMIPS:
-                     switch (block->instructions[linked_insn].id) {
-                        case MIPS_INS_ADDIU:
-                           fprintf(out, "%-5s $%s, %s // %s %s\n", "la.u",
-                                 cs_reg_name(state->handle, insn->operands[0].reg),
-                                 state->globals.labels[label].name,
-                                 insn->mnemonic, insn->op_str);
-                           break;
-                        case MIPS_INS_ORI:
-                           fprintf(out, "%-5s $%s, 0x%08X // %s %s\n", "li.u",
-                                 cs_reg_name(state->handle, insn->operands[0].reg),
-                                 insn->linked_value, insn->mnemonic, insn->op_str);
-                           break;
-                        default: // LW/SW/etc.
-                           fprintf(out, "%-5s $%s, hi(%s) // %s\n", insn->mnemonic,
-                                 cs_reg_name(state->handle, insn->operands[0].reg),
-                                 state->globals.labels[label].name, insn->op_str);
-                           break;
-                     }
-                     break;
-               }
-            } else if (insn->id == MIPS_INS_ADDIU) {
-               label = labels_find(&state->globals, insn->linked_value);
-               switch (state->syntax) {
-                  case ASM_GAS:
-                     fprintf(out, "%-5s $%s, %%lo(%s) # %s %s\n", insn->mnemonic,
-                           cs_reg_name(state->handle, insn->operands[0].reg),
-                           state->globals.labels[label].name,
-                           insn->mnemonic, insn->op_str);
-                     break;
-                  case ASM_ARMIPS:
-                     fprintf(out, "%-5s $%s, %s // %s %s\n", "la.l",
-                           cs_reg_name(state->handle, insn->operands[0].reg),
-                           state->globals.labels[label].name,
-                           insn->mnemonic, insn->op_str);
-                     break;
-               }
-            } else if (insn->id == MIPS_INS_ORI) {
-               switch (state->syntax) {
-                  case ASM_GAS:
-                     fprintf(out, "%-5s $%s, (0x%08X & 0xFFFF) # %s %s\n", insn->mnemonic,
-                           cs_reg_name(state->handle, insn->operands[0].reg),
-                           insn->linked_value,
-                           insn->mnemonic, insn->op_str);
-                     break;
-                  case ASM_ARMIPS:
-                     fprintf(out, "%-5s $%s, 0x%08X // %s %s\n", "li.l",
-                           cs_reg_name(state->handle, insn->operands[0].reg),
-                           insn->linked_value,
-                           insn->mnemonic, insn->op_str);
-                     break;
-               }
-            } else {
-               label = labels_find(&state->globals, insn->linked_value);
-               fprintf(out, "%-5s $%s, %slo(%s)($%s)\n", insn->mnemonic,
-                     cs_reg_name(state->handle, insn->operands[0].reg),
-                     state->syntax == ASM_GAS ? "%" : "",
-                     state->globals.labels[label].name,
-                     cs_reg_name(state->handle, insn->operands[1].reg));
+         put_mnemonic_reg(out, insn->mnemonic, insn->operands[0].reg);
+         strbuf_putc(out, '$');
+         strbuf_dec(out, rd);
+         strbuf_putc(out, '\n');
+      } else if (linked_insn >= 0) {
+         if (insn->id == R4K_INS_LI) {
+            // assume this is LUI converted to LI for matched MTC1
+            float linked_float;
+            memcpy(&linked_float, &block->linked_value[i], sizeof(linked_float));
+            put_mnemonic_reg(out, insn->mnemonic, insn->operands[0].reg);
+            strbuf_append(out, "0x", 2);
+            strbuf_hex(out, (unsigned int)insn->operands[1].imm, 4);
+            strbuf_append(out, "0000", 4);
+            put_comment(out, state->syntax);
+            strbuf_sprintf(out, "%f\n", linked_float);
+            // TODO: this is ideal, but it doesn't work exactly for all floats since some emit imprecise float strings
+            /*
+               fprintf(out, "$%s, %f // 0x%04X\n",
+                     reg_name(insn->operands[0].reg),
+                     linked_float,
+                     (unsigned int)insn->operands[1].imm);
+             */
+         } else if (insn->id == R4K_INS_LUI) {
+            label = labels_find(&state->globals, block->linked_value[i]);
+            // assume matched LUI with ADDIU/LW/SW etc.
+            switch (state->syntax) {
+               case ASM_GAS:
+                  put_mnemonic_reg(out, insn->mnemonic, insn->operands[0].reg);
+                  if (block->ids[linked_insn] == R4K_INS_ORI) {
+                     strbuf_putc(out, '(');
+                     put_hex32(out, block->linked_value[i]);
+                     strbuf_puts(out, " >> 16) # ");
+                     strbuf_puts(out, insn->mnemonic);
+                     strbuf_putc(out, ' ');
+                  } else { // ADDIU/LW/SW/etc.
+                     strbuf_append(out, "%hi(", 4);
+                     strbuf_puts(out, state->globals.labels[label].name);
+                     strbuf_append(out, ") # ", 4);
+                  }
+                  break;
+               case ASM_ARMIPS:
+                  switch (block->ids[linked_insn]) {
+                     case R4K_INS_ADDIU:
+                        put_mnemonic_reg(out, "la.u", insn->operands[0].reg);
+                        strbuf_puts(out, state->globals.labels[label].name);
+                        strbuf_puts(out, " // ");
+                        strbuf_puts(out, insn->mnemonic);
+                        strbuf_putc(out, ' ');
+                        break;
+                     case R4K_INS_ORI:
+                        put_mnemonic_reg(out, "li.u", insn->operands[0].reg);
+                        put_hex32(out, block->linked_value[i]);
+                        strbuf_puts(out, " // ");
+                        strbuf_puts(out, insn->mnemonic);
+                        strbuf_putc(out, ' ');
+                        break;
+                     default: // LW/SW/etc.
+                        put_mnemonic_reg(out, insn->mnemonic, insn->operands[0].reg);
+                        strbuf_append(out, "hi(", 3);
+                        strbuf_puts(out, state->globals.labels[label].name);
+                        strbuf_append(out, ") // ", 5);
+                        break;
+                  }
+                  break;
+            }
+            strbuf_puts(out, insn->op_str);
+            strbuf_putc(out, '\n');
+         } else if (insn->id == R4K_INS_ADDIU) {
+            label = labels_find(&state->globals, block->linked_value[i]);
+            switch (state->syntax) {
+               case ASM_GAS:
+                  put_mnemonic_reg(out, insn->mnemonic, insn->operands[0].reg);
+                  strbuf_append(out, "%lo(", 4);
+                  strbuf_puts(out, state->globals.labels[label].name);
+                  strbuf_append(out, ") # ", 4);
+                  break;
+               case ASM_ARMIPS:
+                  put_mnemonic_reg(out, "la.l", insn->operands[0].reg);
+                  strbuf_puts(out, state->globals.labels[label].name);
+                  strbuf_puts(out, " // ");
+                  break;
             }
+            strbuf_puts(out, insn->mnemonic);
+            strbuf_putc(out, ' ');
+            strbuf_puts(out, insn->op_str);
+            strbuf_putc(out, '\n');
+         } else if (insn->id == R4K_INS_ORI) {
+            switch (state->syntax) {
+               case ASM_GAS:
+                  put_mnemonic_reg(out, insn->mnemonic, insn->operands[0].reg);
+                  strbuf_putc(out, '(');
+                  put_hex32(out, block->linked_value[i]);
+                  strbuf_puts(out, " & 0xFFFF) # ");
+                  break;
+               case ASM_ARMIPS:
+                  put_mnemonic_reg(out, "li.l", insn->operands[0].reg);
+                  put_hex32(out, block->linked_value[i]);
+                  strbuf_puts(out, " // ");
+                  break;
+            }
+            strbuf_puts(out, insn->mnemonic);
+            strbuf_putc(out, ' ');
+            strbuf_puts(out, insn->op_str);
+            strbuf_putc(out, '\n');
          } else {
-            fprintf(out, "%-5s %s\n", insn->mnemonic, insn->op_str);
+            label = labels_find(&state->globals, block->linked_value[i]);
+            put_mnemonic_reg(out, insn->mnemonic, insn->operands[0].reg);
+            if (state->syntax == ASM_GAS) {
+               strbuf_putc(out, '%');
+            }
+            strbuf_append(out, "lo(", 3);
+            strbuf_puts(out, state->globals.labels[label].name);
+            strbuf_append(out, ")($", 3);
+            strbuf_puts(out, reg_name(insn->operands[1].mem.base));
+            strbuf_append(out, ")\n", 2);
          }
+      } else {
+         strbuf_puts_pad(out, insn->mnemonic, 5);
+         strbuf_putc(out, ' ');
+         strbuf_puts(out, insn->op_str);
+         strbuf_putc(out, '\n');
       }
       vaddr += 4;
       offset += 4;
    }
 }
 
+void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset)
+{
+   strbuf buf;
+   strbuf_alloc(&buf, 0);
+   mipsdisasm_pass2_buf(&buf, state, offset);
+   strbuf_write(&buf, out);
+   strbuf_free(&buf);
+}
+
 const char *disasm_get_version(void)
 {
-   static char version[32];
+#ifdef MIPSDISASM_CAPSTONE
+   static char version[64];
    int major, minor;
    (void)cs_version(&major, &minor);
-   // TODO: manually keeping track of capstone revision number
-   sprintf(version, "capstone %d.%d.4", major, minor);
+   sprintf(version, "native R4300i (checked with capstone %d.%d)", major, minor);
    return version;
+#else
+   return "native R4300i";
+#endif
 }
 
 #ifdef MIPSDISASM_STANDALONE
@@ -668,6 +2288,7 @@ typedef struct
    char *output_file;
    int merge_pseudo;
    asm_syntax syntax;
+   int threads;
 } arg_config;
 
 static arg_config default_args =
@@ -679,15 +2300,17 @@ static arg_config default_args =
    NULL, // output_file
    0,    // merge_pseudo
    ASM_GAS, // GNU as
+   1,    // threads
 };
 
 static void print_usage(void)
 {
-   ERROR("Usage: mipsdisasm [-o OUTPUT] [-p] [-s ASSEMBLER] [-v] ROM [RANGES]\n"
+   ERROR("Usage: mipsdisasm [-j N] [-o OUTPUT] [-p] [-s ASSEMBLER] [-v] ROM [RANGES]\n"
          "\n"
          "mipsdisasm v" MIPSDISASM_VERSION ": MIPS disassembler\n"
          "\n"
          "Optional arguments:\n"
+         " -j N         number of threads to disassemble ranges with, 0 for all processors (default: 1)\n"
          " -o OUTPUT    output filename (default: stdout)\n"
          " -p           emit pseudoinstructions for related instructions\n"
          " -s SYNTAX    assembler syntax to use [gas, armips] (default: gas)\n"
@@ -730,6 +2353,15 @@ static void parse_arguments(int argc, char *argv[], arg_config *config)
    for (int i = 1; i < argc; i++) {
       if (argv[i][0] == '-') {
          switch (argv[i][1]) {
+            case 'j':
+               if (++i >= argc) {
+                  print_usage();
+               }
+               config->threads = strtoul(argv[i], NULL, 0);
+               if (config->threads <= 0) {
+                  config->threads = parallel_cpu_count();
+               }
+               break;
             case 'o':
                if (++i >= argc) {
                   print_usage();
@@ -842,13 +2474,18 @@ int main(int argc, char *argv[])
 
    state = disasm_state_init(args.syntax, args.merge_pseudo);
 
-   // run first pass disassembler on each section
+   // run first pass disassembler on all sections
+   disasm_range *ranges = malloc(args.range_count * sizeof(*ranges));
    for (int i = 0; i < args.range_count; i++) {
       range *r = &args.ranges[i];
       INFO("Disassembling range 0x%X-0x%X at 0x%08X\n", r->start, r->start + r->length, r->vaddr);
-
-      (void)mipsdisasm_pass1(data, r->start, r->length, r->vaddr, state);
+      ranges[i].offset = r->start;
+      ranges[i].length = r->length;
+      ranges[i].vaddr = r->vaddr;
    }
+   mipsdisasm_pass1_parallel(data, ranges, args.range_count, args.threads, state);
+   free(ranges);
+   INFO("Found %d functions\n", disasm_function_count(state));
 
    // output global labels not in asm sections
    if (args.syntax == ASM_ARMIPS) {
@@ -1,6 +1,8 @@
 #ifndef MIPSDISASM_H_
 #define MIPSDISASM_H_
 
+#include "strutils.h"
+
 // typedefs
 typedef struct _disasm_state disasm_state;
 
@@ -10,6 +12,45 @@ typedef enum
    ASM_ARMIPS, // armips
 } asm_syntax;
 
+// region of code to disassemble in first pass
+typedef struct
+{
+   unsigned int offset; // buffer offset to start at
+   unsigned int length; // length to disassemble starting at 'offset'
+   unsigned int vaddr;  // virtual address of first byte
+} disasm_range;
+
+// basic block found by control flow analysis in pass 1
+typedef struct
+{
+   unsigned int vaddr;  // address of first instruction
+   unsigned int length; // length in bytes
+   int succ[2];         // successor basic blocks within the function, -1 for none
+   int jump_table;      // index in function's jump_tables the block dispatches through, -1 for none
+   int external;        // entered from outside the function by a call or a branch
+} disasm_bblock;
+
+// jump table dispatched through a JR
+typedef struct
+{
+   unsigned int jr_vaddr;       // address of the JR
+   unsigned int table_vaddr;    // address of the table
+   int count;                   // number of entries, 0 if the table is not in this or an earlier range
+   const unsigned int *targets; // entry addresses, all within the function
+} disasm_jump_table;
+
+// function found by control flow analysis in pass 1
+typedef struct
+{
+   unsigned int vaddr;                   // entry point
+   unsigned int length;                  // length in bytes, including trailing alignment nops
+   unsigned int tail_call;               // target if the function ends jumping to another function, 0 otherwise
+   const disasm_bblock *bblocks;         // basic blocks in address order, bblocks[0] is the entry
+   int bblock_count;
+   const disasm_jump_table *jump_tables; // jump tables in address order
+   int jump_table_count;
+} disasm_function;
+
 // allocate and initialize disassembler state to be passed into disassembler routines
 // syntax: assembler syntax to use
 // merge_pseudo: if true, attempt to link pseudo instructions
@@ -33,6 +74,22 @@ void disasm_label_add(disasm_state *state, const char *name, unsigned int vaddr)
 // returns 1 if found, 0 otherwise
 int disasm_label_lookup(const disasm_state *state, unsigned int vaddr, char *name);
 
+// number of functions found in pass 1 over all ranges
+// state: disassembler state from pass1
+int disasm_function_count(const disasm_state *state);
+
+// get a function found in pass 1
+// state: disassembler state from pass1
+// index: function index, functions are ordered by range then address
+// returns function, NULL if index is out of range
+const disasm_function *disasm_function_get(const disasm_state *state, int index);
+
+// find the function containing an address
+// state: disassembler state from pass1
+// vaddr: virtual address to look up
+// returns function, NULL if vaddr is not within a disassembled range
+const disasm_function *disasm_function_lookup(const disasm_state *state, unsigned int vaddr);
+
 // first pass of disassembler - collects procedures called and sorts them
 // data: buffer containing raw MIPS assembly
 // offset: buffer offset to start at
@@ -42,12 +99,28 @@ int disasm_label_lookup(const disasm_state *state, unsigned int vaddr, char *nam
 // state: disassembler state. if NULL, is allocated, returned at end
 void mipsdisasm_pass1(unsigned char *data, unsigned int offset, unsigned int length, unsigned int vaddr, disasm_state *state);
 
+// first pass of disassembler over several ranges at once, each decoded on its own thread
+// generated labels and pass2 output are identical to calling mipsdisasm_pass1() on each range in order
+// data: buffer containing raw MIPS assembly
+// ranges: regions of code to disassemble
+// count: number of ranges
+// threads: number of worker threads, <= 1 disassembles on the calling thread
+// state: disassembler state from disasm_state_init()
+void mipsdisasm_pass1_parallel(unsigned char *data, const disasm_range *ranges, int count, int threads, disasm_state *state);
+
 // disassemble a region of code, output to file stream
 // out: stream to output data to
 // state: disassembler state from pass1
 // offset: starting offset to match in disassembler state
 void mipsdisasm_pass2(FILE *out, disasm_state *state, unsigned int offset);
 
+// disassemble a region of code, appending to a string buffer
+// state is only read, so separate buffers can be filled from different threads
+// out: buffer to append to
+// state: disassembler state from pass1
+// offset: starting offset to match in disassembler state
+void mipsdisasm_pass2_buf(strbuf *out, disasm_state *state, unsigned int offset);
+
 // get version string of raw disassembler
 const char *disasm_get_version(void);
 
@@ -1,34 +1,222 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+#include "libcksum.h"
 #include "libsm64.h"
+#include "parallel.h"
 #include "utils.h"
 
 #define N64CKSUM_VERSION "0.1"
 
 static void print_usage(void)
 {
-   ERROR("Usage: n64cksum ROM [ROM_OUT]\n"
+   ERROR("Usage: n64cksum [-b] ROM [ROM_OUT]\n"
+         "       n64cksum --batch [-j N] ROM [ROM ...]\n"
          "\n"
          "n64cksum v" N64CKSUM_VERSION ": N64 ROM checksum calculator\n"
          "\n"
+         "Optional arguments:\n"
+         " -b           benchmark checksum engine against reference implementation\n"
+         " --batch      verify header checksums of all ROMs without modifying them\n"
+         " -j N         number of threads for --batch (default: 0 = all CPUs)\n"
+         "\n"
          "File arguments:\n"
          " ROM          input ROM file\n"
          " ROM_OUT      output ROM file (default: overwrites input ROM)\n");
 }
 
+typedef void (*cksum_fn)(const unsigned char *buf, unsigned int cksum[]);
+
+// best time in ms of several rounds of checksumming 'buf'
+static double benchmark_cksum(cksum_fn calc, const unsigned char *buf, unsigned int cksum[])
+{
+#define BENCH_ROUNDS 10
+#define BENCH_RUNS 20
+   double best = 0;
+   for (int r = 0; r < BENCH_ROUNDS; r++) {
+      clock_t start = clock();
+      double ms;
+      for (int i = 0; i < BENCH_RUNS; i++) {
+         calc(buf, cksum);
+      }
+      ms = 1000.0 * (clock() - start) / CLOCKS_PER_SEC / BENCH_RUNS;
+      if (r == 0 || ms < best) {
+         best = ms;
+      }
+   }
+   return best;
+}
+
+static int n64cksum_benchmark(const char *file_in)
+{
+   rom_file in;
+   unsigned int ref[2];
+   unsigned int calc[2];
+   double ms_ref, ms_calc;
+   long length;
+
+   length = rom_map(&in, file_in, ROM_READ);
+   if (length < CKSUM_START + CKSUM_LENGTH) {
+      ERROR("Error reading input file \"%s\"\n", file_in);
+      if (length >= 0) {
+         rom_unmap(&in);
+      }
+      return EXIT_FAILURE;
+   }
+   ms_ref = benchmark_cksum(n64_calc_checksums_ref, in.data, ref);
+   ms_calc = benchmark_cksum(n64_calc_checksums, in.data, calc);
+   printf("reference: %08X %08X %8.3f ms\n", ref[0], ref[1], ms_ref);
+   printf("%-9s: %08X %08X %8.3f ms (%.2fx)\n", n64_cksum_engine(), calc[0], calc[1], ms_calc, ms_ref / ms_calc);
+   rom_unmap(&in);
+   if (ref[0] != calc[0] || ref[1] != calc[1]) {
+      ERROR("Checksum MISMATCH\n");
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
+
+typedef enum
+{
+   BATCH_PASS,
+   BATCH_FAIL,
+   BATCH_ERR_READ,
+   BATCH_ERR_SIZE,
+   BATCH_ERR_CIC,
+} batch_status;
+
+typedef struct
+{
+   const char *file;
+   cic_type cic;
+   unsigned int header[2];
+   unsigned int calc[2];
+   batch_status status;
+} batch_job;
+
+// verify one ROM of a batch, called from parallel_for
+static void verify_rom(void *ctx, int index)
+{
+   const unsigned char bs[] = {0x37, 0x80, 0x40, 0x12}; // byte-swapped
+   const unsigned char le[] = {0x40, 0x12, 0x37, 0x80}; // little-endian
+   batch_job *job = &((batch_job *)ctx)[index];
+   rom_file rom;
+   long length;
+
+   length = rom_map(&rom, job->file, ROM_READ);
+   if (length < 0) {
+      job->status = BATCH_ERR_READ;
+      return;
+   }
+   if (length < CKSUM_START + CKSUM_LENGTH) {
+      job->status = BATCH_ERR_SIZE;
+      rom_unmap(&rom);
+      return;
+   }
+   // mapping is private, so the checksummed region can be normalized in place
+   if (!memcmp(rom.data, bs, sizeof(bs))) {
+      swap_bytes(rom.data, CKSUM_START + CKSUM_LENGTH);
+   } else if (!memcmp(rom.data, le, sizeof(le))) {
+      reverse_endian(rom.data, CKSUM_START + CKSUM_LENGTH);
+   }
+
+   job->cic = n64_detect_cic(rom.data);
+   job->header[0] = read_u32_be(&rom.data[0x10]);
+   job->header[1] = read_u32_be(&rom.data[0x14]);
+   if (n64_calc_checksums_cic(rom.data, job->cic, job->calc) < 0) {
+      job->status = BATCH_ERR_CIC;
+   } else if (job->calc[0] == job->header[0] && job->calc[1] == job->header[1]) {
+      job->status = BATCH_PASS;
+   } else {
+      job->status = BATCH_FAIL;
+   }
+   rom_unmap(&rom);
+}
+
+static int n64cksum_batch(int argc, char *argv[])
+{
+   batch_job *jobs;
+   int threads = 0;
+   int count = 0;
+   int failed = 0;
+
+   // -j may appear anywhere among the ROM files
+   jobs = calloc(argc > 0 ? argc : 1, sizeof(*jobs));
+   for (int i = 0; i < argc; i++) {
+      if (!strcmp(argv[i], "-j")) {
+         if (++i >= argc) {
+            count = 0;
+            break;
+         }
+         threads = strtol(argv[i], NULL, 0);
+      } else {
+         jobs[count++].file = argv[i];
+      }
+   }
+   if (count < 1) {
+      free(jobs);
+      print_usage();
+      return EXIT_FAILURE;
+   }
+   if (threads <= 0) {
+      threads = parallel_cpu_count();
+   }
+
+   parallel_for(count, threads, verify_rom, jobs);
+
+   printf("%-40s %-13s %-10s %-10s %s\n", "ROM", "BootChip", "CRC1", "CRC2", "Result");
+   for (int i = 0; i < count; i++) {
+      batch_job *job = &jobs[i];
+      switch (job->status) {
+         case BATCH_ERR_READ:
+            printf("%-40s %-13s %-10s %-10s %s\n", job->file, "-", "-", "-", "READ ERROR");
+            break;
+         case BATCH_ERR_SIZE:
+            printf("%-40s %-13s %-10s %-10s %s\n", job->file, "-", "-", "-", "TOO SMALL");
+            break;
+         case BATCH_ERR_CIC:
+            printf("%-40s %-13s %-10s %-10s %s\n", job->file, "unknown", "-", "-", "UNKNOWN CIC");
+            break;
+         case BATCH_PASS:
+         case BATCH_FAIL:
+            printf("%-40s CIC-NUS-%-5d 0x%08X 0x%08X %s\n", job->file, job->cic,
+                   job->calc[0], job->calc[1], job->status == BATCH_PASS ? "PASS" : "FAIL");
+            break;
+      }
+      if (job->status != BATCH_PASS) {
+         failed++;
+      }
+   }
+   printf("%d/%d passed\n", count - failed, count);
+
+   free(jobs);
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
-   unsigned char *rom_data;
+   rom_file in;
+   rom_file out;
    char *file_in;
    char *file_out;
    long length;
-   long write_length;
    if (argc < 2) {
       print_usage();
       return EXIT_FAILURE;
    }
 
+   if (!strcmp(argv[1], "-b")) {
+      if (argc < 3) {
+         print_usage();
+         return EXIT_FAILURE;
+      }
+      return n64cksum_benchmark(argv[2]);
+   }
+   if (!strcmp(argv[1], "--batch")) {
+      return n64cksum_batch(argc - 2, &argv[2]);
+   }
+
    file_in = argv[1];
    if (argc > 2) {
       file_out = argv[2];
@@ -36,21 +224,36 @@ int main(int argc, char *argv[])
       file_out = argv[1];
    }
 
-   length = read_file(file_in, &rom_data);
+   // in place updates only touch the header, other outputs copy the input once
+   if (file_out == file_in) {
+      length = rom_map(&in, file_in, ROM_UPDATE);
+   } else {
+      length = rom_map(&in, file_in, ROM_READ);
+   }
    if (length < 0) {
       ERROR("Error reading input file \"%s\"\n", file_in);
       return EXIT_FAILURE;
    }
 
-   sm64_update_checksums(rom_data);
-
-   write_length = write_file(file_out, rom_data, length);
-
-   free(rom_data);
-
-   if (write_length != length) {
-      ERROR("Error writing to output file \"%s\"\n", file_out);
-      return EXIT_FAILURE;
+   if (file_out == file_in) {
+      sm64_update_checksums(in.data);
+      if (rom_unmap(&in) != 0) {
+         ERROR("Error writing to output file \"%s\"\n", file_out);
+         return EXIT_FAILURE;
+      }
+   } else {
+      if (rom_create(&out, file_out, length) < 0) {
+         rom_unmap(&in);
+         ERROR("Error writing to output file \"%s\"\n", file_out);
+         return EXIT_FAILURE;
+      }
+      memcpy(out.data, in.data, length);
+      rom_unmap(&in);
+      sm64_update_checksums(out.data);
+      if (rom_unmap(&out) != 0) {
+         ERROR("Error writing to output file \"%s\"\n", file_out);
+         return EXIT_FAILURE;
+      }
    }
 
    return EXIT_SUCCESS;
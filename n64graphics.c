@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
 #define STBI_NO_LINEAR
@@ -7,12 +8,26 @@
 #define STBI_NO_TGA
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
+
+#ifdef N64GRAPHICS_ZLIB
+// compress PNG image data with zlib instead of stb_image_write's built-in deflate
+#include <zlib.h>
+static unsigned char *zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+#define STBIW_ZLIB_COMPRESS zlib_compress
+#endif
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
 
 #include "n64graphics.h"
+#include "parallel.h"
 #include "utils.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define N64GRAPHICS_X86 1
+  #include <immintrin.h>
+#endif
+
 // SCALE_M_N: upscale/downscale M-bit integer to N-bit
 #define SCALE_5_8(VAL_) (((VAL_) * 0xFF) / 0x1F)
 #define SCALE_8_5(VAL_) ((((VAL_) + 4) * 0x1F) / 0xFF)
@@ -21,6 +36,9 @@
 #define SCALE_3_8(VAL_) ((VAL_) * 0x24)
 #define SCALE_8_3(VAL_) ((VAL_) / 0x24)
 
+// the SIMD kernels use multiply-shift forms of the divisions, exact over their input ranges:
+// SCALE_5_8(v) == (v * 1053) >> 7, SCALE_8_5(v) == (v * 249 + 989) >> 11, SCALE_8_4(v) == ((v + 1) * 15) >> 8
+
 
 typedef struct
 {
@@ -34,6 +52,355 @@ typedef struct
     int depth;
 } img_format;
 
+//---------------------------------------------------------
+// conversion kernels
+//---------------------------------------------------------
+
+// LUTn(F_, N_): F_(N_), F_(N_ + 1), ... F_(N_ + n - 1) for building constant tables
+#define LUT4(F_, N_)   F_(N_), F_((N_) + 1), F_((N_) + 2), F_((N_) + 3)
+#define LUT16(F_, N_)  LUT4(F_, N_), LUT4(F_, (N_) + 4), LUT4(F_, (N_) + 8), LUT4(F_, (N_) + 12)
+#define LUT64(F_, N_)  LUT16(F_, N_), LUT16(F_, (N_) + 16), LUT16(F_, (N_) + 32), LUT16(F_, (N_) + 48)
+#define LUT256(F_, N_) LUT64(F_, N_), LUT64(F_, (N_) + 64), LUT64(F_, (N_) + 128), LUT64(F_, (N_) + 192)
+
+// per-pixel scaling as table lookups instead of divisions
+static const uint8_t scale_5_8[32] = { LUT16(SCALE_5_8, 0), LUT16(SCALE_5_8, 16) };
+static const uint8_t scale_8_5[256] = { LUT256(SCALE_8_5, 0) };
+static const uint8_t scale_8_4[256] = { LUT256(SCALE_8_4, 0) };
+static const uint8_t scale_8_3[256] = { LUT256(SCALE_8_3, 0) };
+
+// one raw byte -> one IA8 pixel, or two IA4/I4 pixels with the high nibble first
+#define IA8_PIXEL(N_) {SCALE_4_8((N_) >> 4), SCALE_4_8((N_) & 0xF)}
+#define IA4_PIXEL(N_) {SCALE_3_8(((N_) >> 1) & 0x7), ((N_) & 0x1) ? 0xFF : 0x00}
+#define IA4_PAIR(N_)  {IA4_PIXEL((N_) >> 4), IA4_PIXEL((N_) & 0xF)}
+#define I4_PAIR(N_)   {{SCALE_4_8((N_) >> 4), 0xFF}, {SCALE_4_8((N_) & 0xF), 0xFF}}
+static const ia ia8_lut[256] = { LUT256(IA8_PIXEL, 0) };
+static const ia ia4_lut[256][2] = { LUT256(IA4_PAIR, 0) };
+static const ia i4_lut[256][2] = { LUT256(I4_PAIR, 0) };
+
+// the formats with arithmetic per pixel, each converting 'count' pixels
+// SIMD variants convert whole vectors and leave the tail to the scalar ones
+typedef struct
+{
+   const char *name;
+   void (*rgba16_to_rgba)(rgba *img, const uint8_t *raw, int count);
+   void (*rgba_to_rgba16)(uint8_t *raw, const rgba *img, int count);
+   void (*ia8_to_ia)(ia *img, const uint8_t *raw, int count);
+   void (*ia_to_ia8)(uint8_t *raw, const ia *img, int count);
+   void (*i4_to_ia)(ia *img, const uint8_t *raw, int count);
+   void (*ia_to_i4)(uint8_t *raw, const ia *img, int count);
+} convert_kernels;
+
+static void rgba16_to_rgba_scalar(rgba *img, const uint8_t *raw, int count)
+{
+   for (int i = 0; i < count; i++) {
+      unsigned int val = (raw[i*2] << 8) | raw[i*2+1];
+      img[i].red   = scale_5_8[val >> 11];
+      img[i].green = scale_5_8[(val >> 6) & 0x1F];
+      img[i].blue  = scale_5_8[(val >> 1) & 0x1F];
+      img[i].alpha = (val & 0x01) ? 0xFF : 0x00;
+   }
+}
+
+static void rgba_to_rgba16_scalar(uint8_t *raw, const rgba *img, int count)
+{
+   for (int i = 0; i < count; i++) {
+      unsigned int val = (scale_8_5[img[i].red] << 11) | (scale_8_5[img[i].green] << 6)
+                       | (scale_8_5[img[i].blue] << 1) | (img[i].alpha ? 0x1 : 0x0);
+      raw[i*2]   = val >> 8;
+      raw[i*2+1] = val & 0xFF;
+   }
+}
+
+static void ia8_to_ia_scalar(ia *img, const uint8_t *raw, int count)
+{
+   for (int i = 0; i < count; i++) {
+      img[i] = ia8_lut[raw[i]];
+   }
+}
+
+static void ia_to_ia8_scalar(uint8_t *raw, const ia *img, int count)
+{
+   for (int i = 0; i < count; i++) {
+      raw[i] = (scale_8_4[img[i].intensity] << 4) | scale_8_4[img[i].alpha];
+   }
+}
+
+static void i4_to_ia_scalar(ia *img, const uint8_t *raw, int count)
+{
+   int i;
+   for (i = 0; i + 1 < count; i += 2) {
+      img[i]   = i4_lut[raw[i/2]][0];
+      img[i+1] = i4_lut[raw[i/2]][1];
+   }
+   if (i < count) {
+      img[i] = i4_lut[raw[i/2]][0];
+   }
+}
+
+// odd trailing pixel only replaces the high nibble of the last byte
+static void ia_to_i4_scalar(uint8_t *raw, const ia *img, int count)
+{
+   int i;
+   for (i = 0; i + 1 < count; i += 2) {
+      raw[i/2] = (scale_8_4[img[i].intensity] << 4) | scale_8_4[img[i+1].intensity];
+   }
+   if (i < count) {
+      raw[i/2] = (raw[i/2] & 0x0F) | (scale_8_4[img[i].intensity] << 4);
+   }
+}
+
+static const convert_kernels kernels_scalar =
+{
+   "scalar",
+   rgba16_to_rgba_scalar,
+   rgba_to_rgba16_scalar,
+   ia8_to_ia_scalar,
+   ia_to_ia8_scalar,
+   i4_to_ia_scalar,
+   ia_to_i4_scalar,
+};
+
+#ifdef N64GRAPHICS_X86
+// 8 RGBA16 pixels: byte swap, split the 5-bit fields into 16-bit lanes and scale them up
+__attribute__((target("sse2")))
+static void rgba16_to_rgba_sse2(rgba *img, const uint8_t *raw, int count)
+{
+   const __m128i mask5 = _mm_set1_epi16(0x1F);
+   const __m128i one = _mm_set1_epi16(0x1);
+   const __m128i mul = _mm_set1_epi16(1053);
+   int i;
+   for (i = 0; i + 8 <= count; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)&raw[i*2]);
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      __m128i r = _mm_srli_epi16(v, 11);
+      __m128i g = _mm_and_si128(_mm_srli_epi16(v, 6), mask5);
+      __m128i b = _mm_and_si128(_mm_srli_epi16(v, 1), mask5);
+      __m128i a = _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(v, one));
+      r = _mm_srli_epi16(_mm_mullo_epi16(r, mul), 7);
+      g = _mm_srli_epi16(_mm_mullo_epi16(g, mul), 7);
+      b = _mm_srli_epi16(_mm_mullo_epi16(b, mul), 7);
+      __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+      __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+      _mm_storeu_si128((__m128i *)&img[i],   _mm_unpacklo_epi16(rg, ba));
+      _mm_storeu_si128((__m128i *)&img[i+4], _mm_unpackhi_epi16(rg, ba));
+   }
+   rgba16_to_rgba_scalar(&img[i], &raw[i*2], count - i);
+}
+
+// 8 RGBA pixels: narrow each channel to 16-bit lanes, scale down and pack big-endian
+__attribute__((target("sse2")))
+static void rgba_to_rgba16_sse2(uint8_t *raw, const rgba *img, int count)
+{
+   const __m128i mask8 = _mm_set1_epi32(0xFF);
+   const __m128i one = _mm_set1_epi16(0x1);
+   const __m128i mul = _mm_set1_epi16(249);
+   const __m128i bias = _mm_set1_epi16(989);
+   int i;
+   for (i = 0; i + 8 <= count; i += 8) {
+      __m128i p0 = _mm_loadu_si128((const __m128i *)&img[i]);
+      __m128i p1 = _mm_loadu_si128((const __m128i *)&img[i+4]);
+      __m128i r = _mm_packs_epi32(_mm_and_si128(p0, mask8), _mm_and_si128(p1, mask8));
+      __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask8), _mm_and_si128(_mm_srli_epi32(p1, 8), mask8));
+      __m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask8), _mm_and_si128(_mm_srli_epi32(p1, 16), mask8));
+      __m128i a = _mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+      r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(r, mul), bias), 11);
+      g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, mul), bias), 11);
+      b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(b, mul), bias), 11);
+      a = _mm_andnot_si128(_mm_cmpeq_epi16(a, _mm_setzero_si128()), one);
+      __m128i v = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 6)),
+                               _mm_or_si128(_mm_slli_epi16(b, 1), a));
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      _mm_storeu_si128((__m128i *)&raw[i*2], v);
+   }
+   rgba_to_rgba16_scalar(&raw[i*2], &img[i], count - i);
+}
+
+// 16 IA8 pixels: nibble * 0x11 is the nibble copied into both halves of the byte
+__attribute__((target("sse2")))
+static void ia8_to_ia_sse2(ia *img, const uint8_t *raw, int count)
+{
+   const __m128i lo = _mm_set1_epi8(0x0F);
+   const __m128i hi = _mm_set1_epi8((char)0xF0);
+   int i;
+   for (i = 0; i + 16 <= count; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)&raw[i]);
+      __m128i in = _mm_or_si128(_mm_and_si128(v, hi), _mm_and_si128(_mm_srli_epi16(v, 4), lo));
+      __m128i al = _mm_or_si128(_mm_and_si128(v, lo), _mm_and_si128(_mm_slli_epi16(v, 4), hi));
+      _mm_storeu_si128((__m128i *)&img[i],   _mm_unpacklo_epi8(in, al));
+      _mm_storeu_si128((__m128i *)&img[i+8], _mm_unpackhi_epi8(in, al));
+   }
+   ia8_to_ia_scalar(&img[i], &raw[i], count - i);
+}
+
+__attribute__((target("sse2")))
+static void ia_to_ia8_sse2(uint8_t *raw, const ia *img, int count)
+{
+   const __m128i mask8 = _mm_set1_epi16(0xFF);
+   const __m128i one = _mm_set1_epi16(0x1);
+   const __m128i mul = _mm_set1_epi16(15);
+   int i;
+   for (i = 0; i + 16 <= count; i += 16) {
+      __m128i out[2];
+      for (int k = 0; k < 2; k++) {
+         __m128i v = _mm_loadu_si128((const __m128i *)&img[i + 8*k]);
+         __m128i in = _mm_and_si128(v, mask8);
+         __m128i al = _mm_srli_epi16(v, 8);
+         in = _mm_srli_epi16(_mm_mullo_epi16(_mm_add_epi16(in, one), mul), 8);
+         al = _mm_srli_epi16(_mm_mullo_epi16(_mm_add_epi16(al, one), mul), 8);
+         out[k] = _mm_or_si128(_mm_slli_epi16(in, 4), al);
+      }
+      _mm_storeu_si128((__m128i *)&raw[i], _mm_packus_epi16(out[0], out[1]));
+   }
+   ia_to_ia8_scalar(&raw[i], &img[i], count - i);
+}
+
+// 32 I4 pixels from 16 bytes: expand both nibbles, interleave them, then add opaque alpha
+__attribute__((target("sse2")))
+static void i4_to_ia_sse2(ia *img, const uint8_t *raw, int count)
+{
+   const __m128i lo = _mm_set1_epi8(0x0F);
+   const __m128i hi = _mm_set1_epi8((char)0xF0);
+   const __m128i opaque = _mm_set1_epi8((char)0xFF);
+   int i;
+   for (i = 0; i + 32 <= count; i += 32) {
+      __m128i v = _mm_loadu_si128((const __m128i *)&raw[i/2]);
+      __m128i in_hi = _mm_or_si128(_mm_and_si128(v, hi), _mm_and_si128(_mm_srli_epi16(v, 4), lo));
+      __m128i in_lo = _mm_or_si128(_mm_and_si128(v, lo), _mm_and_si128(_mm_slli_epi16(v, 4), hi));
+      __m128i in0 = _mm_unpacklo_epi8(in_hi, in_lo);
+      __m128i in1 = _mm_unpackhi_epi8(in_hi, in_lo);
+      _mm_storeu_si128((__m128i *)&img[i],    _mm_unpacklo_epi8(in0, opaque));
+      _mm_storeu_si128((__m128i *)&img[i+8],  _mm_unpackhi_epi8(in0, opaque));
+      _mm_storeu_si128((__m128i *)&img[i+16], _mm_unpacklo_epi8(in1, opaque));
+      _mm_storeu_si128((__m128i *)&img[i+24], _mm_unpackhi_epi8(in1, opaque));
+   }
+   i4_to_ia_scalar(&img[i], &raw[i/2], count - i);
+}
+
+// 32 I4 pixels: scale intensities down to nibbles, then merge adjacent nibble pairs
+__attribute__((target("sse2")))
+static void ia_to_i4_sse2(uint8_t *raw, const ia *img, int count)
+{
+   const __m128i mask8 = _mm_set1_epi16(0xFF);
+   const __m128i one = _mm_set1_epi16(0x1);
+   const __m128i mul = _mm_set1_epi16(15);
+   int i;
+   for (i = 0; i + 32 <= count; i += 32) {
+      __m128i nib[4];
+      __m128i out[2];
+      for (int k = 0; k < 4; k++) {
+         __m128i in = _mm_and_si128(_mm_loadu_si128((const __m128i *)&img[i + 8*k]), mask8);
+         nib[k] = _mm_srli_epi16(_mm_mullo_epi16(_mm_add_epi16(in, one), mul), 8);
+      }
+      for (int k = 0; k < 2; k++) {
+         __m128i pairs = _mm_packus_epi16(nib[2*k], nib[2*k+1]);
+         out[k] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(pairs, mask8), 4), _mm_srli_epi16(pairs, 8));
+      }
+      _mm_storeu_si128((__m128i *)&raw[i/2], _mm_packus_epi16(out[0], out[1]));
+   }
+   ia_to_i4_scalar(&raw[i/2], &img[i], count - i);
+}
+
+// 16 RGBA16 pixels per iteration, same steps as the SSE2 version
+// unpacking works within 128-bit lanes, so the halves are put back in order before storing
+__attribute__((target("avx2")))
+static void rgba16_to_rgba_avx2(rgba *img, const uint8_t *raw, int count)
+{
+   const __m256i mask5 = _mm256_set1_epi16(0x1F);
+   const __m256i one = _mm256_set1_epi16(0x1);
+   const __m256i mul = _mm256_set1_epi16(1053);
+   int i;
+   for (i = 0; i + 16 <= count; i += 16) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)&raw[i*2]);
+      v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+      __m256i r = _mm256_srli_epi16(v, 11);
+      __m256i g = _mm256_and_si256(_mm256_srli_epi16(v, 6), mask5);
+      __m256i b = _mm256_and_si256(_mm256_srli_epi16(v, 1), mask5);
+      __m256i a = _mm256_sub_epi16(_mm256_setzero_si256(), _mm256_and_si256(v, one));
+      r = _mm256_srli_epi16(_mm256_mullo_epi16(r, mul), 7);
+      g = _mm256_srli_epi16(_mm256_mullo_epi16(g, mul), 7);
+      b = _mm256_srli_epi16(_mm256_mullo_epi16(b, mul), 7);
+      __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+      __m256i ba = _mm256_or_si256(b, _mm256_slli_epi16(a, 8));
+      __m256i p0 = _mm256_unpacklo_epi16(rg, ba);
+      __m256i p1 = _mm256_unpackhi_epi16(rg, ba);
+      _mm256_storeu_si256((__m256i *)&img[i],   _mm256_permute2x128_si256(p0, p1, 0x20));
+      _mm256_storeu_si256((__m256i *)&img[i+8], _mm256_permute2x128_si256(p0, p1, 0x31));
+   }
+   rgba16_to_rgba_scalar(&img[i], &raw[i*2], count - i);
+}
+
+__attribute__((target("avx2")))
+static void rgba_to_rgba16_avx2(uint8_t *raw, const rgba *img, int count)
+{
+   const __m256i mask8 = _mm256_set1_epi32(0xFF);
+   const __m256i one = _mm256_set1_epi16(0x1);
+   const __m256i mul = _mm256_set1_epi16(249);
+   const __m256i bias = _mm256_set1_epi16(989);
+   int i;
+   for (i = 0; i + 16 <= count; i += 16) {
+      __m256i p0 = _mm256_loadu_si256((const __m256i *)&img[i]);
+      __m256i p1 = _mm256_loadu_si256((const __m256i *)&img[i+8]);
+      __m256i r = _mm256_packs_epi32(_mm256_and_si256(p0, mask8), _mm256_and_si256(p1, mask8));
+      __m256i g = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 8), mask8), _mm256_and_si256(_mm256_srli_epi32(p1, 8), mask8));
+      __m256i b = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 16), mask8), _mm256_and_si256(_mm256_srli_epi32(p1, 16), mask8));
+      __m256i a = _mm256_packs_epi32(_mm256_srli_epi32(p0, 24), _mm256_srli_epi32(p1, 24));
+      r = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, mul), bias), 11);
+      g = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(g, mul), bias), 11);
+      b = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(b, mul), bias), 11);
+      a = _mm256_andnot_si256(_mm256_cmpeq_epi16(a, _mm256_setzero_si256()), one);
+      __m256i v = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(r, 11), _mm256_slli_epi16(g, 6)),
+                                  _mm256_or_si256(_mm256_slli_epi16(b, 1), a));
+      v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+      // packs interleaved the two sources per 128-bit lane: pixels 0-3, 8-11, 4-7, 12-15
+      _mm256_storeu_si256((__m256i *)&raw[i*2], _mm256_permute4x64_epi64(v, 0xD8));
+   }
+   rgba_to_rgba16_scalar(&raw[i*2], &img[i], count - i);
+}
+
+static const convert_kernels kernels_sse2 =
+{
+   "sse2",
+   rgba16_to_rgba_sse2,
+   rgba_to_rgba16_sse2,
+   ia8_to_ia_sse2,
+   ia_to_ia8_sse2,
+   i4_to_ia_sse2,
+   ia_to_i4_sse2,
+};
+
+// byte-sized formats gain little from wider vectors, so AVX2 only replaces the RGBA16 kernels
+static const convert_kernels kernels_avx2 =
+{
+   "avx2",
+   rgba16_to_rgba_avx2,
+   rgba_to_rgba16_avx2,
+   ia8_to_ia_sse2,
+   ia_to_ia8_sse2,
+   i4_to_ia_sse2,
+   ia_to_i4_sse2,
+};
+#endif
+
+// set by the benchmark to compare against the scalar kernels
+static const convert_kernels *kernels_forced = NULL;
+
+static const convert_kernels *convert_select(void)
+{
+   if (kernels_forced) {
+      return kernels_forced;
+   }
+#ifdef N64GRAPHICS_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      return &kernels_avx2;
+   }
+   if (__builtin_cpu_supports("sse2")) {
+      return &kernels_sse2;
+   }
+#endif
+   return &kernels_scalar;
+}
+
 //---------------------------------------------------------
 // N64 RGBA/IA/I/CI -> internal RGBA/IA
 //---------------------------------------------------------
@@ -51,19 +418,10 @@ rgba *raw2rgba(const uint8_t *raw, int width, int height, int depth)
    }
 
    if (depth == 16) {
-      for (int i = 0; i < width * height; i++) {
-         img[i].red   = SCALE_5_8((raw[i*2] & 0xF8) >> 3);
-         img[i].green = SCALE_5_8(((raw[i*2] & 0x07) << 2) | ((raw[i*2+1] & 0xC0) >> 6));
-         img[i].blue  = SCALE_5_8((raw[i*2+1] & 0x3E) >> 1);
-         img[i].alpha = (raw[i*2+1] & 0x01) ? 0xFF : 0x00;
-      }
+      convert_select()->rgba16_to_rgba(img, raw, width * height);
    } else if (depth == 32) {
-      for (int i = 0; i < width * height; i++) {
-         img[i].red   = raw[i*4];
-         img[i].green = raw[i*4+1];
-         img[i].blue  = raw[i*4+2];
-         img[i].alpha = raw[i*4+3];
-      }
+      // rgba is laid out as RGBA32
+      memcpy(img, raw, img_size);
    }
 
    return img;
@@ -73,6 +431,7 @@ ia *raw2ia(const uint8_t *raw, int width, int height, int depth)
 {
    ia *img;
    int img_size;
+   int count = width * height;
 
    img_size = width * height * sizeof(*img);
    img = malloc(img_size);
@@ -83,37 +442,27 @@ ia *raw2ia(const uint8_t *raw, int width, int height, int depth)
 
    switch (depth) {
       case 16:
-         for (int i = 0; i < width * height; i++) {
-            img[i].intensity = raw[i*2];
-            img[i].alpha     = raw[i*2+1];
-         }
+         // ia is laid out as IA16
+         memcpy(img, raw, img_size);
          break;
       case 8:
-         for (int i = 0; i < width * height; i++) {
-            img[i].intensity = SCALE_4_8((raw[i] & 0xF0) >> 4);
-            img[i].alpha     = SCALE_4_8(raw[i] & 0x0F);
-         }
+         convert_select()->ia8_to_ia(img, raw, count);
          break;
       case 4:
-         for (int i = 0; i < width * height; i++) {
-            uint8_t bits;
-            bits = raw[i/2];
-            if (i % 2) {
-               bits &= 0xF;
-            } else {
-               bits >>= 4;
-            }
-            img[i].intensity = SCALE_3_8((bits >> 1) & 0x07);
-            img[i].alpha     = (bits & 0x01) ? 0xFF : 0x00;
+      {
+         int i;
+         for (i = 0; i + 1 < count; i += 2) {
+            img[i]   = ia4_lut[raw[i/2]][0];
+            img[i+1] = ia4_lut[raw[i/2]][1];
+         }
+         if (i < count) {
+            img[i] = ia4_lut[raw[i/2]][0];
          }
          break;
+      }
       case 1:
-         for (int i = 0; i < width * height; i++) {
-            uint8_t bits;
-            uint8_t mask;
-            bits = raw[i/8];
-            mask = 1 << (7 - (i % 8)); // MSb->LSb
-            bits = (bits & mask) ? 0xFF : 0x00;
+         for (int i = 0; i < count; i++) {
+            uint8_t bits = ((raw[i >> 3] << (i & 7)) & 0x80) ? 0xFF : 0x00; // MSb->LSb
             img[i].intensity = bits;
             img[i].alpha     = bits;
          }
@@ -146,17 +495,7 @@ ia *raw2i(const uint8_t *raw, int width, int height, int depth)
          }
          break;
       case 4:
-         for (int i = 0; i < width * height; i++) {
-            uint8_t bits;
-            bits = raw[i/2];
-            if (i % 2) {
-               bits &= 0xF;
-            } else {
-               bits >>= 4;
-            }
-            img[i].intensity = SCALE_4_8(bits);
-            img[i].alpha     = 0xFF;
-         }
+         convert_select()->i4_to_ia(img, raw, width * height);
          break;
       default:
          ERROR("Error invalid depth %d\n", depth);
@@ -171,6 +510,7 @@ uint8_t *ci2raw(const uint8_t *rawci, const uint8_t *palette, int width, int hei
 {
    uint8_t *raw;
    int raw_size;
+   int count = width * height;
 
    // first convert to raw RGBA
    raw_size = sizeof(uint16_t) * width * height;
@@ -180,16 +520,19 @@ uint8_t *ci2raw(const uint8_t *rawci, const uint8_t *palette, int width, int hei
       return NULL;
    }
 
-   for (int i = 0; i < width * height; i++) {
-      int pal_idx = rawci[i];
-      if (ci_depth == 4) {
-         int byte_idx = i / 2;
-         int nibble = 1 - (i % 2);
-         int shift = 4 * nibble;
-         pal_idx = (rawci[byte_idx] >> shift) & 0xF;
+   if (ci_depth == 4) {
+      int i;
+      for (i = 0; i + 1 < count; i += 2) {
+         memcpy(&raw[2*i],   &palette[2*(rawci[i/2] >> 4)], 2);
+         memcpy(&raw[2*i+2], &palette[2*(rawci[i/2] & 0xF)], 2);
+      }
+      if (i < count) {
+         memcpy(&raw[2*i], &palette[2*(rawci[i/2] >> 4)], 2);
+      }
+   } else {
+      for (int i = 0; i < count; i++) {
+         memcpy(&raw[2*i], &palette[2*rawci[i]], 2);
       }
-      raw[2*i]   = palette[2*pal_idx];
-      raw[2*i+1] = palette[2*pal_idx+1];
    }
 
    return raw;
@@ -207,22 +550,9 @@ int rgba2raw(uint8_t *raw, const rgba *img, int width, int height, int depth)
    INFO("Converting RGBA%d %dx%d to raw\n", depth, width, height);
 
    if (depth == 16) {
-      for (int i = 0; i < width * height; i++) {
-         uint8_t r, g, b, a;
-         r = SCALE_8_5(img[i].red);
-         g = SCALE_8_5(img[i].green);
-         b = SCALE_8_5(img[i].blue);
-         a = img[i].alpha ? 0x1 : 0x0;
-         raw[i*2]   = (r << 3) | (g >> 2);
-         raw[i*2+1] = ((g & 0x3) << 6) | (b << 1) | a;
-      }
+      convert_select()->rgba_to_rgba16(raw, img, width * height);
    } else if (depth == 32) {
-      for (int i = 0; i < width * height; i++) {
-         raw[i*4]   = img[i].red;
-         raw[i*4+1] = img[i].green;
-         raw[i*4+2] = img[i].blue;
-         raw[i*4+3] = img[i].alpha;
-      }
+      memcpy(raw, img, size);
    } else {
       ERROR("Error invalid depth %d\n", depth);
       size = -1;
@@ -234,46 +564,51 @@ int rgba2raw(uint8_t *raw, const rgba *img, int width, int height, int depth)
 int ia2raw(uint8_t *raw, const ia *img, int width, int height, int depth)
 {
    int size = width * height * depth / 8;
+   int count = width * height;
    INFO("Converting IA%d %dx%d to raw\n", depth, width, height);
 
    switch (depth) {
       case 16:
-         for (int i = 0; i < width * height; i++) {
-            raw[i*2]   = img[i].intensity;
-            raw[i*2+1] = img[i].alpha;
-         }
+         memcpy(raw, img, size);
          break;
       case 8:
-         for (int i = 0; i < width * height; i++) {
-            uint8_t val = SCALE_8_4(img[i].intensity);
-            uint8_t alpha = SCALE_8_4(img[i].alpha);
-            raw[i] = (val << 4) | alpha;
-         }
+         convert_select()->ia_to_ia8(raw, img, count);
          break;
       case 4:
-         for (int i = 0; i < width * height; i++) {
-            uint8_t val = SCALE_8_3(img[i].intensity);
-            uint8_t alpha = img[i].alpha ? 0x01 : 0x00;
-            uint8_t old = raw[i/2];
-            if (i % 2) {
-               raw[i/2] = (old & 0xF0) | (val << 1) | alpha;
-            } else {
-               raw[i/2] = (old & 0x0F) | (((val << 1) | alpha) << 4);
-            }
+      {
+         int i;
+         for (i = 0; i + 1 < count; i += 2) {
+            uint8_t hi = (scale_8_3[img[i].intensity] << 1) | (img[i].alpha ? 0x01 : 0x00);
+            uint8_t lo = (scale_8_3[img[i+1].intensity] << 1) | (img[i+1].alpha ? 0x01 : 0x00);
+            raw[i/2] = (hi << 4) | lo;
+         }
+         if (i < count) {
+            uint8_t hi = (scale_8_3[img[i].intensity] << 1) | (img[i].alpha ? 0x01 : 0x00);
+            raw[i/2] = (raw[i/2] & 0x0F) | (hi << 4);
          }
          break;
+      }
       case 1:
-         for (int i = 0; i < width * height; i++) {
-            uint8_t val = img[i].intensity;
-            uint8_t old = raw[i/8];
-            uint8_t bit = 1 << (7 - (i % 8));
-            if (val) {
-               raw[i/8] = old | bit;
+      {
+         // whole bytes first, then the trailing bits keeping the rest of the last byte
+         int i;
+         for (i = 0; i + 8 <= count; i += 8) {
+            uint8_t bits = 0;
+            for (int b = 0; b < 8; b++) {
+               bits = (bits << 1) | (img[i+b].intensity ? 0x1 : 0x0);
+            }
+            raw[i/8] = bits;
+         }
+         for (; i < count; i++) {
+            uint8_t bit = 0x80 >> (i & 7);
+            if (img[i].intensity) {
+               raw[i/8] |= bit;
             } else {
-               raw[i/8] = old & (~bit);
+               raw[i/8] &= ~bit;
             }
          }
          break;
+      }
       default:
          ERROR("Error invalid depth %d\n", depth);
          size = -1;
@@ -295,15 +630,7 @@ int i2raw(uint8_t *raw, const ia *img, int width, int height, int depth)
          }
          break;
       case 4:
-         for (int i = 0; i < width * height; i++) {
-            uint8_t val = SCALE_8_4(img[i].intensity);
-            uint8_t old = raw[i/2];
-            if (i % 2) {
-               raw[i/2] = (old & 0xF0) | val;
-            } else {
-               raw[i/2] = (old & 0x0F) | (val << 4);
-            }
-         }
+         convert_select()->ia_to_i4(raw, img, width * height);
          break;
       default:
          ERROR("Error invalid depth %d\n", depth);
@@ -319,26 +646,41 @@ int i2raw(uint8_t *raw, const ia *img, int width, int height, int depth)
 // internal RGBA/IA -> PNG
 //---------------------------------------------------------
 
+// convert to interleaved bytes stb_image_write expects
+static uint8_t *rgba2bytes(const rgba *img, int width, int height)
+{
+   uint8_t *data = malloc(4*width*height);
+   if (data) {
+      for (int idx = 0; idx < width*height; idx++) {
+         data[4*idx]     = img[idx].red;
+         data[4*idx + 1] = img[idx].green;
+         data[4*idx + 2] = img[idx].blue;
+         data[4*idx + 3] = img[idx].alpha;
+      }
+   }
+   return data;
+}
+
+static uint8_t *ia2bytes(const ia *img, int width, int height)
+{
+   uint8_t *data = malloc(2*width*height);
+   if (data) {
+      for (int idx = 0; idx < width*height; idx++) {
+         data[2*idx]     = img[idx].intensity;
+         data[2*idx + 1] = img[idx].alpha;
+      }
+   }
+   return data;
+}
+
 int rgba2png(const char *png_filename, const rgba *img, int width, int height)
 {
    int ret = 0;
    INFO("Saving RGBA %dx%d to \"%s\"\n", width, height, png_filename);
 
-   // convert to format stb_image_write expects
-   uint8_t *data = malloc(4*width*height);
+   uint8_t *data = rgba2bytes(img, width, height);
    if (data) {
-      for (int j = 0; j < height; j++) {
-         for (int i = 0; i < width; i++) {
-            int idx = j*width + i;
-            data[4*idx]     = img[idx].red;
-            data[4*idx + 1] = img[idx].green;
-            data[4*idx + 2] = img[idx].blue;
-            data[4*idx + 3] = img[idx].alpha;
-         }
-      }
-
       ret = stbi_write_png(png_filename, width, height, 4, data, 0);
-
       free(data);
    }
 
@@ -350,25 +692,181 @@ int ia2png(const char *png_filename, const ia *img, int width, int height)
    int ret = 0;
    INFO("Saving IA %dx%d to \"%s\"\n", width, height, png_filename);
 
-   // convert to format stb_image_write expects
-   uint8_t *data = malloc(2*width*height);
+   uint8_t *data = ia2bytes(img, width, height);
    if (data) {
-      for (int j = 0; j < height; j++) {
-         for (int i = 0; i < width; i++) {
-            int idx = j*width + i;
-            data[2*idx]     = img[idx].intensity;
-            data[2*idx + 1] = img[idx].alpha;
-         }
-      }
-
       ret = stbi_write_png(png_filename, width, height, 2, data, 0);
-
       free(data);
    }
 
    return ret;
 }
 
+#ifdef N64GRAPHICS_ZLIB
+// STBIW_ZLIB_COMPRESS hook: returned buffer is released by stb_image_write with free()
+static unsigned char *zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+{
+   uLongf len = compressBound(data_len);
+   unsigned char *out = malloc(len);
+   if (out == NULL) {
+      return NULL;
+   }
+   if (compress2(out, &len, data, data_len, quality) != Z_OK) {
+      free(out);
+      return NULL;
+   }
+   *out_len = (int)len;
+   return out;
+}
+#endif
+
+void png_set_compression_level(int level)
+{
+   stbi_write_png_compression_level = MIN(MAX(level, 0), 9);
+}
+
+//---------------------------------------------------------
+// internal RGBA/IA -> PNG, batched on worker threads
+//---------------------------------------------------------
+
+void png_queue_init(png_queue *queue)
+{
+   queue->jobs = NULL;
+   queue->count = 0;
+   queue->allocated = 0;
+   queue->failed = NULL;
+}
+
+static png_job *png_queue_add(png_queue *queue, const char *png_filename)
+{
+   png_job *job;
+   if (queue->count >= queue->allocated) {
+      int allocated = queue->allocated ? 2 * queue->allocated : 16;
+      png_job *jobs = realloc(queue->jobs, allocated * sizeof(*jobs));
+      if (jobs == NULL) {
+         return NULL;
+      }
+      queue->jobs = jobs;
+      queue->allocated = allocated;
+   }
+   job = &queue->jobs[queue->count];
+   job->file_name = malloc(strlen(png_filename) + 1);
+   if (job->file_name == NULL) {
+      return NULL;
+   }
+   strcpy(job->file_name, png_filename);
+   job->written = 0;
+   job->failed = queue->failed;
+   return job;
+}
+
+int png_queue_rgba(png_queue *queue, const char *png_filename, const rgba *img, int width, int height)
+{
+   INFO("Queueing RGBA %dx%d to \"%s\"\n", width, height, png_filename);
+   png_job *job = png_queue_add(queue, png_filename);
+   if (job == NULL) {
+      return 0;
+   }
+   job->data = rgba2bytes(img, width, height);
+   if (job->data == NULL) {
+      free(job->file_name);
+      return 0;
+   }
+   job->width = width;
+   job->height = height;
+   job->channels = 4;
+   queue->count++;
+   return 1;
+}
+
+int png_queue_ia(png_queue *queue, const char *png_filename, const ia *img, int width, int height)
+{
+   INFO("Queueing IA %dx%d to \"%s\"\n", width, height, png_filename);
+   png_job *job = png_queue_add(queue, png_filename);
+   if (job == NULL) {
+      return 0;
+   }
+   job->data = ia2bytes(img, width, height);
+   if (job->data == NULL) {
+      free(job->file_name);
+      return 0;
+   }
+   job->width = width;
+   job->height = height;
+   job->channels = 2;
+   queue->count++;
+   return 1;
+}
+
+void png_queue_append(png_queue *dst, png_queue *src)
+{
+   if (src->count == 0) {
+      return;
+   }
+   if (dst->count + src->count > dst->allocated) {
+      int allocated = dst->count + src->count;
+      dst->jobs = realloc(dst->jobs, allocated * sizeof(*dst->jobs));
+      dst->allocated = allocated;
+   }
+   memcpy(&dst->jobs[dst->count], src->jobs, src->count * sizeof(*src->jobs));
+   dst->count += src->count;
+   src->count = 0;
+}
+
+// sort largest images first so one big texture does not end up last on a single worker
+static int png_job_cmp(const void *a, const void *b)
+{
+   const png_job *ja = a;
+   const png_job *jb = b;
+   long size_a = (long)ja->width * ja->height * ja->channels;
+   long size_b = (long)jb->width * jb->height * jb->channels;
+   if (size_a != size_b) {
+      return size_a < size_b ? 1 : -1;
+   }
+   return strcmp(ja->file_name, jb->file_name);
+}
+
+// parallel_for() callback: encode and write one queued PNG, freeing its pixel data
+static void png_job_write(void *ctx, int index)
+{
+   png_queue *queue = ctx;
+   png_job *job = &queue->jobs[index];
+   INFO("Saving %s %dx%d to \"%s\"\n", job->channels == 4 ? "RGBA" : "IA", job->width, job->height, job->file_name);
+   job->written = stbi_write_png(job->file_name, job->width, job->height, job->channels, job->data, 0);
+   if (!job->written) {
+      ERROR("Error writing \"%s\"\n", job->file_name);
+   }
+   free(job->data);
+   job->data = NULL;
+}
+
+int png_queue_flush(png_queue *queue, int threads)
+{
+   int failed = 0;
+   qsort(queue->jobs, queue->count, sizeof(*queue->jobs), png_job_cmp);
+   parallel_for(queue->count, threads, png_job_write, queue);
+   for (int i = 0; i < queue->count; i++) {
+      if (!queue->jobs[i].written) {
+         failed++;
+         if (queue->jobs[i].failed) {
+            *queue->jobs[i].failed = 1;
+         }
+      }
+      free(queue->jobs[i].file_name);
+   }
+   queue->count = 0;
+   return failed;
+}
+
+void png_queue_free(png_queue *queue)
+{
+   for (int i = 0; i < queue->count; i++) {
+      free(queue->jobs[i].file_name);
+      free(queue->jobs[i].data);
+   }
+   free(queue->jobs);
+   png_queue_init(queue);
+}
+
 //---------------------------------------------------------
 // PNG -> internal RGBA/IA
 //---------------------------------------------------------
@@ -498,70 +996,274 @@ ia *png2ia(const char *png_filename, int *width, int *height)
    return img;
 }
 
-// find index of palette color
-// return -1 if not found
-static int pal_find_color(const palette_t *pal, uint16_t val)
+//---------------------------------------------------------
+// CI palette building
+//---------------------------------------------------------
+
+static unsigned int palette_hash(uint16_t color)
 {
-   for (int i = 0; i < pal->used; i++) {
-      if (pal->data[i] == val) {
-         return i;
+   // multiplicative hash, taking bits from the middle of the product
+   return (((uint32_t)color * 0x9E3779B1u) >> 16) & (PALETTE_SLOTS - 1);
+}
+
+// slot holding color, or the empty slot it would be inserted into
+static unsigned int palette_slot(const palette_t *pal, uint16_t color)
+{
+   unsigned int slot = palette_hash(color);
+   while (pal->slots[slot] && pal->data[pal->slots[slot] - 1] != color) {
+      slot = (slot + 1) & (PALETTE_SLOTS - 1);
+   }
+   return slot;
+}
+
+void palette_init(palette_t *pal, int max)
+{
+   memset(pal->data, 0, sizeof(pal->data));
+   memset(pal->slots, 0, sizeof(pal->slots));
+   pal->max = MIN(max, (int)DIM(pal->data));
+   pal->used = 0;
+}
+
+int palette_find(const palette_t *pal, uint16_t color)
+{
+   return pal->slots[palette_slot(pal, color)] - 1;
+}
+
+int palette_add(palette_t *pal, uint16_t color)
+{
+   unsigned int slot = palette_slot(pal, color);
+   if (pal->slots[slot] == 0) {
+      if (pal->used >= pal->max) {
+         return -1;
+      }
+      pal->data[pal->used] = color;
+      pal->used++;
+      pal->slots[slot] = pal->used;
+   }
+   return pal->slots[slot] - 1;
+}
+
+#define QUANT_CHANNELS 4
+
+// expand 16-bit color to 8-bit channels
+static void quant_channels(uint16_t color, palette_format format, unsigned int ch[QUANT_CHANNELS])
+{
+   if (format == PAL_IA16) {
+      ch[0] = color >> 8;
+      ch[1] = color & 0xFF;
+      ch[2] = 0;
+      ch[3] = 0;
+   } else {
+      ch[0] = scale_5_8[color >> 11];
+      ch[1] = scale_5_8[(color >> 6) & 0x1F];
+      ch[2] = scale_5_8[(color >> 1) & 0x1F];
+      ch[3] = (color & 0x1) ? 0xFF : 0x00;
+   }
+}
+
+static uint16_t quant_color(const unsigned int ch[QUANT_CHANNELS], palette_format format)
+{
+   if (format == PAL_IA16) {
+      return (ch[0] << 8) | ch[1];
+   }
+   return (scale_8_5[ch[0]] << 11) | (scale_8_5[ch[1]] << 6) | (scale_8_5[ch[2]] << 1) | (ch[3] >= 0x80);
+}
+
+// box of distinct colors colors[start..start+count) in median cut
+typedef struct
+{
+   int start;
+   int count;
+   int channel; // channel with the widest range
+   int range;   // width of that range, 0 if the box holds one color
+} quant_box;
+
+static void quant_box_measure(quant_box *box, const uint16_t *colors, palette_format format)
+{
+   unsigned int lo[QUANT_CHANNELS] = {0xFF, 0xFF, 0xFF, 0xFF};
+   unsigned int hi[QUANT_CHANNELS] = {0, 0, 0, 0};
+   unsigned int ch[QUANT_CHANNELS];
+   for (int i = box->start; i < box->start + box->count; i++) {
+      quant_channels(colors[i], format, ch);
+      for (int c = 0; c < QUANT_CHANNELS; c++) {
+         lo[c] = MIN(lo[c], ch[c]);
+         hi[c] = MAX(hi[c], ch[c]);
+      }
+   }
+   box->channel = 0;
+   box->range = 0;
+   for (int c = 0; c < QUANT_CHANNELS; c++) {
+      if (box->count > 1 && (int)(hi[c] - lo[c]) > box->range) {
+         box->channel = c;
+         box->range = hi[c] - lo[c];
+      }
+   }
+}
+
+// sort box by its widest channel with a counting sort, then split it where half its weight is on each side
+static void quant_box_split(quant_box *box, quant_box *split, uint16_t *colors, uint16_t *tmp,
+                            const uint32_t *weight, palette_format format)
+{
+   int pos[256 + 1] = {0};
+   unsigned int ch[QUANT_CHANNELS];
+   uint64_t total = 0, half = 0;
+   int s;
+   for (int i = box->start; i < box->start + box->count; i++) {
+      quant_channels(colors[i], format, ch);
+      pos[ch[box->channel] + 1]++;
+      total += weight[colors[i]];
+   }
+   for (int v = 0; v < 256; v++) {
+      pos[v + 1] += pos[v];
+   }
+   for (int i = box->start; i < box->start + box->count; i++) {
+      quant_channels(colors[i], format, ch);
+      tmp[pos[ch[box->channel]]++] = colors[i];
+   }
+   memcpy(&colors[box->start], tmp, box->count * sizeof(*colors));
+
+   // s: number of colors kept, leaving at least one for the split
+   for (s = 1; s < box->count - 1; s++) {
+      half += weight[colors[box->start + s - 1]];
+      if (2 * half >= total) {
+         break;
       }
    }
-   return -1;
+   split->start = box->start + s;
+   split->count = box->count - s;
+   box->count = s;
+   quant_box_measure(box, colors, format);
+   quant_box_measure(split, colors, format);
 }
 
-// find value in palette, or add if not there
-// returns palette index entered or -1 if palette full
-static int pal_add_color(palette_t *pal, uint16_t val)
+void palette_quantize(palette_t *pal, const uint16_t *colors, int count, palette_format format, uint8_t *map)
 {
-   int idx;
-   idx = pal_find_color(pal, val);
-   if (idx < 0) {
-      if (pal->used == pal->max) {
-         ERROR("Error: trying to use more than %d\n", pal->max);
+   uint32_t *weight = calloc(0x10000, sizeof(*weight));
+   uint16_t *distinct = calloc(MIN(count, 0x10000), sizeof(*distinct));
+   uint16_t *tmp = malloc(MIN(count, 0x10000) * sizeof(*tmp));
+   quant_box boxes[256];
+   int box_count = 1;
+   int distinct_count = 0;
+
+   palette_init(pal, pal->max);
+   for (int i = 0; i < count; i++) {
+      if (weight[colors[i]]++ == 0) {
+         distinct[distinct_count++] = colors[i];
+      }
+   }
+
+   // repeatedly split the box with the widest channel range
+   boxes[0].start = 0;
+   boxes[0].count = distinct_count;
+   quant_box_measure(&boxes[0], distinct, format);
+   while (box_count < pal->max) {
+      int widest = 0;
+      for (int b = 1; b < box_count; b++) {
+         if (boxes[b].range > boxes[widest].range) {
+            widest = b;
+         }
+      }
+      if (boxes[widest].range == 0) {
+         break;
+      }
+      quant_box_split(&boxes[widest], &boxes[box_count], distinct, tmp, weight, format);
+      box_count++;
+   }
+
+   // each box becomes its weighted average color
+   for (int b = 0; b < box_count && distinct_count > 0; b++) {
+      uint64_t sum[QUANT_CHANNELS] = {0, 0, 0, 0};
+      uint64_t total = 0;
+      unsigned int ch[QUANT_CHANNELS];
+      int pal_idx;
+      for (int i = boxes[b].start; i < boxes[b].start + boxes[b].count; i++) {
+         quant_channels(distinct[i], format, ch);
+         for (int c = 0; c < QUANT_CHANNELS; c++) {
+            sum[c] += (uint64_t)ch[c] * weight[distinct[i]];
+         }
+         total += weight[distinct[i]];
+      }
+      for (int c = 0; c < QUANT_CHANNELS; c++) {
+         ch[c] = (sum[c] + total / 2) / total;
+      }
+      // boxes averaging to the same color share an entry
+      pal_idx = palette_add(pal, quant_color(ch, format));
+      for (int i = boxes[b].start; i < boxes[b].start + boxes[b].count; i++) {
+         map[distinct[i]] = pal_idx;
+      }
+   }
+
+   free(tmp);
+   free(distinct);
+   free(weight);
+}
+
+// store palette index of pixel i in CI4 or CI8 data
+static void ci_set(uint8_t *rawci, int i, int pal_idx, int ci_depth)
+{
+   if (ci_depth == 4) {
+      if (i & 1) {
+         rawci[i/2] = (rawci[i/2] & 0xF0) | pal_idx;
       } else {
-         idx = pal->used;
-         pal->data[pal->used] = val;
-         pal->used++;
+         rawci[i/2] = (rawci[i/2] & 0x0F) | (pal_idx << 4);
+      }
+   } else if (ci_depth == 8) {
+      rawci[i] = pal_idx;
+   }
+}
+
+// assign raw colors to an empty palette, adding them as they are found
+// returns number of pixels converted before the palette filled up
+static int ci_assign(uint8_t *rawci, palette_t *pal, const uint8_t *raw, int count, int ci_depth)
+{
+   palette_init(pal, pal->max);
+   for (int i = 0; i < count; i++) {
+      int pal_idx = palette_add(pal, read_u16_be(&raw[2*i]));
+      if (pal_idx < 0) {
+         return i;
       }
+      ci_set(rawci, i, pal_idx, ci_depth);
    }
-   return idx;
+   return count;
 }
 
 // convert from raw (RGBA16 or IA16) format to CI + palette
 // returns 1 on success
 int raw2ci(uint8_t *rawci, palette_t *pal, const uint8_t *raw, int raw_len, int ci_depth)
 {
-   // assign colors to palette
-   pal->used = 0;
-   memset(pal->data, 0, sizeof(pal->data));
-   int ci_idx = 0;
-   for (int i = 0; i < raw_len; i += sizeof(uint16_t)) {
-      uint16_t val = read_u16_be(&raw[i]);
-      int pal_idx = pal_add_color(pal, val);
-      if (pal_idx < 0) {
-         ERROR("Error adding color @ (%d): %d (used: %d/%d)\n", i, pal_idx, pal->used, pal->max);
-         return 0;
-      } else {
-         switch (ci_depth) {
-            case 8:
-               rawci[ci_idx] = (uint8_t)pal_idx;
-               break;
-            case 4:
-            {
-               int byte_idx = ci_idx / 2;
-               int nibble = 1 - (ci_idx % 2);
-               uint8_t mask = 0xF << (4 * (1 - nibble));
-               rawci[byte_idx] = (rawci[byte_idx] & mask) | (pal_idx << (4 * nibble));
-               break;
-            }
-         }
-         ci_idx++;
-      }
+   int count = raw_len / 2;
+   int converted = ci_assign(rawci, pal, raw, count, ci_depth);
+   if (converted < count) {
+      ERROR("Error adding color @ (%d): more than %d colors\n", 2*converted, pal->max);
+      return 0;
    }
    return 1;
 }
 
+int raw2ci_quantize(uint8_t *rawci, palette_t *pal, const uint8_t *raw, int raw_len, int ci_depth, palette_format format)
+{
+   int count = raw_len / 2;
+   uint16_t *colors;
+   uint8_t *map;
+
+   if (ci_assign(rawci, pal, raw, count, ci_depth) == count) {
+      return 1;
+   }
+
+   colors = calloc(count, sizeof(*colors));
+   map = malloc(0x10000);
+   for (int i = 0; i < count; i++) {
+      colors[i] = read_u16_be(&raw[2*i]);
+   }
+   palette_quantize(pal, colors, count, format, map);
+   for (int i = 0; i < count; i++) {
+      ci_set(rawci, i, map[colors[i]], ci_depth);
+   }
+   free(map);
+   free(colors);
+   return 2;
+}
+
 const char *n64graphics_get_read_version(void)
 {
    return "stb_image 2.19";
@@ -574,12 +1276,14 @@ const char *n64graphics_get_write_version(void)
 
 #ifdef N64GRAPHICS_STANDALONE
 #define N64GRAPHICS_VERSION "0.4"
-#include <string.h>
+#include <time.h>
 
 typedef enum
 {
    MODE_EXPORT,
    MODE_IMPORT,
+   MODE_BENCHMARK,
+   MODE_BATCH,
 } tool_mode;
 
 typedef struct
@@ -587,6 +1291,7 @@ typedef struct
    char *img_filename;
    char *bin_filename;
    char *pal_filename;
+   char *batch_filename;
    tool_mode mode;
    unsigned int bin_offset;
    unsigned int pal_offset;
@@ -596,6 +1301,8 @@ typedef struct
    int height;
    int bin_truncate;
    int pal_truncate;
+   int quantize;
+   int threads;
 } graphics_config;
 
 static const graphics_config default_config =
@@ -603,6 +1310,7 @@ static const graphics_config default_config =
    .img_filename = NULL,
    .bin_filename = NULL,
    .pal_filename = NULL,
+   .batch_filename = NULL,
    .mode = MODE_EXPORT,
    .bin_offset = 0,
    .pal_offset = 0,
@@ -612,6 +1320,8 @@ static const graphics_config default_config =
    .height = 32,
    .bin_truncate = 1,
    .pal_truncate = 1,
+   .quantize = 0,
+   .threads = 0,
 };
 
 typedef struct
@@ -658,7 +1368,9 @@ static int parse_format(img_format *format, const char *str)
 
 static void print_usage(void)
 {
-   ERROR("Usage: n64graphics -e/-i BIN_FILE -g IMG_FILE [-p PAL_FILE] [-o BIN_OFFSET] [-P PAL_OFFSET] [-f FORMAT] [-c CI_FORMAT] [-w WIDTH] [-h HEIGHT] [-V]\n"
+   ERROR("Usage: n64graphics -e/-i BIN_FILE -g IMG_FILE [-p PAL_FILE] [-o BIN_OFFSET] [-P PAL_OFFSET] [-f FORMAT] [-c CI_FORMAT] [-q] [-w WIDTH] [-h HEIGHT] [-z LEVEL] [-V]\n"
+         "       n64graphics --batch MANIFEST [-j THREADS] [-z LEVEL]\n"
+         "       n64graphics -b\n"
          "\n"
          "n64graphics v" N64GRAPHICS_VERSION ": N64 graphics manipulator\n"
          "\n"
@@ -671,17 +1383,26 @@ static void print_usage(void)
          " -f FORMAT     texture format: rgba16, rgba32, ia1, ia4, ia8, ia16, i4, i8, ci4, ci8 (default: %s)\n"
          " -w WIDTH      export texture width (default: %d)\n"
          " -h HEIGHT     export texture height (default: %d)\n"
+         " -z LEVEL      export PNG compression level 0-9 (default: %d)\n"
          "CI arguments:\n"
          " -c CI_FORMAT  CI palette format: rgba16, ia16 (default: %s)\n"
          " -p PAL_FILE   palette binary file to import/export from/to\n"
          " -P PAL_OFFSET starting offset in PAL_FILE (prevents truncation during import)\n"
+         " -q            quantize images with more colors than fit in the palette instead of failing\n"
+         "Batch arguments:\n"
+         " --batch MANIFEST convert each \"INPUT OUTPUT FORMAT [WIDTH HEIGHT]\" line of MANIFEST:\n"
+         "               .png inputs are imported, others exported; outputs newer than their input are skipped\n"
+         " -j THREADS    number of conversion threads, 0 for all processors (default: %d)\n"
          "Other arguments:\n"
+         " -b            benchmark converting a synthetic texture in every format\n"
          " -v            verbose logging\n"
          " -V            print version information\n",
          format2str(&default_config.format),
          default_config.width,
          default_config.height,
-         format2str(&default_config.pal_format));
+         stbi_write_png_compression_level,
+         format2str(&default_config.pal_format),
+         default_config.threads);
 }
 
 static void print_version(void)
@@ -696,8 +1417,15 @@ static void print_version(void)
 static int parse_arguments(int argc, char *argv[], graphics_config *config)
 {
    for (int i = 1; i < argc; i++) {
-      if (argv[i][0] == '-') {
+      if (!strcmp(argv[i], "--batch")) {
+         if (++i >= argc) return 0;
+         config->batch_filename = argv[i];
+         config->mode = MODE_BATCH;
+      } else if (argv[i][0] == '-') {
          switch (argv[i][1]) {
+            case 'b':
+               config->mode = MODE_BENCHMARK;
+               break;
             case 'c':
                if (++i >= argc) return 0;
                if (!parse_format(&config->pal_format, argv[i])) {
@@ -728,6 +1456,10 @@ static int parse_arguments(int argc, char *argv[], graphics_config *config)
                config->bin_filename = argv[i];
                config->mode = MODE_IMPORT;
                break;
+            case 'j':
+               if (++i >= argc) return 0;
+               config->threads = strtol(argv[i], NULL, 0);
+               break;
             case 'o':
                if (++i >= argc) return 0;
                config->bin_offset = strtoul(argv[i], NULL, 0);
@@ -742,6 +1474,9 @@ static int parse_arguments(int argc, char *argv[], graphics_config *config)
                config->pal_offset = strtoul(argv[i], NULL, 0);
                config->pal_truncate = 0;
                break;
+            case 'q':
+               config->quantize = 1;
+               break;
             case 'v':
                g_verbosity = 1;
                break;
@@ -753,6 +1488,10 @@ static int parse_arguments(int argc, char *argv[], graphics_config *config)
                if (++i >= argc) return 0;
                config->width = strtoul(argv[i], NULL, 0);
                break;
+            case 'z':
+               if (++i >= argc) return 0;
+               png_set_compression_level(strtol(argv[i], NULL, 0));
+               break;
             default:
                return 0;
                break;
@@ -767,6 +1506,9 @@ static int parse_arguments(int argc, char *argv[], graphics_config *config)
 // returns 1 if config is valid
 static int valid_config(const graphics_config *config)
 {
+   if (config->mode == MODE_BENCHMARK || config->mode == MODE_BATCH) {
+      return 1;
+   }
    if (!config->bin_filename || !config->img_filename) {
       return 0;
    }
@@ -779,6 +1521,369 @@ static int valid_config(const graphics_config *config)
    return 1;
 }
 
+// load PNG and convert it to raw RGBA, IA or I data
+// returns raw data with its length in *length, or NULL on error
+static uint8_t *png2raw(const char *png_filename, const img_format *format, int *width, int *height, int *length)
+{
+   uint8_t *raw = NULL;
+   int raw_size;
+
+   *length = 0;
+   if (format->format == IMG_FORMAT_RGBA) {
+      rgba *img = png2rgba(png_filename, width, height);
+      if (!img) {
+         return NULL;
+      }
+      raw_size = (*width * *height * format->depth + 7) / 8;
+      raw = malloc(raw_size);
+      if (raw) {
+         *length = rgba2raw(raw, img, *width, *height, format->depth);
+      }
+      free(img);
+   } else {
+      ia *img = png2ia(png_filename, width, height);
+      if (!img) {
+         return NULL;
+      }
+      raw_size = (*width * *height * format->depth + 7) / 8;
+      raw = malloc(raw_size);
+      if (raw) {
+         if (format->format == IMG_FORMAT_IA) {
+            *length = ia2raw(raw, img, *width, *height, format->depth);
+         } else {
+            *length = i2raw(raw, img, *width, *height, format->depth);
+         }
+      }
+      free(img);
+   }
+   if (!raw) {
+      ERROR("Error allocating %d bytes\n", raw_size);
+   } else if (*length <= 0) {
+      free(raw);
+      raw = NULL;
+   }
+   return raw;
+}
+
+// convert raw RGBA, IA or I data to the interleaved pixels stb_image_write expects
+// returns pixel data with *channels bytes per pixel, or NULL on error
+static uint8_t *raw2bytes(const uint8_t *raw, const img_format *format, int width, int height, int *channels)
+{
+   uint8_t *data = NULL;
+   if (format->format == IMG_FORMAT_RGBA) {
+      rgba *img = raw2rgba(raw, width, height, format->depth);
+      if (img) {
+         data = rgba2bytes(img, width, height);
+         free(img);
+      }
+      *channels = 4;
+   } else {
+      ia *img;
+      if (format->format == IMG_FORMAT_IA) {
+         img = raw2ia(raw, width, height, format->depth);
+      } else {
+         img = raw2i(raw, width, height, format->depth);
+      }
+      if (img) {
+         data = ia2bytes(img, width, height);
+         free(img);
+      }
+      *channels = 2;
+   }
+   return data;
+}
+
+// one conversion from a batch manifest
+typedef struct
+{
+   char *input;
+   char *output;
+   img_format format;
+   int width;
+   int height;
+   int import; // PNG -> raw, otherwise raw -> PNG
+   enum
+   {
+      BATCH_FAILED,
+      BATCH_CONVERTED,
+      BATCH_UP_TO_DATE,
+   } result;
+} batch_entry;
+
+// split next whitespace separated token off a line
+// returns token or NULL at end of line
+static char *batch_token(char **pos)
+{
+   char *p = *pos;
+   char *token;
+   while (*p == ' ' || *p == '\t' || *p == '\r') {
+      p++;
+   }
+   if (*p == '\0') {
+      *pos = p;
+      return NULL;
+   }
+   token = p;
+   while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') {
+      p++;
+   }
+   if (*p != '\0') {
+      *p++ = '\0';
+   }
+   *pos = p;
+   return token;
+}
+
+// read manifest of "INPUT OUTPUT FORMAT [WIDTH HEIGHT]" lines, '#' starts a comment
+// PNG inputs are imported to raw OUTPUT, anything else is exported to PNG OUTPUT and needs WIDTH and HEIGHT
+// returns entries pointing into *buf, which the caller frees, or NULL on error
+static batch_entry *batch_load(const char *file_name, char **buf, int *count)
+{
+   unsigned char *data;
+   batch_entry *entries = NULL;
+   int allocated = 0;
+   int line_num = 0;
+   long length;
+   char *line;
+
+   *count = 0;
+   *buf = NULL;
+   length = read_file(file_name, &data);
+   if (length < 0) {
+      ERROR("Error reading \"%s\"\n", file_name);
+      return NULL;
+   }
+   *buf = realloc(data, length + 1);
+   (*buf)[length] = '\0';
+
+   for (line = *buf; line != NULL; ) {
+      char *next = strchr(line, '\n');
+      char *comment;
+      char *tokens[5] = {NULL, NULL, NULL, NULL, NULL};
+      char *pos = line;
+      int token_count = 0;
+      batch_entry *entry;
+      size_t in_len;
+
+      line_num++;
+      if (next) {
+         *next++ = '\0';
+      }
+      comment = strchr(line, '#');
+      if (comment) {
+         *comment = '\0';
+      }
+      while (token_count < 5 && (tokens[token_count] = batch_token(&pos)) != NULL) {
+         token_count++;
+      }
+      line = next;
+      if (token_count == 0) {
+         continue;
+      }
+
+      if (*count >= allocated) {
+         allocated = allocated ? 2 * allocated : 256;
+         entries = realloc(entries, allocated * sizeof(*entries));
+      }
+      entry = &entries[*count];
+      entry->input = tokens[0];
+      entry->output = tokens[1];
+      entry->width = tokens[3] ? strtol(tokens[3], NULL, 0) : 0;
+      entry->height = tokens[4] ? strtol(tokens[4], NULL, 0) : 0;
+      entry->result = BATCH_FAILED;
+      in_len = strlen(entry->input);
+      entry->import = in_len >= 4 && !strcasecmp(&entry->input[in_len - 4], ".png");
+      if (token_count < 3 || batch_token(&pos) != NULL || !parse_format(&entry->format, tokens[2])) {
+         ERROR("%s:%d: expected \"INPUT OUTPUT FORMAT [WIDTH HEIGHT]\"\n", file_name, line_num);
+         goto error;
+      }
+      if (entry->format.format == IMG_FORMAT_CI) {
+         ERROR("%s:%d: CI formats need a palette and aren't supported in batch mode\n", file_name, line_num);
+         goto error;
+      }
+      if (!entry->import && (entry->width <= 0 || entry->height <= 0)) {
+         ERROR("%s:%d: exporting to PNG needs WIDTH and HEIGHT\n", file_name, line_num);
+         goto error;
+      }
+      (*count)++;
+   }
+   return entries;
+
+error:
+   free(entries);
+   free(*buf);
+   *buf = NULL;
+   return NULL;
+}
+
+// parallel_for() callback: convert one manifest entry unless its output is newer than its input
+static void batch_convert(void *ctx, int index)
+{
+   batch_entry *entry = &((batch_entry *)ctx)[index];
+   uint8_t *out = NULL;
+   int out_len = 0;
+
+   if (file_up_to_date(entry->input, entry->output)) {
+      entry->result = BATCH_UP_TO_DATE;
+      return;
+   }
+
+   if (entry->import) {
+      int width, height;
+      out = png2raw(entry->input, &entry->format, &width, &height, &out_len);
+      if (out && entry->width > 0 && (width != entry->width || height != entry->height)) {
+         ERROR("Error: \"%s\" is %dx%d, expected %dx%d\n", entry->input, width, height, entry->width, entry->height);
+         free(out);
+         out = NULL;
+      }
+   } else {
+      unsigned char *raw;
+      long raw_len = read_file(entry->input, &raw);
+      long need = (long)entry->width * entry->height * entry->format.depth / 8;
+      if (raw_len < 0) {
+         ERROR("Error reading \"%s\"\n", entry->input);
+      } else {
+         if (raw_len < need) {
+            ERROR("Error: \"%s\" is %ld bytes, %ld needed\n", entry->input, raw_len, need);
+         } else {
+            int channels;
+            uint8_t *pixels = raw2bytes(raw, &entry->format, entry->width, entry->height, &channels);
+            if (pixels) {
+               out = stbi_write_png_to_mem(pixels, 0, entry->width, entry->height, channels, &out_len);
+               free(pixels);
+            }
+         }
+         free(raw);
+      }
+   }
+
+   if (out && write_file(entry->output, out, out_len) == out_len) {
+      INFO("Converted \"%s\" to \"%s\"\n", entry->input, entry->output);
+      entry->result = BATCH_CONVERTED;
+   } else {
+      ERROR("Error converting \"%s\" to \"%s\"\n", entry->input, entry->output);
+      entry->result = BATCH_FAILED;
+   }
+   free(out);
+}
+
+// convert every entry of a manifest on a pool of worker threads
+// returns number of entries that failed, or -1 if the manifest couldn't be loaded
+static int batch_run(const char *file_name, int threads)
+{
+   batch_entry *entries;
+   char *buf;
+   int count;
+   int totals[3] = {0, 0, 0};
+
+   entries = batch_load(file_name, &buf, &count);
+   if (buf == NULL) {
+      return -1;
+   }
+   parallel_for(count, threads, batch_convert, entries);
+   for (int i = 0; i < count; i++) {
+      totals[entries[i].result]++;
+   }
+   printf("%d converted, %d up to date, %d failed\n",
+          totals[BATCH_CONVERTED], totals[BATCH_UP_TO_DATE], totals[BATCH_FAILED]);
+
+   free(entries);
+   free(buf);
+   return totals[BATCH_FAILED];
+}
+
+#define BENCH_DIM  1024
+#define BENCH_RUNS 20
+
+// decode and encode a synthetic texture BENCH_RUNS times each with the selected kernels
+// keeps the last decoded image and encoded raw data for comparison, returns Mpixels/s in dec/enc
+static void benchmark_format(const img_format *format, const uint8_t *raw, const uint8_t *palette,
+                             uint8_t *img_out, uint8_t *raw_out, double *dec, double *enc)
+{
+   const int w = BENCH_DIM, h = BENCH_DIM;
+   const double mpx = (double)w * h * BENCH_RUNS / 1e6;
+   int img_size = 0;
+   void *img = NULL;
+   clock_t start;
+
+   start = clock();
+   for (int r = 0; r < BENCH_RUNS; r++) {
+      free(img);
+      switch (format->format) {
+         case IMG_FORMAT_RGBA: img = raw2rgba(raw, w, h, format->depth); img_size = w * h * sizeof(rgba); break;
+         case IMG_FORMAT_IA:   img = raw2ia(raw, w, h, format->depth);   img_size = w * h * sizeof(ia); break;
+         case IMG_FORMAT_I:    img = raw2i(raw, w, h, format->depth);    img_size = w * h * sizeof(ia); break;
+         case IMG_FORMAT_CI:   img = ci2raw(raw, palette, w, h, format->depth); img_size = w * h * sizeof(uint16_t); break;
+      }
+   }
+   *dec = mpx / MAX((double)(clock() - start) / CLOCKS_PER_SEC, 1e-6);
+   memcpy(img_out, img, img_size);
+
+   start = clock();
+   for (int r = 0; r < BENCH_RUNS; r++) {
+      switch (format->format) {
+         case IMG_FORMAT_RGBA: rgba2raw(raw_out, img, w, h, format->depth); break;
+         case IMG_FORMAT_IA:   ia2raw(raw_out, img, w, h, format->depth); break;
+         case IMG_FORMAT_I:    i2raw(raw_out, img, w, h, format->depth); break;
+         case IMG_FORMAT_CI:
+         {
+            palette_t pal;
+            pal.max = 1 << format->depth;
+            raw2ci(raw_out, &pal, img, img_size, format->depth);
+            break;
+         }
+      }
+   }
+   *enc = mpx / MAX((double)(clock() - start) / CLOCKS_PER_SEC, 1e-6);
+   free(img);
+}
+
+// convert a synthetic texture in every format with the best kernels and the scalar ones
+// returns 0 if both produce identical images and raw data
+static int convert_benchmark(void)
+{
+   const int raw_size = BENCH_DIM * BENCH_DIM * 4;
+   const int img_size = BENCH_DIM * BENCH_DIM * sizeof(rgba);
+   uint8_t *raw = malloc(raw_size);
+   uint8_t palette[2 * 256];
+   uint8_t *img[2], *out[2];
+   unsigned int seed = 0x12345678;
+   int mismatches = 0;
+
+   for (int i = 0; i < raw_size; i++) {
+      seed = seed * 1103515245 + 12345;
+      raw[i] = seed >> 16;
+   }
+   memcpy(palette, raw, sizeof(palette));
+   for (int k = 0; k < 2; k++) {
+      img[k] = calloc(img_size, 1);
+      out[k] = calloc(raw_size, 1);
+   }
+
+   kernels_forced = NULL;
+   printf("Converting %dx%d texture %d times, kernels: %s\n\n", BENCH_DIM, BENCH_DIM, BENCH_RUNS, convert_select()->name);
+   printf("format  decode Mpx/s (scalar)  encode Mpx/s (scalar)\n");
+   for (unsigned f = 0; f < DIM(format_table); f++) {
+      const img_format *format = &format_table[f].format;
+      double dec[2], enc[2];
+      benchmark_format(format, raw, palette, img[0], out[0], &dec[0], &enc[0]);
+      kernels_forced = &kernels_scalar;
+      benchmark_format(format, raw, palette, img[1], out[1], &dec[1], &enc[1]);
+      kernels_forced = NULL;
+      int same = !memcmp(img[0], img[1], img_size) && !memcmp(out[0], out[1], raw_size);
+      printf("%-6s  %8.1f (%8.1f)      %8.1f (%8.1f)  %s\n", format_table[f].name,
+             dec[0], dec[1], enc[0], enc[1], same ? "" : "MISMATCH");
+      mismatches += !same;
+   }
+
+   for (int k = 0; k < 2; k++) {
+      free(img[k]);
+      free(out[k]);
+   }
+   free(raw);
+   return mismatches;
+}
+
 int main(int argc, char *argv[])
 {
    graphics_config config = default_config;
@@ -797,6 +1902,15 @@ int main(int argc, char *argv[])
       exit(EXIT_FAILURE);
    }
 
+   if (config.mode == MODE_BENCHMARK) {
+      return convert_benchmark() ? EXIT_FAILURE : EXIT_SUCCESS;
+   }
+
+   if (config.mode == MODE_BATCH) {
+      int threads = config.threads > 0 ? config.threads : parallel_cpu_count();
+      return batch_run(config.batch_filename, threads) ? EXIT_FAILURE : EXIT_SUCCESS;
+   }
+
    if (config.mode == MODE_IMPORT) {
       if (config.bin_truncate) {
          bin_fp = fopen(config.bin_filename, "w");
@@ -812,31 +1926,9 @@ int main(int argc, char *argv[])
       }
       switch (config.format.format) {
          case IMG_FORMAT_RGBA:
-            imgr = png2rgba(config.img_filename, &config.width, &config.height);
-            raw_size = config.width * config.height * config.format.depth / 8;
-            raw = malloc(raw_size);
-            if (!raw) {
-               ERROR("Error allocating %u bytes\n", raw_size);
-            }
-            length = rgba2raw(raw, imgr, config.width, config.height, config.format.depth);
-            break;
          case IMG_FORMAT_IA:
-            imgi = png2ia(config.img_filename, &config.width, &config.height);
-            raw_size = config.width * config.height * config.format.depth / 8;
-            raw = malloc(raw_size);
-            if (!raw) {
-               ERROR("Error allocating %u bytes\n", raw_size);
-            }
-            length = ia2raw(raw, imgi, config.width, config.height, config.format.depth);
-            break;
          case IMG_FORMAT_I:
-            imgi = png2ia(config.img_filename, &config.width, &config.height);
-            raw_size = config.width * config.height * config.format.depth / 8;
-            raw = malloc(raw_size);
-            if (!raw) {
-               ERROR("Error allocating %u bytes\n", raw_size);
-            }
-            length = i2raw(raw, imgi, config.width, config.height, config.format.depth);
+            raw = png2raw(config.img_filename, &config.format, &config.width, &config.height, &length);
             break;
          case IMG_FORMAT_CI:
          {
@@ -863,31 +1955,48 @@ int main(int argc, char *argv[])
                fseek(pal_fp, config.bin_offset, SEEK_SET);
             }
 
-            raw16_size = config.width * config.height * config.pal_format.depth / 8;
-            raw16 = malloc(raw16_size);
-            if (!raw16) {
-               ERROR("Error allocating %d bytes\n", raw16_size);
-               return EXIT_FAILURE;
-            }
+            // image dimensions are only known once it is loaded
+            imgr = NULL;
+            imgi = NULL;
             switch (config.pal_format.format) {
                case IMG_FORMAT_RGBA:
                   imgr = png2rgba(config.img_filename, &config.width, &config.height);
-                  raw16_length = rgba2raw(raw16, imgr, config.width, config.height, config.pal_format.depth);
                   break;
                case IMG_FORMAT_IA:
                   imgi = png2ia(config.img_filename, &config.width, &config.height);
-                  raw16_length = ia2raw(raw16, imgi, config.width, config.height, config.pal_format.depth);
                   break;
                default:
                   ERROR("Unsupported palette format: %s\n", format2str(&config.pal_format));
                   exit(EXIT_FAILURE);
             }
+            if (!imgr && !imgi) {
+               return EXIT_FAILURE;
+            }
+            raw16_size = config.width * config.height * config.pal_format.depth / 8;
+            raw16 = malloc(raw16_size);
+            if (!raw16) {
+               ERROR("Error allocating %d bytes\n", raw16_size);
+               return EXIT_FAILURE;
+            }
+            if (imgr) {
+               raw16_length = rgba2raw(raw16, imgr, config.width, config.height, config.pal_format.depth);
+            } else {
+               raw16_length = ia2raw(raw16, imgi, config.width, config.height, config.pal_format.depth);
+            }
 
             // convert raw to palette
             pal.max = (1 << config.format.depth);
             ci_length = config.width * config.height * config.format.depth / 8;
             ci = malloc(ci_length);
-            pal_success = raw2ci(ci, &pal, raw16, raw16_length, config.format.depth);
+            if (config.quantize) {
+               palette_format format = imgr ? PAL_RGBA16 : PAL_IA16;
+               pal_success = raw2ci_quantize(ci, &pal, raw16, raw16_length, config.format.depth, format);
+               if (pal_success == 2) {
+                  ERROR("Warning: \"%s\" has more than %d colors, quantized to %d\n", config.img_filename, pal.max, pal.used);
+               }
+            } else {
+               pal_success = raw2ci(ci, &pal, raw16, raw16_length, config.format.depth);
+            }
             if (!pal_success) {
                ERROR("Error converting palette\n");
                exit(EXIT_FAILURE);
@@ -925,6 +2034,7 @@ int main(int argc, char *argv[])
          ERROR("Error writing %d bytes to \"%s\"\n", length, config.bin_filename);
       }
       fclose(bin_fp);
+      free(raw);
 
    } else {
       if (config.width <= 0 || config.height <= 0 || config.format.depth <= 0) {
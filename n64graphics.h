@@ -19,13 +19,23 @@ typedef struct _ia
 } ia;
 
 // CI palette
+#define PALETTE_SLOTS 512 // hash slots, a power of 2 at least twice the largest palette
+
 typedef struct
 {
    uint16_t data[256];
    int max; // max number of entries
    int used; // number of entries used
+   uint16_t slots[PALETTE_SLOTS]; // open addressing hash of data: entry index + 1, 0 if empty
 } palette_t;
 
+// layout of 16-bit palette colors, needed to compare them when quantizing
+typedef enum
+{
+   PAL_RGBA16, // RGBA5551
+   PAL_IA16,   // 8-bit intensity and alpha
+} palette_format;
+
 //---------------------------------------------------------
 // N64 RGBA/IA/I/CI -> intermediate RGBA/IA
 //---------------------------------------------------------
@@ -61,9 +71,35 @@ int i2raw(uint8_t *raw, const ia *img, int width, int height, int depth);
 // N64 CI raw data and palette to raw data (either RGBA16 or IA16)
 uint8_t *ci2raw(const uint8_t *rawci, const uint8_t *palette, int width, int height, int ci_depth);
 
-// convert from raw (RGBA16 or IA16) format to CI + palette
+// convert from raw (RGBA16 or IA16) format to CI + palette of at most pal->max entries
+// returns 1 on success, 0 if raw has more colors than fit in the palette
 int raw2ci(uint8_t *rawci, palette_t *pal, const uint8_t *raw, int raw_len, int ci_depth);
 
+// as raw2ci(), but quantizes raw with palette_quantize() if it has more colors than fit in the palette
+// returns 1 if the colors fit as they are, 2 if they were quantized
+int raw2ci_quantize(uint8_t *rawci, palette_t *pal, const uint8_t *raw, int raw_len, int ci_depth, palette_format format);
+
+
+//---------------------------------------------------------
+// CI palette building
+//---------------------------------------------------------
+
+// empty palette holding up to max entries
+void palette_init(palette_t *pal, int max);
+
+// find index of color in palette
+// returns palette index or -1 if not found
+int palette_find(const palette_t *pal, uint16_t color);
+
+// find color in palette, or add it if not there
+// returns palette index or -1 if palette full
+int palette_add(palette_t *pal, uint16_t color);
+
+// reduce colors to an empty palette of at most pal->max entries with median cut, weighted by use
+// colors: count 16-bit colors in format, repeats included
+// map: 0x10000 entries, receives the palette index each color used in 'colors' is replaced by
+void palette_quantize(palette_t *pal, const uint16_t *colors, int count, palette_format format, uint8_t *map);
+
 
 //---------------------------------------------------------
 // intermediate RGBA/IA -> PNG
@@ -75,6 +111,54 @@ int rgba2png(const char *png_filename, const rgba *img, int width, int height);
 // intermediate IA write to grayscale PNG file
 int ia2png(const char *png_filename, const ia *img, int width, int height);
 
+// set zlib compression level used for PNG output, 0 (fastest) to 9 (smallest)
+// the full range needs N64GRAPHICS_ZLIB (the default), stb_image_write's built-in deflate treats levels below 5 as 5
+void png_set_compression_level(int level);
+
+
+//---------------------------------------------------------
+// intermediate RGBA/IA -> PNG, batched on worker threads
+//---------------------------------------------------------
+
+typedef struct
+{
+   char *file_name;
+   uint8_t *data; // interleaved RGBA or IA bytes
+   int width;
+   int height;
+   int channels;
+   int written;
+   int *failed; // from the queue the job was added to
+} png_job;
+
+typedef struct
+{
+   png_job *jobs;
+   int count;
+   int allocated;
+   int *failed; // if not NULL, set to 1 by png_queue_flush() when a job added to this queue fails
+} png_queue;
+
+void png_queue_init(png_queue *queue);
+
+// queue intermediate RGBA to be written to PNG file by png_queue_flush()
+// img is copied, so the caller keeps ownership of it
+// returns 1 on success, 0 on allocation failure
+int png_queue_rgba(png_queue *queue, const char *png_filename, const rgba *img, int width, int height);
+
+// queue intermediate IA to be written to grayscale PNG file by png_queue_flush()
+int png_queue_ia(png_queue *queue, const char *png_filename, const ia *img, int width, int height);
+
+// move all jobs from src to the end of dst, leaving src empty
+void png_queue_append(png_queue *dst, png_queue *src);
+
+// encode and write all queued PNG files on a pool of worker threads, largest images first
+// threads: number of worker threads, <= 1 writes them on the calling thread
+// returns number of files that failed to write, queue is left empty
+int png_queue_flush(png_queue *queue, int threads);
+
+void png_queue_free(png_queue *queue);
+
 
 //---------------------------------------------------------
 // PNG -> intermediate RGBA/IA
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 
 #include <zlib.h>
 
@@ -12,6 +13,7 @@
 #include "libsfx.h"
 #include "mipsdisasm.h"
 #include "n64graphics.h"
+#include "parallel.h"
 #include "strutils.h"
 #include "utils.h"
 
@@ -31,6 +33,9 @@ typedef struct _arg_config
    bool large_texture_depth;
    bool keep_going;
    bool merge_pseudo;
+   bool incremental;
+   int threads;
+   int png_level;
 } arg_config;
 
 typedef enum {
@@ -51,6 +56,9 @@ static const arg_config default_args =
    .large_texture_depth = 16,
    .keep_going = false,
    .merge_pseudo = false,
+   .incremental = false,
+   .threads = 1,
+   .png_level = 8,
 };
 
 // static files
@@ -68,14 +76,60 @@ const char asm_header[] =
    ".include \"" GLOBALS_FILE "\"\n"
    "\n";
 
-static void print_spaces(FILE *fp, int count)
+static void print_spaces(strbuf *out, int count)
 {
    int i;
    for (i = 0; i < count; i++) {
-      fputc(' ', fp);
+      strbuf_putc(out, ' ');
    }
 }
 
+// write a generated text file with a single write
+static void write_text_output(const char *file_name, const strbuf *text)
+{
+   FILE *fp = fopen(file_name, "w");
+   if (fp == NULL) {
+      perror(file_name);
+      exit(1);
+   }
+   strbuf_write(text, fp);
+   fclose(fp);
+}
+
+// open a generated text file for writing
+// in incremental mode, output goes to a temporary file that close_output() only
+// moves over the original if the contents changed, so unchanged files keep their timestamps
+static FILE *open_output(const arg_config *args, const char *file_name)
+{
+   char tmp_name[FILENAME_MAX];
+   if (args->incremental) {
+      sprintf(tmp_name, "%s.tmp", file_name);
+      return fopen(tmp_name, "w");
+   }
+   return fopen(file_name, "w");
+}
+
+static void close_output(const arg_config *args, FILE *fp, const char *file_name)
+{
+   char tmp_name[FILENAME_MAX];
+   fclose(fp);
+   if (args->incremental) {
+      sprintf(tmp_name, "%s.tmp", file_name);
+      if (replace_file_changed(tmp_name, file_name) != 0) {
+         perror(file_name);
+      }
+   }
+}
+
+// write a generated binary file, leaving it untouched in incremental mode if unchanged
+static long write_output(const arg_config *args, const char *file_name, unsigned char *data, long length)
+{
+   if (args->incremental) {
+      return write_file_changed(file_name, data, length);
+   }
+   return write_file(file_name, data, length);
+}
+
 static n64_rom_format n64_rom_type(unsigned char *buf, unsigned int length)
 {
    const unsigned char bs[] = {0x37, 0x80, 0x40, 0x12}; // byte-swapped
@@ -91,43 +145,83 @@ static n64_rom_format n64_rom_type(unsigned char *buf, unsigned int length)
    return N64_ROM_INVALID;
 }
 
-static void gzip_decode_file(char *gzfilename, int offset, char *binfilename)
+// inflate gzip data in memory
+// returns buffer to be freed by the caller, or NULL on failure
+static unsigned char *gzip_decode(const unsigned char *in, unsigned int in_len, unsigned int *out_len)
 {
-#define CHUNK 0x4000
-   FILE *file;
-   FILE *fout;
    z_stream strm = {0};
-   unsigned char in[CHUNK];
-   unsigned char out[CHUNK];
-
-   // TODO: add some error checking
-   strm.zalloc = Z_NULL;
-   strm.zfree = Z_NULL;
-   strm.opaque = Z_NULL;
-   strm.avail_in = 0;
-   inflateInit2(&strm, 16+MAX_WBITS);
-
-   file = fopen(gzfilename, "rb");
-   fout = fopen(binfilename, "wb");
-   fseek(file, offset, SEEK_SET);
-   while (1) {
-      int bytes_read;
-      bytes_read = fread(in, sizeof(char), sizeof(in), file);
-      strm.avail_in = bytes_read;
-      strm.next_in = in;
-      do {
-         strm.avail_out = CHUNK;
-         strm.next_out = out;
-         inflate(&strm, Z_NO_FLUSH);
-         fwrite(out, sizeof(char), CHUNK - strm.avail_out, fout);
-      } while (strm.avail_out == 0);
-      if (feof(file)) {
+   unsigned char *out;
+   unsigned int out_size;
+   int ret;
+
+   if (inflateInit2(&strm, 16+MAX_WBITS) != Z_OK) {
+      return NULL;
+   }
+   // gzip trailer holds the uncompressed size mod 2^32, only used as a first guess
+   // capped at the max deflate ratio
+   out_size = 0x1000;
+   if (in_len >= 4) {
+      const unsigned char *isize = &in[in_len - 4];
+      unsigned int guess = isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((unsigned int)isize[3] << 24);
+      out_size = MAX(out_size, MIN(guess, in_len * 1032));
+   }
+   out = malloc(out_size);
+   strm.next_in = (unsigned char *)in;
+   strm.avail_in = in_len;
+   do {
+      if (strm.total_out == out_size) {
+         out_size *= 2;
+         out = realloc(out, out_size);
+      }
+      if (out == NULL) {
          inflateEnd(&strm);
-         break;
+         return NULL;
       }
+      strm.next_out = &out[strm.total_out];
+      strm.avail_out = out_size - strm.total_out;
+      ret = inflate(&strm, Z_NO_FLUSH);
+   } while (ret == Z_OK);
+   if (ret != Z_STREAM_END) {
+      inflateEnd(&strm);
+      free(out);
+      return NULL;
    }
-   fclose(file);
-   fclose(fout);
+   *out_len = strm.total_out;
+   inflateEnd(&strm);
+   return out;
+}
+
+// decompress a TYPE_BLAST, TYPE_GZIP or TYPE_MIO0 section straight from ROM data
+// returns buffer to be freed by the caller, or NULL on failure
+static unsigned char *decompress_section(unsigned char *data, const split_section *sec, unsigned int *out_len)
+{
+   unsigned char *lut;
+   int blast_len;
+   unsigned char *out = NULL;
+   switch (sec->type) {
+      case TYPE_BLAST:
+         // TODO: make this configurable?
+         switch (sec->subtype) {
+            case 4: lut = &data[0x047480]; break;
+            case 5: lut = &data[0x0998E0]; break; // TODO: fix this
+            default: lut = data; break;
+         }
+         out = blast_decode(&data[sec->start], sec->end - sec->start, sec->subtype, lut, &blast_len);
+         if (out) {
+            *out_len = blast_len;
+         }
+         break;
+      case TYPE_GZIP:
+         out = gzip_decode(&data[sec->start], sec->end - sec->start, out_len);
+         break;
+      case TYPE_MIO0:
+         // bounded by the section
+         out = mio0_decode_alloc(&data[sec->start], sec->end - sec->start, out_len);
+         break;
+      default:
+         break;
+   }
+   return out;
 }
 
 static int config_section_lookup(rom_config *config, unsigned int addr, char *label, int is_end)
@@ -169,7 +263,23 @@ static int config_section_lookup(rom_config *config, unsigned int addr, char *la
    return -1;
 }
 
-static void write_behavior(FILE *out, unsigned char *data, rom_config *config, int s, disasm_state *state)
+// append prefix and value as "0xXXXXXXXX"
+static void put_word(strbuf *out, const char *prefix, unsigned int value)
+{
+   strbuf_puts(out, prefix);
+   strbuf_append(out, "0x", 2);
+   strbuf_hex(out, value, 8);
+}
+
+// append ", label" and end the line
+static void put_label(strbuf *out, const char *label)
+{
+   strbuf_append(out, ", ", 2);
+   strbuf_puts(out, label);
+   strbuf_putc(out, '\n');
+}
+
+static void write_behavior(strbuf *out, unsigned char *data, rom_config *config, int s, disasm_state *state)
 {
    char label[128];
    unsigned int a, i;
@@ -186,7 +296,7 @@ static void write_behavior(FILE *out, unsigned char *data, rom_config *config, i
       if (beh_i < sec->child_count) {
          unsigned int offset = a - sec->start;
          if (offset == beh[beh_i].start) {
-            fprintf(out, "%s: # %04X\n", beh[beh_i].label, beh[beh_i].start);
+            strbuf_sprintf(out, "%s: # %04X\n", beh[beh_i].label, beh[beh_i].start);
             beh_i++;
          } else if (offset > beh[beh_i].start) {
             ERROR("Warning: skipped behavior %04X \"%s\"\n", beh[beh_i].start, beh[beh_i].label);
@@ -227,12 +337,12 @@ static void write_behavior(FILE *out, unsigned char *data, rom_config *config, i
             break;
       }
       val = read_u32_be(&data[a]);
-      fprintf(out, ".word 0x%08X", val);
+      put_word(out, ".word ", val);
       switch(data[a]) {
          case 0x0C: // behavior 0x0C is a function pointer
             val = read_u32_be(&data[a+4]);
             disasm_label_lookup(state, val, label);
-            fprintf(out, ", %s\n", label);
+            put_label(out, label);
             break;
          case 0x02: // jump to another behavior
          case 0x04: // jump to segmented address
@@ -241,18 +351,18 @@ static void write_behavior(FILE *out, unsigned char *data, rom_config *config, i
          case 0x2C: // sub-objects
             for (i = 4; i < len-4; i += 4) {
                val = read_u32_be(&data[a+i]);
-               fprintf(out, ", 0x%08X", val);
+               put_word(out, ", ", val);
             }
             val = read_u32_be(&data[a+len-4]);
             disasm_label_lookup(state, val, label);
-            fprintf(out, ", %s\n", label);
+            put_label(out, label);
             break;
          default:
             for (i = 4; i < len; i += 4) {
                val = read_u32_be(&data[a+i]);
-               fprintf(out, ", 0x%08X", val);
+               put_word(out, ", ", val);
             }
-            fprintf(out, "\n");
+            strbuf_putc(out, '\n');
             break;
       }
       a += len;
@@ -302,7 +412,7 @@ static geo_command geo_table[] =
    /* 0x20 */ {0x04, "geo_start_distance"},
 };
 
-static void write_geolayout(FILE *out, unsigned char *data, unsigned int start, unsigned int end, disasm_state *state)
+static void write_geolayout(strbuf *out, unsigned char *data, unsigned int start, unsigned int end, disasm_state *state)
 {
    const int INDENT_AMOUNT = 3;
    const int INDENT_START = INDENT_AMOUNT;
@@ -313,13 +423,13 @@ static void write_geolayout(FILE *out, unsigned char *data, unsigned int start,
    int cmd_len;
    int print_label = 1;
    indent = INDENT_START;
-   fprintf(out, ".include \"macros.inc\"\n"
+   strbuf_sprintf(out, ".include \"macros.inc\"\n"
                 ".include \"geo_commands.inc\"\n\n"
                 ".section .geo, \"a\"\n\n");
    while (a < end) {
       unsigned cmd = data[a];
       if (print_label) {
-         fprintf(out, "glabel geo_layout_X_%06X # %04X\n", a, a);
+         strbuf_sprintf(out, "glabel geo_layout_X_%06X # %04X\n", a, a);
          print_label = 0;
       }
       if ((cmd == 0x01 || cmd == 0x05) && indent > INDENT_AMOUNT) {
@@ -328,7 +438,7 @@ static void write_geolayout(FILE *out, unsigned char *data, unsigned int start,
       print_spaces(out, indent);
       if (cmd < DIM(geo_table)) {
          if (cmd != 0x10) { // special case 0x10 since multiple pseudo
-            fprintf(out, "%s", geo_table[cmd].macro);
+            strbuf_sprintf(out, "%s", geo_table[cmd].macro);
          }
       } else {
          ERROR("Unknown geo layout command: 0x%02X\n", cmd);
@@ -337,12 +447,12 @@ static void write_geolayout(FILE *out, unsigned char *data, unsigned int start,
       switch (cmd) {
          case 0x00: // 00 00 00 00 [SS SS SS SS]: branch and store
             tmp = read_u32_be(&data[a+4]);
-            fprintf(out, " geo_layout_%08X # 0x%08X", tmp, tmp);
+            strbuf_sprintf(out, " geo_layout_%08X # 0x%08X", tmp, tmp);
             break;
          case 0x01: // 01 00 00 00: terminate
          case 0x03: // 03 00 00 00: return from branch
             // no params
-            fprintf(out, "\n");
+            strbuf_putc(out, '\n');
             indent = INDENT_START;
             print_label = 1;
             break;
@@ -357,39 +467,39 @@ static void write_geolayout(FILE *out, unsigned char *data, unsigned int start,
             break;
          case 0x02: // 02 [AA] 00 00 [SS SS SS SS]
             tmp = read_u32_be(&data[a+4]);
-            fprintf(out, " %d, geo_layout_%08X # 0x%08X", data[a+1], tmp, tmp);
+            strbuf_sprintf(out, " %d, geo_layout_%08X # 0x%08X", data[a+1], tmp, tmp);
             break;
          case 0x08: // 08 00 00 [AA] [XX XX] [YY YY] [WW WW] [HH HH]
-            fprintf(out, " %d, %d, %d, %d, %d", data[a+3],
+            strbuf_sprintf(out, " %d, %d, %d, %d, %d", data[a+3],
                   read_s16_be(&data[a+4]), read_s16_be(&data[a+6]),
                   read_s16_be(&data[a+8]), read_s16_be(&data[a+10]));
             break;
          case 0x09: // 09 00 00 [AA]
-            fprintf(out, " %d", data[a+3]);
+            strbuf_sprintf(out, " %d", data[a+3]);
             break;
          case 0x0A: // 0A [AA] [BB BB] [NN NN] [FF FF] {EE EE EE EE}: set camera frustum
-            fprintf(out, " %d, %d, %d", read_s16_be(&data[a+2]), read_s16_be(&data[a+4]), read_s16_be(&data[a+6]));
+            strbuf_sprintf(out, " %d, %d, %d", read_s16_be(&data[a+2]), read_s16_be(&data[a+4]), read_s16_be(&data[a+6]));
             if (data[a+1] > 0) {
                cmd_len += 4;
                disasm_label_lookup(state, read_u32_be(&data[a+8]), label);
-               fprintf(out, ", %s", label);
+               strbuf_sprintf(out, ", %s", label);
             }
             break;
          case 0x0C: // 0C [AA] 00 00: enable/disable Z-buffer
-            fprintf(out, " %d", data[a+1]);
+            strbuf_sprintf(out, " %d", data[a+1]);
             break;
          case 0x0D: // 0D 00 00 00 [AA AA] [BB BB]: set render range
-            fprintf(out, " %d, %d", read_s16_be(&data[a+4]), read_s16_be(&data[a+6]));
+            strbuf_sprintf(out, " %d, %d", read_s16_be(&data[a+4]), read_s16_be(&data[a+6]));
             break;
          case 0x0E: // 0E 00 [NN NN] [AA AA AA AA]: switch/case
-            fprintf(out, " %d, geo_switch_case_%08X", read_s16_be(&data[a+2]), read_u32_be(&data[a+4]));
+            strbuf_sprintf(out, " %d, geo_switch_case_%08X", read_s16_be(&data[a+2]), read_u32_be(&data[a+4]));
             break;
          case 0x0F: // 0F 00 [TT TT] [XX XX] [YY YY] [ZZ ZZ] [UU UU] [VV VV] [WW WW] [AA AA AA AA]
-            fprintf(out, " %d, %d, %d, %d, %d, %d, %d", read_s16_be(&data[a+2]),
+            strbuf_sprintf(out, " %d, %d, %d, %d, %d, %d, %d", read_s16_be(&data[a+2]),
                   read_s16_be(&data[a+4]), read_s16_be(&data[a+6]), read_s16_be(&data[a+8]),
                   read_s16_be(&data[a+10]), read_s16_be(&data[a+12]), read_s16_be(&data[a+14]));
             disasm_label_lookup(state, read_u32_be(&data[a+0x10]), label);
-            fprintf(out, ", %s", label);
+            strbuf_sprintf(out, ", %s", label);
             break;
          case 0x10: // 10 [AA] [BB BB] [XX XX] [YY YY] [ZZ ZZ] [RX RX] [RY RY] [RZ RZ] {SS SS SS SS}: translate & rotate
          {
@@ -398,29 +508,29 @@ static void write_geolayout(FILE *out, unsigned char *data, unsigned int start,
             unsigned char layer = params & 0xF;
             switch (field_type) {
                case 0: // 10 [0L] 00 00 [TX TX] [TY TY] [TZ TZ] [RX RX] [RY RY] [RZ RZ] {SS SS SS SS}: translate & rotate
-                  fprintf(out, "geo_translate_rotate %d, %d, %d, %d, %d, %d, %d", layer,
+                  strbuf_sprintf(out, "geo_translate_rotate %d, %d, %d, %d, %d, %d, %d", layer,
                           read_s16_be(&data[a+4]), read_s16_be(&data[a+6]), read_s16_be(&data[a+8]),
                           read_s16_be(&data[a+10]), read_s16_be(&data[a+12]), read_s16_be(&data[a+14]));
                   cmd_len = 16;
                   break;
                case 1: // 10 [1L] [TX TX] [TY TY] [TZ TZ] {SS SS SS SS}: translate
-                  fprintf(out, "geo_translate %d, %d, %d, %d", layer,
+                  strbuf_sprintf(out, "geo_translate %d, %d, %d, %d", layer,
                           read_s16_be(&data[a+2]), read_s16_be(&data[a+4]), read_s16_be(&data[a+6]));
                   cmd_len = 8;
                   break;
                case 2: // 10 [2L] [RX RX] [RY RY] [RZ RZ] {SS SS SS SS}: rotate
-                  fprintf(out, "geo_rotate %d, %d, %d, %d", layer,
+                  strbuf_sprintf(out, "geo_rotate %d, %d, %d, %d", layer,
                           read_s16_be(&data[a+2]), read_s16_be(&data[a+4]), read_s16_be(&data[a+6]));
                   cmd_len = 8;
                   break;
                case 3: // 10 [3L] [RY RY] {SS SS SS SS}: rotate Y
-                  fprintf(out, "geo_rotate_y %d, %d", layer, read_s16_be(&data[a+2]));
+                  strbuf_sprintf(out, "geo_rotate_y %d, %d", layer, read_s16_be(&data[a+2]));
                   cmd_len = 4;
                   break;
             }
             if (params & 0x80) {
                tmp = read_u32_be(&data[a+cmd_len]);
-               fprintf(out, ", seg%X_dl_%08X", (tmp >> 24) & 0xFF, tmp);
+               strbuf_sprintf(out, ", seg%X_dl_%08X", (tmp >> 24) & 0xFF, tmp);
                cmd_len += 4;
             }
             break;
@@ -428,57 +538,57 @@ static void write_geolayout(FILE *out, unsigned char *data, unsigned int start,
          case 0x11: // 11 [P][L] [XX XX] [YY YY] [ZZ ZZ] {SS SS SS SS}: ? scene graph node, optional DL
          case 0x12: // 12 [P][L] [XX XX] [YY YY] [ZZ ZZ] {SS SS SS SS}: ? scene graph node, optional DL
          case 0x14: // 14 [P][L] [XX XX] [YY YY] [ZZ ZZ] {SS SS SS SS}: billboard model
-            fprintf(out, " 0x%02X, %d, %d, %d", data[a+1] & 0xF, read_s16_be(&data[a+2]),
+            strbuf_sprintf(out, " 0x%02X, %d, %d, %d", data[a+1] & 0xF, read_s16_be(&data[a+2]),
                   read_s16_be(&data[a+4]), read_s16_be(&data[a+6]));
             if (data[a+1] & 0x80) {
                disasm_label_lookup(state, read_u32_be(&data[a+8]), label);
-               fprintf(out, ", %s", label);
+               strbuf_sprintf(out, ", %s", label);
                cmd_len += 4;
             }
             break;
          case 0x13: // 13 [LL] [XX XX] [YY YY] [ZZ ZZ] [AA AA AA AA]: scene graph node with layer and translation
-            fprintf(out, " 0x%02X, %d, %d, %d", data[a+1],
+            strbuf_sprintf(out, " 0x%02X, %d, %d, %d", data[a+1],
                     read_s16_be(&data[a+2]), read_s16_be(&data[a+4]), read_s16_be(&data[a+6]));
             tmp = read_u32_be(&data[a+8]);
             if (tmp != 0x0) {
-               fprintf(out, ", seg%X_dl_%08X", data[a+8], tmp);
+               strbuf_sprintf(out, ", seg%X_dl_%08X", data[a+8], tmp);
             }
             break;
          case 0x15: // 15 [LL] 00 00 [AA AA AA AA]: load display list
-            fprintf(out, " 0x%02X, seg%X_dl_%08X", data[a+1], data[a+4], read_u32_be(&data[a+4]));
+            strbuf_sprintf(out, " 0x%02X, seg%X_dl_%08X", data[a+1], data[a+4], read_u32_be(&data[a+4]));
             break;
          case 0x16: // 16 00 00 [AA] 00 [BB] [CC CC]: start geo layout with shadow
-            fprintf(out, " 0x%02X, 0x%02X, %d", data[a+3], data[a+5], read_s16_be(&data[a+6]));
+            strbuf_sprintf(out, " 0x%02X, 0x%02X, %d", data[a+3], data[a+5], read_s16_be(&data[a+6]));
             break;
          case 0x18: // 18 00 [XX XX] [AA AA AA AA]: load polygons from asm
          case 0x19: // 19 00 [TT TT] [AA AA AA AA]: set background/skybox
             disasm_label_lookup(state, read_u32_be(&data[a+4]), label);
-            fprintf(out, " %d, %s", read_s16_be(&data[a+2]), label);
+            strbuf_sprintf(out, " %d, %s", read_s16_be(&data[a+2]), label);
             break;
          case 0x1B: // 1B 00 [XX XX]: ??
-            fprintf(out, " %d", read_s16_be(&data[a+2]));
+            strbuf_sprintf(out, " %d", read_s16_be(&data[a+2]));
             break;
          case 0x1C: // 1C [PP] [XX XX] [YY YY] [ZZ ZZ] [AA AA AA AA]
             disasm_label_lookup(state, read_u32_be(&data[a+8]), label);
-            fprintf(out, " 0x%02X, %d, %d, %d, %s", data[a+1], read_s16_be(&data[a+2]),
+            strbuf_sprintf(out, " 0x%02X, %d, %d, %d, %s", data[a+1], read_s16_be(&data[a+2]),
                     read_s16_be(&data[a+4]), read_s16_be(&data[a+6]), label);
             break;
          case 0x1D: // 1D [P][L] 00 00 [MM MM MM MM] {SS SS SS SS}: scale model
-            fprintf(out, " 0x%02X, %d", data[a+1] & 0xF, read_u32_be(&data[a+4]));
+            strbuf_sprintf(out, " 0x%02X, %d", data[a+1] & 0xF, read_u32_be(&data[a+4]));
             if (data[a+1] & 0x80) {
                disasm_label_lookup(state, read_u32_be(&data[a+8]), label);
-               fprintf(out, ", %s", label);
+               strbuf_sprintf(out, ", %s", label);
                cmd_len += 4;
             }
             break;
          case 0x20: // 20 00 [AA AA]: start geo layout with rendering area
-            fprintf(out, " %d", read_s16_be(&data[a+2]));
+            strbuf_sprintf(out, " %d", read_s16_be(&data[a+2]));
             break;
          default:
             ERROR("Unknown geo layout command: 0x%02X\n", cmd);
             break;
       }
-      fprintf(out, "\n");
+      strbuf_putc(out, '\n');
       switch (cmd) {
          case 0x04: // open_node
          case 0x08: // node_screen_area
@@ -493,7 +603,7 @@ static void write_geolayout(FILE *out, unsigned char *data, unsigned int start,
          a += cmd_len;
          cmd_len = 0;
          while (a < end && 0 == read_u32_be(&data[a])) {
-             fprintf(out, ".word 0x0\n");
+             strbuf_puts(out, ".word 0x0\n");
              a += 4;
          }
       }
@@ -501,7 +611,7 @@ static void write_geolayout(FILE *out, unsigned char *data, unsigned int start,
    }
 }
 
-static void write_level(FILE *out, unsigned char *data, rom_config *config, int s, disasm_state *state)
+static void write_level(strbuf *out, unsigned char *data, rom_config *config, int s, disasm_state *state)
 {
    char start_label[128];
    char end_label[128];
@@ -540,28 +650,25 @@ static void write_level(FILE *out, unsigned char *data, rom_config *config, int
             ptr_end = read_u32_be(&data[a+8]);
             config_section_lookup(config, ptr_start, start_label, 0);
             config_section_lookup(config,   ptr_end,   end_label, 1);
-            fprintf(out, ".word 0x");
-            for (i = 0; i < 4; i++) {
-               fprintf(out, "%02X", data[a+i]);
-            }
+            put_word(out, ".word ", read_u32_be(&data[a]));
             if (0 == strcmp("behavior_data", start_label)) {
-               fprintf(out, ", __load_%s, __load_%s", start_label, end_label);
+               strbuf_sprintf(out, ", __load_%s, __load_%s", start_label, end_label);
             } else {
-               fprintf(out, ", %s, %s", start_label, end_label);
+               strbuf_sprintf(out, ", %s, %s", start_label, end_label);
             }
             for (i = 12; i < data[a+1]; i++) {
                if ((i & 0x3) == 0) {
-                  fprintf(out, ", 0x");
+                  strbuf_puts(out, ", 0x");
                }
-               fprintf(out, "%02X", data[a+i]);
+               strbuf_hex(out, data[a+i], 2);
             }
-            fprintf(out, "\n");
+            strbuf_putc(out, '\n');
             break;
          case 0x11: // call function
          case 0x12: // call function
             ptr_start = read_u32_be(&data[a+0x4]);
             disasm_label_lookup(state, ptr_start, start_label);
-            fprintf(out, ".word 0x%08X, %s # %08X\n", read_u32_be(&data[a]), start_label, ptr_start);
+            strbuf_sprintf(out, ".word 0x%08X, %s # %08X\n", read_u32_be(&data[a]), start_label, ptr_start);
             break;
          case 0x16: // load ASM into RAM
             dst       = read_u32_be(&data[a+0x4]);
@@ -571,17 +678,14 @@ static void write_level(FILE *out, unsigned char *data, rom_config *config, int
             disasm_label_lookup(state, dst, dst_label);
             config_section_lookup(config, ptr_start, start_label, 0);
             config_section_lookup(config, ptr_end, end_label, 1);
-            fprintf(out, ".word 0x");
-            for (i = 0; i < 4; i++) {
-               fprintf(out, "%02X", data[a+i]);
-            }
-            fprintf(out, ", %s, %s, %s\n", dst_label, start_label, end_label);
+            put_word(out, ".word ", read_u32_be(&data[a]));
+            strbuf_sprintf(out, ", %s, %s, %s\n", dst_label, start_label, end_label);
             break;
          case 0x25: // load mario object with behavior
          case 0x24: // load object with behavior
-            fprintf(out, ".word 0x%08X", read_u32_be(&data[a]));
+            put_word(out, ".word ", read_u32_be(&data[a]));
             for (i = 4; i < data[a+1]-4; i+=4) {
-               fprintf(out, ", 0x%08X", read_u32_be(&data[a+i]));
+               put_word(out, ", ", read_u32_be(&data[a+i]));
             }
             dst = read_u32_be(&data[a+i]);
             if (beh_i >= 0) {
@@ -589,7 +693,8 @@ static void write_level(FILE *out, unsigned char *data, rom_config *config, int
                split_section *beh = config->sections[beh_i].children;
                for (i = 0; i < config->sections[beh_i].child_count; i++) {
                   if (offset == beh[i].start) {
-                     fprintf(out, ", %s", beh[i].label);
+                     strbuf_puts(out, ", ");
+                     strbuf_puts(out, beh[i].label);
                      break;
                   }
                }
@@ -597,30 +702,30 @@ static void write_level(FILE *out, unsigned char *data, rom_config *config, int
                   ERROR("Error: cannot find behavior %04X needed at offset %X\n", offset, a);
                }
             } else {
-               fprintf(out, ", 0x%08X", dst);
+               put_word(out, ", ", dst);
             }
-            fprintf(out, "\n");
+            strbuf_putc(out, '\n');
             break;
          default:
-            fprintf(out, ".word 0x%08X", read_u32_be(&data[a]));
+            put_word(out, ".word ", read_u32_be(&data[a]));
             for (i = 4; i < data[a+1]; i+=4) {
-               fprintf(out, ", 0x%08X", read_u32_be(&data[a+i]));
+               put_word(out, ", ", read_u32_be(&data[a+i]));
             }
-            fprintf(out, "\n");
+            strbuf_putc(out, '\n');
             break;
       }
       a += data[a+1];
    }
    // align to next 16-byte boundary
    if (a & 0x0F) {
-      fprintf(out, "# begin %s alignment 0x%X\n", sec->label, a);
-      fprintf(out, ".byte ");
-      fprint_hex_source(out, &data[a], ALIGN(a, 16) - a);
-      fprintf(out, "\n");
+      strbuf_sprintf(out, "# begin %s alignment 0x%X\n", sec->label, a);
+      strbuf_puts(out, ".byte ");
+      strbuf_hex_source(out, &data[a], ALIGN(a, 16) - a);
+      strbuf_putc(out, '\n');
       a = ALIGN(a, 16);
    }
    // remaining is geo layout script
-   fprintf(out, "# begin %s geo 0x%X\n", sec->label, a);
+   strbuf_sprintf(out, "# begin %s geo 0x%X\n", sec->label, a);
    write_geolayout(out, &data[sec->start], a - sec->start, sec->end - sec->start, state);
 }
 
@@ -673,7 +778,7 @@ static void parse_music_sequences(FILE *out, unsigned char *data, split_section
       fprintf(out, "\n%s:", seq_name);
 
       sprintf(m64_file, "%s/%s.m64", music_dir, seq_name);
-      write_file(m64_file, &data[sec->start + seq_bank.seq[i].start], seq_bank.seq[i].length);
+      write_output(args, m64_file, &data[sec->start + seq_bank.seq[i].start], seq_bank.seq[i].length);
 
       sprintf(m64_file_rel, "%s/%s.m64", MUSIC_SUBDIR, seq_name);
       fprintf(out, "\n.incbin \"%s\"\n", m64_file_rel);
@@ -726,7 +831,7 @@ static void generate_globals(arg_config *args, rom_config *config)
    char globalfilename[FILENAME_MAX];
    FILE *fglobal;
    sprintf(globalfilename, "%s/%s", args->output_dir, GLOBALS_FILE);
-   fglobal = fopen(globalfilename, "w");
+   fglobal = open_output(args, globalfilename);
    if (fglobal == NULL) {
       ERROR("Error opening %s\n", globalfilename);
       exit(3);
@@ -738,7 +843,7 @@ static void generate_globals(arg_config *args, rom_config *config)
    }
    fprintf(fglobal, "\n");
 
-   fclose(fglobal);
+   close_output(args, fglobal, globalfilename);
 }
 
 static void generate_macros(arg_config *args)
@@ -746,7 +851,7 @@ static void generate_macros(arg_config *args)
    char incfilename[FILENAME_MAX];
    FILE *finc;
    sprintf(incfilename, "%s/%s", args->output_dir, MACROS_FILE);
-   finc = fopen(incfilename, "w");
+   finc = open_output(args, incfilename);
    if (finc == NULL) {
       ERROR("Error opening %s\n", incfilename);
       exit(3);
@@ -757,7 +862,7 @@ static void generate_macros(arg_config *args)
                  ".macro vertex \\x, \\y, \\z, \\u, \\v, \\r=0xFF, \\g=0xFF, \\b=0xFF, \\a=0xFF\n"
                  "   .hword \\x, \\y, \\z, 0, \\u, \\v\n   .byte \\r, \\g, \\b, \\a\n"
                  ".endm\n");
-   fclose(finc);
+   close_output(args, finc, incfilename);
 }
 
 static void parse_sound_banks(FILE *out, unsigned char *data, split_section *secCtl, split_section *secTbl, arg_config *args, strbuf *makeheader)
@@ -818,7 +923,7 @@ static void generate_geo_macros(arg_config *args)
    char macrofilename[FILENAME_MAX];
    FILE *fmacro;
    sprintf(macrofilename, "%s/geo_commands.inc", args->output_dir);
-   fmacro = fopen(macrofilename, "w");
+   fmacro = open_output(args, macrofilename);
    if (fmacro == NULL) {
       ERROR("Error opening %s\n", macrofilename);
       exit(3);
@@ -1246,6 +1351,7 @@ static void generate_geo_macros(arg_config *args)
 ".endm\n"
 "\n"
    );
+   close_output(args, fmacro, macrofilename);
 }
 
 static void generate_ld_script(arg_config *args, rom_config *config)
@@ -1253,7 +1359,7 @@ static void generate_ld_script(arg_config *args, rom_config *config)
    char ldfilename[FILENAME_MAX];
    FILE *fld;
    sprintf(ldfilename, "%s/%s.ld", args->output_dir, config->basename);
-   fld = fopen(ldfilename, "w");
+   fld = open_output(args, ldfilename);
    if (fld == NULL) {
       ERROR("Error opening %s\n", ldfilename);
       exit(3);
@@ -1312,7 +1418,7 @@ static void generate_ld_script(arg_config *args, rom_config *config)
    }
    fprintf(fld, "}\n");
 
-   fclose(fld);
+   close_output(args, fld, ldfilename);
 }
 
 typedef struct
@@ -1345,10 +1451,10 @@ static const terrain_t terrain_table[] =
    {0x00FD, "pool_warp"},
 };
 
-char *terrain2str(unsigned type)
+// retval: buffer of at least 16 characters, used for names that are not in terrain_table
+static const char *terrain2str(unsigned type, char *retval)
 {
    unsigned i;
-   static char retval[16];
    if (0x1B <= type && type <= 0x1E) {
       sprintf(retval, "switch%02X", type);
       return retval;
@@ -1368,11 +1474,9 @@ char *terrain2str(unsigned type)
    return retval;
 }
 
-int collision2obj(char *binfilename, unsigned int binoffset, char *objfilename, char *name, float scale)
+int collision2obj(unsigned char *data, unsigned int binoffset, char *objfilename, char *name, float scale)
 {
-   unsigned char *data;
    FILE *fobj;
-   long in_size;
    unsigned vcount;
    unsigned tcount;
    unsigned cur_tcount;
@@ -1382,6 +1486,8 @@ int collision2obj(char *binfilename, unsigned int binoffset, char *objfilename,
    unsigned offset;
    unsigned i;
    unsigned vidx[3];
+   const char *terrain_name;
+   char terrain_buf[16];
    short x, y, z;
    int ret_len = 0;
 
@@ -1391,12 +1497,6 @@ int collision2obj(char *binfilename, unsigned int binoffset, char *objfilename,
       exit(EXIT_FAILURE);
    }
 
-   in_size = read_file(binfilename, &data);
-   if (in_size <= 0) {
-      ERROR("Error reading input file \"%s\"\n", binfilename);
-      exit(EXIT_FAILURE);
-   }
-
    offset = binoffset;
    if (data[offset] != 0x00 || data[offset+1] != 0x40) {
       ERROR("Unknown collision data %s.%X: %08X\n", name, offset, read_u32_be(data));
@@ -1440,8 +1540,9 @@ int collision2obj(char *binfilename, unsigned int binoffset, char *objfilename,
             v_per_t = 3;
             break;
       }
-      fprintf(fobj, "\ng %s_%05X_%s\n", name, binoffset, terrain2str(terrain));
-      fprintf(fobj, "usemtl %s\n", terrain2str(terrain));
+      terrain_name = terrain2str(terrain, terrain_buf);
+      fprintf(fobj, "\ng %s_%05X_%s\n", name, binoffset, terrain_name);
+      fprintf(fobj, "usemtl %s\n", terrain_name);
 
       INFO("Loading %u triangles of terrain %02X\n", cur_tcount, terrain);
       offset += 4;
@@ -1456,14 +1557,11 @@ int collision2obj(char *binfilename, unsigned int binoffset, char *objfilename,
    }
 
    fclose(fobj);
-   free(data);
 
    ret_len = offset - binoffset;
    return ret_len;
 }
 
-static void split_file(unsigned char *data, unsigned int length, arg_config *args, rom_config *config, disasm_state *state)
-{
 #define BIN_SUBDIR      "bin"
 #define MIO0_SUBDIR     "bin"
 #define TEXTURE_SUBDIR  "textures"
@@ -1471,6 +1569,690 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
 #define LEVEL_SUBDIR    "levels"
 #define MODEL_SUBDIR    "models"
 #define BEHAVIOR_SUBDIR "."
+
+// outputs of one section that are stitched into the shared files in section order
+typedef struct
+{
+   strbuf asm_out;     // main assembly file
+   strbuf make_rules;  // texture rules in Makefile.split
+   strbuf mio0_files;  // MIO0_FILES entries
+   strbuf level_files; // LEVEL_FILES entries
+   int cached;         // unchanged since the last split, files are already in place
+   int failed;         // a file failed to write, so the section isn't cached in the manifest
+   png_queue textures; // texture PNGs, encoded together once all sections are extracted
+   unsigned char *bin_data; // decompressed MIO0 block, written after its textures
+   long bin_len;
+   char *bin_file;
+   char *mio0_file;    // compressed MIO0 block, written after the decompressed one
+} section_output;
+
+#define SECTION_OUTPUT_PARTS 4
+
+static strbuf *section_output_part(section_output *out, int part)
+{
+   strbuf *parts[SECTION_OUTPUT_PARTS] = {&out->asm_out, &out->make_rules, &out->mio0_files, &out->level_files};
+   return parts[part];
+}
+
+// manifest of a previous split: hash of each section's inputs and its stitched outputs
+// stored as magic, u32 count, then per section u64 hash and the outputs as u32 length + text
+#define MANIFEST_FILE  "n64split.manifest"
+#define MANIFEST_MAGIC "N64SPLIT MANIFEST 1\n"
+#define HASH_INIT      0xCBF29CE484222325ULL
+
+typedef struct
+{
+   uint64_t hash;
+   const char *parts[SECTION_OUTPUT_PARTS];
+   unsigned int lengths[SECTION_OUTPUT_PARTS];
+} manifest_entry;
+
+typedef struct
+{
+   unsigned char *buf;
+   manifest_entry *entries;
+   int count;
+} manifest;
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(uint64_t h, const void *buf, size_t length)
+{
+   const unsigned char *bytes = buf;
+   for (size_t i = 0; i < length; i++) {
+      h = (h ^ bytes[i]) * 0x100000001B3ULL;
+   }
+   return h;
+}
+
+static uint64_t hash_u32(uint64_t h, unsigned int val)
+{
+   unsigned char buf[4];
+   write_u32_be(buf, val);
+   return hash_bytes(h, buf, sizeof(buf));
+}
+
+// config fields of a section and its children
+static uint64_t hash_section_config(uint64_t h, const split_section *sec)
+{
+   h = hash_bytes(h, sec->label, strlen(sec->label) + 1);
+   h = hash_u32(h, sec->start);
+   h = hash_u32(h, sec->end);
+   h = hash_u32(h, sec->vaddr);
+   h = hash_u32(h, sec->type);
+   h = hash_u32(h, sec->subtype);
+   h = hash_u32(h, sec->tex.offset);
+   h = hash_u32(h, sec->tex.palette);
+   h = hash_u32(h, sec->tex.width);
+   h = hash_u32(h, sec->tex.height);
+   h = hash_u32(h, sec->tex.depth);
+   h = hash_u32(h, sec->tex.format);
+   h = hash_u32(h, sec->child_count);
+   // pointer tables and instrument sets only use child_count
+   if (sec->children) {
+      for (int i = 0; i < sec->child_count; i++) {
+         h = hash_section_config(h, &sec->children[i]);
+      }
+   }
+   return h;
+}
+
+// inputs every section depends on: options, config labels, section layout and
+// behaviors for label lookups, and code sections for disassembly labels
+static uint64_t hash_split_context(const unsigned char *data, const arg_config *args, const rom_config *config)
+{
+   uint64_t h = hash_bytes(HASH_INIT, N64SPLIT_VERSION, sizeof(N64SPLIT_VERSION));
+   h = hash_u32(h, args->raw_texture);
+   h = hash_u32(h, args->large_texture);
+   h = hash_u32(h, args->large_texture_depth);
+   h = hash_u32(h, args->merge_pseudo);
+   h = hash_u32(h, args->png_level);
+   h = hash_bytes(h, &args->model_scale, sizeof(args->model_scale));
+   h = hash_bytes(h, config->basename, strlen(config->basename) + 1);
+   for (int i = 0; i < config->label_count; i++) {
+      h = hash_bytes(h, config->labels[i].name, strlen(config->labels[i].name) + 1);
+      h = hash_u32(h, config->labels[i].ram_addr);
+   }
+   for (int i = 0; i < config->section_count; i++) {
+      const split_section *sec = &config->sections[i];
+      h = hash_bytes(h, sec->label, strlen(sec->label) + 1);
+      h = hash_u32(h, sec->start);
+      h = hash_u32(h, sec->end);
+      h = hash_u32(h, sec->type);
+      if (sec->type == TYPE_SM64_BEHAVIOR) {
+         h = hash_section_config(h, sec);
+      } else if (sec->type == TYPE_ASM) {
+         h = hash_bytes(h, &data[sec->start], sec->end - sec->start);
+      }
+   }
+   return h;
+}
+
+// hash of everything a section's files are generated from, 0 if it can't be cached
+static uint64_t hash_section(const unsigned char *data, const split_section *sec, uint64_t context)
+{
+   // Blast types 4 and 5 decode with lookup tables from outside the section
+   if (sec->type == TYPE_BLAST && (sec->subtype == 4 || sec->subtype == 5)) {
+      return 0;
+   }
+   return hash_bytes(hash_section_config(context, sec), &data[sec->start], sec->end - sec->start);
+}
+
+// load a manifest, leaving it empty if it is missing or invalid
+static void manifest_load(const char *file_name, manifest *man)
+{
+   const unsigned int magic_len = sizeof(MANIFEST_MAGIC) - 1;
+   unsigned int offset;
+   long length;
+   int count;
+
+   man->entries = NULL;
+   man->count = 0;
+   length = read_file(file_name, &man->buf);
+   if (length < 0) {
+      man->buf = NULL;
+      return;
+   }
+   if ((unsigned long)length < magic_len + 4 || memcmp(man->buf, MANIFEST_MAGIC, magic_len)) {
+      return;
+   }
+   count = read_u32_be(&man->buf[magic_len]);
+   offset = magic_len + 4;
+   if (count <= 0 || (unsigned long)count > (unsigned long)length) {
+      return;
+   }
+   man->entries = calloc(count, sizeof(*man->entries));
+   for (int i = 0; i < count; i++) {
+      manifest_entry *entry = &man->entries[i];
+      if (offset + 8 > (unsigned long)length) {
+         return;
+      }
+      entry->hash = ((uint64_t)read_u32_be(&man->buf[offset]) << 32) | read_u32_be(&man->buf[offset + 4]);
+      offset += 8;
+      for (int p = 0; p < SECTION_OUTPUT_PARTS; p++) {
+         if (offset + 4 > (unsigned long)length) {
+            return;
+         }
+         entry->lengths[p] = read_u32_be(&man->buf[offset]);
+         offset += 4;
+         if (entry->lengths[p] > length - offset) {
+            return;
+         }
+         entry->parts[p] = (const char *)&man->buf[offset];
+         offset += entry->lengths[p];
+      }
+      // only count complete entries
+      man->count = i + 1;
+   }
+}
+
+static int manifest_match(const manifest *man, int s, uint64_t hash)
+{
+   return hash != 0 && s < man->count && man->entries[s].hash == hash;
+}
+
+static void manifest_free(manifest *man)
+{
+   free(man->entries);
+   free(man->buf);
+}
+
+static void manifest_save(const char *file_name, const uint64_t *hashes, section_output *outputs, int count)
+{
+   unsigned char buf[8];
+   FILE *fp = fopen(file_name, "wb");
+   if (fp == NULL) {
+      perror(file_name);
+      return;
+   }
+   fwrite(MANIFEST_MAGIC, 1, sizeof(MANIFEST_MAGIC) - 1, fp);
+   write_u32_be(buf, count);
+   fwrite(buf, 1, 4, fp);
+   for (int s = 0; s < count; s++) {
+      // a 0 hash never matches, so sections with failed writes are extracted again next time
+      uint64_t hash = outputs[s].failed ? 0 : hashes[s];
+      write_u32_be(buf, (unsigned int)(hash >> 32));
+      write_u32_be(&buf[4], (unsigned int)hash);
+      fwrite(buf, 1, 8, fp);
+      for (int p = 0; p < SECTION_OUTPUT_PARTS; p++) {
+         strbuf *part = section_output_part(&outputs[s], p);
+         write_u32_be(buf, part->index);
+         fwrite(buf, 1, 4, fp);
+         fwrite(part->buf, 1, part->index, fp);
+      }
+   }
+   fclose(fp);
+}
+
+typedef struct
+{
+   unsigned char *data;
+   arg_config *args;
+   rom_config *config;
+   disasm_state *state;
+   char bin_dir[FILENAME_MAX];
+   char mio0_dir[FILENAME_MAX];
+   char texture_dir[FILENAME_MAX];
+   char model_dir[FILENAME_MAX];
+   section_output *outputs;
+} split_ctx;
+
+// write all standalone files of section 's', called from parallel_for
+// anything that has to appear in a shared file in order goes into the section's outputs
+static void extract_section(void *job_ctx, int s)
+{
+   split_ctx *ctx = job_ctx;
+   unsigned char *data = ctx->data;
+   arg_config *args = ctx->args;
+   rom_config *config = ctx->config;
+   disasm_state *state = ctx->state;
+   section_output *out = &ctx->outputs[s];
+   split_section *sec = &config->sections[s];
+   char outfilename[FILENAME_MAX];
+   char outfilepath[FILENAME_MAX];
+   char mio0filename[FILENAME_MAX];
+   char start_label[256];
+   unsigned int w, h;
+
+   if (out->cached) {
+      return;
+   }
+
+   switch (sec->type) {
+      case TYPE_SM64_GEO:
+      {
+         char geofilename[FILENAME_MAX];
+         strbuf geo;
+         if (sec->label == NULL || sec->label[0] == '\0') {
+            sprintf(geofilename, "%s.%06X.geo.s", config->basename, sec->start);
+            sprintf(start_label, "L%06X", sec->start);
+         } else {
+            sprintf(geofilename, "%s.geo.s", sec->label);
+            strcpy(start_label, sec->label);
+         }
+         sprintf(outfilename, "%s/%s", GEO_SUBDIR, geofilename);
+         sprintf(outfilepath, "%s/%s", args->output_dir, outfilename);
+
+         // decode and write level data out
+         strbuf_alloc(&geo, 64 * KB);
+         write_geolayout(&geo, &data[sec->start], 0, sec->end - sec->start, state);
+         write_text_output(outfilepath, &geo);
+         strbuf_free(&geo);
+
+         strbuf_sprintf(&out->asm_out, "\n.align 4, 0x01\n");
+         strbuf_sprintf(&out->asm_out, ".global %s\n", start_label);
+         strbuf_sprintf(&out->asm_out, "%s:\n", start_label);
+         strbuf_sprintf(&out->asm_out, ".include \"%s\"\n", outfilename);
+         strbuf_sprintf(&out->asm_out, "%s_end:\n", start_label);
+         // append to Makefile
+         strbuf_sprintf(&out->level_files, " \\\n$(GEO_DIR)/%s", geofilename);
+         break;
+      }
+      case TYPE_BLAST:
+      case TYPE_GZIP:
+      case TYPE_MIO0:
+      {
+         char binfilename[FILENAME_MAX];
+         char extension[8] = {0};
+         char binasmfilename[FILENAME_MAX];
+         strbuf binasm;
+         unsigned char *binfilecontents;
+         unsigned int binfilelen = 0;
+         if (sec->label == NULL || sec->label[0] == '\0') {
+            sprintf(start_label, "L%06X", sec->start);
+         } else {
+            strcpy(start_label, sec->label);
+         }
+         sprintf(binfilename, "%s.s", start_label);
+         sprintf(binasmfilename, "%s/%s", ctx->bin_dir, binfilename);
+         // decode and write
+         strbuf_alloc(&binasm, 64 * KB);
+         strbuf_sprintf(&binasm, "# generated by n64split\n.section .rodata\n\n.include \"%s\"\n", MACROS_FILE);
+         switch (sec->type) {
+            case TYPE_BLAST:
+               INFO("Section Blast: %d %s %X-%X\n", sec->subtype, sec->label, sec->start, sec->end);
+               sprintf(extension, "bc%d", sec->subtype);
+               break;
+            case TYPE_MIO0:
+               INFO("Section MIO0: %s %X-%X\n", sec->label, sec->start, sec->end);
+               strcpy(extension, "mio0");
+               break;
+            case TYPE_GZIP:
+               INFO("Section GZIP: %s %X-%X\n", sec->label, sec->start, sec->end);
+               strcpy(extension, "gz");
+               break;
+            default:
+               break;
+         }
+         sprintf(outfilename, "%s.%s", start_label, extension);
+         sprintf(binfilename, "%s/%s.bin", ctx->bin_dir, start_label);
+         sprintf(mio0filename, "%s/%s", ctx->mio0_dir, outfilename);
+
+         strbuf_sprintf(&out->asm_out, "\n.align 4, 0x01\n");
+         strbuf_sprintf(&out->asm_out, ".global %s\n", start_label);
+         strbuf_sprintf(&out->asm_out, "%s:\n", start_label);
+         strbuf_sprintf(&out->asm_out, ".incbin \"%s/%s\"\n", MIO0_SUBDIR, outfilename);
+         strbuf_sprintf(&out->asm_out, "%s_end:\n", start_label);
+
+         // append to Makefile
+         strbuf_sprintf(&out->mio0_files, " \\\n$(MIO0_DIR)/%s", outfilename);
+
+         // extract compressed data
+         binfilecontents = decompress_section(data, sec, &binfilelen);
+         if (binfilecontents == NULL) {
+            ERROR("Error decoding section %s %X-%X\n", sec->label, sec->start, sec->end);
+            binfilelen = 0;
+         }
+
+         // extract texture data
+         if (sec->children && binfilecontents) {
+            unsigned int offset = 0;
+	       unsigned int next_offset = 0;
+            // TODO: add segment base to config file
+	       const unsigned int segment_base = 0x07000000;
+            unsigned int seg_address = segment_base + offset;
+            strbuf_sprintf(&out->make_rules, "$(MIO0_DIR)/%s.bin:", start_label);
+            INFO("Extracting textures from %s\n", start_label);
+            for (int t = 0; t < sec->child_count; t++) {
+               split_section *child = &sec->children[t];
+               texture *tex = &child->tex;
+               w = tex->width;
+               h = tex->height;
+		  if (next_offset > child->start) {
+                  ERROR("Error section overlap region %d (%X > %X)\n", t, next_offset, child->start);
+		     exit(1);
+		  }
+		  if (next_offset != child->start) {
+                  unsigned gap_len = child->start - next_offset;
+		     INFO("Filling gap before region %d (%d bytes)\n", t, gap_len);
+		     strbuf_sprintf(&binasm, "# Unknown region %06X-%06X [%X]\n", next_offset, child->start, gap_len);
+		     while (gap_len > 0) {
+                     int group_len = MIN(gap_len, 0x10);
+			strbuf_sprintf(&binasm, ".byte ");
+			strbuf_hex_source(&binasm, &binfilecontents[next_offset], group_len);
+			strbuf_sprintf(&binasm, "\n");
+			gap_len -= group_len;
+			next_offset += group_len;
+		     }
+               }
+               offset = tex->offset;
+               seg_address = segment_base + offset;
+		  if (child->end) {
+		     next_offset = child->end;
+		  } else if (tex->format == TYPE_F3D_LIGHT) {
+		     next_offset = child->start + 0x18;
+		  } else { // assume texture
+		     next_offset = child->start + w * h * tex->depth / 8;
+		  }
+               strbuf_sprintf(&binasm, "\n");
+               switch (tex->format) {
+                  case TYPE_TEX_IA:
+                  {
+                     sprintf(outfilename, "%s.%05X.ia%d", start_label, offset, tex->depth);
+                     ia *img = raw2ia(&binfilecontents[offset], w, h, tex->depth);
+                     if (img) {
+                        sprintf(outfilepath, "%s/%s.png", ctx->texture_dir, outfilename);
+                        png_queue_ia(&out->textures, outfilepath, img, w, h);
+                        free(img);
+                        strbuf_sprintf(&out->make_rules, " $(TEXTURE_DIR)/%s", outfilename);
+                     }
+                     if (args->raw_texture && binfilelen > 0) {
+                        INFO("Saving raw texture for %s\n", start_label);
+                        int len = w*h*tex->depth/8;
+                        sprintf(outfilepath, "%s/%s", ctx->texture_dir, outfilename);
+                        write_file(outfilepath, &binfilecontents[offset], len);
+                     }
+                     strbuf_sprintf(&binasm, "texture_%08X: # 0x%08X\n", seg_address, seg_address);
+                     strbuf_sprintf(&binasm, ".incbin \"%s\"\n", outfilename);
+                     break;
+                  }
+                  case TYPE_TEX_I:
+                  {
+                     sprintf(outfilename, "%s.%05X.i%d", start_label, offset, tex->depth);
+                     ia *img = raw2i(&binfilecontents[offset], w, h, tex->depth);
+                     if (img) {
+                        sprintf(outfilepath, "%s/%s.png", ctx->texture_dir, outfilename);
+                        png_queue_ia(&out->textures, outfilepath, img, w, h);
+                        free(img);
+                        strbuf_sprintf(&out->make_rules, " $(TEXTURE_DIR)/%s", outfilename);
+                     }
+                     if (args->raw_texture && binfilelen > 0) {
+                        INFO("Saving raw texture for %s\n", start_label);
+                        int len = w*h*tex->depth/8;
+                        sprintf(outfilepath, "%s/%s", ctx->texture_dir, outfilename);
+                        write_file(outfilepath, &binfilecontents[offset], len);
+                     }
+                     strbuf_sprintf(&binasm, "texture_%08X: # 0x%08X\n", seg_address, seg_address);
+                     strbuf_sprintf(&binasm, ".incbin \"%s\"\n", outfilename);
+                     break;
+                  }
+                  case TYPE_TEX_RGBA:
+                  {
+                     sprintf(outfilename, "%s.%05X.rgba%d", start_label, offset, tex->depth);
+                     rgba *img = raw2rgba(&binfilecontents[offset], w, h, tex->depth);
+                     if (img) {
+                        sprintf(outfilepath, "%s/%s.png", ctx->texture_dir, outfilename);
+                        png_queue_rgba(&out->textures, outfilepath, img, w, h);
+                        free(img);
+                        strbuf_sprintf(&out->make_rules, " $(TEXTURE_DIR)/%s", outfilename);
+                     }
+                     if (args->raw_texture && binfilelen > 0) {
+                        INFO("Saving raw texture for %s\n", start_label);
+                        int len = w*h*tex->depth/8;
+                        sprintf(outfilepath, "%s/%s", ctx->texture_dir, outfilename);
+                        write_file(outfilepath, &binfilecontents[offset], len);
+                     }
+                     strbuf_sprintf(&binasm, "texture_%08X: # 0x%08X\n", seg_address, seg_address);
+                     strbuf_sprintf(&binasm, ".incbin \"%s\"\n", outfilename);
+                     break;
+                  }
+                  case TYPE_TEX_SKYBOX:
+                  {
+                     // read in grid of MxN 32x32 tiles and save them as M*31xN*31 image
+                     rgba *img;
+                     unsigned int sky_offset = offset;
+                     int m, n;
+                     int tx, ty;
+                     m = w/32;
+                     n = h/32;
+                     img = malloc(w*h*sizeof(rgba));
+                     w -= m; // adjust for overlap
+                     h -= n;
+                     for (ty = 0; ty < n; ty++) {
+                        for (tx = 0; tx < m; tx++) {
+                           rgba *tile = raw2rgba(&binfilecontents[sky_offset], 32, 32, tex->depth);
+                           int cx, cy;
+                           for (cy = 0; cy < 31; cy++) {
+                              for (cx = 0; cx < 31; cx++) {
+                                 int out_off = 31*w*ty + 31*tx + w*cy + cx;
+                                 int in_off = 32*cy+cx;
+                                 img[out_off] = tile[in_off];
+                              }
+                           }
+                           free(tile);
+                           sky_offset += 32*32*2;
+                        }
+                     }
+                     sprintf(outfilename, "%s.%05X.skybox.png", start_label, offset);
+                     sprintf(outfilepath, "%s/%s", ctx->texture_dir, outfilename);
+                     png_queue_rgba(&out->textures, outfilepath, img, w, h);
+                     free(img);
+                     strbuf_sprintf(&out->make_rules, " $(TEXTURE_DIR)/%s", outfilename);
+                     break;
+                  }
+                  case TYPE_F3D_DL:
+                  {
+                     int sec_len = child->end - child->start;
+                     strbuf_sprintf(&binasm, "f3d_%08X: # 0x%08X\n", seg_address, seg_address);
+                     for (int o = 0; o < sec_len; o += 8) {
+                        unsigned char cmd = binfilecontents[offset + o];
+                        unsigned int second = read_u32_be(&binfilecontents[offset + o + 4]);
+                        put_word(&binasm, ".word ", read_u32_be(&binfilecontents[offset + o]));
+                        switch (cmd) {
+                           case 0x03: strbuf_puts(&binasm, ", light_"); break;
+                           case 0x04: strbuf_puts(&binasm, ", vertex_"); break;
+                           case 0x06: strbuf_puts(&binasm, ", f3d_"); break;
+                           case 0xFD: strbuf_puts(&binasm, ", texture_"); break;
+                           default:   strbuf_puts(&binasm, ", 0x"); break;
+                        }
+                        strbuf_hex(&binasm, second, 8);
+                        strbuf_putc(&binasm, '\n');
+                     }
+                     break;
+                  }
+                  case TYPE_F3D_LIGHT:
+                  {
+                     strbuf_sprintf(&binasm, "light_%08X: # 0x%08X\n", seg_address, seg_address);
+                     strbuf_sprintf(&binasm, ".byte ");
+                     strbuf_hex_source(&binasm, &binfilecontents[offset], 8);
+                     strbuf_sprintf(&binasm, "\n");
+                     strbuf_sprintf(&binasm, "light_%08X: # 0x%08X\n", seg_address + 8, seg_address + 8);
+                     strbuf_sprintf(&binasm, ".byte ");
+                     strbuf_hex_source(&binasm, &binfilecontents[offset + 8], 8);
+                     strbuf_sprintf(&binasm, "\n.byte ");
+                     strbuf_hex_source(&binasm, &binfilecontents[offset + 16], 8);
+                     strbuf_sprintf(&binasm, "\n");
+                     break;
+                  }
+                  case TYPE_F3D_VERTEX:
+                  {
+                     int sec_len = child->end - child->start;
+                     strbuf_sprintf(&binasm, "vertex_%08X: # 0x%08X\n", seg_address, seg_address);
+                     for (int o = 0; o < sec_len; o += 16) {
+                        strbuf_puts(&binasm, "vertex ");
+                        for (int h = 0; h < 6; h++) {
+                           // X, Y, Z, UNUSED, U, V
+                           if (h != 3) {
+                              strbuf_dec_pad(&binasm, read_s16_be(&binfilecontents[offset + o + h*2]), 6);
+                              strbuf_append(&binasm, ", ", 2);
+                           }
+                        }
+                        // R, G, B, A
+                        strbuf_hex_source(&binasm, &binfilecontents[offset + o + 12], 4);
+                        strbuf_putc(&binasm, '\n');
+                     }
+                     break;
+                  }
+                  case TYPE_SM64_COLLISION:
+                  {
+                     int sec_len = 0;
+                     sprintf(outfilename, "%s.%05X.collision", start_label, offset);
+                     sprintf(outfilepath, "%s/%s.obj", ctx->model_dir, outfilename);
+                     INFO("Generating collision model %s\n", outfilename);
+                     sec_len = collision2obj(binfilecontents, offset, outfilepath, start_label, args->model_scale);
+                     if (args->raw_texture && binfilelen > 0) {
+                        INFO("Saving raw collision for %s\n", start_label);
+                        sprintf(outfilepath, "%s/%s", ctx->texture_dir, outfilename);
+                        write_file(outfilepath, &binfilecontents[offset], sec_len);
+                     }
+                     strbuf_sprintf(&binasm, "collision_%06X: # 0x%08X\n", seg_address, seg_address);
+                     strbuf_sprintf(&binasm, ".incbin \"%s\"\n", outfilename);
+                     break;
+                  }
+                  default:
+                     ERROR("Don't know what to do with format %d\n", tex->format);
+                     exit(1);
+               }
+            }
+            strbuf_sprintf(&out->make_rules, "\n\t$(N64GRAPHICS) $@ $^\n\n");
+         }
+
+         // extract texture data
+         if (args->large_texture && binfilecontents) {
+            INFO("Generating large texture for %s\n", start_label);
+            w = 32;
+            h = binfilelen / (w * (args->large_texture_depth / 8));
+            rgba *img = raw2rgba(binfilecontents, w, h, args->large_texture_depth);
+            if (img) {
+               sprintf(outfilename, "%s.ALL.png", start_label);
+               sprintf(outfilepath, "%s/%s", ctx->texture_dir, outfilename);
+               png_queue_rgba(&out->textures, outfilepath, img, w, h);
+               free(img);
+               strbuf_sprintf(&out->make_rules, " $(TEXTURE_DIR)/%s", outfilename);
+               img = NULL;
+            }
+         }
+         // bin is written after the textures it is built from, then the compressed
+         // block, so 'make' doesn't rebuild them right away
+         if (binfilecontents) {
+            out->bin_data = binfilecontents;
+            out->bin_len = binfilelen;
+            out->bin_file = strdup(binfilename);
+         }
+         out->mio0_file = strdup(mio0filename);
+         write_text_output(binasmfilename, &binasm);
+         strbuf_free(&binasm);
+         break;
+      }
+      case TYPE_SM64_LEVEL:
+      {
+         strbuf level;
+         char levelfilename[FILENAME_MAX];
+         if (sec->label == NULL || sec->label[0] == '\0') {
+            sprintf(start_label, "L%06X", sec->start);
+         } else {
+            strcpy(start_label, sec->label);
+         }
+         INFO("Section relocated level: %s %X-%X\n", start_label, sec->start, sec->end);
+         sprintf(levelfilename, "%s.s", start_label);
+         sprintf(outfilename, "%s/%s", LEVEL_SUBDIR, levelfilename);
+         sprintf(outfilepath, "%s/%s", args->output_dir, outfilename);
+
+         // decode and write level data out
+         strbuf_alloc(&level, 64 * KB);
+         strbuf_sprintf(&level, "# level script %s from %X-%X\n\n", start_label, sec->start, sec->end);
+         strbuf_sprintf(&level, ".section .mio0\n\n");
+         strbuf_sprintf(&level, ".global %s\n", start_label);
+         strbuf_sprintf(&level, ".align 4, 0x01\n");
+         strbuf_sprintf(&level, "%s:\n", start_label);
+         write_level(&level, data, config, s, state);
+         strbuf_sprintf(&level, "%s_end:\n", start_label);
+         write_text_output(outfilepath, &level);
+         strbuf_free(&level);
+
+         if (sec->label == NULL || sec->label[0] == '\0') {
+            sprintf(start_label, "L%06X", sec->start);
+         } else {
+            strcpy(start_label, sec->label);
+         }
+         strbuf_sprintf(&out->asm_out, "\n.include \"%s\"\n", outfilename);
+         // append to Makefile
+         strbuf_sprintf(&out->level_files, " \\\n$(LEVEL_DIR)/%s", levelfilename);
+         break;
+      }
+      case TYPE_SM64_BEHAVIOR:
+      {
+         strbuf beh;
+         char beh_filename[FILENAME_MAX];
+         INFO("Section relocated behavior: %s %X-%X\n", sec->label, sec->start, sec->end);
+         if (sec->label == NULL || sec->label[0] == '\0') {
+            sprintf(beh_filename, "%06X.s", sec->start);
+         } else {
+            sprintf(beh_filename, "%s.s", sec->label);
+         }
+         sprintf(outfilename, "%s/%s", BEHAVIOR_SUBDIR, beh_filename);
+         sprintf(outfilepath, "%s/%s", args->output_dir, outfilename);
+         // decode and write level data out
+         strbuf_alloc(&beh, 256 * KB);
+         write_behavior(&beh, data, config, s, state);
+         write_text_output(outfilepath, &beh);
+         strbuf_free(&beh);
+
+         strbuf_sprintf(&out->asm_out, "\n.section .behavior, \"a\"\n");
+         strbuf_sprintf(&out->asm_out, "\n.global %s\n", sec->label);
+         strbuf_sprintf(&out->asm_out, ".global %s_end\n", sec->label);
+         strbuf_sprintf(&out->asm_out, "%s:\n", sec->label);
+         strbuf_sprintf(&out->asm_out, ".include \"%s\"\n", outfilename);
+         strbuf_sprintf(&out->asm_out, "%s_end:\n", sec->label);
+         strbuf_sprintf(&out->asm_out, "\n\n.section .mio0\n");
+
+         // append to Makefile
+         strbuf_sprintf(&out->level_files, " \\\n%s/%s", BEHAVIOR_SUBDIR, beh_filename);
+         break;
+      }
+      default:
+         break;
+   }
+}
+
+typedef struct
+{
+   rom_config *config;
+   disasm_state *state;
+   strbuf *asm_text; // disassembly of each TYPE_ASM section
+} disasm_ctx;
+
+// disassemble section 's' if it is code, called from parallel_for
+static void disassemble_section(void *job_ctx, int s)
+{
+   disasm_ctx *ctx = job_ctx;
+   split_section *sec = &ctx->config->sections[s];
+   if (sec->type == TYPE_ASM) {
+      strbuf_alloc(&ctx->asm_text[s], 0);
+      mipsdisasm_pass2_buf(&ctx->asm_text[s], ctx->state, sec->start);
+   }
+}
+
+// write the decompressed and compressed MIO0 block files of section 's' and free its buffers,
+// called from parallel_for once the textures built into them are written
+static void write_section_files(void *job_ctx, int s)
+{
+   split_ctx *ctx = job_ctx;
+   section_output *out = &ctx->outputs[s];
+   split_section *sec = &ctx->config->sections[s];
+   if (out->bin_file && write_file(out->bin_file, out->bin_data, out->bin_len) != out->bin_len) {
+      out->failed = 1;
+   }
+   if (out->mio0_file && write_file(out->mio0_file, &ctx->data[sec->start], sec->end - sec->start) != sec->end - sec->start) {
+      out->failed = 1;
+   }
+   png_queue_free(&out->textures);
+   free(out->bin_data);
+   free(out->bin_file);
+   free(out->mio0_file);
+}
+
+static void split_file(unsigned char *data, unsigned int length, arg_config *args, rom_config *config, disasm_state *state)
+{
    char makefile_name[FILENAME_MAX];
    char bin_dir[FILENAME_MAX];
    char mio0_dir[FILENAME_MAX];
@@ -1482,8 +2264,15 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
    char asmfilename[FILENAME_MAX];
    char outfilename[FILENAME_MAX];
    char outfilepath[FILENAME_MAX];
-   char mio0filename[FILENAME_MAX];
+   char manifest_name[FILENAME_MAX];
    char start_label[256];
+   split_ctx ctx;
+   disasm_ctx asm_ctx;
+   png_queue textures;
+   manifest prev;
+   uint64_t context;
+   uint64_t *hashes;
+   int cached_count = 0;
    strbuf makeheader_mio0;
    strbuf makeheader_level;
    strbuf makeheader_music;
@@ -1492,7 +2281,6 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
    int s;
    int i;
    unsigned int a;
-   unsigned int w, h;
    unsigned int prev_end = 0;
    unsigned int ptr;
    split_section *sections = config->sections;
@@ -1517,7 +2305,7 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
 
    // open main assembly file and write header
    sprintf(asmfilename, "%s/%s.s", args->output_dir, config->basename);
-   fasm = fopen(asmfilename, "w");
+   fasm = open_output(args, asmfilename);
    if (fasm == NULL) {
       ERROR("Error opening %s\n", asmfilename);
       exit(3);
@@ -1532,6 +2320,25 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
    strbuf_alloc(&makeheader_music, 256);
    strbuf_sprintf(&makeheader_music, "MUSIC_FILES =");
 
+   // hash section inputs to skip unchanged ones in incremental mode
+   sprintf(manifest_name, "%s/%s", args->output_dir, MANIFEST_FILE);
+   if (args->incremental) {
+      manifest_load(manifest_name, &prev);
+   } else {
+      memset(&prev, 0, sizeof(prev));
+   }
+   context = hash_split_context(data, args, config);
+   hashes = malloc(config->section_count * sizeof(*hashes));
+   for (s = 0; s < config->section_count; s++) {
+      hashes[s] = hash_section(data, &sections[s], context);
+   }
+
+   // disassemble code sections in parallel, the text is written in section order below
+   asm_ctx.config = config;
+   asm_ctx.state = state;
+   asm_ctx.asm_text = calloc(config->section_count, sizeof(*asm_ctx.asm_text));
+   parallel_for(config->section_count, args->threads, disassemble_section, &asm_ctx);
+
    //Need both sfx sections to parse
    split_section *sfxSec = NULL;
    
@@ -1564,7 +2371,7 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
          } else {
             sprintf(outfilename, "%s/%s.%06X.bin", BIN_SUBDIR, config->basename, prev_end);
             sprintf(outfilepath, "%s/%s", args->output_dir, outfilename);
-            write_file(outfilepath, &data[prev_end], gap_len);
+            write_output(args, outfilepath, &data[prev_end], gap_len);
             fprintf(fasm, ".incbin \"%s\"\n", outfilename);
          }
          fprintf(fasm, "\n");
@@ -1607,7 +2414,7 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
                sprintf(outfilename, "%s/%s.%06X.%s.bin", BIN_SUBDIR, config->basename, sec->start, sec->label);
             }
             sprintf(outfilepath, "%s/%s", args->output_dir, outfilename);
-            write_file(outfilepath, &data[sec->start], sec->end - sec->start);
+            write_output(args, outfilepath, &data[sec->start], sec->end - sec->start);
             if (sec->label == NULL || sec->label[0] == '\0') {
                sprintf(start_label, "L%06X", sec->start);
             } else {
@@ -1651,7 +2458,8 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
          case TYPE_ASM:
             INFO("Section asm: %X-%X\n", sec->start, sec->end);
             fprintf(fasm, "\n.section .text%08X, \"ax\"\n\n", sec->vaddr);
-            mipsdisasm_pass2(fasm, state, sec->start);
+            strbuf_write(&asm_ctx.asm_text[s], fasm);
+            strbuf_free(&asm_ctx.asm_text[s]);
             break;
          case TYPE_SM64_LEVEL:
             // relocate level scripts to .mio0 area
@@ -1666,16 +2474,18 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
             parse_music_sequences(fasm, data, sec, args, &makeheader_music);
             break;
          case TYPE_SFX_CTL:
-            if (sfxSec == NULL)
-               sfxSec = sec;
-            else
-               parse_sound_banks(fasm, data, sec, sfxSec, args, &makeheader_music); //Fix header later
-            break;
          case TYPE_SFX_TBL:
-            if (sfxSec == NULL)
+            if (sfxSec == NULL) {
                sfxSec = sec;
-            else
-               parse_sound_banks(fasm, data, sfxSec, sec, args, &makeheader_music); //Fix header later
+            } else {
+               split_section *secCtl = (sec->type == TYPE_SFX_CTL) ? sec : sfxSec;
+               split_section *secTbl = (sec->type == TYPE_SFX_TBL) ? sec : sfxSec;
+               // sounds are generated from both sections
+               hashes[s] = hash_section(data, sfxSec, hashes[s]);
+               if (!(args->incremental && manifest_match(&prev, s, hashes[s]))) {
+                  parse_sound_banks(fasm, data, secCtl, secTbl, args, &makeheader_music); //Fix header later
+               }
+            }
             break;
          case TYPE_INSTRUMENT_SET:
             parse_instrument_set(fasm, data, sec);
@@ -1688,13 +2498,15 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
       prev_end = sec->end;
    }
 
+   free(asm_ctx.asm_text);
+
    strbuf_alloc(&makeheader_mio0, 1024);
    strbuf_sprintf(&makeheader_mio0, "MIO0_FILES =");
 
    strbuf_alloc(&makeheader_level, 1024);
    strbuf_sprintf(&makeheader_level, "LEVEL_FILES =");
 
-   fmake = fopen(makefile_name, "w");
+   fmake = open_output(args, makefile_name);
    fprintf(fmake, "TARGET = %s\n", config->basename);
    fprintf(fmake, "LD_SCRIPT = $(TARGET).ld\n");
    fprintf(fmake, "MIO0_DIR = %s\n", MIO0_SUBDIR);
@@ -1704,437 +2516,76 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
    fprintf(fmake, "MUSIC_DIR = %s\n\n", MUSIC_SUBDIR);
 
    fprintf(fasm, "\n.section .mio0\n");
-   for (s = 0; s < config->section_count; s++) {
-      split_section *sec = &sections[s];
-      switch (sec->type) {
-         case TYPE_SM64_GEO:
-         {
-            char geofilename[FILENAME_MAX];
-            FILE *fgeo;
-            if (sec->label == NULL || sec->label[0] == '\0') {
-               sprintf(geofilename, "%s.%06X.geo.s", config->basename, sec->start);
-               sprintf(start_label, "L%06X", sec->start);
-            } else {
-               sprintf(geofilename, "%s.geo.s", sec->label);
-               strcpy(start_label, sec->label);
-            }
-            sprintf(outfilename, "%s/%s", GEO_SUBDIR, geofilename);
-            sprintf(outfilepath, "%s/%s", args->output_dir, outfilename);
-
-            // decode and write level data out
-            fgeo = fopen(outfilepath, "w");
-            if (fgeo == NULL) {
-               perror(outfilepath);
-               exit(1);
-            }
-            write_geolayout(fgeo, &data[sec->start], 0, sec->end - sec->start, state);
-            fclose(fgeo);
 
-            fprintf(fasm, "\n.align 4, 0x01\n");
-            fprintf(fasm, ".global %s\n", start_label);
-            fprintf(fasm, "%s:\n", start_label);
-            fprintf(fasm, ".include \"%s\"\n", outfilename);
-            fprintf(fasm, "%s_end:\n", start_label);
-            // append to Makefile
-            strbuf_sprintf(&makeheader_level, " \\\n$(GEO_DIR)/%s", geofilename);
-            break;
-         }
-         case TYPE_BLAST:
-         case TYPE_GZIP:
-         case TYPE_MIO0:
-         {
-            char binfilename[FILENAME_MAX];
-            char extension[8] = {0};
-            unsigned char *lut;
-            char binasmfilename[FILENAME_MAX];
-            FILE *binasm;
-            unsigned char *binfilecontents = NULL;
-            long binfilelen = 0;
-            if (sec->label == NULL || sec->label[0] == '\0') {
-               sprintf(start_label, "L%06X", sec->start);
-            } else {
-               strcpy(start_label, sec->label);
-            }
-            sprintf(binfilename, "%s.s", start_label);
-            sprintf(binasmfilename, "%s/%s", bin_dir, binfilename);
-            // decode and write
-            binasm = fopen(binasmfilename, "w");
-            if (binasm == NULL) {
-               perror(binasmfilename);
-               exit(1);
-            }
-            fprintf(binasm, "# generated by n64split\n.section .rodata\n\n.include \"%s\"\n", MACROS_FILE);
-            switch (sec->type) {
-               case TYPE_BLAST:
-                  INFO("Section Blast: %d %s %X-%X\n", sec->subtype, sec->label, sec->start, sec->end);
-                  sprintf(extension, "bc%d", sec->subtype);
-                  break;
-               case TYPE_MIO0:
-                  INFO("Section MIO0: %s %X-%X\n", sec->label, sec->start, sec->end);
-                  strcpy(extension, "mio0");
-                  break;
-               case TYPE_GZIP:
-                  INFO("Section GZIP: %s %X-%X\n", sec->label, sec->start, sec->end);
-                  strcpy(extension, "gz");
-                  break;
-               default:
-                  break;
-            }
-            sprintf(outfilename, "%s.%s", start_label, extension);
-            sprintf(binfilename, "%s/%s.bin", bin_dir, start_label);
-            sprintf(mio0filename, "%s/%s", mio0_dir, outfilename);
-            write_file(mio0filename, &data[sec->start], sec->end - sec->start);
-
-            fprintf(fasm, "\n.align 4, 0x01\n");
-            fprintf(fasm, ".global %s\n", start_label);
-            fprintf(fasm, "%s:\n", start_label);
-            fprintf(fasm, ".incbin \"%s/%s\"\n", MIO0_SUBDIR, outfilename);
-            fprintf(fasm, "%s_end:\n", start_label);
-
-            // append to Makefile
-            strbuf_sprintf(&makeheader_mio0, " \\\n$(MIO0_DIR)/%s", outfilename);
-
-            // TODO: use in-memory decompression?
-            // extract compressed data
-            switch (sec->type) {
-               case TYPE_BLAST:
-                  // TODO: make this configurable?
-                  switch (sec->subtype) {
-                     case 4: lut = &data[0x047480]; break;
-                     case 5: lut = &data[0x0998E0]; break; // TODO: fix this
-                     default: lut = data; break;
-                  }
-                  blast_decode_file(mio0filename, sec->subtype, binfilename, lut);
-                  break;
-               case TYPE_MIO0:
-                  mio0_decode_file(mio0filename, 0, binfilename);
-                  break;
-               case TYPE_GZIP:
-                  gzip_decode_file(mio0filename, 0, binfilename);
-                  break;
-               default:
-                  break;
-            }
-            binfilelen = read_file(binfilename, &binfilecontents);
-
-            // extract texture data
-            if (sec->children) {
-               unsigned int offset = 0;
-	       unsigned int next_offset = 0;
-               // TODO: add segment base to config file
-	       const unsigned int segment_base = 0x07000000;
-               unsigned int seg_address = segment_base + offset;
-               fprintf(fmake, "$(MIO0_DIR)/%s.bin:", start_label);
-               INFO("Extracting textures from %s\n", start_label);
-               for (int t = 0; t < sec->child_count; t++) {
-                  split_section *child = &sec->children[t];
-                  texture *tex = &child->tex;
-                  w = tex->width;
-                  h = tex->height;
-		  if (next_offset > child->start) {
-                     ERROR("Error section overlap region %d (%X > %X)\n", t, next_offset, child->start);
-		     exit(1);
-		  }
-		  if (next_offset != child->start) {
-                     unsigned gap_len = child->start - next_offset;
-		     INFO("Filling gap before region %d (%d bytes)\n", t, gap_len);
-		     fprintf(binasm, "# Unknown region %06X-%06X [%X]\n", next_offset, child->start, gap_len);
-		     while (gap_len > 0) {
-                        int group_len = MIN(gap_len, 0x10);
-			fprintf(binasm, ".byte ");
-			fprint_hex_source(binasm, &binfilecontents[next_offset], group_len);
-			fprintf(binasm, "\n");
-			gap_len -= group_len;
-			next_offset += group_len;
-		     }
-                  }
-                  offset = tex->offset;
-                  seg_address = segment_base + offset;
-		  if (child->end) {
-		     next_offset = child->end;
-		  } else if (tex->format == TYPE_F3D_LIGHT) {
-		     next_offset = child->start + 0x18;
-		  } else { // assume texture
-		     next_offset = child->start + w * h * tex->depth / 8;
-		  }
-                  fprintf(binasm, "\n");
-                  switch (tex->format) {
-                     case TYPE_TEX_IA:
-                     {
-                        sprintf(outfilename, "%s.%05X.ia%d", start_label, offset, tex->depth);
-                        ia *img = raw2ia(&binfilecontents[offset], w, h, tex->depth);
-                        if (img) {
-                           sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
-                           ia2png(outfilepath, img, w, h);
-                           free(img);
-                           fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
-                        }
-                        if (args->raw_texture && binfilelen > 0) {
-                           INFO("Saving raw texture for %s\n", start_label);
-                           int len = w*h*tex->depth/8;
-                           sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
-                           write_file(outfilepath, &binfilecontents[offset], len);
-                        }
-                        fprintf(binasm, "texture_%08X: # 0x%08X\n", seg_address, seg_address);
-                        fprintf(binasm, ".incbin \"%s\"\n", outfilename);
-                        break;
-                     }
-                     case TYPE_TEX_I:
-                     {
-                        sprintf(outfilename, "%s.%05X.i%d", start_label, offset, tex->depth);
-                        ia *img = raw2i(&binfilecontents[offset], w, h, tex->depth);
-                        if (img) {
-                           sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
-                           ia2png(outfilepath, img, w, h);
-                           free(img);
-                           fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
-                        }
-                        if (args->raw_texture && binfilelen > 0) {
-                           INFO("Saving raw texture for %s\n", start_label);
-                           int len = w*h*tex->depth/8;
-                           sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
-                           write_file(outfilepath, &binfilecontents[offset], len);
-                        }
-                        fprintf(binasm, "texture_%08X: # 0x%08X\n", seg_address, seg_address);
-                        fprintf(binasm, ".incbin \"%s\"\n", outfilename);
-                        break;
-                     }
-                     case TYPE_TEX_RGBA:
-                     {
-                        sprintf(outfilename, "%s.%05X.rgba%d", start_label, offset, tex->depth);
-                        rgba *img = raw2rgba(&binfilecontents[offset], w, h, tex->depth);
-                        if (img) {
-                           sprintf(outfilepath, "%s/%s.png", texture_dir, outfilename);
-                           rgba2png(outfilepath, img, w, h);
-                           free(img);
-                           fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
-                        }
-                        if (args->raw_texture && binfilelen > 0) {
-                           INFO("Saving raw texture for %s\n", start_label);
-                           int len = w*h*tex->depth/8;
-                           sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
-                           write_file(outfilepath, &binfilecontents[offset], len);
-                        }
-                        fprintf(binasm, "texture_%08X: # 0x%08X\n", seg_address, seg_address);
-                        fprintf(binasm, ".incbin \"%s\"\n", outfilename);
-                        break;
-                     }
-                     case TYPE_TEX_SKYBOX:
-                     {
-                        // read in grid of MxN 32x32 tiles and save them as M*31xN*31 image
-                        rgba *img;
-                        unsigned int sky_offset = offset;
-                        int m, n;
-                        int tx, ty;
-                        m = w/32;
-                        n = h/32;
-                        img = malloc(w*h*sizeof(rgba));
-                        w -= m; // adjust for overlap
-                        h -= n;
-                        for (ty = 0; ty < n; ty++) {
-                           for (tx = 0; tx < m; tx++) {
-                              rgba *tile = raw2rgba(&binfilecontents[sky_offset], 32, 32, tex->depth);
-                              int cx, cy;
-                              for (cy = 0; cy < 31; cy++) {
-                                 for (cx = 0; cx < 31; cx++) {
-                                    int out_off = 31*w*ty + 31*tx + w*cy + cx;
-                                    int in_off = 32*cy+cx;
-                                    img[out_off] = tile[in_off];
-                                 }
-                              }
-                              free(tile);
-                              sky_offset += 32*32*2;
-                           }
-                        }
-                        sprintf(outfilename, "%s.%05X.skybox.png", start_label, offset);
-                        sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
-                        rgba2png(outfilepath, img, w, h);
-                        free(img);
-                        fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
-                        break;
-                     }
-                     case TYPE_F3D_DL:
-                     {
-                        int sec_len = child->end - child->start;
-                        fprintf(binasm, "f3d_%08X: # 0x%08X\n", seg_address, seg_address);
-                        for (int o = 0; o < sec_len; o += 8) {
-                           unsigned char cmd = binfilecontents[offset + o];
-                           unsigned int second = read_u32_be(&binfilecontents[offset + o + 4]);
-                           fprintf(binasm, ".word 0x%08X, ", read_u32_be(&binfilecontents[offset + o]));
-                           switch (cmd) {
-                              case 0x03: // light
-                                 fprintf(binasm, "light_%08X\n", second);
-                                 break;
-                              case 0x04: // vertex
-                                 fprintf(binasm, "vertex_%08X\n", second);
-                                 break;
-                              case 0x06: // f3d
-                                 fprintf(binasm, "f3d_%08X\n", second);
-                                 break;
-                              case 0xFD: // texture
-                                 fprintf(binasm, "texture_%08X\n", second);
-                                 break;
-                              default:
-                                 fprintf(binasm, "0x%08X\n", second);
-                                 break;
-                           }
-                        }
-                        break;
-                     }
-                     case TYPE_F3D_LIGHT:
-                     {
-                        fprintf(binasm, "light_%08X: # 0x%08X\n", seg_address, seg_address);
-                        fprintf(binasm, ".byte ");
-                        fprint_hex_source(binasm, &binfilecontents[offset], 8);
-                        fprintf(binasm, "\n");
-                        fprintf(binasm, "light_%08X: # 0x%08X\n", seg_address + 8, seg_address + 8);
-                        fprintf(binasm, ".byte ");
-                        fprint_hex_source(binasm, &binfilecontents[offset + 8], 8);
-                        fprintf(binasm, "\n.byte ");
-                        fprint_hex_source(binasm, &binfilecontents[offset + 16], 8);
-                        fprintf(binasm, "\n");
-                        break;
-                     }
-                     case TYPE_F3D_VERTEX:
-                     {
-                        int sec_len = child->end - child->start;
-                        fprintf(binasm, "vertex_%08X: # 0x%08X\n", seg_address, seg_address);
-                        for (int o = 0; o < sec_len; o += 16) {
-                           fprintf(binasm, "vertex ");
-                           for (int h = 0; h < 6; h++) {
-                              // X, Y, Z, UNUSED, U, V
-                              if (h != 3) {
-                                 fprintf(binasm, "%6d, ", read_s16_be(&binfilecontents[offset + o + h*2]));
-                              }
-                           }
-                           // R, G, B, A
-                           fprint_hex_source(binasm, &binfilecontents[offset + o + 12], 4);
-                           fprintf(binasm, "\n");
-                        }
-                        break;
-                     }
-                     case TYPE_SM64_COLLISION:
-                     {
-                        int sec_len = 0;
-                        sprintf(outfilename, "%s.%05X.collision", start_label, offset);
-                        sprintf(outfilepath, "%s/%s.obj", model_dir, outfilename);
-                        INFO("Generating collision model %s\n", outfilename);
-                        sec_len = collision2obj(binfilename, offset, outfilepath, start_label, args->model_scale);
-                        if (args->raw_texture && binfilelen > 0) {
-                           INFO("Saving raw collision for %s\n", start_label);
-                           sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
-                           write_file(outfilepath, &binfilecontents[offset], sec_len);
-                        }
-                        fprintf(binasm, "collision_%06X: # 0x%08X\n", seg_address, seg_address);
-                        fprintf(binasm, ".incbin \"%s\"\n", outfilename);
-                        break;
-                     }
-                     default:
-                        ERROR("Don't know what to do with format %d\n", tex->format);
-                        exit(1);
-                  }
-               }
-               fprintf(fmake, "\n\t$(N64GRAPHICS) $@ $^\n\n");
-            }
-
-            // extract texture data
-            if (args->large_texture) {
-               INFO("Generating large texture for %s\n", start_label);
-               w = 32;
-               h = filesize(binfilename) / (w * (args->large_texture_depth / 8));
-               rgba *img = raw2rgba(binfilecontents, w, h, args->large_texture_depth);
-               if (img) {
-                  sprintf(outfilename, "%s.ALL.png", start_label);
-                  sprintf(outfilepath, "%s/%s", texture_dir, outfilename);
-                  rgba2png(outfilepath, img, w, h);
-                  free(img);
-                  fprintf(fmake, " $(TEXTURE_DIR)/%s", outfilename);
-                  img = NULL;
-               }
-            }
-            // TODO: write files in correct order to avoid this
-            // touch bin, then mio0 files so 'make' doesn't rebuild them right away
-            touch_file(binfilename);
-            touch_file(mio0filename);
-            fclose(binasm);
-            break;
+   // extract sections in parallel, then stitch their outputs together in order
+   ctx.data = data;
+   ctx.args = args;
+   ctx.config = config;
+   ctx.state = state;
+   strcpy(ctx.bin_dir, bin_dir);
+   strcpy(ctx.mio0_dir, mio0_dir);
+   strcpy(ctx.texture_dir, texture_dir);
+   strcpy(ctx.model_dir, model_dir);
+   ctx.outputs = malloc(config->section_count * sizeof(*ctx.outputs));
+   for (s = 0; s < config->section_count; s++) {
+      section_output *out = &ctx.outputs[s];
+      strbuf_alloc(&out->asm_out, 0);
+      strbuf_alloc(&out->make_rules, 0);
+      strbuf_alloc(&out->mio0_files, 0);
+      strbuf_alloc(&out->level_files, 0);
+      png_queue_init(&out->textures);
+      out->textures.failed = &out->failed;
+      out->failed = 0;
+      out->bin_data = NULL;
+      out->bin_file = NULL;
+      out->mio0_file = NULL;
+      // unchanged sections reuse their previous outputs and keep their files
+      out->cached = manifest_match(&prev, s, hashes[s]);
+      if (out->cached) {
+         manifest_entry *entry = &prev.entries[s];
+         for (i = 0; i < SECTION_OUTPUT_PARTS; i++) {
+            strbuf_sprintf(section_output_part(out, i), "%.*s", (int)entry->lengths[i], entry->parts[i]);
          }
-         case TYPE_SM64_LEVEL:
-         {
-            FILE *flevel;
-            char levelfilename[FILENAME_MAX];
-            if (sec->label == NULL || sec->label[0] == '\0') {
-               sprintf(start_label, "L%06X", sec->start);
-            } else {
-               strcpy(start_label, sec->label);
-            }
-            INFO("Section relocated level: %s %X-%X\n", start_label, sec->start, sec->end);
-            sprintf(levelfilename, "%s.s", start_label);
-            sprintf(outfilename, "%s/%s", LEVEL_SUBDIR, levelfilename);
-            sprintf(outfilepath, "%s/%s", args->output_dir, outfilename);
-
-            // decode and write level data out
-            flevel = fopen(outfilepath, "w");
-            if (flevel == NULL) {
-               perror(outfilepath);
-               exit(1);
-            }
-            fprintf(flevel, "# level script %s from %X-%X\n\n", start_label, sec->start, sec->end);
-            fprintf(flevel, ".section .mio0\n\n");
-            fprintf(flevel, ".global %s\n", start_label);
-            fprintf(flevel, ".align 4, 0x01\n");
-            fprintf(flevel, "%s:\n", start_label);
-            write_level(flevel, data, config, s, state);
-            fprintf(flevel, "%s_end:\n", start_label);
-            fclose(flevel);
+         cached_count++;
+      }
+   }
+   if (args->incremental) {
+      printf("Reusing %d of %d sections from previous split\n", cached_count, config->section_count);
+   }
+   parallel_for(config->section_count, args->threads, extract_section, &ctx);
 
-            if (sec->label == NULL || sec->label[0] == '\0') {
-               sprintf(start_label, "L%06X", sec->start);
-            } else {
-               strcpy(start_label, sec->label);
-            }
-            fprintf(fasm, "\n.include \"%s\"\n", outfilename);
-            // append to Makefile
-            strbuf_sprintf(&makeheader_level, " \\\n$(LEVEL_DIR)/%s", levelfilename);
-            break;
-         }
-         case TYPE_SM64_BEHAVIOR:
-         {
-            FILE *f_beh;
-            char beh_filename[FILENAME_MAX];
-            INFO("Section relocated behavior: %s %X-%X\n", sec->label, sec->start, sec->end);
-            if (sec->label == NULL || sec->label[0] == '\0') {
-               sprintf(beh_filename, "%06X.s", sec->start);
-            } else {
-               sprintf(beh_filename, "%s.s", sec->label);
-            }
-            sprintf(outfilename, "%s/%s", BEHAVIOR_SUBDIR, beh_filename);
-            sprintf(outfilepath, "%s/%s", args->output_dir, outfilename);
-            // decode and write level data out
-            f_beh = fopen(outfilepath, "w");
-            if (f_beh == NULL) {
-               perror(outfilepath);
-               exit(1);
-            }
-            write_behavior(f_beh, data, config, s, state);
-            fclose(f_beh);
-
-            fprintf(fasm, "\n.section .behavior, \"a\"\n");
-            fprintf(fasm, "\n.global %s\n", sec->label);
-            fprintf(fasm, ".global %s_end\n", sec->label);
-            fprintf(fasm, "%s:\n", sec->label);
-            fprintf(fasm, ".include \"%s\"\n", outfilename);
-            fprintf(fasm, "%s_end:\n", sec->label);
-            fprintf(fasm, "\n\n.section .mio0\n");
-
-            // append to Makefile
-            strbuf_sprintf(&makeheader_level, " \\\n%s/%s", BEHAVIOR_SUBDIR, beh_filename);
-            break;
-         }
-         default:
-            break;
+   // encode the textures of all sections on one pool so a few texture-heavy
+   // MIO0 blocks don't serialize on single workers, then write the bin and
+   // compressed blocks they are built into on the same number of threads
+   png_queue_init(&textures);
+   for (s = 0; s < config->section_count; s++) {
+      png_queue_append(&textures, &ctx.outputs[s].textures);
+   }
+   if (textures.count > 0) {
+      INFO("Writing %d textures\n", textures.count);
+      if (png_queue_flush(&textures, args->threads) > 0 && !args->keep_going) {
+         exit(EXIT_FAILURE);
       }
    }
+   png_queue_free(&textures);
+   parallel_for(config->section_count, args->threads, write_section_files, &ctx);
+
+   manifest_save(manifest_name, hashes, ctx.outputs, config->section_count);
+   manifest_free(&prev);
+   free(hashes);
+   for (s = 0; s < config->section_count; s++) {
+      section_output *out = &ctx.outputs[s];
+      fwrite(out->asm_out.buf, 1, out->asm_out.index, fasm);
+      fwrite(out->make_rules.buf, 1, out->make_rules.index, fmake);
+      strbuf_sprintf(&makeheader_mio0, "%s", out->mio0_files.buf);
+      strbuf_sprintf(&makeheader_level, "%s", out->level_files.buf);
+      strbuf_free(&out->asm_out);
+      strbuf_free(&out->make_rules);
+      strbuf_free(&out->mio0_files);
+      strbuf_free(&out->level_files);
+   }
+   free(ctx.outputs);
+
    fprintf(fmake, "\n\n%s", makeheader_mio0.buf);
    fprintf(fmake, "\n\n%s", makeheader_level.buf);
    fprintf(fmake, "\n\n%s", makeheader_music.buf);
@@ -2143,20 +2594,20 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
    strbuf_free(&makeheader_mio0);
    strbuf_free(&makeheader_level);
    strbuf_free(&makeheader_music);
-   fclose(fmake);
-   fclose(fasm);
+   close_output(args, fmake, makefile_name);
+   close_output(args, fasm, asmfilename);
 
    // output top-level makefile
    sprintf(makefile_name, "%s/Makefile", args->output_dir);
-   fmake = fopen(makefile_name, "w");
+   fmake = open_output(args, makefile_name);
    fprintf(fmake, makefile_data);
-   fclose(fmake);
+   close_output(args, fmake, makefile_name);
 
    // output collision model material file
    sprintf(makefile_name, "%s/collision.mtl", model_dir);
-   fmake = fopen(makefile_name, "w");
+   fmake = open_output(args, makefile_name);
    fprintf(fmake, collision_mtl_data);
-   fclose(fmake);
+   close_output(args, fmake, makefile_name);
 
    generate_ld_script(args, config);
    generate_geo_macros(args);
@@ -2164,12 +2615,14 @@ static void split_file(unsigned char *data, unsigned int length, arg_config *arg
 
 static void print_usage(void)
 {
-   ERROR("Usage: n64split [-c CONFIG] [-k] [-m] [-o OUTPUT_DIR] [-s SCALE] [-t] [-v] [-V] ROM\n"
+   ERROR("Usage: n64split [-c CONFIG] [-i] [-j N] [-k] [-m] [-o OUTPUT_DIR] [-s SCALE] [-t] [-v] [-V] [-z LEVEL] ROM\n"
          "\n"
          "n64split v" N64SPLIT_VERSION ": N64 ROM splitter, resource ripper, disassembler\n"
          "\n"
          "Optional arguments:\n"
          " -c CONFIG     ROM configuration file (default: determine from checksum)\n"
+         " -i            incremental: only extract sections that changed since the last split\n"
+         " -j N          number of threads to disassemble and extract sections with, 0 for all processors (default: %d)\n"
          " -k            keep going as much as possible after error\n"
          " -m            merge related instructions in to pseudoinstructions\n"
          " -o OUTPUT_DIR output directory (default: {CONFIG.basename}.split)\n"
@@ -2178,10 +2631,11 @@ static void print_usage(void)
          " -t            generate large texture for MIO0 blocks\n"
          " -v            verbose progress output\n"
          " -V            print version information\n"
+         " -z LEVEL      texture PNG compression level, 1 for fast dev splits to 9 for smallest files (default: %d)\n"
          "\n"
          "File arguments:\n"
          " ROM        input ROM file\n",
-         default_args.model_scale);
+         default_args.threads, default_args.model_scale, default_args.png_level);
    exit(1);
 }
 
@@ -2213,6 +2667,18 @@ static void parse_arguments(int argc, char *argv[], arg_config *config)
                }
                strcpy(config->config_file, argv[i]);
                break;
+            case 'i':
+               config->incremental = true;
+               break;
+            case 'j':
+               if (++i >= argc) {
+                  print_usage();
+               }
+               config->threads = strtoul(argv[i], NULL, 0);
+               if (config->threads <= 0) {
+                  config->threads = parallel_cpu_count();
+               }
+               break;
             case 'k':
                config->keep_going = true;
                break;
@@ -2244,6 +2710,12 @@ static void parse_arguments(int argc, char *argv[], arg_config *config)
                print_version();
                exit(0);
                break;
+            case 'z':
+               if (++i >= argc) {
+                  print_usage();
+               }
+               config->png_level = strtol(argv[i], NULL, 0);
+               break;
             default:
                print_usage();
                break;
@@ -2263,28 +2735,207 @@ static void parse_arguments(int argc, char *argv[], arg_config *config)
    }
 }
 
+#define CONFIGS_DIR "configs"
+// binary cache of parsed configs with an index keyed by checksums, kept in the user's cache
+// directory with one file per configs directory
+// layout: config_cache_header, config_index_entry[count], config_write_binary() blobs
+#define CONFIG_CACHE_MAGIC "N64SPLIT CONFIGS 2\n"
+
+typedef struct
+{
+   char magic[24];
+   unsigned int count;
+} config_cache_header;
+
+typedef struct
+{
+   char file[256];
+   int64_t mtime;
+   int64_t size;
+   unsigned int checksum1;
+   unsigned int checksum2;
+   unsigned int valid;  // parsed without errors
+   unsigned int offset; // binary config in cache file
+   unsigned int length;
+} config_index_entry;
+
+// cache file for CONFIGS_DIR under $XDG_CACHE_HOME, ~/.cache or %LOCALAPPDATA%, named by a
+// hash of the directory's absolute path so separate checkouts don't overwrite each other's cache
+// returns 1 if cache_file is set, 0 if there is no cache directory to use or the path is too long
+static int config_cache_path(char *cache_file, size_t size)
+{
+   char configs_path[FILENAME_MAX];
+   char cache_dir[FILENAME_MAX];
+   const char *base;
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+   if (_fullpath(configs_path, CONFIGS_DIR, sizeof(configs_path)) == NULL) {
+      return 0;
+   }
+   base = getenv("LOCALAPPDATA");
+   if (base == NULL || base[0] == '\0') {
+      return 0;
+   }
+   snprintf(cache_dir, sizeof(cache_dir), "%s", base);
+#else
+   if (realpath(CONFIGS_DIR, configs_path) == NULL) {
+      return 0;
+   }
+   base = getenv("XDG_CACHE_HOME");
+   if (base != NULL && base[0] != '\0') {
+      snprintf(cache_dir, sizeof(cache_dir), "%s", base);
+   } else {
+      base = getenv("HOME");
+      if (base == NULL || base[0] == '\0') {
+         return 0;
+      }
+      snprintf(cache_dir, sizeof(cache_dir), "%s/.cache", base);
+   }
+#endif
+   make_dir(cache_dir);
+   strncat(cache_dir, "/n64split", sizeof(cache_dir) - strlen(cache_dir) - 1);
+   make_dir(cache_dir);
+   return (size_t)snprintf(cache_file, size, "%s/configs-%016" PRIX64 ".cache", cache_dir,
+                           hash_bytes(HASH_INIT, configs_path, strlen(configs_path))) < size;
+}
+
+static const config_cache_header *config_cache_check(const rom_file *cache, long cache_len)
+{
+   const config_cache_header *head = (const config_cache_header *)cache->data;
+   if (cache_len < (long)sizeof(*head) || strcmp(head->magic, CONFIG_CACHE_MAGIC) ||
+       head->count > (cache_len - sizeof(*head)) / sizeof(config_index_entry)) {
+      return NULL;
+   }
+   return head;
+}
+
+static void config_cache_write(const char *cache_file, const config_index_entry *index, unsigned char **blobs,
+                               const unsigned char *old_data, int count)
+{
+   char tmp_name[FILENAME_MAX];
+   config_cache_header head = {CONFIG_CACHE_MAGIC, count};
+   unsigned int offset = sizeof(head) + count * sizeof(*index);
+   config_index_entry *out_index;
+   FILE *fp;
+
+   if ((size_t)snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", cache_file) >= sizeof(tmp_name)) {
+      INFO("Config cache path too long: %s\n", cache_file);
+      return;
+   }
+   fp = fopen(tmp_name, "wb");
+   if (fp == NULL) {
+      INFO("Can't write config cache %s\n", tmp_name);
+      return;
+   }
+   fwrite(&head, sizeof(head), 1, fp);
+   out_index = malloc(count * sizeof(*out_index));
+   memcpy(out_index, index, count * sizeof(*out_index));
+   for (int i = 0; i < count; i++) {
+      out_index[i].offset = offset;
+      offset += out_index[i].length;
+   }
+   fwrite(out_index, sizeof(*out_index), count, fp);
+   // unchanged configs are copied over from the old cache
+   for (int i = 0; i < count; i++) {
+      if (blobs[i]) {
+         fwrite(blobs[i], 1, index[i].length, fp);
+      } else if (index[i].length) {
+         fwrite(&old_data[index[i].offset], 1, index[i].length, fp);
+      }
+   }
+   free(out_index);
+   fclose(fp);
+   if (replace_file_changed(tmp_name, cache_file) != 0) {
+      remove(tmp_name);
+   }
+}
+
 static int detect_config_file(unsigned int c1, unsigned int c2, rom_config *config)
 {
-#define CONFIGS_DIR "configs"
    dir_list list;
-   int config_ret;
+   rom_file cache;
+   char cache_file[FILENAME_MAX];
+   int use_cache;
+   long cache_len = -1;
+   const config_cache_header *head = NULL;
+   const config_index_entry *old_index = NULL;
+   config_index_entry *index;
+   unsigned char **blobs;
+   int stale = 0;
+   int found = -1;
    int ret_val = 0;
    int i;
 
    dir_list_ext(CONFIGS_DIR, ".yaml", &list);
 
+   // only the index and the matching config are touched in the mapped cache
+   use_cache = config_cache_path(cache_file, sizeof(cache_file));
+   if (use_cache) {
+      cache_len = rom_map(&cache, cache_file, ROM_READ);
+   }
+   if (cache_len >= 0) {
+      head = config_cache_check(&cache, cache_len);
+      if (head) {
+         old_index = (const config_index_entry *)&cache.data[sizeof(*head)];
+      }
+   }
+
+   index = calloc(list.count, sizeof(*index));
+   blobs = calloc(list.count, sizeof(*blobs));
    for (i = 0; i < list.count; i++) {
-      config_ret = config_parse_file(list.files[i], config);
-      INFO("Checking config file '%s' (%X, %X)\n", list.files[i], config->checksum1, config->checksum2);
-      if (config_ret == 0 && c1 == config->checksum1 && c2 == config->checksum2) {
-         ERROR("Using config file: %s\n", list.files[i]);
-         ret_val = 1;
-         break;
-      } else {
+      config_index_entry *entry = &index[i];
+      struct stat st;
+      unsigned int j;
+      snprintf(entry->file, sizeof(entry->file), "%s", list.files[i]);
+      if (stat(list.files[i], &st) == 0) {
+         entry->mtime = st.st_mtime;
+         entry->size = st.st_size;
+      }
+      for (j = 0; head && j < head->count; j++) {
+         const config_index_entry *old = &old_index[j];
+         if (!strcmp(old->file, entry->file) && old->mtime == entry->mtime && old->size == entry->size &&
+             old->offset <= cache_len && old->length <= cache_len - old->offset) {
+            *entry = *old;
+            break;
+         }
+      }
+      // re-parse configs that are new or changed since the cache was written
+      if (head == NULL || j >= head->count) {
+         stale = 1;
+         if (config_parse_file(list.files[i], config) == 0) {
+            entry->valid = 1;
+            entry->checksum1 = config->checksum1;
+            entry->checksum2 = config->checksum2;
+            blobs[i] = config_write_binary(config, &entry->length);
+         }
          config_free(config);
       }
+      INFO("Checking config file '%s' (%X, %X)\n", list.files[i], entry->checksum1, entry->checksum2);
+      if (found < 0 && entry->valid && c1 == entry->checksum1 && c2 == entry->checksum2) {
+         found = i;
+      }
+   }
+
+   if (found >= 0) {
+      const unsigned char *blob = blobs[found] ? blobs[found] : &cache.data[index[found].offset];
+      if (config_read_binary(blob, index[found].length, config) == 0) {
+         ERROR("Using config file: %s\n", list.files[found]);
+         ret_val = 1;
+      }
    }
 
+   if (use_cache && (stale || head == NULL || head->count != (unsigned int)list.count)) {
+      config_cache_write(cache_file, index, blobs, head ? cache.data : NULL, list.count);
+   }
+
+   if (cache_len >= 0) {
+      rom_unmap(&cache);
+   }
+   for (i = 0; i < list.count; i++) {
+      free(blobs[i]);
+   }
+   free(blobs);
+   free(index);
    dir_list_free(&list);
 
    return ret_val;
@@ -2295,6 +2946,10 @@ int main(int argc, char *argv[])
    arg_config args;
    rom_config config;
    disasm_state *state;
+   disasm_range *asm_ranges;
+   int asm_count;
+   int function_count;
+   rom_file rom;
    long len;
    unsigned char *data;
    int ret_val;
@@ -2305,12 +2960,15 @@ int main(int argc, char *argv[])
 
    args = default_args;
    parse_arguments(argc, argv, &args);
+   png_set_compression_level(args.png_level);
 
-   len = read_file(args.input_file, &data);
+   // map ROM privately so byte swapping doesn't modify the input file
+   len = rom_map(&rom, args.input_file, ROM_READ);
 
    if (len <= 0) {
       return 2;
    }
+   data = rom.data;
 
    // confirm valid N64 ROM
    rom_type = n64_rom_type(data, len);
@@ -2362,19 +3020,26 @@ int main(int argc, char *argv[])
 
    // first pass disassembler on each asm section
    INFO("Running first pass disassembler...\n");
+   asm_ranges = malloc(config.section_count * sizeof(*asm_ranges));
+   asm_count = 0;
    for (i = 0; i < config.section_count; i++) {
       if (config.sections[i].type == TYPE_ASM) {
          unsigned int start = config.sections[i].start;
          unsigned int end = config.sections[i].end;
          unsigned int vaddr = config.sections[i].vaddr;
          if (end <= (unsigned int)len) {
-            mipsdisasm_pass1(data, start, end - start, vaddr, state);
+            asm_ranges[asm_count].offset = start;
+            asm_ranges[asm_count].length = end - start;
+            asm_ranges[asm_count].vaddr = vaddr;
+            asm_count++;
          } else {
             ERROR("Trying to disassemble past end of file (%X > %X)\n", end, (unsigned int)len);
             exit(1);
          }
       }
    }
+   mipsdisasm_pass1_parallel(data, asm_ranges, asm_count, args.threads, state);
+   free(asm_ranges);
 
    // split the ROM
    INFO("Splitting ROM...\n");
@@ -2391,6 +3056,13 @@ int main(int argc, char *argv[])
    percent = (float)(100 * size) / (float)(len);
    printf("Total decoded section size:  %X/%lX (%.2f%%)\n", size, len, percent);
    size = 0;
+   function_count = disasm_function_count(state);
+   for (i = 0; i < function_count; i++) {
+      size += disasm_function_get(state, i)->jump_table_count;
+   }
+   printf("Functions found:             %d (%u jump tables)\n", function_count, size);
+
+   rom_unmap(&rom);
 
    return 0;
 }
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+
+#include "parallel.h"
+
+#if defined(_WIN32)
+  #include <windows.h>
+  typedef CRITICAL_SECTION parallel_lock;
+  #define lock_init(L_)    InitializeCriticalSection(L_)
+  #define lock_destroy(L_) DeleteCriticalSection(L_)
+  #define lock_acquire(L_) EnterCriticalSection(L_)
+  #define lock_release(L_) LeaveCriticalSection(L_)
+#else
+  #include <pthread.h>
+  #include <unistd.h>
+  typedef pthread_mutex_t parallel_lock;
+  #define lock_init(L_)    pthread_mutex_init(L_, NULL)
+  #define lock_destroy(L_) pthread_mutex_destroy(L_)
+  #define lock_acquire(L_) pthread_mutex_lock(L_)
+  #define lock_release(L_) pthread_mutex_unlock(L_)
+#endif
+
+typedef struct
+{
+   parallel_fn fn;
+   void *ctx;
+   int count;
+   int next; // next job index to hand out, guarded by lock
+   parallel_lock lock;
+} parallel_pool;
+
+// worker loop: grab the next job index until all are handed out
+static void parallel_worker(parallel_pool *pool)
+{
+   for (;;) {
+      int index;
+      lock_acquire(&pool->lock);
+      index = pool->next++;
+      lock_release(&pool->lock);
+      if (index >= pool->count) {
+         break;
+      }
+      pool->fn(pool->ctx, index);
+   }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI parallel_thread(LPVOID arg)
+{
+   parallel_worker(arg);
+   return 0;
+}
+#else
+static void *parallel_thread(void *arg)
+{
+   parallel_worker(arg);
+   return NULL;
+}
+#endif
+
+int parallel_cpu_count(void)
+{
+#if defined(_WIN32)
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   return count > 0 ? (int)count : 1;
+#endif
+}
+
+void parallel_for(int count, int threads, parallel_fn fn, void *ctx)
+{
+   parallel_pool pool;
+   int started = 0;
+   int i;
+
+   if (threads > count) {
+      threads = count;
+   }
+   if (threads <= 1) {
+      for (i = 0; i < count; i++) {
+         fn(ctx, i);
+      }
+      return;
+   }
+
+   pool.fn = fn;
+   pool.ctx = ctx;
+   pool.count = count;
+   pool.next = 0;
+   lock_init(&pool.lock);
+
+   // calling thread acts as one of the workers
+#if defined(_WIN32)
+   HANDLE *handles = malloc((threads - 1) * sizeof(*handles));
+   for (i = 0; i < threads - 1; i++) {
+      handles[started] = CreateThread(NULL, 0, parallel_thread, &pool, 0, NULL);
+      if (handles[started] != NULL) {
+         started++;
+      }
+   }
+   parallel_worker(&pool);
+   if (started > 0) {
+      WaitForMultipleObjects(started, handles, TRUE, INFINITE);
+   }
+   for (i = 0; i < started; i++) {
+      CloseHandle(handles[i]);
+   }
+#else
+   pthread_t *handles = malloc((threads - 1) * sizeof(*handles));
+   for (i = 0; i < threads - 1; i++) {
+      if (pthread_create(&handles[started], NULL, parallel_thread, &pool) == 0) {
+         started++;
+      }
+   }
+   parallel_worker(&pool);
+   for (i = 0; i < started; i++) {
+      pthread_join(handles[i], NULL);
+   }
+#endif
+
+   free(handles);
+   lock_destroy(&pool.lock);
+}
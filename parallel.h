@@ -0,0 +1,22 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+// function prototypes
+
+// job callback for parallel_for()
+// ctx: user context passed through from parallel_for()
+// index: job index in [0, count)
+typedef void (*parallel_fn)(void *ctx, int index);
+
+// number of online processors, at least 1
+int parallel_cpu_count(void);
+
+// run fn(ctx, index) for every index in [0, count) on a pool of worker threads
+// jobs are handed out in index order, but may complete in any order
+// count: number of jobs
+// threads: number of worker threads, <= 1 runs all jobs on the calling thread
+// fn: job callback
+// ctx: user context passed to fn
+void parallel_for(int count, int threads, parallel_fn fn, void *ctx);
+
+#endif // PARALLEL_H_
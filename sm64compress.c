@@ -1,15 +1,20 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "libmio0.h"
 #include "libsm64.h"
+#include "parallel.h"
 #include "utils.h"
 
 #define SM64COMPRESS_VERSION "0.2a"
 
 #define MAX_REFS 64
 
+// extended data starts at 8MB, only blocks at or after this are relocated
+#define EXT_ROM_OFFSET 0x800000
+
 typedef struct
 {
    unsigned int level;  // original level script offset where referenced
@@ -38,19 +43,39 @@ typedef struct
    char *in_filename;
    char *out_filename;
    unsigned int alignment;
-   char compress;
+   int compress; // MIO0 compression level, 0 to disable
+   int threads;
    char dump;
    char fix_f3d;
    char fix_geo;
 } compress_config;
 
+// result of compressing one block
+typedef struct
+{
+   unsigned char *cmp; // compressed data, NULL if block is copied as is
+   int cmp_len;
+   int raw_len;        // decompressed length of BLOCK_MIO0 blocks
+} compress_job;
+
+// shared state for compress_block() workers
+typedef struct
+{
+   const compress_config *config;
+   const block *blocks;
+   const unsigned char *in_buf;
+   unsigned int in_length;
+   compress_job *jobs;
+} compress_ctx;
+
 // default configuration
 static const compress_config default_config = 
 {
    NULL, // input filename
    NULL, // output filename
    16,   // block alignment
-   0,    // compress all MIO0 blocks
+   0,    // compress all MIO0 blocks (level)
+   1,    // threads
    0,    // dump
    0,    // f3d
    0,    // geo
@@ -58,22 +83,24 @@ static const compress_config default_config =
 
 static void print_usage(void)
 {
-   ERROR("Usage: sm64compress [-a ALIGNMENT] [-c] [-d] [-f] [-g] [-v] FILE [OUT_FILE]\n"
+   ERROR("Usage: sm64compress [-a ALIGNMENT] [-c [LEVEL]] [-d] [-f] [-g] [-j N] [-v] FILE [OUT_FILE]\n"
          "\n"
          "sm64compress v" SM64COMPRESS_VERSION ": Super Mario 64 ROM compressor and fixer\n"
          "\n"
          "Optional arguments:\n"
          " -a ALIGNMENT byte boundary to align blocks (default: %d)\n"
-         " -c           compress all 0x17 blocks using MIO0 (experimental)\n"
+         " -c [LEVEL]   compress all 0x17 blocks using MIO0 (experimental)\n"
+         "              LEVEL: %d = fast (default), %d = best (smallest, slower)\n"
          " -d           dump blocks to 'dump' directory\n"
          " -f           fix F3D combine blending parameters\n"
          " -g           fix geo layout display list layers\n"
+         " -j N         number of threads to compress with, 0 for all processors (default: %d)\n"
          " -v           verbose progress output\n"
          "\n"
          "File arguments:\n"
          " FILE         input ROM file\n"
          " OUT_FILE     output compressed ROM file (default: replaces input extension with .out.z64)\n",
-         default_config.alignment);
+         default_config.alignment, MIO0_LEVEL_FAST, MIO0_LEVEL_BEST, default_config.threads);
    exit(1);
 }
 
@@ -100,7 +127,20 @@ static void parse_arguments(int argc, char *argv[], compress_config *config)
                }
                break;
             case 'c':
-               config->compress = 1;
+               config->compress = MIO0_LEVEL_DEFAULT;
+               // optional numeric level argument
+               if (i + 1 < argc && isdigit((unsigned char)argv[i+1][0])) {
+                  char *end;
+                  unsigned long level = strtoul(argv[i+1], &end, 0);
+                  if (*end == '\0') {
+                     if (level < MIO0_LEVEL_FAST || level > MIO0_LEVEL_BEST) {
+                        ERROR("Error: MIO0 level must be %d or %d\n", MIO0_LEVEL_FAST, MIO0_LEVEL_BEST);
+                        exit(2);
+                     }
+                     config->compress = level;
+                     i++;
+                  }
+               }
                break;
             case 'd':
                config->dump = 1;
@@ -111,6 +151,15 @@ static void parse_arguments(int argc, char *argv[], compress_config *config)
             case 'g':
                config->fix_geo = 1;
                break;
+            case 'j':
+               if (++i >= argc) {
+                  print_usage();
+               }
+               config->threads = strtoul(argv[i], NULL, 0);
+               if (config->threads <= 0) {
+                  config->threads = parallel_cpu_count();
+               }
+               break;
             case 'v':
                g_verbosity = 1;
                break;
@@ -333,6 +382,45 @@ static void fix_geo(unsigned char *buf, int len)
    }
 }
 
+// compress a single extended ROM block into its own buffer
+// parallel_for() callback, only reads shared data and writes jobs[index]
+static void compress_block(void *arg, int index)
+{
+   compress_ctx *ctx = arg;
+   const block *blk = &ctx->blocks[index];
+   compress_job *job = &ctx->jobs[index];
+   const unsigned char *blk_buf = &ctx->in_buf[blk->old];
+   int block_len = blk->old_end - blk->old;
+
+   if (blk->old < EXT_ROM_OFFSET) {
+      return;
+   }
+   if (blk->type == BLOCK_MIO0) {
+      // decompress to remove fake header and recompress
+      // decoding is bounded by the end of the ROM and rejects corrupt blocks
+      mio0_stream stream;
+      mio0_header_t head;
+      unsigned char *raw;
+      if (!mio0_decode_header(blk_buf, &head)) {
+         return;
+      }
+      raw = malloc(head.dest_size);
+      mio0_stream_init(&stream, raw, head.dest_size, ctx->in_length - blk->old);
+      if (mio0_stream_feed(&stream, blk_buf, ctx->in_length - blk->old) != MIO0_STREAM_DONE) {
+         free(raw);
+         return;
+      }
+      job->raw_len = head.dest_size;
+      job->cmp = malloc(MIO0_HEADER_LENGTH + 4 + (job->raw_len + 7) / 8 + job->raw_len);
+      job->cmp_len = mio0_encode_ex(raw, job->raw_len, job->cmp, ctx->config->compress);
+      free(raw);
+   } else if (blk->compressible) {
+      // compress blocks that don't have a fake header and are compressible
+      job->cmp = malloc(MIO0_HEADER_LENGTH + 4 + (block_len + 7) / 8 + block_len);
+      job->cmp_len = mio0_encode_ex(blk_buf, block_len, job->cmp, ctx->config->compress);
+   }
+}
+
 // find and compact/compress all MIO0 blocks
 // config: configuration to determine alignment and compression
 // in_buf: buffer containing entire contents of SM64 data in big endian
@@ -349,13 +437,13 @@ static int sm64_compress_mio0(const compress_config *config,
 #define SEGMENT2_ROM_OFFSET 0x800000
 #define SEGMENT2_ROM_END    0x81BB64
    block block_table[MAX_BLOCKS];
-   unsigned char *tmp_raw = NULL;
-   unsigned char *tmp_cmp = NULL;
+   compress_job jobs[MAX_BLOCKS];
    int block_count = 0;
    int out_length;
    int cur_offset;
 
    memset(block_table, 0, sizeof(block_table));
+   memset(jobs, 0, sizeof(jobs));
 
    // hard code ASM pointer
    block_table[0].old     = SEGMENT2_ROM_OFFSET;
@@ -386,16 +474,38 @@ static int sm64_compress_mio0(const compress_config *config,
    }
 #endif
 
-   // allocate 1MB buffer for MIO0 compression
+   // implement fixes
+   // TODO: this is liberally applied to all data
+   // TODO: this assumes fake MIO0 headers
+   for (int i = 0; i < block_count; i++) {
+      block *blk = &block_table[i];
+      if (blk->old >= EXT_ROM_OFFSET) {
+         int block_len = blk->old_end - blk->old;
+         if (config->fix_f3d) {
+            fix_f3d(&in_buf[blk->old], block_len);
+         }
+         if (config->fix_geo) {
+            fix_geo(&in_buf[blk->old], block_len);
+         }
+      }
+   }
+
+   // compress all blocks independently into their own buffers
    if (config->compress) {
-      tmp_raw = malloc(512*KB);
-      tmp_cmp = malloc(512*KB);
+      compress_ctx ctx;
+      ctx.config = config;
+      ctx.blocks = block_table;
+      ctx.in_buf = in_buf;
+      ctx.in_length = in_length;
+      ctx.jobs = jobs;
+      parallel_for(block_count, config->threads, compress_block, &ctx);
    }
 
-#define EXT_ROM_OFFSET 0x800000
+   // lay out blocks in sorted order
    cur_offset = EXT_ROM_OFFSET;
    for (int i = 0; i < block_count; i++) {
       block *blk = &block_table[i];
+      compress_job *job = &jobs[i];
       // only relocate extended data
       if (blk->old < EXT_ROM_OFFSET) {
          blk->new = blk->old;
@@ -404,28 +514,14 @@ static int sm64_compress_mio0(const compress_config *config,
          unsigned char *src;
          int src_len;
          int block_len = blk->old_end - blk->old;
-         // implement fixes
-         // TODO: this is liberally applied to all data
-         // TODO: this assumes fake MIO0 headers
-         if (config->fix_f3d) {
-            fix_f3d(&in_buf[blk->old], block_len);
-         }
-         if (config->fix_geo) {
-            fix_geo(&in_buf[blk->old], block_len);
-         }
-         if (config->compress && blk->type == BLOCK_MIO0) {
-            // decompress to remove fake header and recompress
-            int raw_len = mio0_decode(&in_buf[blk->old], tmp_raw, NULL);
-            int cmp_len = mio0_encode(tmp_raw, raw_len, tmp_cmp);
-            src = tmp_cmp;
-            src_len = cmp_len;
-            INFO("Compressed %08X[%06X=%06X] => %08X[%06X]\n", blk->old, block_len, raw_len, cur_offset, cmp_len);
-         } else if(config->compress && blk->compressible) {
-            // compress blocks that don't have a fake header and are compressible
-            int cmp_len = mio0_encode(&in_buf[blk->old], block_len, tmp_cmp);
-            src = tmp_cmp;
-            src_len = cmp_len;
-            INFO("Compressed %08X[%06X] => %08X[%06X]\n", blk->old, block_len, cur_offset, cmp_len);
+         if (job->cmp != NULL && blk->type == BLOCK_MIO0) {
+            src = job->cmp;
+            src_len = job->cmp_len;
+            INFO("Compressed %08X[%06X=%06X] => %08X[%06X]\n", blk->old, block_len, job->raw_len, cur_offset, src_len);
+         } else if (job->cmp != NULL) {
+            src = job->cmp;
+            src_len = job->cmp_len;
+            INFO("Compressed %08X[%06X] => %08X[%06X]\n", blk->old, block_len, cur_offset, src_len);
             for (int r = 0; r < blk->ref_count; r++) {
                if (blk->refs[r].type == 0x17) {
                   blk->refs[r].type = 0x18;
@@ -434,6 +530,9 @@ static int sm64_compress_mio0(const compress_config *config,
                }
             }
          } else {
+            if (config->compress && blk->type == BLOCK_MIO0) {
+               ERROR("Error: invalid MIO0 block at %08X, copying as is\n", blk->old);
+            }
             src = &in_buf[blk->old];
             src_len = block_len;
          }
@@ -570,9 +669,10 @@ static int sm64_compress_mio0(const compress_config *config,
       }
    }
 
-   if (tmp_raw != NULL) {
-      free(tmp_raw);
-      free(tmp_cmp);
+   for (int i = 0; i < block_count; i++) {
+      if (jobs[i].cmp != NULL) {
+         free(jobs[i].cmp);
+      }
    }
 
    // align output length to nearest MB
@@ -586,10 +686,11 @@ int main(int argc, char *argv[])
 {
    char out_filename[FILENAME_MAX];
    compress_config config;
+   rom_file in_rom;
+   rom_file out_rom;
    unsigned char *in_buf = NULL;
    unsigned char *out_buf = NULL;
    long in_size;
-   long bytes_written;
    int out_size;
 
    // get configuration from arguments
@@ -600,17 +701,22 @@ int main(int argc, char *argv[])
       generate_filename(config.in_filename, config.out_filename, "out.z64");
    }
 
-   // read input file into memory
-   in_size = read_file(config.in_filename, &in_buf);
+   // map input file privately, fixes are applied to it in memory
+   in_size = rom_map(&in_rom, config.in_filename, ROM_READ);
    if (in_size <= 0) {
       ERROR("Error reading input file \"%s\"\n", config.in_filename);
       exit(1);
    }
+   in_buf = in_rom.data;
 
    // TODO: confirm valid SM64
 
-   // allocate output memory
-   out_buf = malloc(in_size);
+   // create output file mapped in memory, truncated once the compressed size is known
+   if (rom_create(&out_rom, config.out_filename, in_size) < 0) {
+      ERROR("Error creating output file \"%s\"\n", config.out_filename);
+      exit(1);
+   }
+   out_buf = out_rom.data;
    memset(out_buf, 0x01, in_size);
 
    // copy first 8MB from input to output
@@ -622,9 +728,10 @@ int main(int argc, char *argv[])
    // update N64 header CRC
    sm64_update_checksums(out_buf);
 
-   // write to output file
-   bytes_written = write_file(config.out_filename, out_buf, out_size);
-   if (bytes_written < out_size) {
+   // finish output file, input first in case they are the same file
+   rom_unmap(&in_rom);
+   rom_truncate(&out_rom, out_size);
+   if (rom_unmap(&out_rom) != 0) {
       ERROR("Error writing bytes to output file \"%s\"\n", config.out_filename);
       exit(1);
    }
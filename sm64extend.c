@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "libsm64.h"
+#include "parallel.h"
 #include "utils.h"
 
 #define SM64EXTEND_VERSION "0.3.2"
@@ -17,11 +18,12 @@ static const sm64_config default_config =
    1,    // MIO0 alignment
    0,    // fill old MIO0 blocks
    0,    // dump MIO0 blocks to files
+   1,    // threads
 };
 
 static void print_usage(void)
 {
-   ERROR("Usage: sm64extend [-a ALIGNMENT] [-p PADDING] [-s SIZE] [-d] [-f] [-v] FILE [OUT_FILE]\n"
+   ERROR("Usage: sm64extend [-a ALIGNMENT] [-p PADDING] [-s SIZE] [-d] [-f] [-j N] [-v] FILE [OUT_FILE]\n"
          "\n"
          "sm64extend v" SM64EXTEND_VERSION ": Super Mario 64 ROM extender\n"
          "Supports (E), (J), (U), Shindou, and iQue ROMs in .n64, .v64, or .z64 formats\n"
@@ -32,12 +34,13 @@ static void print_usage(void)
          " -s SIZE      size of the extended ROM in MB (default: %d)\n"
          " -d           dump MIO0 blocks to files in 'mio0files' directory\n"
          " -f           fill old MIO0 blocks with 0x01\n"
+         " -j N         number of threads to decompress with, 0 for all processors (default: %d)\n"
          " -v           verbose progress output\n"
          "\n"
          "File arguments:\n"
          " FILE        input ROM file\n"
          " OUT_FILE    output ROM file (default: replaces FILE extension with .ext.z64)\n",
-         default_config.alignment, default_config.padding, default_config.ext_size);
+         default_config.alignment, default_config.padding, default_config.ext_size, default_config.threads);
    exit(EXIT_FAILURE);
 }
 
@@ -64,6 +67,15 @@ static void parse_arguments(int argc, char *argv[], sm64_config *config)
             case 'f':
                config->fill = 1;
                break;
+            case 'j':
+               if (++i >= argc) {
+                  print_usage();
+               }
+               config->threads = strtoul(argv[i], NULL, 0);
+               if (config->threads <= 0) {
+                  config->threads = parallel_cpu_count();
+               }
+               break;
             case 'p':
                if (++i >= argc) {
                   print_usage();
@@ -107,10 +119,11 @@ int main(int argc, char *argv[])
 {
    char ext_filename[FILENAME_MAX];
    sm64_config config;
+   rom_file in_rom;
+   rom_file out_rom;
    unsigned char *in_buf = NULL;
    unsigned char *out_buf = NULL;
    long in_size;
-   long bytes_written;
    rom_type rtype;
    rom_version rversion;
 
@@ -141,12 +154,13 @@ int main(int argc, char *argv[])
       make_dir(MIO0_DIR);
    }
 
-   // read input file into memory
-   in_size = read_file(config.in_filename, &in_buf);
+   // map input file, privately so byte swapping doesn't modify it
+   in_size = rom_map(&in_rom, config.in_filename, ROM_READ);
    if (in_size <= 0) {
       ERROR("Error reading input file \"%s\"\n", config.in_filename);
       exit(EXIT_FAILURE);
    }
+   in_buf = in_rom.data;
 
    // confirm valid SM64
    rtype = sm64_rom_type(in_buf, in_size);
@@ -177,8 +191,12 @@ int main(int argc, char *argv[])
       exit(EXIT_FAILURE);
    }
 
-   // allocate output memory
-   out_buf = malloc(config.ext_size);
+   // create output file mapped in memory
+   if (rom_create(&out_rom, config.ext_filename, config.ext_size) < 0) {
+      ERROR("Error creating output file \"%s\"\n", config.ext_filename);
+      exit(EXIT_FAILURE);
+   }
+   out_buf = out_rom.data;
 
    // copy file from input to output
    memcpy(out_buf, in_buf, in_size);
@@ -192,9 +210,9 @@ int main(int argc, char *argv[])
    // update N64 header CRC
    sm64_update_checksums(out_buf);
 
-   // write to output file
-   bytes_written = write_file(config.ext_filename, out_buf, config.ext_size);
-   if (bytes_written < (long)config.ext_size) {
+   // finish output file, input first in case they are the same file
+   rom_unmap(&in_rom);
+   if (rom_unmap(&out_rom) != 0) {
       ERROR("Error writing bytes to output file \"%s\"\n", config.ext_filename);
       exit(EXIT_FAILURE);
    }
@@ -5,9 +5,6 @@
 
 #include "strutils.h"
 
-// buffer for local sprintf
-static char tmpbuf[4096];
-
 void strbuf_alloc(strbuf *sbuf, size_t allocate)
 {
    // some sane default allocation
@@ -15,6 +12,7 @@ void strbuf_alloc(strbuf *sbuf, size_t allocate)
       allocate = 512;
    }
    sbuf->buf = malloc(allocate);
+   sbuf->buf[0] = '\0';
    sbuf->allocated = allocate;
    sbuf->index = 0;
 }
@@ -22,17 +20,114 @@ void strbuf_alloc(strbuf *sbuf, size_t allocate)
 void strbuf_sprintf(strbuf *sbuf, const char *format, ...)
 {
    va_list args;
+   size_t avail = sbuf->allocated - sbuf->index;
 
+   // format in place, only measuring and formatting again if it did not fit
    va_start(args, format);
-   int len = vsprintf(tmpbuf, format, args);
+   int len = vsnprintf(&sbuf->buf[sbuf->index], avail, format, args);
    va_end(args);
 
-   while (sbuf->allocated <= sbuf->index + len) {
-      sbuf->allocated *= 2;
+   if (len < 0) {
+      sbuf->buf[sbuf->index] = '\0';
+      return;
+   }
+   if ((size_t)len >= avail) {
+      strbuf_reserve(sbuf, len);
+      va_start(args, format);
+      vsnprintf(&sbuf->buf[sbuf->index], sbuf->allocated - sbuf->index, format, args);
+      va_end(args);
+   }
+   sbuf->index += len;
+}
+
+void strbuf_reserve(strbuf *sbuf, size_t len)
+{
+   if (sbuf->allocated <= sbuf->index + len) {
+      while (sbuf->allocated <= sbuf->index + len) {
+         sbuf->allocated *= 2;
+      }
       sbuf->buf = realloc(sbuf->buf, sbuf->allocated);
    }
-   memcpy(&sbuf->buf[sbuf->index], tmpbuf, len + 1);
+}
+
+void strbuf_append(strbuf *sbuf, const char *str, size_t len)
+{
+   strbuf_reserve(sbuf, len);
+   memcpy(&sbuf->buf[sbuf->index], str, len);
    sbuf->index += len;
+   sbuf->buf[sbuf->index] = '\0';
+}
+
+void strbuf_puts(strbuf *sbuf, const char *str)
+{
+   strbuf_append(sbuf, str, strlen(str));
+}
+
+void strbuf_puts_pad(strbuf *sbuf, const char *str, int width)
+{
+   size_t len = strlen(str);
+   strbuf_append(sbuf, str, len);
+   if ((int)len < width) {
+      strbuf_reserve(sbuf, width - len);
+      memset(&sbuf->buf[sbuf->index], ' ', width - len);
+      sbuf->index += width - len;
+      sbuf->buf[sbuf->index] = '\0';
+   }
+}
+
+void strbuf_putc(strbuf *sbuf, char c)
+{
+   strbuf_reserve(sbuf, 1);
+   sbuf->buf[sbuf->index++] = c;
+   sbuf->buf[sbuf->index] = '\0';
+}
+
+void strbuf_hex(strbuf *sbuf, uint64_t value, int digits)
+{
+   strbuf_reserve(sbuf, 16);
+   sbuf->index += str_hex(&sbuf->buf[sbuf->index], value, digits, 1);
+   sbuf->buf[sbuf->index] = '\0';
+}
+
+void strbuf_dec(strbuf *sbuf, int64_t value)
+{
+   strbuf_reserve(sbuf, 20);
+   sbuf->index += str_dec(&sbuf->buf[sbuf->index], value);
+   sbuf->buf[sbuf->index] = '\0';
+}
+
+void strbuf_dec_pad(strbuf *sbuf, int64_t value, int width)
+{
+   char tmp[20];
+   int len = str_dec(tmp, value);
+   if (len < width) {
+      strbuf_reserve(sbuf, width - len);
+      memset(&sbuf->buf[sbuf->index], ' ', width - len);
+      sbuf->index += width - len;
+   }
+   strbuf_append(sbuf, tmp, len);
+}
+
+void strbuf_hex_source(strbuf *sbuf, const unsigned char *buf, int length)
+{
+   for (int i = 0; i < length; i++) {
+      if (i > 0) {
+         strbuf_append(sbuf, ", ", 2);
+      }
+      strbuf_append(sbuf, "0x", 2);
+      strbuf_hex(sbuf, buf[i], 2);
+   }
+}
+
+size_t strbuf_write(const strbuf *sbuf, FILE *fp)
+{
+   return fwrite(sbuf->buf, 1, sbuf->index, fp);
+}
+
+void strbuf_reset(strbuf *sbuf)
+{
+   sbuf->index = 0;
+   sbuf->buf[0] = '\0';
 }
 
 void strbuf_free(strbuf *sbuf)
@@ -42,3 +137,39 @@ void strbuf_free(strbuf *sbuf)
       sbuf->allocated = 0;
    }
 }
+
+int str_hex(char *out, uint64_t value, int digits, int upper)
+{
+   const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+   int len = 1;
+   while (len < 16 && (value >> (4 * len)) != 0) {
+      len++;
+   }
+   if (len < digits) {
+      len = digits > 16 ? 16 : digits;
+   }
+   for (int i = len - 1; i >= 0; i--) {
+      out[i] = hex[value & 0xF];
+      value >>= 4;
+   }
+   return len;
+}
+
+int str_dec(char *out, int64_t value)
+{
+   char tmp[20];
+   uint64_t mag = value < 0 ? -(uint64_t)value : (uint64_t)value;
+   int len = 0;
+   int count = 0;
+   do {
+      tmp[count++] = '0' + (mag % 10);
+      mag /= 10;
+   } while (mag != 0);
+   if (value < 0) {
+      out[len++] = '-';
+   }
+   while (count > 0) {
+      out[len++] = tmp[--count];
+   }
+   return len;
+}
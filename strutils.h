@@ -1,6 +1,9 @@
 #ifndef STRUTILS_H
 #define STRUTILS_H
 
+#include <stdint.h>
+#include <stdio.h>
+
 typedef struct
 {
    char *buf;
@@ -13,6 +16,48 @@ void strbuf_alloc(strbuf *sbuf, size_t allocate);
 // sprintf and strcat to end of buffer
 void strbuf_sprintf(strbuf *sbuf, const char *format, ...);
 
+// make room for at least len more characters and the terminating null
+void strbuf_reserve(strbuf *sbuf, size_t len);
+
+// append len characters of str
+void strbuf_append(strbuf *sbuf, const char *str, size_t len);
+
+// append null-terminated string
+void strbuf_puts(strbuf *sbuf, const char *str);
+
+// append string left-justified and padded with spaces to width characters, like "%-*s"
+void strbuf_puts_pad(strbuf *sbuf, const char *str, int width);
+
+void strbuf_putc(strbuf *sbuf, char c);
+
+// append value in uppercase hex, zero-padded to at least digits, like "%0*X"
+void strbuf_hex(strbuf *sbuf, uint64_t value, int digits);
+
+// append signed decimal, like "%d"
+void strbuf_dec(strbuf *sbuf, int64_t value);
+
+// append signed decimal right-justified and padded with spaces to width characters, like "%*d"
+void strbuf_dec_pad(strbuf *sbuf, int64_t value, int width);
+
+// append bytes as comma separated "0xXX" list, like fprint_hex_source()
+void strbuf_hex_source(strbuf *sbuf, const unsigned char *buf, int length);
+
+// write buffer contents with a single fwrite
+// returns number of characters written
+size_t strbuf_write(const strbuf *sbuf, FILE *fp);
+
+// empty buffer, keeping its allocation for reuse
+void strbuf_reset(strbuf *sbuf);
+
 void strbuf_free(strbuf *sbuf);
 
+// format value in hex into out, zero-padded to at least digits, without a terminating null
+// upper: use uppercase digits if nonzero
+// returns number of characters written, at most 16
+int str_hex(char *out, uint64_t value, int digits, int upper);
+
+// format signed decimal into out without a terminating null
+// returns number of characters written, at most 20
+int str_dec(char *out, int64_t value);
+
 #endif /* STRUTILS_H */
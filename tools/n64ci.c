@@ -15,79 +15,48 @@ typedef struct
    unsigned pal_entries;
    char **input_files;
    unsigned input_count;
+   int quantize;
 } arg_config;
 
 typedef struct
 {
    rgba *data;
+   unsigned short *rgba16;
    unsigned char *ci;
    int width;
    int height;
 } image_t;
 
-typedef struct
-{
-   unsigned short data[256];
-   unsigned max; // max number of entries
-   unsigned used;
-} palette_t;
-
 // default configuration
 static const arg_config default_args = 
 {
    "palette.bin", // output palette filename
    256,           // number of palette entries
    NULL,          // array of input file names
-   0              // count of input files
+   0,             // count of input files
+   0              // quantize if colors don't fit in palette
 };
 
-// find index of palette color
-// return -1 if not found
-static int pal_find_color(palette_t *pal, unsigned short col)
-{
-   unsigned i;
-   for (i = 0; i < pal->used; i++) {
-      if (pal->data[i] == col) {
-         return i;
-      }
-   }
-   return -1;
-}
-
-// find color in palette, or add if not there
-// returns palette index entered or -1 if palette full
-static int pal_add_color(palette_t *pal, rgba *col)
+static unsigned short rgba2rgba16(const rgba *col)
 {
-   unsigned short rgba16;
-   char r, g, b, a;
-   int idx;
+   unsigned short r, g, b, a;
    r = SCALE_8_5(col->red);
    g = SCALE_8_5(col->green);
    b = SCALE_8_5(col->blue);
    a = col->alpha ? 0x1 : 0x0;
-   rgba16 = (((r << 3) | (g >> 2)) << 8) | ((g & 0x3) << 6) | (b << 1) | a;
-   idx = pal_find_color(pal, rgba16);
-   if (idx < 0) {
-      if (pal->used == pal->max) {
-         ERROR("Error: trying to use more than %d\n", pal->max);
-      } else {
-         idx = pal->used;
-         pal->data[pal->used] = rgba16;
-         pal->used++;
-      }
-   }
-   return idx;
+   return (r << 11) | (g << 6) | (b << 1) | a;
 }
 
 static void print_usage(void)
 {
-   ERROR("Usage: n64ci [-e PAL_ENTIRES] [-p PAL_FILE] [-v] [PNG images]\n"
+   ERROR("Usage: n64ci [-e PAL_ENTIRES] [-p PAL_FILE] [-q] [-v] [PNG images]\n"
          "\n"
          "n64ci v" N64CI_VERSION ": N64 CI image encoder\n"
          "\n"
          "Optional arguments:\n"
          " -e PAL_ENTRIES number of palette entires (default: %d)\n"
          " -p PAL_FILE    output palette file (default: \"%s\")\n"
+         " -q             quantize images to the palette size instead of failing when they have more colors\n"
          " -v             verbose progress output\n"
          "\n"
          "File arguments:\n"
@@ -122,6 +91,9 @@ static void parse_arguments(int argc, char *argv[], arg_config *config)
                }
                strcpy(config->pal_filename, argv[i]);
                break;
+            case 'q':
+               config->quantize = 1;
+               break;
             case 'v':
                g_verbosity = 1;
                break;
@@ -147,7 +119,10 @@ int main(int argc, char *argv[])
    arg_config config;
    palette_t palette;
    image_t *images;
+   unsigned short *colors;
    unsigned pal_length;
+   unsigned pixel_count = 0;
+   int overflow = 0;
    unsigned i;
    int x, y;
 
@@ -159,26 +134,48 @@ int main(int argc, char *argv[])
 
    // load all images
    for (i = 0; i < config.input_count; i++) {
-      images[i].data = pngfile2rgba(config.input_files[i], &images[i].width, &images[i].height);
+      images[i].data = png2rgba(config.input_files[i], &images[i].width, &images[i].height);
+      if (images[i].data == NULL) {
+         exit(1);
+      }
+      pixel_count += images[i].width * images[i].height;
    }
 
-   // assign colors to palette
-   palette.max = config.pal_entries;
-   palette.used = 0;
+   // assign colors to a palette shared by all images
+   colors = malloc(sizeof(*colors) * pixel_count);
+   palette_init(&palette, config.pal_entries);
+   pixel_count = 0;
    for (i = 0; i < config.input_count; i++) {
+      images[i].rgba16 = &colors[pixel_count];
       images[i].ci = malloc(sizeof(*images[i].ci) * images[i].width * images[i].height);
       for (x = 0; x < images[i].width; x++) {
          for (y = 0; y < images[i].height; y++) {
             unsigned img_idx = y * images[i].width + x;
-            int pal_idx = pal_add_color(&palette, &images[i].data[img_idx]);
+            images[i].rgba16[img_idx] = rgba2rgba16(&images[i].data[img_idx]);
+            int pal_idx = palette_add(&palette, images[i].rgba16[img_idx]);
             if (pal_idx < 0) {
-               ERROR("Error adding color @ (%d, %d): %d (used: %u)\n", x, y, pal_idx, palette.used);
-               exit(1);
+               if (!config.quantize) {
+                  ERROR("Error adding color @ (%d, %d): more than %d colors\n", x, y, palette.max);
+                  exit(1);
+               }
+               overflow = 1;
             } else {
                images[i].ci[img_idx] = (unsigned char)pal_idx;
             }
          }
       }
+      pixel_count += images[i].width * images[i].height;
+   }
+   if (overflow) {
+      // quantize all images together so they keep sharing one palette
+      unsigned char *map = malloc(0x10000);
+      palette_quantize(&palette, colors, pixel_count, PAL_RGBA16, map);
+      for (i = 0; i < config.input_count; i++) {
+         for (x = 0; x < images[i].width * images[i].height; x++) {
+            images[i].ci[x] = map[images[i].rgba16[x]];
+         }
+      }
+      free(map);
    }
 
    // output bin files
@@ -192,7 +189,7 @@ int main(int argc, char *argv[])
    // unused entries set to 0xFFFF
    palette_bin = malloc(pal_length);
    memset(palette_bin, 0xFF, pal_length);
-   for (i = 0; i < palette.used; i++) {
+   for (i = 0; i < (unsigned)palette.used; i++) {
       write_u16_be(&palette_bin[i*2], palette.data[i]);
    }
    write_file(config.pal_filename, palette_bin, pal_length);
@@ -201,6 +198,7 @@ int main(int argc, char *argv[])
 
    free(config.input_files);
    free(palette_bin);
+   free(colors);
    free(images);
 
    return 0;
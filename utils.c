@@ -5,10 +5,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #if defined(_MSC_VER) || defined(__MINGW32__)
   #include <io.h>
   #include <sys/utime.h>
+  #include <windows.h>
 #else
+  #include <sys/mman.h>
   #include <unistd.h>
   #include <utime.h>
 #endif
@@ -105,6 +108,18 @@ long filesize(const char *filename)
    return -1;
 }
 
+int file_up_to_date(const char *in_name, const char *out_name)
+{
+   struct stat in_st;
+   struct stat out_st;
+
+   if (stat(in_name, &in_st) != 0 || stat(out_name, &out_st) != 0) {
+      return 0;
+   }
+
+   return out_st.st_mtime >= in_st.st_mtime;
+}
+
 void touch_file(const char *filename)
 {
    int fd;
@@ -116,6 +131,20 @@ void touch_file(const char *filename)
    }
 }
 
+double wall_clock(void)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+   LARGE_INTEGER freq, count;
+   QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+   return (double)count.QuadPart / freq.QuadPart;
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
 long read_file(const char *file_name, unsigned char **data)
 {
    FILE *in;
@@ -165,6 +194,246 @@ long write_file(const char *file_name, unsigned char *data, long length)
    return bytes_written;
 }
 
+// check if a file exists with exactly the given contents
+static int file_matches(const char *file_name, const unsigned char *data, long length)
+{
+   unsigned char *old_data;
+   long old_length;
+   int match;
+   if (filesize(file_name) != length) {
+      return 0;
+   }
+   old_length = read_file(file_name, &old_data);
+   if (old_length < 0) {
+      return 0;
+   }
+   match = (old_length == length) && !memcmp(old_data, data, length);
+   free(old_data);
+   return match;
+}
+
+long write_file_changed(const char *file_name, unsigned char *data, long length)
+{
+   if (file_matches(file_name, data, length)) {
+      return length;
+   }
+   return write_file(file_name, data, length);
+}
+
+int replace_file_changed(const char *tmp_name, const char *file_name)
+{
+   unsigned char *data;
+   long length;
+   int ret_val = 0;
+   length = read_file(tmp_name, &data);
+   if (length < 0) {
+      return -1;
+   }
+   if (file_matches(file_name, data, length)) {
+      remove(tmp_name);
+   } else {
+#if defined(_MSC_VER) || defined(__MINGW32__)
+      if (!MoveFileEx(tmp_name, file_name, MOVEFILE_REPLACE_EXISTING)) {
+         ret_val = -1;
+      }
+#else
+      if (rename(tmp_name, file_name) != 0) {
+         ret_val = -1;
+      }
+#endif
+   }
+   free(data);
+   return ret_val;
+}
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+// map 'size' bytes of an open file handle, returns NULL on failure
+static unsigned char *rom_map_handle(rom_file *rom, HANDLE file, long size, int writable, int shared)
+{
+   DWORD protect = writable ? PAGE_READWRITE : (shared ? PAGE_READONLY : PAGE_WRITECOPY);
+   DWORD access = writable ? FILE_MAP_WRITE : (shared ? FILE_MAP_READ : FILE_MAP_COPY);
+   rom->file = file;
+   rom->mapping = CreateFileMapping(file, NULL, protect, 0, (DWORD)size, NULL);
+   if (rom->mapping == NULL) {
+      return NULL;
+   }
+   return MapViewOfFile(rom->mapping, access, 0, 0, size);
+}
+
+static void rom_close_handles(rom_file *rom)
+{
+   if (rom->mapping != NULL) {
+      CloseHandle(rom->mapping);
+      rom->mapping = NULL;
+   }
+   if (rom->file != NULL && rom->file != INVALID_HANDLE_VALUE) {
+      CloseHandle(rom->file);
+   }
+   rom->file = NULL;
+}
+#endif
+
+long rom_map(rom_file *rom, const char *file_name, rom_mode mode)
+{
+   long size;
+
+   memset(rom, 0, sizeof(*rom));
+   strncpy(rom->name, file_name, sizeof(rom->name) - 1);
+
+   size = filesize(file_name);
+   if (size < 0) {
+      return -1;
+   }
+   // sanity check
+   if (size > 256*MB) {
+      return -2;
+   }
+   rom->size = rom->map_size = size;
+
+   if (size > 0) {
+#if defined(_MSC_VER) || defined(__MINGW32__)
+      DWORD access = GENERIC_READ | (mode == ROM_UPDATE ? GENERIC_WRITE : 0);
+      HANDLE file = CreateFile(file_name, access, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+      if (file != INVALID_HANDLE_VALUE) {
+         rom->data = rom_map_handle(rom, file, size, mode == ROM_UPDATE, mode == ROM_UPDATE);
+         if (rom->data == NULL) {
+            rom_close_handles(rom);
+         }
+      }
+#else
+      int fd = open(file_name, mode == ROM_UPDATE ? O_RDWR : O_RDONLY);
+      if (fd >= 0) {
+         int flags = (mode == ROM_UPDATE) ? MAP_SHARED : MAP_PRIVATE;
+         void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+         // mapping stays valid after the descriptor is closed
+         close(fd);
+         if (addr != MAP_FAILED) {
+            rom->data = addr;
+         }
+      }
+#endif
+      if (rom->data != NULL) {
+         rom->mapped = 1;
+         return size;
+      }
+   }
+
+   // fall back to reading the whole file
+   size = read_file(file_name, &rom->data);
+   if (size < 0) {
+      return size;
+   }
+   rom->writeback = (mode == ROM_UPDATE);
+   return size;
+}
+
+long rom_create(rom_file *rom, const char *file_name, long size)
+{
+   memset(rom, 0, sizeof(*rom));
+   strncpy(rom->name, file_name, sizeof(rom->name) - 1);
+   snprintf(rom->tmp_name, sizeof(rom->tmp_name), "%s.tmp", file_name);
+   rom->size = rom->map_size = size;
+
+   if (size > 0) {
+#if defined(_MSC_VER) || defined(__MINGW32__)
+      HANDLE file = CreateFile(rom->tmp_name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+      if (file != INVALID_HANDLE_VALUE) {
+         // mapping a file larger than its size extends it
+         rom->data = rom_map_handle(rom, file, size, 1, 1);
+         if (rom->data == NULL) {
+            rom_close_handles(rom);
+            DeleteFile(rom->tmp_name);
+         }
+      }
+#else
+      int fd = open(rom->tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+      if (fd >= 0) {
+         // extending with ftruncate leaves a sparse zero-filled file
+         if (ftruncate(fd, size) == 0) {
+            void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+               rom->data = addr;
+            }
+         }
+         close(fd);
+         if (rom->data == NULL) {
+            unlink(rom->tmp_name);
+         }
+      }
+#endif
+      if (rom->data != NULL) {
+         rom->mapped = 1;
+         return size;
+      }
+   }
+
+   // fall back to a buffer written out on unmap
+   rom->data = calloc(size > 0 ? size : 1, 1);
+   if (rom->data == NULL) {
+      return -1;
+   }
+   rom->tmp_name[0] = '\0';
+   rom->writeback = 1;
+   return size;
+}
+
+void rom_truncate(rom_file *rom, long size)
+{
+   rom->size = MIN(rom->size, size);
+}
+
+int rom_unmap(rom_file *rom)
+{
+   int ret_val = 0;
+
+   if (rom->mapped) {
+#if defined(_MSC_VER) || defined(__MINGW32__)
+      if (!UnmapViewOfFile(rom->data)) {
+         ret_val = -1;
+      }
+      CloseHandle(rom->mapping);
+      rom->mapping = NULL;
+      if (rom->size < rom->map_size) {
+         LARGE_INTEGER end;
+         end.QuadPart = rom->size;
+         if (!SetFilePointerEx(rom->file, end, NULL, FILE_BEGIN) || !SetEndOfFile(rom->file)) {
+            ret_val = -1;
+         }
+      }
+      rom_close_handles(rom);
+      if (rom->tmp_name[0] != '\0' && ret_val == 0) {
+         if (!MoveFileEx(rom->tmp_name, rom->name, MOVEFILE_REPLACE_EXISTING)) {
+            ret_val = -1;
+         }
+      }
+#else
+      if (munmap(rom->data, rom->map_size) != 0) {
+         ret_val = -1;
+      }
+      if (rom->size < rom->map_size && truncate(rom->tmp_name[0] ? rom->tmp_name : rom->name, rom->size) != 0) {
+         ret_val = -1;
+      }
+      if (rom->tmp_name[0] != '\0' && ret_val == 0) {
+         if (rename(rom->tmp_name, rom->name) != 0) {
+            ret_val = -1;
+         }
+      }
+#endif
+      if (ret_val != 0) {
+         perror(rom->name);
+      }
+   } else if (rom->data != NULL) {
+      if (rom->writeback && write_file(rom->name, rom->data, rom->size) != rom->size) {
+         ret_val = -1;
+      }
+      free(rom->data);
+   }
+   rom->data = NULL;
+   rom->size = rom->map_size = 0;
+   rom->mapped = 0;
+   return ret_val;
+}
+
 void generate_filename(const char *in_name, char *out_name, char *extension)
 {
    char tmp_name[FILENAME_MAX];
@@ -66,6 +66,28 @@ typedef struct
    int count;
 } dir_list;
 
+// memory mapped ROM file, see rom_map()
+typedef enum
+{
+   ROM_READ,   // private copy-on-write mapping, modifications stay in memory
+   ROM_UPDATE, // shared writable mapping, modifications are written back to the file
+} rom_mode;
+
+typedef struct
+{
+   unsigned char *data;
+   long size;
+   long map_size; // size of mapping, may exceed size after rom_truncate()
+   int mapped;    // 1 if data is a file mapping, 0 if it was read into memory
+   int writeback; // write data to 'name' on unmap
+   char name[FILENAME_MAX];
+   char tmp_name[FILENAME_MAX];
+#if defined(_MSC_VER) || defined(__MINGW32__)
+   void *file;
+   void *mapping;
+#endif
+} rom_file;
+
 // global verbosity setting
 extern int g_verbosity;
 
@@ -103,9 +125,16 @@ void reverse_endian(unsigned char *data, long length);
 // returns file size or negative on error
 long filesize(const char *file_name);
 
+// check if output file exists and is no older than input file, like make
+// returns 1 if out_name is up to date, 0 if it is missing, older or either can't be checked
+int file_up_to_date(const char *in_name, const char *out_name);
+
 // update file timestamp to now, creating it if it doesn't exist
 void touch_file(const char *filename);
 
+// monotonic wall-clock time in seconds from an arbitrary start, for timing work spread over threads
+double wall_clock(void);
+
 // read entire contents of file into buffer
 // returns file size or negative on error
 long read_file(const char *file_name, unsigned char **data);
@@ -114,6 +143,37 @@ long read_file(const char *file_name, unsigned char **data);
 // returns number of bytes written out or -1 on failure
 long write_file(const char *file_name, unsigned char *data, long length);
 
+// write buffer to file unless the file already holds exactly that data, keeping its timestamp
+// returns number of bytes in buffer or -1 on failure
+long write_file_changed(const char *file_name, unsigned char *data, long length);
+
+// replace a file with a temporary file, unless both have the same contents,
+// in which case the file and its timestamp are kept and the temporary file is removed
+// returns 0 on success, -1 on failure
+int replace_file_changed(const char *tmp_name, const char *file_name);
+
+// map an existing file into memory without copying it
+// falls back to read_file() behavior if the file can't be mapped
+// rom: mapping to fill in, data and size are valid until rom_unmap()
+// file_name: file to map
+// mode: ROM_READ or ROM_UPDATE
+// returns file size or negative on error
+long rom_map(rom_file *rom, const char *file_name, rom_mode mode);
+
+// create a new zero-filled output file of 'size' bytes mapped writable
+// data is written to a temporary file and renamed to 'file_name' on rom_unmap(),
+// so 'file_name' may be the same as a file currently mapped for reading
+// returns size or negative on error
+long rom_create(rom_file *rom, const char *file_name, long size);
+
+// shrink an output file from rom_create(), applied on rom_unmap()
+// size: final file size, must not be larger than the created size
+void rom_truncate(rom_file *rom, long size);
+
+// unmap a file from rom_map() or rom_create(), finishing any output file
+// returns 0 on success or negative if output could not be written
+int rom_unmap(rom_file *rom);
+
 // generate an output file name from input name by replacing file extension
 // in_name: input file name
 // out_name: buffer to write output name in
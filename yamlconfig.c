@@ -683,6 +683,215 @@ const char *config_get_version(void)
    return version;
 }
 
+// binary form stores numbers as variable length values, 7 bits per byte with the high bit set
+// on all but the last, and strings as a length byte followed by the characters. sections are
+// followed by their children, then come the labels
+// each put_*() helper only measures when buf is NULL and returns the offset after what it wrote
+static unsigned int put_u32(unsigned char *buf, unsigned int offset, unsigned int value)
+{
+   while (value >= 0x80) {
+      if (buf) {
+         buf[offset] = (value & 0x7F) | 0x80;
+      }
+      offset++;
+      value >>= 7;
+   }
+   if (buf) {
+      buf[offset] = value;
+   }
+   return offset + 1;
+}
+
+static unsigned int put_str(unsigned char *buf, unsigned int offset, const char *str, size_t max)
+{
+   size_t len = strnlen(str, MIN(max - 1, 0xFF));
+   if (buf) {
+      buf[offset] = (unsigned char)len;
+      memcpy(&buf[offset + 1], str, len);
+   }
+   return offset + 1 + len;
+}
+
+static unsigned int put_section(unsigned char *buf, unsigned int offset, const split_section *sec)
+{
+   // ptr and instrument set sections use child_count without any children
+   int stored_children = sec->children ? sec->child_count : 0;
+   offset = put_str(buf, offset, sec->label, sizeof(sec->label));
+   offset = put_u32(buf, offset, sec->start);
+   offset = put_u32(buf, offset, sec->end);
+   offset = put_u32(buf, offset, sec->vaddr);
+   offset = put_u32(buf, offset, sec->type);
+   offset = put_u32(buf, offset, sec->subtype);
+   offset = put_u32(buf, offset, sec->tex.offset);
+   offset = put_u32(buf, offset, sec->tex.palette);
+   offset = put_u32(buf, offset, sec->tex.width);
+   offset = put_u32(buf, offset, sec->tex.height);
+   offset = put_u32(buf, offset, sec->tex.depth);
+   offset = put_u32(buf, offset, sec->tex.format);
+   offset = put_u32(buf, offset, sec->child_count);
+   offset = put_u32(buf, offset, stored_children);
+   for (int i = 0; i < stored_children; i++) {
+      offset = put_section(buf, offset, &sec->children[i]);
+   }
+   return offset;
+}
+
+static unsigned int put_config(unsigned char *buf, unsigned int offset, const rom_config *config)
+{
+   offset = put_str(buf, offset, config->name, sizeof(config->name));
+   offset = put_str(buf, offset, config->basename, sizeof(config->basename));
+   offset = put_u32(buf, offset, config->checksum1);
+   offset = put_u32(buf, offset, config->checksum2);
+   offset = put_u32(buf, offset, config->section_count);
+   for (int i = 0; i < config->section_count; i++) {
+      offset = put_section(buf, offset, &config->sections[i]);
+   }
+   offset = put_u32(buf, offset, config->label_count);
+   for (int i = 0; i < config->label_count; i++) {
+      offset = put_u32(buf, offset, config->labels[i].ram_addr);
+      offset = put_str(buf, offset, config->labels[i].name, sizeof(config->labels[i].name));
+   }
+   return offset;
+}
+
+unsigned char *config_write_binary(const rom_config *config, unsigned int *length)
+{
+   unsigned int size = put_config(NULL, 0, config);
+   unsigned char *buf = malloc(size);
+   if (buf == NULL) {
+      return NULL;
+   }
+   put_config(buf, 0, config);
+   *length = size;
+   return buf;
+}
+
+// read position in the binary form, error is set once anything runs past the end
+typedef struct
+{
+   const unsigned char *buf;
+   unsigned int length;
+   unsigned int offset;
+   int error;
+} binary_reader;
+
+static unsigned int get_u32(binary_reader *rd)
+{
+   unsigned int value = 0;
+   for (int shift = 0; shift < 35 && !rd->error; shift += 7) {
+      unsigned char byte;
+      if (rd->offset >= rd->length) {
+         break;
+      }
+      byte = rd->buf[rd->offset++];
+      value |= (unsigned int)(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) {
+         return value;
+      }
+   }
+   rd->error = 1;
+   return 0;
+}
+
+static void get_str(binary_reader *rd, char *str, size_t max)
+{
+   unsigned int len;
+   str[0] = '\0';
+   if (rd->error || rd->offset >= rd->length || rd->buf[rd->offset] >= max ||
+       rd->length - rd->offset - 1 < rd->buf[rd->offset]) {
+      rd->error = 1;
+      return;
+   }
+   len = rd->buf[rd->offset];
+   memcpy(str, &rd->buf[rd->offset + 1], len);
+   str[len] = '\0';
+   rd->offset += 1 + len;
+}
+
+// read an element count, rejecting counts that can't fit in the remaining data
+static int get_count(binary_reader *rd, unsigned int min_size)
+{
+   unsigned int count = get_u32(rd);
+   if (rd->error || count > (rd->length - rd->offset) / min_size) {
+      rd->error = 1;
+      return 0;
+   }
+   return count;
+}
+
+static void get_section(binary_reader *rd, split_section *sec)
+{
+   int stored_children;
+   get_str(rd, sec->label, sizeof(sec->label));
+   sec->start = get_u32(rd);
+   sec->end = get_u32(rd);
+   sec->vaddr = get_u32(rd);
+   sec->type = get_u32(rd);
+   sec->subtype = get_u32(rd);
+   sec->tex.offset = get_u32(rd);
+   sec->tex.palette = get_u32(rd);
+   sec->tex.width = get_u32(rd);
+   sec->tex.height = get_u32(rd);
+   sec->tex.depth = get_u32(rd);
+   sec->tex.format = get_u32(rd);
+   sec->child_count = get_u32(rd);
+   sec->children = NULL;
+   // smallest section is an empty label and 13 single byte values
+   stored_children = get_count(rd, 1 + 13);
+   if (stored_children != 0 && stored_children != sec->child_count) {
+      rd->error = 1;
+   } else if (stored_children > 0) {
+      sec->children = calloc(sec->child_count, sizeof(*sec->children));
+      for (int i = 0; i < sec->child_count; i++) {
+         get_section(rd, &sec->children[i]);
+      }
+   }
+}
+
+// children are freed here since config_free() only frees them for the types that have them
+static void free_children(split_section *sec)
+{
+   if (sec->children) {
+      for (int i = 0; i < sec->child_count; i++) {
+         free_children(&sec->children[i]);
+      }
+      free(sec->children);
+      sec->children = NULL;
+      sec->child_count = 0;
+   }
+}
+
+int config_read_binary(const unsigned char *buf, unsigned int length, rom_config *config)
+{
+   binary_reader rd = {buf, length, 0, 0};
+
+   memset(config, 0, sizeof(*config));
+   get_str(&rd, config->name, sizeof(config->name));
+   get_str(&rd, config->basename, sizeof(config->basename));
+   config->checksum1 = get_u32(&rd);
+   config->checksum2 = get_u32(&rd);
+   config->section_count = get_count(&rd, 1 + 13);
+   config->sections = calloc(config->section_count ? config->section_count : 1, sizeof(*config->sections));
+   for (int i = 0; i < config->section_count; i++) {
+      get_section(&rd, &config->sections[i]);
+   }
+   // smallest label is a single byte address and an empty name
+   config->label_count = get_count(&rd, 1 + 1);
+   config->labels = calloc(config->label_count ? config->label_count : 1, sizeof(*config->labels));
+   for (int i = 0; i < config->label_count; i++) {
+      config->labels[i].ram_addr = get_u32(&rd);
+      get_str(&rd, config->labels[i].name, sizeof(config->labels[i].name));
+   }
+   if (rd.error) {
+      for (int i = 0; i < config->section_count; i++) {
+         free_children(&config->sections[i]);
+      }
+      config_free(config);
+      return -1;
+   }
+   return 0;
+}
+
 #ifdef YAML_CONFIG_TEST
 int main(int argc, char *argv[])
 {